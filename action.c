@@ -447,7 +447,11 @@ actionConstructFinalize(action_t *__restrict__ const pThis, struct nvlst *lst)
 	if(pThis->isTransactional) {
 		int i;
 		for(i = 0 ; i < pThis->iNumTpls ; ++i) {
-			if(pThis->peParamPassing[i] != ACT_STRING_PASSING) {
+			/* JSON objects are kept in the parameter array until the
+			 * transaction is committed, see releaseTxJSONParams().
+			 */
+			if(pThis->peParamPassing[i] != ACT_STRING_PASSING
+			   && pThis->peParamPassing[i] != ACT_JSON_PASSING) {
 				LogError(0, RS_RET_INVLD_OMOD, "action '%s'(%d) is transactional but "
 						"parameter %d "
 						"uses invalid parameter passing mode -- disabling "
@@ -977,9 +981,14 @@ prepareDoActionParams(action_t * __restrict__ const pAction,
 	if(pAction->isTransactional) {
 		CHKiRet(wtiNewIParam(pWti, pAction, &iparams));
 		for(i = 0 ; i < pAction->iNumTpls ; ++i) {
-			CHKiRet(tplToString(pAction->ppTpl[i], pMsg, 
-					    &actParam(iparams, pAction->iNumTpls, 0, i),
-				            ttNow));
+			if(pAction->peParamPassing[i] == ACT_JSON_PASSING) {
+				CHKiRet(tplToJSON(pAction->ppTpl[i], pMsg, &json, ttNow));
+				actParam(iparams, pAction->iNumTpls, 0, i).param = (void*) json;
+			} else {
+				CHKiRet(tplToString(pAction->ppTpl[i], pMsg,
+						    &actParam(iparams, pAction->iNumTpls, 0, i),
+						    ttNow));
+			}
 		}
 	} else {
 		for(i = 0 ; i < pAction->iNumTpls ; ++i) {
@@ -1315,8 +1324,13 @@ actionWriteErrorFile(action_t *__restrict__ const pThis, const rsRetVal ret,
 			char tplname[20];
 			snprintf(tplname, sizeof(tplname), "template%d", j);
 			tplname[sizeof(tplname)-1] = '\0';
-			fjson_object_object_add(etry, tplname,
-				fjson_object_new_string((char*)actParam(iparams, 1, i, j).param));
+			if(pThis->peParamPassing[j] == ACT_JSON_PASSING) {
+				fjson_object_object_add(etry, tplname, fjson_object_get(
+					(struct fjson_object*) actParam(iparams, 1, i, j).param));
+			} else {
+				fjson_object_object_add(etry, tplname,
+					fjson_object_new_string((char*)actParam(iparams, 1, i, j).param));
+			}
 		}
 
 		char *const rendered = strdup((char*)fjson_object_to_json_string(etry));
@@ -1374,6 +1388,23 @@ actionTryRemoveHardErrorsFromBatch(action_t *__restrict__ const pThis, wti_t *__
 	RETiRet;
 }
 
+/* release the JSON objects of the current transaction. String parameters
+ * are kept, as their buffers are reused for the next transaction.
+ */
+static void
+releaseTxJSONParams(action_t *__restrict__ const pThis, actWrkrInfo_t *__restrict__ const wrkrInfo)
+{
+	for(int i = 0 ; i < pThis->iNumTpls ; ++i) {
+		if(pThis->peParamPassing[i] != ACT_JSON_PASSING)
+			continue;
+		for(int j = 0 ; j < wrkrInfo->p.tx.currIParam ; ++j) {
+			json_object_put((struct json_object*)
+				actParam(wrkrInfo->p.tx.iparams, pThis->iNumTpls, j, i).param);
+			actParam(wrkrInfo->p.tx.iparams, pThis->iNumTpls, j, i).param = NULL;
+		}
+	}
+}
+
 /* Note: we currently need to return an iRet, as this is used in 
  * direct mode. TODO: However, it may be worth further investigating this,
  * as it looks like there is no ultimate consumer of this code.
@@ -1474,6 +1505,8 @@ finalize_it:
 	if(needfree_iparams) {
 		free(iparams);
 	}
+	if(pThis->isTransactional)
+		releaseTxJSONParams(pThis, wrkrInfo);
 	wrkrInfo->p.tx.currIParam = 0; /* reset to beginning */
 	RETiRet;
 }
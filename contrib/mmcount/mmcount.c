@@ -38,7 +38,7 @@
 #include "template.h"
 #include "module-template.h"
 #include "errmsg.h"
-#include "hashtable.h"
+#include "ctrmap.h"
 
 
 #define JSON_COUNT_NAME "!mmcount"
@@ -56,12 +56,11 @@ DEF_OMOD_STATIC_DATA
 
 typedef struct _instanceData {
 	char *pszAppName;
-	int severity[SEVERITY_COUNT];
+	ctrmapCounter_t severity[SEVERITY_COUNT];
 	char *pszKey;
 	char *pszValue;
-	int valueCounter;
-	struct hashtable *ht;
-	pthread_mutex_t mut;
+	ctrmapCounter_t valueCounter;
+	ctrmap_t *ctrs;		/* per-value counters if only key is given */
 } instanceData;
 
 typedef struct wrkrInstanceData {
@@ -113,8 +112,11 @@ ENDfreeCnf
 
 
 BEGINcreateInstance
+	int i;
 CODESTARTcreateInstance
-	pthread_mutex_init(&pData->mut, NULL);
+	for(i = 0 ; i < SEVERITY_COUNT ; ++i)
+		ctrmapCounterInit(&pData->severity[i], 0);
+	ctrmapCounterInit(&pData->valueCounter, 0);
 ENDcreateInstance
 
 BEGINcreateWrkrInstance
@@ -128,7 +130,15 @@ ENDisCompatibleWithFeature
 
 
 BEGINfreeInstance
+	int i;
 CODESTARTfreeInstance
+	for(i = 0 ; i < SEVERITY_COUNT ; ++i)
+		ctrmapCounterDestruct(&pData->severity[i]);
+	ctrmapCounterDestruct(&pData->valueCounter);
+	ctrmapDestruct(&pData->ctrs);
+	free(pData->pszAppName);
+	free(pData->pszKey);
+	free(pData->pszValue);
 ENDfreeInstance
 
 
@@ -139,27 +149,10 @@ ENDfreeWrkrInstance
 static inline void
 setInstParamDefaults(instanceData *pData)
 {
-	int i;
-
 	pData->pszAppName = NULL;
-	for (i = 0; i < SEVERITY_COUNT; i++)
-	        pData->severity[i] = 0;
 	pData->pszKey = NULL;
 	pData->pszValue = NULL;
-	pData->valueCounter = 0;
-	pData->ht = NULL;
-}
-
-static unsigned int
-hash_from_key_fn(void *k)
-{
-	return *(unsigned int *)k;
-}
-
-static int
-key_equals_fn(void *k1, void *k2)
-{
-	return (*(unsigned int *)k1 == *(unsigned int *)k2);
+	pData->ctrs = NULL;
 }
 
 BEGINnewActInst
@@ -201,8 +194,9 @@ CODESTARTnewActInst
 	}
 
 	if(pData->pszKey != NULL && pData->pszValue == NULL) {
-		if(NULL == (pData->ht = create_hashtable(100, hash_from_key_fn, key_equals_fn, NULL))) {
-			DBGPRINTF("mmcount: error creating hash table!\n");
+		/* initial size only, the map grows with the number of values */
+		if(ctrmapConstruct(&pData->ctrs, 100) != RS_RET_OK) {
+			DBGPRINTF("mmcount: error creating counter map!\n");
 			ABORT_FINALIZE(RS_RET_ERR);
 		}
 	}
@@ -220,44 +214,6 @@ BEGINtryResume
 CODESTARTtryResume
 ENDtryResume
 
-static int *
-getCounter(struct hashtable *ht, const char *str) {
-	unsigned int key;
-	int *pCounter;
-	unsigned int *pKey;
-
-	/* we dont store str as key, instead we store hash of the str
-	   as key to reduce memory usage */
-	key = hash_from_string((char*)str);
-	pCounter = hashtable_search(ht, &key);
-	if(pCounter) {
-		return pCounter;
-	}
-
-	/* counter is not found for the str, so add new entry and
-	   return the counter */
-	if(NULL == (pKey = (unsigned int*)malloc(sizeof(unsigned int)))) {
-		DBGPRINTF("mmcount: memory allocation for key failed\n");
-		return NULL;
-	}
-	*pKey = key;
-
-	if(NULL == (pCounter = (int*)malloc(sizeof(int)))) {
-		DBGPRINTF("mmcount: memory allocation for value failed\n");
-		free(pKey);
-		return NULL;
-	}
-	*pCounter = 0;
-
-	if(!hashtable_insert(ht, pKey, pCounter)) {
-		DBGPRINTF("mmcount: inserting element into hashtable failed\n");
-		free(pKey);
-		free(pCounter);
-		return NULL;
-	}
-	return pCounter;
-}
-
 BEGINdoAction_NoStrings
 	smsg_t **ppMsg = (smsg_t **) pMsgData;
 	smsg_t *pMsg = ppMsg[0];
@@ -265,12 +221,11 @@ BEGINdoAction_NoStrings
 	struct json_object *json = NULL;
 	struct json_object *keyjson = NULL;
 	const char *pszValue;
-	int *pCounter;
+	ctrmapCounter_t *pCtr;
 	instanceData *const pData = pWrkrData->pData;
 CODESTARTdoAction
 	appname = getAPPNAME(pMsg, LOCK_MUTEX);
 
-	pthread_mutex_lock(&pData->mut);
 	if(0 != strcmp(appname, pData->pszAppName)) {
 		/* we are not working for this appname. nothing to do */
 		ABORT_FINALIZE(RS_RET_OK);
@@ -279,8 +234,7 @@ CODESTARTdoAction
 	if(!pData->pszKey) {
 		/* no key given for count, so we count severity */
 		if(pMsg->iSeverity < SEVERITY_COUNT) {
-			pData->severity[pMsg->iSeverity]++;
-			json = json_object_new_int(pData->severity[pMsg->iSeverity]);
+			json = json_object_new_int(ctrmapIncAndFetch(&pData->severity[pMsg->iSeverity]));
 		}
 		ABORT_FINALIZE(RS_RET_OK);
 	}
@@ -305,21 +259,18 @@ CODESTARTdoAction
 		/* value also given for count */
 		if(!strcmp(pszValue, pData->pszValue)) {
 			/* count for (value and key and appname) matched */
-			pData->valueCounter++;
-			json = json_object_new_int(pData->valueCounter);
+			json = json_object_new_int(ctrmapIncAndFetch(&pData->valueCounter));
 		}
 		ABORT_FINALIZE(RS_RET_OK);
 	}
 
 	/* value is not given, so we count for each value of given key */
-	pCounter = getCounter(pData->ht, pszValue);
-	if(pCounter) {
-		(*pCounter)++;
-		json = json_object_new_int(*pCounter);
+	if(ctrmapGet(pData->ctrs, pszValue, 0, &pCtr) == RS_RET_OK) {
+		json = json_object_new_int(ctrmapIncAndFetch(pCtr));
+	} else {
+		DBGPRINTF("mmcount: cannot obtain counter for value '%s'\n", pszValue);
 	}
 finalize_it:
-	pthread_mutex_unlock(&pData->mut);
-
 	if(json) {
 		msgAddJSON(pMsg, (uchar *)JSON_COUNT_NAME, json, 0, 0);
 	}
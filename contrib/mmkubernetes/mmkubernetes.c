@@ -41,6 +41,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <libestr.h>
 #include <liblognorm.h>
@@ -54,6 +55,7 @@
 #include "errmsg.h"
 #include "regexp.h"
 #include "hashtable.h"
+#include "hashtable_itr.h"
 #include "srUtils.h"
 
 /* static data */
@@ -99,13 +101,11 @@ DEFobjCurrIf(regexp)
 #define DFLT_CONTAINER_NAME "$!CONTAINER_NAME" /* name of variable holding CONTAINER_NAME value */
 #define DFLT_CONTAINER_ID_FULL "$!CONTAINER_ID_FULL" /* name of variable holding CONTAINER_ID_FULL value */
 #define DFLT_KUBERNETES_URL "https://kubernetes.default.svc.cluster.local:443"
-
-static struct cache_s {
-	const uchar *kbUrl;
-	struct hashtable *mdHt;
-	struct hashtable *nsHt;
-	pthread_mutex_t *cacheMtx;
-} **caches;
+#define DFLT_CACHE_ENTRY_TTL 3600 /* seconds until cached metadata is considered stale */
+#define DFLT_CACHE_SIZE 10000 /* max number of pods (and of namespaces) cached per kubernetesurl */
+#define WATCH_TIMEOUT 300 /* seconds after which the API server ends a watch - we then re-watch */
+#define WATCH_RETRY_INTERVAL 5 /* seconds to wait before retrying after an API error */
+#define MISSING_ENTRY_TTL 60 /* seconds to remember that a pod could not be obtained (watch mode) */
 
 typedef struct {
 	int nmemb;
@@ -131,6 +131,10 @@ struct modConfData_s {
 	uchar *fnRulebase; /* lognorm rulebase filename for container log filename match */
 	char *contRules; /* lognorm rules for CONTAINER_NAME value match */
 	uchar *contRulebase; /* lognorm rulebase filename for CONTAINER_NAME value match */
+	int cacheEntryTTL; /* seconds after which cached metadata is refreshed */
+	int cacheSize; /* max number of cached pods and namespaces */
+	sbool bWatch; /* keep the cache current with list+watch, never query from the workers */
+	uchar *nodeName; /* watch mode: only list+watch the pods of this node */
 };
 
 /* action (instance) configuration data */
@@ -154,6 +158,10 @@ typedef struct _instanceData {
 	ln_ctx contCtxln;	/**< context to be used for liblognorm */
 	msgPropDescr_t *contNameDescr; /* CONTAINER_NAME field */
 	msgPropDescr_t *contIdFullDescr; /* CONTAINER_ID_FULL field */
+	int cacheEntryTTL; /* seconds after which cached metadata is refreshed */
+	int cacheSize; /* max number of cached pods and namespaces */
+	sbool bWatch; /* keep the cache current with list+watch, never query from the workers */
+	uchar *nodeName; /* watch mode: only list+watch the pods of this node */
 	struct cache_s *cache;
 } instanceData;
 
@@ -165,6 +173,58 @@ typedef struct wrkrInstanceData {
 	size_t curlRplyLen;
 } wrkrInstanceData_t;
 
+/* A cached pod or namespace. Pods are kept as serialized json, which the
+ * workers parse into a private copy for each message; this only needs
+ * the read lock. Namespace objects are only touched with the write lock
+ * held, when pod metadata is built.
+ */
+typedef struct cacheEntry_s {
+	char *json; /* pod metadata, NULL if the pod could not be obtained */
+	struct json_object *jo; /* namespace metadata */
+	time_t expires;
+	const char *key; /* owned by the hash table */
+	struct cacheEntry_s *prev, *next; /* in order of storing, see cacheStore() */
+} cacheEntry_t;
+
+/* the entries of a cache table, least recently stored first */
+typedef struct cacheList_s {
+	cacheEntry_t *head;
+	cacheEntry_t *tail;
+} cacheList_t;
+
+/* There is one cache per Kubernetes API url, shared by all actions using
+ * that url. In watch mode, a background fetcher thread keeps it current
+ * via list+watch of all pods and refreshes pods workers asked for, so that
+ * the workers only wait for the API if a pod has not been delivered by the
+ * watch yet. Otherwise, workers query the API themselves on a cache miss.
+ * The cache is owned by the action that created it; the fetcher uses the
+ * settings of that action and is stopped when the action is freed.
+ */
+static struct cache_s {
+	uchar *kbUrl;
+	struct hashtable *mdHt; /* pods, key "namespace/pod" */
+	struct hashtable *nsHt; /* namespaces, key namespace name */
+	cacheList_t mdList; /* entries of mdHt */
+	cacheList_t nsList; /* entries of nsHt */
+	pthread_rwlock_t cacheLock;
+	int entryTTL;
+	int maxEntries;
+	sbool bWatch;
+	instanceData *pData; /* owning action, its settings are used by the fetcher */
+	/* background fetcher (watch mode only) */
+	pthread_t fetcherTid;
+	sbool bFetcherRunning;
+	pthread_mutex_t reqMtx; /* protects the fields below */
+	pthread_cond_t reqCond;
+	sbool bStop;
+	struct hashtable *reqHt; /* pods workers need, key "namespace/pod" */
+	char *resourceVersion; /* resume the pod watch from here, fetcher only */
+} **caches;
+
+/* forward definitions */
+static void *fetcherThread(void *arg);
+static void cacheStopFetcher(struct cache_s *cache);
+
 /* module parameters (v6 config format) */
 static struct cnfparamdescr modpdescr[] = {
 	{ "kubernetesurl", eCmdHdlrString, 0 },
@@ -178,7 +238,11 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "de_dot", eCmdHdlrBinary, 0 },
 	{ "de_dot_separator", eCmdHdlrString, 0 },
 	{ "filenamerulebase", eCmdHdlrString, 0 },
-	{ "containerrulebase", eCmdHdlrString, 0 }
+	{ "containerrulebase", eCmdHdlrString, 0 },
+	{ "cacheentryttl", eCmdHdlrPositiveInt, 0 },
+	{ "cachesize", eCmdHdlrPositiveInt, 0 },
+	{ "watch", eCmdHdlrBinary, 0 },
+	{ "nodename", eCmdHdlrString, 0 }
 #if HAVE_LOADSAMPLESFROMSTRING == 1
 	,
 	{ "filenamerules", eCmdHdlrArray, 0 },
@@ -204,7 +268,11 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "de_dot", eCmdHdlrBinary, 0 },
 	{ "de_dot_separator", eCmdHdlrString, 0 },
 	{ "filenamerulebase", eCmdHdlrString, 0 },
-	{ "containerrulebase", eCmdHdlrString, 0 }
+	{ "containerrulebase", eCmdHdlrString, 0 },
+	{ "cacheentryttl", eCmdHdlrPositiveInt, 0 },
+	{ "cachesize", eCmdHdlrPositiveInt, 0 },
+	{ "watch", eCmdHdlrBinary, 0 },
+	{ "nodename", eCmdHdlrString, 0 }
 #if HAVE_LOADSAMPLESFROMSTRING == 1
 	,
 	{ "filenamerules", eCmdHdlrArray, 0 },
@@ -513,6 +581,9 @@ CODESTARTsetModCnf
 	}
 
 	loadModConf->de_dot = DFLT_DE_DOT;
+	loadModConf->cacheEntryTTL = DFLT_CACHE_ENTRY_TTL;
+	loadModConf->cacheSize = DFLT_CACHE_SIZE;
+	loadModConf->bWatch = 0;
 	for(i = 0 ; i < modpblk.nParams ; ++i) {
 		if(!pvals[i].bUsed) {
 			continue;
@@ -611,6 +682,15 @@ CODESTARTsetModCnf
 			} else {
 				fclose(fp);
 			}
+		} else if(!strcmp(modpblk.descr[i].name, "cacheentryttl")) {
+			loadModConf->cacheEntryTTL = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "cachesize")) {
+			loadModConf->cacheSize = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "watch")) {
+			loadModConf->bWatch = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "nodename")) {
+			free(loadModConf->nodeName);
+			loadModConf->nodeName = (uchar *) es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else {
 			dbgprintf("mmkubernetes: program error, non-handled "
 				"param '%s' in module() block\n", modpblk.descr[i].name);
@@ -666,6 +746,9 @@ ENDcreateInstance
 
 BEGINfreeInstance
 CODESTARTfreeInstance
+	/* the fetcher uses our settings, so it must end before they are freed */
+	if(pData->cache != NULL && pData->cache->pData == pData)
+		cacheStopFetcher(pData->cache);
 	free(pData->kubernetesUrl);
 	msgPropDescrDestruct(pData->srcMetadataDescr);
 	free(pData->srcMetadataDescr);
@@ -673,6 +756,7 @@ CODESTARTfreeInstance
 	free(pData->caCertFile);
 	free(pData->token);
 	free(pData->tokenFile);
+	free(pData->nodeName);
 	free(pData->fnRules);
 	free(pData->fnRulebase);
 	ln_exitCtx(pData->fnCtxln);
@@ -753,6 +837,7 @@ CODESTARTcreateWrkrInstance
 		curl_easy_setopt(ctx, CURLOPT_CAINFO, pWrkrData->pData->caCertFile);
 	if(pWrkrData->pData->allowUnsignedCerts)
 		curl_easy_setopt(ctx, CURLOPT_SSL_VERIFYPEER, 0);
+	curl_easy_setopt(ctx, CURLOPT_NOSIGNAL, 1); /* we run in threads */
 
 	pWrkrData->curlCtx = ctx;
 finalize_it:
@@ -770,33 +855,168 @@ CODESTARTfreeWrkrInstance
 ENDfreeWrkrInstance
 
 
-static struct cache_s *cacheNew(const uchar *url)
+static void cacheEntryFree(void *p)
+{
+	cacheEntry_t *const entry = (cacheEntry_t *) p;
+
+	free(entry->json);
+	json_object_put(entry->jo);
+	free(entry);
+}
+
+
+static void cacheFree(struct cache_s *cache)
+{
+	if(cache->mdHt != NULL)
+		hashtable_destroy(cache->mdHt, 1);
+	if(cache->nsHt != NULL)
+		hashtable_destroy(cache->nsHt, 1);
+	if(cache->reqHt != NULL)
+		hashtable_destroy(cache->reqHt, 0);
+	free(cache->resourceVersion);
+	free(cache->kbUrl);
+	pthread_rwlock_destroy(&cache->cacheLock);
+	pthread_mutex_destroy(&cache->reqMtx);
+	pthread_cond_destroy(&cache->reqCond);
+	free(cache);
+}
+
+
+static struct cache_s *cacheNew(instanceData *pData)
 {
 	struct cache_s *cache;
 
 	if (NULL == (cache = calloc(1, sizeof(struct cache_s)))) {
 		goto finalize_it;
 	}
-	cache->kbUrl = url;
+	if (NULL == (cache->kbUrl = (uchar *) strdup((char *) pData->kubernetesUrl))) {
+		free(cache);
+		cache = NULL;
+		goto finalize_it;
+	}
+	cache->entryTTL = pData->cacheEntryTTL;
+	cache->maxEntries = pData->cacheSize;
+	cache->bWatch = pData->bWatch;
+	cache->pData = pData;
+	pthread_rwlock_init(&cache->cacheLock, NULL);
+	pthread_mutex_init(&cache->reqMtx, NULL);
+	pthread_cond_init(&cache->reqCond, NULL);
 	cache->mdHt = create_hashtable(100, hash_from_string,
-		key_equals_string, (void (*)(void *)) json_object_put);
+		key_equals_string, cacheEntryFree);
 	cache->nsHt = create_hashtable(100, hash_from_string,
-		key_equals_string, (void (*)(void *)) json_object_put);
-	cache->cacheMtx = malloc(sizeof(pthread_mutex_t));
-	pthread_mutex_init(cache->cacheMtx, NULL);
+		key_equals_string, cacheEntryFree);
+	cache->reqHt = create_hashtable(100, hash_from_string,
+		key_equals_string, NULL);
+	if(cache->mdHt == NULL || cache->nsHt == NULL || cache->reqHt == NULL) {
+		cacheFree(cache);
+		cache = NULL;
+	}
 
 finalize_it:
 	return cache;
 }
 
 
-static void cacheFree(struct cache_s *cache)
+static void cacheListUnlink(cacheList_t *const list, cacheEntry_t *const entry)
 {
-	hashtable_destroy(cache->mdHt, 1);
-	hashtable_destroy(cache->nsHt, 1);
-	pthread_mutex_destroy(cache->cacheMtx);
-	free(cache->cacheMtx);
-	free(cache);
+	if(entry->prev == NULL)
+		list->head = entry->next;
+	else
+		entry->prev->next = entry->next;
+	if(entry->next == NULL)
+		list->tail = entry->prev;
+	else
+		entry->next->prev = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+
+static void cacheListAppend(cacheList_t *const list, cacheEntry_t *const entry)
+{
+	entry->next = NULL;
+	entry->prev = list->tail;
+	if(list->tail == NULL)
+		list->head = entry;
+	else
+		list->tail->next = entry;
+	list->tail = entry;
+}
+
+
+/* make room in a full cache table: drop the expired entries at the head
+ * of the list or, if there are none, the least recently stored entry.
+ * As all entries but the short lived "missing" ones have the same TTL,
+ * these are also the ones that expire first. We do not reorder on lookup,
+ * because lookups only hold the read lock.
+ * Must be called with the write lock held.
+ */
+static void cacheMakeRoom(struct hashtable *ht, cacheList_t *const list, const time_t now)
+{
+	cacheEntry_t *entry;
+	int nRemoved = 0;
+
+	while((entry = list->head) != NULL && (nRemoved == 0 || entry->expires <= now)) {
+		cacheListUnlink(list, entry);
+		cacheEntryFree(hashtable_remove(ht, (void *) entry->key));
+		++nRemoved;
+	}
+}
+
+
+/* add or replace a cache entry. Key and entry are handed over to the
+ * cache (and freed if they cannot be stored).
+ * Must be called with the write lock held.
+ */
+static void cacheStore(struct cache_s *cache, struct hashtable *ht, cacheList_t *const list,
+	char *key, cacheEntry_t *entry)
+{
+	cacheEntry_t *old;
+
+	if((old = hashtable_search(ht, key)) != NULL) {
+		cacheListUnlink(list, old);
+		cacheEntryFree(hashtable_remove(ht, key));
+	}
+	if(hashtable_count(ht) >= (unsigned) cache->maxEntries)
+		cacheMakeRoom(ht, list, time(NULL));
+	entry->key = key;
+	if(!hashtable_insert(ht, key, entry)) {
+		free(key);
+		cacheEntryFree(entry);
+		return;
+	}
+	cacheListAppend(list, entry);
+}
+
+
+/* start the background fetchers of the caches running in watch mode */
+static void cacheStartFetchers(void)
+{
+	int r;
+
+	for(int i = 0; caches != NULL && caches[i] != NULL; i++) {
+		if(!caches[i]->bWatch || caches[i]->bFetcherRunning)
+			continue;
+		caches[i]->bStop = 0;
+		if((r = pthread_create(&caches[i]->fetcherTid, NULL, fetcherThread, caches[i])) != 0) {
+			errmsg.LogError(r, RS_RET_ERR, "mmkubernetes: cannot create fetcher thread "
+				"for [%s] - no metadata will be available", caches[i]->kbUrl);
+			continue;
+		}
+		caches[i]->bFetcherRunning = 1;
+	}
+}
+
+
+static void cacheStopFetcher(struct cache_s *cache)
+{
+	if(!cache->bFetcherRunning)
+		return;
+	pthread_mutex_lock(&cache->reqMtx);
+	cache->bStop = 1;
+	pthread_cond_broadcast(&cache->reqCond);
+	pthread_mutex_unlock(&cache->reqMtx);
+	pthread_join(cache->fetcherTid, NULL);
+	cache->bFetcherRunning = 0;
 }
 
 
@@ -827,6 +1047,9 @@ CODESTARTnewActInst
 
 	pData->de_dot = loadModConf->de_dot;
 	pData->allowUnsignedCerts = loadModConf->allowUnsignedCerts;
+	pData->cacheEntryTTL = loadModConf->cacheEntryTTL;
+	pData->cacheSize = loadModConf->cacheSize;
+	pData->bWatch = loadModConf->bWatch;
 	for(i = 0 ; i < actpblk.nParams ; ++i) {
 		if(!pvals[i].bUsed) {
 			continue;
@@ -929,6 +1152,15 @@ CODESTARTnewActInst
 			} else {
 				fclose(fp);
 			}
+		} else if(!strcmp(actpblk.descr[i].name, "cacheentryttl")) {
+			pData->cacheEntryTTL = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "cachesize")) {
+			pData->cacheSize = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "watch")) {
+			pData->bWatch = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "nodename")) {
+			free(pData->nodeName);
+			pData->nodeName = (uchar *) es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else {
 			dbgprintf("mmkubernetes: program error, non-handled "
 				"param '%s' in action() block\n", actpblk.descr[i].name);
@@ -973,6 +1205,8 @@ CODESTARTnewActInst
 		pData->token = (uchar *) strdup((char *) loadModConf->token);
 	if(pData->tokenFile == NULL && loadModConf->tokenFile)
 		pData->tokenFile = (uchar *) strdup((char *) loadModConf->tokenFile);
+	if(pData->nodeName == NULL && loadModConf->nodeName)
+		pData->nodeName = (uchar *) strdup((char *) loadModConf->nodeName);
 	if(pData->de_dot_separator == NULL && loadModConf->de_dot_separator)
 		pData->de_dot_separator = (uchar *) strdup((char *) loadModConf->de_dot_separator);
 	if((pData->annotation_match.nmemb == 0) && (loadModConf->annotation_match.nmemb > 0))
@@ -996,7 +1230,7 @@ CODESTARTnewActInst
 	if(caches[i] != NULL) {
 		pData->cache = caches[i];
 	} else {
-		pData->cache = cacheNew(pData->kubernetesUrl);
+		CHKmalloc(pData->cache = cacheNew(pData));
 
 		CHKmalloc(caches = realloc(caches, (i + 2) * sizeof(struct cache_s *)));
 		caches[i] = pData->cache;
@@ -1037,6 +1271,7 @@ ENDcheckCnf
 BEGINactivateCnf
 CODESTARTactivateCnf
 	runModConf = pModConf;
+	cacheStartFetchers();
 ENDactivateCnf
 
 
@@ -1050,14 +1285,17 @@ CODESTARTfreeCnf
 	free(pModConf->caCertFile);
 	free(pModConf->token);
 	free(pModConf->tokenFile);
+	free(pModConf->nodeName);
 	free(pModConf->de_dot_separator);
 	free(pModConf->fnRules);
 	free(pModConf->fnRulebase);
 	free(pModConf->contRules);
 	free(pModConf->contRulebase);
 	free_annotationmatch(&pModConf->annotation_match);
-	for(i = 0; caches[i] != NULL; i++)
+	for(i = 0; caches[i] != NULL; i++) {
+		cacheStopFetcher(caches[i]);
 		cacheFree(caches[i]);
+	}
 	free(caches);
 ENDfreeCnf
 
@@ -1076,6 +1314,10 @@ CODESTARTdbgPrintInstInfo
 	dbgprintf("\tde_dot_separator='%s'\n", pData->de_dot_separator);
 	dbgprintf("\tfilenamerulebase='%s'\n", pData->fnRulebase);
 	dbgprintf("\tcontainerrulebase='%s'\n", pData->contRulebase);
+	dbgprintf("\tcacheentryttl='%d'\n", pData->cacheEntryTTL);
+	dbgprintf("\tcachesize='%d'\n", pData->cacheSize);
+	dbgprintf("\twatch='%d'\n", pData->bWatch);
+	dbgprintf("\tnodename='%s'\n", pData->nodeName);
 #if HAVE_LOADSAMPLESFROMSTRING == 1
 	dbgprintf("\tfilenamerules='%s'\n", pData->fnRules);
 	dbgprintf("\tcontainerrules='%s'\n", pData->contRules);
@@ -1257,6 +1499,527 @@ finalize_it:
 }
 
 
+/* add a namespace (as returned by the API) to the cache */
+static rsRetVal
+cacheAddNamespace(struct cache_s *cache, instanceData *pData, struct json_object *jNs)
+{
+	struct json_object *jNsMeta = NULL, *jo = NULL;
+	cacheEntry_t *entry = NULL;
+	char *key = NULL;
+	DEFiRet;
+
+	if(!fjson_object_object_get_ex(jNs, "metadata", &jNsMeta) ||
+		!fjson_object_object_get_ex(jNsMeta, "name", &jo)) {
+		/* namespace with no metadata??? */
+		errmsg.LogMsg(0, RS_RET_ERR, LOG_INFO,
+			      "mmkubernetes: namespace received from [%s] has no metadata!\n", cache->kbUrl);
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	CHKmalloc(key = strdup(json_object_get_string(jo)));
+	CHKmalloc(entry = calloc(1, sizeof(cacheEntry_t)));
+	entry->jo = json_object_get(jNsMeta);
+	parse_labels_annotations(entry->jo, &pData->annotation_match, pData->de_dot,
+		(const char *)pData->de_dot_separator, pData->de_dot_separator_len);
+	entry->expires = time(NULL) + cache->entryTTL;
+
+	pthread_rwlock_wrlock(&cache->cacheLock);
+	cacheStore(cache, cache->nsHt, &cache->nsList, key, entry);
+	pthread_rwlock_unlock(&cache->cacheLock);
+	key = NULL;
+	entry = NULL;
+
+finalize_it:
+	free(key);
+	if(entry != NULL)
+		cacheEntryFree(entry);
+	RETiRet;
+}
+
+
+/* build the metadata of a pod (as returned by the API) plus its namespace,
+ * if that is cached, and add it to the cache. If pJson is non-NULL, it
+ * receives a copy of the serialized metadata.
+ */
+static rsRetVal
+cacheAddPod(struct cache_s *cache, instanceData *pData, struct json_object *jPod, char **pJson)
+{
+	struct json_object *jPodData = NULL, *jSpec = NULL, *jNsMeta = NULL, *jo = NULL, *jo2 = NULL;
+	const char *ns = NULL, *podName = NULL;
+	cacheEntry_t *nsEntry, *entry = NULL;
+	char *key = NULL;
+	sbool bLocked = 0;
+	DEFiRet;
+
+	if(fjson_object_object_get_ex(jPod, "metadata", &jPodData)) {
+		if(fjson_object_object_get_ex(jPodData, "namespace", &jo2))
+			ns = json_object_get_string(jo2);
+		if(fjson_object_object_get_ex(jPodData, "name", &jo2))
+			podName = json_object_get_string(jo2);
+	}
+	if(ns == NULL || podName == NULL) {
+		errmsg.LogMsg(0, RS_RET_ERR, LOG_INFO,
+			      "mmkubernetes: pod received from [%s] has no name or namespace!\n", cache->kbUrl);
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	if ((-1 == asprintf(&key, "%s/%s", ns, podName)) || (!key)) {
+		key = NULL;
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	parse_labels_annotations(jPodData, &pData->annotation_match, pData->de_dot,
+		(const char *)pData->de_dot_separator, pData->de_dot_separator_len);
+	CHKmalloc(entry = calloc(1, sizeof(cacheEntry_t)));
+	entry->expires = time(NULL) + cache->entryTTL;
+
+	/* namespace objects may only be referenced with the write lock held */
+	pthread_rwlock_wrlock(&cache->cacheLock);
+	bLocked = 1;
+	if((nsEntry = hashtable_search(cache->nsHt, (void *) ns)) != NULL)
+		jNsMeta = nsEntry->jo;
+	CHKmalloc(jo = json_object_new_object());
+	if(jNsMeta && fjson_object_object_get_ex(jNsMeta, "uid", &jo2))
+		json_object_object_add(jo, "namespace_id", json_object_get(jo2));
+	if(jNsMeta && fjson_object_object_get_ex(jNsMeta, "labels", &jo2))
+		json_object_object_add(jo, "namespace_labels", json_object_get(jo2));
+	if(jNsMeta && fjson_object_object_get_ex(jNsMeta, "annotations", &jo2))
+		json_object_object_add(jo, "namespace_annotations", json_object_get(jo2));
+	if(jNsMeta && fjson_object_object_get_ex(jNsMeta, "creationTimestamp", &jo2))
+		json_object_object_add(jo, "creation_timestamp", json_object_get(jo2));
+	if(fjson_object_object_get_ex(jPodData, "uid", &jo2))
+		json_object_object_add(jo, "pod_id", json_object_get(jo2));
+	if(fjson_object_object_get_ex(jPodData, "annotations", &jo2))
+		json_object_object_add(jo, "annotations", json_object_get(jo2));
+	if(fjson_object_object_get_ex(jPodData, "labels", &jo2))
+		json_object_object_add(jo, "labels", json_object_get(jo2));
+	if(fjson_object_object_get_ex(jPod, "spec", &jSpec)) {
+		if(fjson_object_object_get_ex(jSpec, "nodeName", &jo2)) {
+			json_object_object_add(jo, "host", json_object_get(jo2));
+		}
+	}
+	CHKmalloc(entry->json = strdup(json_object_get_string(jo)));
+	if(pJson != NULL)
+		CHKmalloc(*pJson = strdup(entry->json));
+	cacheStore(cache, cache->mdHt, &cache->mdList, key, entry);
+	key = NULL;
+	entry = NULL;
+
+finalize_it:
+	json_object_put(jo); /* drops the references to namespace objects, so needs the lock */
+	if(bLocked)
+		pthread_rwlock_unlock(&cache->cacheLock);
+	free(key);
+	if(entry != NULL)
+		cacheEntryFree(entry);
+	RETiRet;
+}
+
+
+/* remember that a pod could not be obtained, so that the fetcher does
+ * not query it over and over again
+ */
+static void
+cacheAddMissingPod(struct cache_s *cache, const char *key)
+{
+	cacheEntry_t *entry;
+	char *keyCopy;
+
+	if((keyCopy = strdup(key)) == NULL)
+		return;
+	if((entry = calloc(1, sizeof(cacheEntry_t))) == NULL) {
+		free(keyCopy);
+		return;
+	}
+	entry->expires = time(NULL) + (cache->entryTTL < MISSING_ENTRY_TTL ? cache->entryTTL : MISSING_ENTRY_TTL);
+	pthread_rwlock_wrlock(&cache->cacheLock);
+	cacheStore(cache, cache->mdHt, &cache->mdList, keyCopy, entry);
+	pthread_rwlock_unlock(&cache->cacheLock);
+}
+
+
+/* query the namespace, unless we already have current data for it */
+static rsRetVal
+ensureNamespace(wrkrInstanceData_t *pWrkrData, struct cache_s *cache, const char *ns)
+{
+	cacheEntry_t *nsEntry;
+	sbool bCurrent;
+	char *url = NULL;
+	struct json_object *jReply = NULL;
+	DEFiRet;
+
+	pthread_rwlock_rdlock(&cache->cacheLock);
+	nsEntry = hashtable_search(cache->nsHt, (void *) ns);
+	bCurrent = (nsEntry != NULL && nsEntry->expires > time(NULL));
+	pthread_rwlock_unlock(&cache->cacheLock);
+	if(bCurrent)
+		FINALIZE;
+
+	/* todo: implement support for the .orphaned namespace */
+	if ((-1 == asprintf(&url, "%s/api/v1/namespaces/%s", (char *) cache->kbUrl, ns)) || (!url)) {
+		url = NULL;
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	CHKiRet(queryKB(pWrkrData, url, &jReply));
+	CHKiRet(cacheAddNamespace(cache, pWrkrData->pData, jReply));
+
+finalize_it:
+	free(url);
+	json_object_put(jReply);
+	RETiRet;
+}
+
+
+/* query a pod (and its namespace, if needed) and add it to the cache */
+static rsRetVal
+fetchPod(wrkrInstanceData_t *pWrkrData, struct cache_s *cache, const char *ns, const char *podName,
+	char **pJson)
+{
+	char *url = NULL;
+	struct json_object *jReply = NULL;
+	DEFiRet;
+
+	CHKiRet(ensureNamespace(pWrkrData, cache, ns));
+	if ((-1 == asprintf(&url, "%s/api/v1/namespaces/%s/pods/%s", (char *) cache->kbUrl, ns, podName)) ||
+		(!url)) {
+		url = NULL;
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	CHKiRet(queryKB(pWrkrData, url, &jReply));
+	CHKiRet(cacheAddPod(cache, pWrkrData->pData, jReply, pJson));
+
+finalize_it:
+	free(url);
+	json_object_put(jReply);
+	RETiRet;
+}
+
+
+/* ask the fetcher to obtain a pod (watch mode). Never blocks on the API. */
+static void
+requestPod(struct cache_s *cache, const char *key)
+{
+	static char requested; /* the values of reqHt are unused, they only must not be NULL */
+	char *keyCopy;
+
+	pthread_mutex_lock(&cache->reqMtx);
+	if(hashtable_search(cache->reqHt, (void *) key) == NULL &&
+		hashtable_count(cache->reqHt) < (unsigned) cache->maxEntries &&
+		(keyCopy = strdup(key)) != NULL) {
+		if(hashtable_insert(cache->reqHt, keyCopy, &requested))
+			pthread_cond_signal(&cache->reqCond);
+		else
+			free(keyCopy);
+	}
+	pthread_mutex_unlock(&cache->reqMtx);
+}
+
+
+static sbool
+fetcherShouldStop(struct cache_s *cache)
+{
+	sbool bStop;
+
+	pthread_mutex_lock(&cache->reqMtx);
+	bStop = cache->bStop;
+	pthread_mutex_unlock(&cache->reqMtx);
+	return bStop;
+}
+
+
+/* wait before retrying after an API error, but end early on shutdown */
+static void
+fetcherSleep(struct cache_s *cache, const int seconds)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_REALTIME, &t);
+	t.tv_sec += seconds;
+	pthread_mutex_lock(&cache->reqMtx);
+	while(!cache->bStop && pthread_cond_timedwait(&cache->reqCond, &cache->reqMtx, &t) != ETIMEDOUT)
+		/* just wait */;
+	pthread_mutex_unlock(&cache->reqMtx);
+}
+
+
+/* obtain all pods workers have asked for */
+static void
+fetchRequested(wrkrInstanceData_t *pWrkrData, struct cache_s *cache)
+{
+	struct hashtable *reqHt, *newHt;
+	struct hashtable_itr *itr;
+
+	if((newHt = create_hashtable(100, hash_from_string, key_equals_string, NULL)) == NULL)
+		return;
+	pthread_mutex_lock(&cache->reqMtx);
+	reqHt = cache->reqHt;
+	cache->reqHt = newHt;
+	pthread_mutex_unlock(&cache->reqMtx);
+
+	if(hashtable_count(reqHt) > 0 && (itr = hashtable_iterator(reqHt)) != NULL) {
+		do {
+			char *const key = (char *) hashtable_iterator_key(itr);
+			char *const slash = strchr(key, '/');
+			rsRetVal localRet;
+			if(slash == NULL)
+				continue;
+			*slash = '\0';
+			localRet = fetchPod(pWrkrData, cache, key, slash + 1, NULL);
+			*slash = '/';
+			if(localRet != RS_RET_OK)
+				cacheAddMissingPod(cache, key);
+		} while(!fetcherShouldStop(cache) && hashtable_iterator_advance(itr));
+		free(itr);
+	}
+	hashtable_destroy(reqHt, 0);
+}
+
+
+/* get all namespaces and pods and remember where to start watching */
+static rsRetVal
+listKB(wrkrInstanceData_t *pWrkrData, struct cache_s *cache)
+{
+	char *url = NULL;
+	struct json_object *jReply = NULL, *jItems = NULL, *jo = NULL, *jo2 = NULL;
+	int i, nItems;
+	DEFiRet;
+
+	if ((-1 == asprintf(&url, "%s/api/v1/namespaces", (char *) cache->kbUrl)) || (!url)) {
+		url = NULL;
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	CHKiRet(queryKB(pWrkrData, url, &jReply));
+	if(fjson_object_object_get_ex(jReply, "items", &jItems)) {
+		nItems = (int) json_object_array_length(jItems);
+		for(i = 0 ; i < nItems ; ++i)
+			cacheAddNamespace(cache, pWrkrData->pData, json_object_array_get_idx(jItems, i));
+	}
+	json_object_put(jReply);
+	jReply = NULL;
+	free(url);
+
+	if ((-1 == asprintf(&url, "%s/api/v1/pods%s%s", (char *) cache->kbUrl,
+		(cache->pData->nodeName == NULL) ? "" : "?fieldSelector=spec.nodeName%3D",
+		(cache->pData->nodeName == NULL) ? "" : (char *) cache->pData->nodeName)) || (!url)) {
+		url = NULL;
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	CHKiRet(queryKB(pWrkrData, url, &jReply));
+	if(!fjson_object_object_get_ex(jReply, "metadata", &jo) ||
+		!fjson_object_object_get_ex(jo, "resourceVersion", &jo2)) {
+		errmsg.LogMsg(0, RS_RET_ERR, LOG_ERR,
+			      "mmkubernetes: pod list from [%s] has no resourceVersion, cannot watch\n", url);
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	free(cache->resourceVersion);
+	CHKmalloc(cache->resourceVersion = strdup(json_object_get_string(jo2)));
+	nItems = 0;
+	if(fjson_object_object_get_ex(jReply, "items", &jItems)) {
+		nItems = (int) json_object_array_length(jItems);
+		for(i = 0 ; i < nItems ; ++i)
+			cacheAddPod(cache, pWrkrData->pData, json_object_array_get_idx(jItems, i), NULL);
+	}
+	DBGPRINTF("mmkubernetes: listed %d pods from [%s], watching from resourceVersion %s\n",
+		nItems, cache->kbUrl, cache->resourceVersion);
+
+finalize_it:
+	free(url);
+	json_object_put(jReply);
+	RETiRet;
+}
+
+
+typedef struct watchCtx_s {
+	struct cache_s *cache;
+	wrkrInstanceData_t *pWrkrFetch; /* for namespace queries while processing events */
+	char *buf; /* incomplete event data */
+	size_t len;
+	sbool bNeedList;
+} watchCtx_t;
+
+static rsRetVal
+watchProcessEvent(watchCtx_t *const ctx, const char *const line, const size_t len)
+{
+	struct json_tokener *jt = NULL;
+	struct json_object *jEvent = NULL, *jType = NULL, *jObject = NULL, *jMeta = NULL, *jo = NULL;
+	const char *type;
+	DEFiRet;
+
+	CHKmalloc(jt = json_tokener_new());
+	jEvent = json_tokener_parse_ex(jt, line, (int) len);
+	if(!json_object_is_type(jEvent, json_type_object) ||
+		!fjson_object_object_get_ex(jEvent, "type", &jType) ||
+		!fjson_object_object_get_ex(jEvent, "object", &jObject)) {
+		errmsg.LogMsg(0, RS_RET_JSON_PARSE_ERR, LOG_INFO,
+			      "mmkubernetes: unable to parse watch event:[%.*s]\n", (int)len, line);
+		ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+	}
+	type = json_object_get_string(jType);
+	if(!strcmp(type, "ERROR")) {
+		/* usually "410 Gone" - our resourceVersion is too old */
+		DBGPRINTF("mmkubernetes: watch error event:[%.*s], re-listing\n", (int)len, line);
+		ctx->bNeedList = 1;
+		FINALIZE;
+	}
+	if(fjson_object_object_get_ex(jObject, "metadata", &jMeta) &&
+		fjson_object_object_get_ex(jMeta, "resourceVersion", &jo)) {
+		free(ctx->cache->resourceVersion);
+		if((ctx->cache->resourceVersion = strdup(json_object_get_string(jo))) == NULL) {
+			ctx->bNeedList = 1;
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+	}
+	if(!strcmp(type, "ADDED") || !strcmp(type, "MODIFIED")) {
+		if(jMeta != NULL && fjson_object_object_get_ex(jMeta, "namespace", &jo))
+			ensureNamespace(ctx->pWrkrFetch, ctx->cache, json_object_get_string(jo));
+		CHKiRet(cacheAddPod(ctx->cache, ctx->cache->pData, jObject, NULL));
+	}
+	/* DELETED pods are kept until they expire: their log files are
+	 * frequently processed after the pod is gone.
+	 */
+
+finalize_it:
+	if(jt != NULL)
+		json_tokener_free(jt);
+	json_object_put(jEvent);
+	RETiRet;
+}
+
+/* curl write callback for the watch stream: one event per line */
+static size_t watchCB(char *data, size_t size, size_t nmemb, void *usrptr)
+{
+	watchCtx_t *const ctx = (watchCtx_t *) usrptr;
+	const size_t len = size * nmemb;
+	char *buf, *line, *eol;
+
+	if((buf = realloc(ctx->buf, ctx->len + len)) == NULL)
+		return 0;
+	memcpy(buf + ctx->len, data, len);
+	ctx->buf = buf;
+	ctx->len += len;
+
+	line = ctx->buf;
+	while(!ctx->bNeedList && (eol = memchr(line, '\n', ctx->len - (line - ctx->buf))) != NULL) {
+		if(eol > line)
+			watchProcessEvent(ctx, line, eol - line);
+		line = eol + 1;
+	}
+	if(ctx->bNeedList)
+		return 0; /* abort the watch, the fetcher re-lists */
+	ctx->len -= line - ctx->buf;
+	memmove(ctx->buf, line, ctx->len);
+	return len;
+}
+
+/* called by curl about once a second during the watch: interrupt it if
+ * we shall stop or workers need pods we do not know
+ */
+static int watchProgressCB(void *clientp,
+	curl_off_t __attribute__((unused)) dltotal, curl_off_t __attribute__((unused)) dlnow,
+	curl_off_t __attribute__((unused)) ultotal, curl_off_t __attribute__((unused)) ulnow)
+{
+	struct cache_s *const cache = (struct cache_s *) clientp;
+	int bAbort;
+
+	pthread_mutex_lock(&cache->reqMtx);
+	bAbort = cache->bStop || hashtable_count(cache->reqHt) > 0;
+	pthread_mutex_unlock(&cache->reqMtx);
+	return bAbort;
+}
+
+/* watch pods until the API server ends the watch or we are interrupted */
+static rsRetVal
+watchKB(wrkrInstanceData_t *pWrkrWatch, wrkrInstanceData_t *pWrkrFetch, struct cache_s *cache,
+	sbool *pbNeedList)
+{
+	watchCtx_t ctx;
+	char *url = NULL;
+	CURLcode ccode;
+	long resp_code = 0;
+	DEFiRet;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.cache = cache;
+	ctx.pWrkrFetch = pWrkrFetch;
+	if ((-1 == asprintf(&url, "%s/api/v1/pods?watch=true&resourceVersion=%s&timeoutSeconds=%d%s%s",
+		(char *) cache->kbUrl, cache->resourceVersion, WATCH_TIMEOUT,
+		(cache->pData->nodeName == NULL) ? "" : "&fieldSelector=spec.nodeName%3D",
+		(cache->pData->nodeName == NULL) ? "" : (char *) cache->pData->nodeName)) || (!url)) {
+		url = NULL;
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	curl_easy_setopt(pWrkrWatch->curlCtx, CURLOPT_URL, url);
+	curl_easy_setopt(pWrkrWatch->curlCtx, CURLOPT_WRITEFUNCTION, watchCB);
+	curl_easy_setopt(pWrkrWatch->curlCtx, CURLOPT_WRITEDATA, &ctx);
+	curl_easy_setopt(pWrkrWatch->curlCtx, CURLOPT_NOPROGRESS, 0L);
+	curl_easy_setopt(pWrkrWatch->curlCtx, CURLOPT_XFERINFOFUNCTION, watchProgressCB);
+	curl_easy_setopt(pWrkrWatch->curlCtx, CURLOPT_XFERINFODATA, cache);
+	curl_easy_setopt(pWrkrWatch->curlCtx, CURLOPT_TIMEOUT, (long) WATCH_TIMEOUT + 30);
+
+	ccode = curl_easy_perform(pWrkrWatch->curlCtx);
+	if(ctx.bNeedList) {
+		*pbNeedList = 1;
+		FINALIZE;
+	}
+	if(ccode == CURLE_ABORTED_BY_CALLBACK || ccode == CURLE_OPERATION_TIMEDOUT)
+		FINALIZE; /* shutdown, pods requested or a watch that did not end in time */
+	if(ccode != CURLE_OK) {
+		errmsg.LogMsg(0, RS_RET_ERR, LOG_ERR,
+			      "mmkubernetes: failed to watch [%s] - %d:%s\n",
+			      url, ccode, curl_easy_strerror(ccode));
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	curl_easy_getinfo(pWrkrWatch->curlCtx, CURLINFO_RESPONSE_CODE, &resp_code);
+	if(resp_code != 200) {
+		errmsg.LogMsg(0, RS_RET_ERR, LOG_ERR,
+			      "mmkubernetes: server returned unexpected code [%ld] for watch [%s]\n",
+			      resp_code, url);
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+
+finalize_it:
+	free(url);
+	free(ctx.buf);
+	RETiRet;
+}
+
+
+/* background fetcher of a cache in watch mode */
+static void *
+fetcherThread(void *arg)
+{
+	struct cache_s *const cache = (struct cache_s *) arg;
+	wrkrInstanceData_t *pWrkrFetch = NULL, *pWrkrWatch = NULL;
+	sbool bNeedList = 1;
+
+	if(createWrkrInstance(&pWrkrFetch, cache->pData) != RS_RET_OK ||
+		createWrkrInstance(&pWrkrWatch, cache->pData) != RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_ERR, "mmkubernetes: cannot initialize fetcher for [%s] "
+			"- no metadata will be available", cache->kbUrl);
+		goto finalize_it;
+	}
+
+	while(!fetcherShouldStop(cache)) {
+		if(bNeedList) {
+			if(listKB(pWrkrFetch, cache) != RS_RET_OK) {
+				fetcherSleep(cache, WATCH_RETRY_INTERVAL);
+				continue;
+			}
+			bNeedList = 0;
+		}
+		fetchRequested(pWrkrFetch, cache);
+		if(watchKB(pWrkrWatch, pWrkrFetch, cache, &bNeedList) != RS_RET_OK) {
+			bNeedList = 1;
+			fetcherSleep(cache, WATCH_RETRY_INTERVAL);
+		}
+	}
+
+finalize_it:
+	if(pWrkrFetch != NULL)
+		freeWrkrInstance(pWrkrFetch);
+	if(pWrkrWatch != NULL)
+		freeWrkrInstance(pWrkrWatch);
+	return NULL;
+}
+
+
 /* versions < 8.16.0 don't support BEGINdoAction_NoStrings */
 #if defined(BEGINdoAction_NoStrings)
 BEGINdoAction_NoStrings
@@ -1269,9 +2032,12 @@ BEGINdoAction
 	const char *podName = NULL, *ns = NULL, *containerName = NULL,
 		*containerID = NULL;
 	char *mdKey = NULL;
-	struct json_object *jMetadata = NULL, *jMetadataCopy = NULL, *jMsgMeta = NULL,
-			*jo = NULL;
-	int add_ns_metadata = 0;
+	char *jsonStr = NULL;
+	struct json_object *jMetadata = NULL, *jMsgMeta = NULL, *jo = NULL, *jo2 = NULL;
+	struct cache_s *const cache = pWrkrData->pData->cache;
+	cacheEntry_t *entry;
+	sbool bKnown = 0, bCurrent = 0;
+	rsRetVal localRet;
 CODESTARTdoAction
 	CHKiRet_Hdlr(extractMsgMetadata(pMsg, pWrkrData->pData, &jMsgMeta)) {
 		ABORT_FINALIZE((iRet == RS_RET_NOT_FOUND) ? RS_RET_OK : iRet);
@@ -1289,146 +2055,85 @@ CODESTARTdoAction
 	assert(ns != NULL);
 	assert(containerName != NULL);
 	assert(containerID != NULL);
+	jo = NULL; /* only borrowed from jMsgMeta so far */
 
 	dbgprintf("mmkubernetes:\n  podName: '%s'\n  namespace: '%s'\n  containerName: '%s'\n"
 		"  containerID: '%s'\n", podName, ns, containerName, containerID);
 
 	/* check cache for metadata */
-	if ((-1 == asprintf(&mdKey, "%s_%s_%s", ns, podName, containerName)) ||
+	if ((-1 == asprintf(&mdKey, "%s/%s", ns, podName)) ||
 		(!mdKey)) {
+		mdKey = NULL;
 		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
-	pthread_mutex_lock(pWrkrData->pData->cache->cacheMtx);
-	jMetadata = hashtable_search(pWrkrData->pData->cache->mdHt, mdKey);
-
-	if(jMetadata == NULL) {
-		char *url = NULL;
-		struct json_object *jReply = NULL, *jo2 = NULL, *jNsMeta = NULL, *jPodData = NULL;
-
-		/* check cache for namespace metadata */
-		jNsMeta = hashtable_search(pWrkrData->pData->cache->nsHt, (char *)ns);
-
-		if(jNsMeta == NULL) {
-			/* query kubernetes for namespace info */
-			/* todo: move url definitions elsewhere */
-			if ((-1 == asprintf(&url, "%s/api/v1/namespaces/%s",
-				 (char *) pWrkrData->pData->kubernetesUrl, ns)) ||
-				(!url)) {
-				pthread_mutex_unlock(pWrkrData->pData->cache->cacheMtx);
-				ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
-			}
-			iRet = queryKB(pWrkrData, url, &jReply);
-			free(url);
-			/* todo: implement support for the .orphaned namespace */
-			if (iRet != RS_RET_OK) {
-				json_object_put(jReply);
-				jReply = NULL;
-				pthread_mutex_unlock(pWrkrData->pData->cache->cacheMtx);
-				FINALIZE;
-			}
-
-			if(fjson_object_object_get_ex(jReply, "metadata", &jNsMeta)) {
-				jNsMeta = json_object_get(jNsMeta);
-				parse_labels_annotations(jNsMeta, &pWrkrData->pData->annotation_match,
-					pWrkrData->pData->de_dot,
-					(const char *)pWrkrData->pData->de_dot_separator,
-					pWrkrData->pData->de_dot_separator_len);
-				add_ns_metadata = 1;
-			} else {
-				/* namespace with no metadata??? */
-				errmsg.LogMsg(0, RS_RET_ERR, LOG_INFO,
-					      "mmkubernetes: namespace [%s] has no metadata!\n", ns);
-				jNsMeta = NULL;
-			}
-
-			json_object_put(jReply);
-			jReply = NULL;
-		}
-
-		if ((-1 == asprintf(&url, "%s/api/v1/namespaces/%s/pods/%s",
-			 (char *) pWrkrData->pData->kubernetesUrl, ns, podName)) ||
-			(!url)) {
-			pthread_mutex_unlock(pWrkrData->pData->cache->cacheMtx);
-			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
-		}
-		iRet = queryKB(pWrkrData, url, &jReply);
-		free(url);
-		if(iRet != RS_RET_OK) {
-			if(jNsMeta && add_ns_metadata) {
-				hashtable_insert(pWrkrData->pData->cache->nsHt, strdup(ns), jNsMeta);
-			}
-			json_object_put(jReply);
-			jReply = NULL;
-			pthread_mutex_unlock(pWrkrData->pData->cache->cacheMtx);
-			FINALIZE;
-		}
-
-		jo = json_object_new_object();
-		if(jNsMeta && fjson_object_object_get_ex(jNsMeta, "uid", &jo2))
-			json_object_object_add(jo, "namespace_id", json_object_get(jo2));
-		if(jNsMeta && fjson_object_object_get_ex(jNsMeta, "labels", &jo2))
-			json_object_object_add(jo, "namespace_labels", json_object_get(jo2));
-		if(jNsMeta && fjson_object_object_get_ex(jNsMeta, "annotations", &jo2))
-			json_object_object_add(jo, "namespace_annotations", json_object_get(jo2));
-		if(jNsMeta && fjson_object_object_get_ex(jNsMeta, "creationTimestamp", &jo2))
-			json_object_object_add(jo, "creation_timestamp", json_object_get(jo2));
-		if(fjson_object_object_get_ex(jReply, "metadata", &jPodData)) {
-			if(fjson_object_object_get_ex(jPodData, "uid", &jo2))
-				json_object_object_add(jo, "pod_id", json_object_get(jo2));
-			parse_labels_annotations(jPodData, &pWrkrData->pData->annotation_match,
-				pWrkrData->pData->de_dot,
-				(const char *)pWrkrData->pData->de_dot_separator,
-				pWrkrData->pData->de_dot_separator_len);
-			if(fjson_object_object_get_ex(jPodData, "annotations", &jo2))
-				json_object_object_add(jo, "annotations", json_object_get(jo2));
-			if(fjson_object_object_get_ex(jPodData, "labels", &jo2))
-				json_object_object_add(jo, "labels", json_object_get(jo2));
-		}
-		if(fjson_object_object_get_ex(jReply, "spec", &jPodData)) {
-			if(fjson_object_object_get_ex(jPodData, "nodeName", &jo2)) {
-				json_object_object_add(jo, "host", json_object_get(jo2));
-			}
+	/* the msg gets its own copy of the metadata - it must not share
+	 * objects with the cache
+	 */
+	pthread_rwlock_rdlock(&cache->cacheLock);
+	if((entry = hashtable_search(cache->mdHt, mdKey)) != NULL) {
+		bKnown = 1;
+		bCurrent = entry->expires > time(NULL);
+		if(entry->json != NULL)
+			jo = json_tokener_parse(entry->json);
+	}
+	pthread_rwlock_unlock(&cache->cacheLock);
+
+	if(!bKnown) {
+		if(cache->bWatch) {
+			/* not delivered by the watch (yet), e.g. a pod just started:
+			 * look it up once, so its first messages get metadata, too
+			 */
+			if(fetchPod(pWrkrData, cache, ns, podName, &jsonStr) == RS_RET_OK)
+				jo = json_tokener_parse(jsonStr);
+			else
+				cacheAddMissingPod(cache, mdKey);
+		} else {
+			CHKiRet(fetchPod(pWrkrData, cache, ns, podName, &jsonStr));
+			jo = json_tokener_parse(jsonStr);
 		}
-		json_object_put(jReply);
-		jReply = NULL;
-
-		if (fjson_object_object_get_ex(jMsgMeta, "pod_name", &jo2))
-			json_object_object_add(jo, "pod_name", json_object_get(jo2));
-		if (fjson_object_object_get_ex(jMsgMeta, "namespace_name", &jo2))
-			json_object_object_add(jo, "namespace_name", json_object_get(jo2));
-		if (fjson_object_object_get_ex(jMsgMeta, "container_name", &jo2))
-			json_object_object_add(jo, "container_name", json_object_get(jo2));
-		json_object_object_add(jo, "master_url",
-			json_object_new_string((const char *)pWrkrData->pData->kubernetesUrl));
-		jMetadata = json_object_new_object();
-		json_object_object_add(jMetadata, "kubernetes", jo);
-		jo = json_object_new_object();
-		if (fjson_object_object_get_ex(jMsgMeta, "container_id", &jo2))
-			json_object_object_add(jo, "container_id", json_object_get(jo2));
-		json_object_object_add(jMetadata, "docker", jo);
-
-		hashtable_insert(pWrkrData->pData->cache->mdHt, mdKey, jMetadata);
-		mdKey = NULL;
-		if(jNsMeta && add_ns_metadata) {
-			hashtable_insert(pWrkrData->pData->cache->nsHt, strdup(ns), jNsMeta);
-			ns = NULL;
+	} else if(!bCurrent) {
+		if(cache->bWatch) {
+			/* the fetcher refreshes it, until then we use what we have (if anything) */
+			requestPod(cache, mdKey);
+		} else if((localRet = fetchPod(pWrkrData, cache, ns, podName, &jsonStr)) == RS_RET_OK) {
+			json_object_put(jo);
+			jo = json_tokener_parse(jsonStr);
+		} else if(jo == NULL) {
+			ABORT_FINALIZE(localRet);
+		} else {
+			DBGPRINTF("mmkubernetes: cannot refresh metadata for pod '%s', "
+				"using stale data\n", mdKey);
 		}
 	}
+	if(jo == NULL) {
+		DBGPRINTF("mmkubernetes: no metadata (yet) for pod '%s'\n", mdKey);
+		FINALIZE;
+	}
+
+	if (fjson_object_object_get_ex(jMsgMeta, "pod_name", &jo2))
+		json_object_object_add(jo, "pod_name", json_object_get(jo2));
+	if (fjson_object_object_get_ex(jMsgMeta, "namespace_name", &jo2))
+		json_object_object_add(jo, "namespace_name", json_object_get(jo2));
+	if (fjson_object_object_get_ex(jMsgMeta, "container_name", &jo2))
+		json_object_object_add(jo, "container_name", json_object_get(jo2));
+	json_object_object_add(jo, "master_url",
+		json_object_new_string((const char *)pWrkrData->pData->kubernetesUrl));
+	CHKmalloc(jMetadata = json_object_new_object());
+	json_object_object_add(jMetadata, "kubernetes", jo);
+	jo = json_object_new_object();
+	if (fjson_object_object_get_ex(jMsgMeta, "container_id", &jo2))
+		json_object_object_add(jo, "container_id", json_object_get(jo2));
+	json_object_object_add(jMetadata, "docker", jo);
+	jo = NULL;
 
-	/* make a copy of the metadata for the msg to own */
-	/* todo: use json_object_deep_copy when implementation available in libfastjson */
-	/* yes, this is expensive - but there is no other way to make this thread safe - we
-	 * can't allow the msg to have a shared pointer to an element inside the cache,
-	 * outside of the cache lock
-	 */
-	jMetadataCopy = json_tokener_parse(json_object_get_string(jMetadata));
-	pthread_mutex_unlock(pWrkrData->pData->cache->cacheMtx);
 	/* the +1 is there to skip the leading '$' */
-	msgAddJSON(pMsg, (uchar *) pWrkrData->pData->dstMetadataPath + 1, jMetadataCopy, 0, 0);
+	msgAddJSON(pMsg, (uchar *) pWrkrData->pData->dstMetadataPath + 1, jMetadata, 0, 0);
 
 finalize_it:
+	json_object_put(jo);
 	json_object_put(jMsgMeta);
 	free(mdKey);
+	free(jsonStr);
 ENDdoAction
 
 
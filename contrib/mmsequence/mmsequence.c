@@ -43,7 +43,7 @@
 #include "template.h"
 #include "module-template.h"
 #include "errmsg.h"
-#include "hashtable.h"
+#include "ctrmap.h"
 
 #define JSON_VAR_NAME "$!mmsequence"
 
@@ -68,7 +68,8 @@ typedef struct _instanceData {
 	int valueTo;
 	int step;
 	unsigned int seed;
-	int value;
+	ctrmapCounter_t ctrInst;	/* for mmSequencePerInstance */
+	ctrmapCounter_t *pCtrKey;	/* for mmSequencePerKey, owned by ctrs */
 	char *pszKey;
 	char *pszVar;
 } instanceData;
@@ -100,12 +101,9 @@ static struct cnfparamblk actpblk =
 	  actpdescr
 	};
 
-/* table for key-counter pairs */	
-static struct hashtable *ght;
-static pthread_mutex_t ght_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* table for key-counter pairs, shared by all instances */
+static ctrmap_t *ctrs;
 
-static pthread_mutex_t inst_mutex = PTHREAD_MUTEX_INITIALIZER;
-	
 BEGINbeginCnfLoad
 CODESTARTbeginCnfLoad
 	loadModConf = pModConf;
@@ -132,6 +130,7 @@ ENDfreeCnf
 
 BEGINcreateInstance
 CODESTARTcreateInstance
+	ctrmapCounterInit(&pData->ctrInst, 0);
 ENDcreateInstance
 
 BEGINcreateWrkrInstance
@@ -146,6 +145,7 @@ ENDisCompatibleWithFeature
 
 BEGINfreeInstance
 CODESTARTfreeInstance
+	ctrmapCounterDestruct(&pData->ctrInst);
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
@@ -242,21 +242,20 @@ CODESTARTnewActInst
 		pData->seed = (unsigned int)(intptr_t)pData ^ (unsigned int)time(NULL);
 		break;
 	case mmSequencePerInstance:
-		pData->value = pData->valueTo;
+		pData->ctrInst.val = pData->valueTo;
 		break;
 	case mmSequencePerKey:
-		if (pthread_mutex_lock(&ght_mutex)) {
-			DBGPRINTF("mmsequence: mutex lock has failed!\n");
-			ABORT_FINALIZE(RS_RET_ERR);
-		}
-		if (ght == NULL) {
-			if(NULL == (ght = create_hashtable(100, hash_from_string, key_equals_string, NULL))) {
-				pthread_mutex_unlock(&ght_mutex);
-				DBGPRINTF("mmsequence: error creating hash table!\n");
+		/* config load is single-threaded, so no need to guard ctrs here.
+		 * The counter is looked up only once; the first step of a new
+		 * key always yields "from", no matter which instance does it.
+		 */
+		if(ctrs == NULL) {
+			if(ctrmapConstruct(&ctrs, 100) != RS_RET_OK) {
+				DBGPRINTF("mmsequence: error creating counter map!\n");
 				ABORT_FINALIZE(RS_RET_ERR);
 			}
 		}
-		pthread_mutex_unlock(&ght_mutex);
+		CHKiRet(ctrmapGet(ctrs, pData->pszKey, INT_MAX, &pData->pCtrKey));
 		break;
 	default:
 		LogError(0, RS_RET_INVLD_MODE,
@@ -277,46 +276,11 @@ BEGINtryResume
 CODESTARTtryResume
 ENDtryResume
 
-static int *
-getCounter(struct hashtable *ht, char *str, int initial) {
-	int *pCounter;
-	char *pStr;
-
-	pCounter = hashtable_search(ht, str);
-	if(pCounter) {
-		return pCounter;
-	}
-
-	/* counter is not found for the str, so add new entry and
-	   return the counter */
-	if(NULL == (pStr = strdup(str))) {
-		DBGPRINTF("mmsequence: memory allocation for key failed\n");
-		return NULL;
-	}
-
-	if(NULL == (pCounter = (int*)malloc(sizeof(*pCounter)))) {
-		DBGPRINTF("mmsequence: memory allocation for value failed\n");
-		free(pStr);
-		return NULL;
-	}
-	*pCounter = initial;
-
-	if(!hashtable_insert(ht, pStr, pCounter)) {
-		DBGPRINTF("mmsequence: inserting element into hashtable failed\n");
-		free(pStr);
-		free(pCounter);
-		return NULL;
-	}
-	return pCounter;
-}
-
-
 BEGINdoAction_NoStrings
 	smsg_t **ppMsg = (smsg_t **) pMsgData;
 	smsg_t *pMsg = ppMsg[0];
 	struct json_object *json;
 	int val = 0;
-	int *pCounter;
 	instanceData *pData;
 CODESTARTdoAction
 	pData = pWrkrData->pData;
@@ -327,40 +291,12 @@ CODESTARTdoAction
 				(pData->valueTo - pData->valueFrom));
 		break;
 	case mmSequencePerInstance:
-		if (!pthread_mutex_lock(&inst_mutex)) {
-			if (pData->value >= pData->valueTo - pData->step) {
-				pData->value = pData->valueFrom;
-			} else {
-				pData->value += pData->step;
-			}
-			val = pData->value;
-			pthread_mutex_unlock(&inst_mutex);
-		} else {
-			LogError(0, RS_RET_ERR,
-					"mmsequence: mutex lock has failed!");
-		}
+		val = ctrmapStepAndFetch(&pData->ctrInst, pData->valueFrom,
+				pData->valueTo, pData->step);
 		break;
 	case mmSequencePerKey:
-		if (!pthread_mutex_lock(&ght_mutex)) {
-			pCounter = getCounter(ght, pData->pszKey, pData->valueTo);
-			if(pCounter) {
-				if (*pCounter >= pData->valueTo - pData->step
-						|| *pCounter < pData->valueFrom ) {
-					*pCounter = pData->valueFrom;
-				} else {
-					*pCounter += pData->step;
-				}
-				val = *pCounter;
-			} else {
-				LogError(0, RS_RET_NOT_FOUND,
-						"mmsequence: unable to fetch the counter from hash");
-			}
-			pthread_mutex_unlock(&ght_mutex);
-		} else {
-			LogError(0, RS_RET_ERR,
-					"mmsequence: mutex lock has failed!");
-		}
-		
+		val = ctrmapStepAndFetch(pData->pCtrKey, pData->valueFrom,
+				pData->valueTo, pData->step);
 		break;
 	default:
 		LogError(0, RS_RET_NOT_IMPLEMENTED,
@@ -385,6 +321,7 @@ NO_LEGACY_CONF_parseSelectorAct
 
 BEGINmodExit
 CODESTARTmodExit
+	ctrmapDestruct(&ctrs);
 ENDmodExit
 
 
@@ -30,6 +30,7 @@
 #include <assert.h>
 #include <signal.h>
 #include <time.h>
+#include <poll.h>
 #include <hiredis/hiredis.h>
 
 #include "rsyslog.h"
@@ -41,6 +42,7 @@
 #include "errmsg.h"
 #include "cfsysline.h"
 #include "unicode-helper.h"
+#include "srUtils.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -54,6 +56,15 @@ DEFobjCurrIf(errmsg)
 #define OMHIREDIS_MODE_QUEUE 1
 #define OMHIREDIS_MODE_PUBLISH 2
 
+#define OMHIREDIS_NB_READ_EVERY 128	/* commands between non-blocking reply reads */
+#define OMHIREDIS_MAX_PUSH_KEYS 64	/* max number of keys with batched pushes per worker */
+
+/* a redis server we shard keys over */
+typedef struct redisServer_s {
+	uchar *host;
+	int port; /* 0 - use serverport */
+} redisServer_t;
+
 /* our instance data.
  * this will be accessable 
  * via pData */
@@ -67,12 +78,34 @@ typedef struct _instanceData {
 	uchar *key; /* key for QUEUE and PUBLISH modes */
 	sbool dynaKey; /* Should we treat the key as a template? */
 	sbool useRPush; /* Should we use RPUSH instead of LPUSH? */
+	redisServer_t *servers; /* servers to shard keys over, NULL - just use server */
+	int nServers;
+	int pipelineMaxSize; /* read replies when that many are outstanding, 0 - only at end of batch */
+	int pipelineFlushInterval; /* ...or when the oldest is that many ms old, 0 - disabled */
+	int pushBatchSize; /* max number of values per LPUSH/RPUSH command (queue mode) */
 } instanceData;
 
+/* connection to a single server */
+typedef struct hiredisConn_s {
+	redisContext *conn; /* redis connection */
+	int count; /* count of commands sent for which we did not yet read the reply */
+	long long tFirstPending; /* when the oldest of these was sent (ms) */
+} hiredisConn_t;
+
+/* values for a key which are collected to be pushed with a single command.
+ * argv is laid out as the command needs it: command, key, values.
+ */
+typedef struct pendingPush_s {
+	int shard;
+	int argc;
+	char **argv;
+} pendingPush_t;
+
 typedef struct wrkrInstanceData {
 	instanceData *pData; /* instanc data */
-	redisContext *conn; /* redis connection */
-	int count; /* count of command sent for current batch */
+	hiredisConn_t *conns; /* one per server */
+	pendingPush_t *pushes;
+	int nPushes;
 } wrkrInstanceData_t;
 
 static struct cnfparamdescr actpdescr[] = {
@@ -84,6 +117,10 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "key", eCmdHdlrGetWord, 0 },
 	{ "dynakey", eCmdHdlrBinary, 0 },
 	{ "userpush", eCmdHdlrBinary, 0 },
+	{ "servers", eCmdHdlrArray, 0 },
+	{ "pipeline.maxsize", eCmdHdlrNonNegInt, 0 },
+	{ "pipeline.flushinterval", eCmdHdlrNonNegInt, 0 },
+	{ "push.batchsize", eCmdHdlrPositiveInt, 0 },
 };
 
 static struct cnfparamblk actpblk = {
@@ -98,7 +135,13 @@ ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
-	pWrkrData->conn = NULL; /* Connect later */
+	/* Connect later */
+	CHKmalloc(pWrkrData->conns = calloc(pData->nServers, sizeof(hiredisConn_t)));
+	CHKmalloc(pWrkrData->pushes = calloc(OMHIREDIS_MAX_PUSH_KEYS, sizeof(pendingPush_t)));
+	pWrkrData->nPushes = 0;
+finalize_it:
+	if(iRet != RS_RET_OK)
+		free(pWrkrData->conns);
 ENDcreateWrkrInstance
 
 BEGINisCompatibleWithFeature
@@ -108,25 +151,64 @@ CODESTARTisCompatibleWithFeature
 ENDisCompatibleWithFeature
 
 /* called when closing */
-static void closeHiredis(wrkrInstanceData_t *pWrkrData)
+static void closeHiredis(wrkrInstanceData_t *pWrkrData, const int shard)
 {
-	if(pWrkrData->conn != NULL) {
-		redisFree(pWrkrData->conn);
-		pWrkrData->conn = NULL;
+	hiredisConn_t *const c = &pWrkrData->conns[shard];
+
+	if(c->conn != NULL) {
+		redisFree(c->conn);
+		c->conn = NULL;
 	}
+	c->count = 0;
+}
+
+static void freePush(pendingPush_t *const push)
+{
+	int i;
+
+	for(i = 1 ; i < push->argc ; ++i)
+		free(push->argv[i]);
+	free(push->argv);
+	push->argv = NULL;
+	push->argc = 0;
+}
+
+/* drop all values collected for batched pushes */
+static void discardPushes(wrkrInstanceData_t *const pWrkrData)
+{
+	int i;
+
+	for(i = 0 ; i < pWrkrData->nPushes ; ++i)
+		freePush(&pWrkrData->pushes[i]);
+	pWrkrData->nPushes = 0;
 }
 
 /* Free our instance data. */
 BEGINfreeInstance
+	int i;
 CODESTARTfreeInstance
 	if (pData->server != NULL) {
 		free(pData->server);
 	}
+	if(pData->servers != NULL) {
+		for(i = 0 ; i < pData->nServers ; ++i)
+			free(pData->servers[i].host);
+		free(pData->servers);
+	}
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
+	int i;
 CODESTARTfreeWrkrInstance
-	closeHiredis(pWrkrData);
+	if(pWrkrData->conns != NULL) {
+		for(i = 0 ; i < pWrkrData->pData->nServers ; ++i)
+			closeHiredis(pWrkrData, i);
+		free(pWrkrData->conns);
+	}
+	if(pWrkrData->pushes != NULL) {
+		discardPushes(pWrkrData);
+		free(pWrkrData->pushes);
+	}
 ENDfreeWrkrInstance
 
 BEGINdbgPrintInstInfo
@@ -135,53 +217,189 @@ CODESTARTdbgPrintInstInfo
 ENDdbgPrintInstInfo
 
 /* establish our connection to redis */
-static rsRetVal initHiredis(wrkrInstanceData_t *pWrkrData, int bSilent)
+static rsRetVal initHiredis(wrkrInstanceData_t *pWrkrData, const int shard, int bSilent)
 {
 	char *server;
+	int port;
 	char *serverpasswd;
+	hiredisConn_t *const c = &pWrkrData->conns[shard];
 	DEFiRet;
 
-	server = (pWrkrData->pData->server == NULL) ? (char *)"127.0.0.1" : 
-			(char*) pWrkrData->pData->server;
-	DBGPRINTF("omhiredis: trying connect to '%s' at port %d\n", server, 
-			pWrkrData->pData->port);
-	
+	if(pWrkrData->pData->servers == NULL) {
+		server = (pWrkrData->pData->server == NULL) ? (char *)"127.0.0.1" :
+				(char*) pWrkrData->pData->server;
+		port = pWrkrData->pData->port;
+	} else {
+		server = (char*) pWrkrData->pData->servers[shard].host;
+		port = (pWrkrData->pData->servers[shard].port == 0) ? pWrkrData->pData->port
+				: pWrkrData->pData->servers[shard].port;
+	}
+	DBGPRINTF("omhiredis: trying connect to '%s' at port %d\n", server, port);
+
 	struct timeval timeout = { 1, 500000 }; /* 1.5 seconds */
-	pWrkrData->conn = redisConnectWithTimeout(server, pWrkrData->pData->port,
-			timeout);
-	if (pWrkrData->conn->err) {
+	c->count = 0;
+	c->conn = redisConnectWithTimeout(server, port, timeout);
+	if (c->conn == NULL || c->conn->err) {
 		if(!bSilent)
 			errmsg.LogError(0, RS_RET_SUSPENDED,
-				"can not initialize redis handle");
+				"can not initialize redis handle for %s:%d", server, port);
 		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
 
 	if (pWrkrData->pData->serverpassword != NULL) {
 		serverpasswd = (char*) pWrkrData->pData->serverpassword;
 		int rc;
-		rc = redisAppendCommand(pWrkrData->conn, "AUTH %s", serverpasswd);
+		rc = redisAppendCommand(c->conn, "AUTH %s", serverpasswd);
 		if (rc == REDIS_ERR) {
-			errmsg.LogError(0, NO_ERRCODE, "omhiredis: %s", pWrkrData->conn->errstr);
+			errmsg.LogError(0, NO_ERRCODE, "omhiredis: %s", c->conn->errstr);
 			ABORT_FINALIZE(RS_RET_ERR);
 		} else {
-			pWrkrData->count++;
+			c->count++;
+			c->tFirstPending = currentTimeMills();
 		}
 	}
 
+finalize_it:
+	if(iRet != RS_RET_OK)
+		closeHiredis(pWrkrData, shard);
+	RETiRet;
+}
+
+/* select the server for a key. We use the same slot function as redis
+ * cluster (CRC16 of the key or of its {hash tag}), so keys which are
+ * meant to be kept together by using a hash tag end up on the same
+ * server.
+ */
+static int getShard(const instanceData *const pData, const uchar *key)
+{
+	const uchar *tagStart;
+	const uchar *tagEnd;
+	size_t len;
+	size_t i;
+	unsigned crc = 0;
+	int bit;
+
+	if(pData->nServers == 1 || key == NULL)
+		return 0;
+
+	len = ustrlen(key);
+	if((tagStart = (uchar*) strchr((char*) key, '{')) != NULL
+	   && (tagEnd = (uchar*) strchr((char*) tagStart + 1, '}')) != NULL
+	   && tagEnd > tagStart + 1) {
+		key = tagStart + 1;
+		len = tagEnd - key;
+	}
+	for(i = 0 ; i < len ; ++i) {
+		crc ^= (unsigned) key[i] << 8;
+		for(bit = 0 ; bit < 8 ; ++bit)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return (int) ((crc & 0x3fff) % pData->nServers);
+}
+
+static void processReply(redisReply *reply)
+{
+	if(reply->type == REDIS_REPLY_ERROR)
+		dbgprintf("omhiredis: server replied with error: %s\n", reply->str);
+	freeReplyObject(reply);
+}
+
+/* read the replies to the commands sent to a server. If bBlock is set,
+ * we wait for all outstanding replies. Otherwise we only write out what
+ * hiredis has buffered and read what is already available, so that
+ * neither our nor the server's buffers grow without bound on long
+ * batches.
+ */
+static rsRetVal readReplies(wrkrInstanceData_t *pWrkrData, const int shard, const int bBlock)
+{
+	hiredisConn_t *const c = &pWrkrData->conns[shard];
+	redisReply *reply;
+	struct pollfd pfd;
+	int done;
+	DEFiRet;
+
+	if(c->conn == NULL || c->count == 0)
+		FINALIZE;
+
+	if(bBlock) {
+		for( ; c->count > 0 ; --c->count) {
+			if(redisGetReply(c->conn, (void*)&reply) != REDIS_OK)
+				ABORT_FINALIZE(RS_RET_SUSPENDED);
+			processReply(reply);
+		}
+	} else {
+		do {
+			if(redisBufferWrite(c->conn, &done) != REDIS_OK)
+				ABORT_FINALIZE(RS_RET_SUSPENDED);
+		} while(!done);
+		pfd.fd = c->conn->fd;
+		pfd.events = POLLIN;
+		while(c->count > 0 && poll(&pfd, 1, 0) > 0) {
+			if(redisBufferRead(c->conn) != REDIS_OK)
+				ABORT_FINALIZE(RS_RET_SUSPENDED);
+			while(c->count > 0) {
+				if(redisGetReplyFromReader(c->conn, (void*)&reply) != REDIS_OK)
+					ABORT_FINALIZE(RS_RET_SUSPENDED);
+				if(reply == NULL)
+					break;
+				processReply(reply);
+				--c->count;
+			}
+		}
+	}
+	if(c->count == 0)
+		c->tFirstPending = currentTimeMills();
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		dbgprintf("omhiredis: %s\n", c->conn->errstr);
+		closeHiredis(pWrkrData, shard);
+	}
+	RETiRet;
+}
+
+/* book-keeping after a command was appended to a server's pipeline:
+ * read the replies if the pipeline has become too large or too old.
+ */
+static rsRetVal cmdAppended(wrkrInstanceData_t *pWrkrData, const int shard, const int rc)
+{
+	hiredisConn_t *const c = &pWrkrData->conns[shard];
+	const instanceData *const pData = pWrkrData->pData;
+	DEFiRet;
+
+	if (rc == REDIS_ERR) {
+		errmsg.LogError(0, NO_ERRCODE, "omhiredis: %s", c->conn->errstr);
+		dbgprintf("omhiredis: %s\n", c->conn->errstr);
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+
+	if(c->count++ == 0 && pData->pipelineFlushInterval > 0)
+		c->tFirstPending = currentTimeMills();
+	if((pData->pipelineMaxSize > 0 && c->count >= pData->pipelineMaxSize)
+	   || (pData->pipelineFlushInterval > 0
+	       && currentTimeMills() - c->tFirstPending >= pData->pipelineFlushInterval)) {
+		CHKiRet(readReplies(pWrkrData, shard, 1));
+	} else if(c->count % OMHIREDIS_NB_READ_EVERY == 0) {
+		CHKiRet(readReplies(pWrkrData, shard, 0));
+	}
+
 finalize_it:
 	RETiRet;
 }
 
 static rsRetVal writeHiredis(uchar* key, uchar *message, wrkrInstanceData_t *pWrkrData)
 {
+	const int shard = getShard(pWrkrData->pData, key);
+	redisContext *conn;
 	DEFiRet;
 
 	/* if we do not have a redis connection, call
 	 * initHiredis and try to establish one */
-	if(pWrkrData->conn == NULL)
-		CHKiRet(initHiredis(pWrkrData, 0));
+	if(pWrkrData->conns[shard].conn == NULL)
+		CHKiRet(initHiredis(pWrkrData, shard, 0));
+	conn = pWrkrData->conns[shard].conn;
 
-	/* try to append the command to the pipeline. 
+	/* try to append the command to the pipeline.
 	 * REDIS_ERR reply indicates something bad
 	 * happened, in which case abort. otherwise
 	 * increase our current pipeline count
@@ -189,91 +407,164 @@ static rsRetVal writeHiredis(uchar* key, uchar *message, wrkrInstanceData_t *pWr
 	int rc;
 	switch(pWrkrData->pData->mode) {
 		case OMHIREDIS_MODE_TEMPLATE:
-			rc = redisAppendCommand(pWrkrData->conn, (char*)message);
+			rc = redisAppendCommand(conn, (char*)message);
 			break;
 		case OMHIREDIS_MODE_QUEUE:
-			rc = redisAppendCommand(pWrkrData->conn,
+			rc = redisAppendCommand(conn,
 				pWrkrData->pData->useRPush ? "RPUSH %s %s" : "LPUSH %s %s",
 				key, (char*)message);
 			break;
 		case OMHIREDIS_MODE_PUBLISH:
-			rc = redisAppendCommand(pWrkrData->conn, "PUBLISH %s %s", key, (char*)message);
+			rc = redisAppendCommand(conn, "PUBLISH %s %s", key, (char*)message);
 			break;
 		default:
 			dbgprintf("omhiredis: mode %d is invalid something is really wrong\n",
 				pWrkrData->pData->mode);
 			ABORT_FINALIZE(RS_RET_ERR);
 	}
+	CHKiRet(cmdAppended(pWrkrData, shard, rc));
 
-	if (rc == REDIS_ERR) {
-		errmsg.LogError(0, NO_ERRCODE, "omhiredis: %s", pWrkrData->conn->errstr);
-		dbgprintf("omhiredis: %s\n", pWrkrData->conn->errstr);
-		ABORT_FINALIZE(RS_RET_ERR);
-	} else {
-		pWrkrData->count++;
+finalize_it:
+	RETiRet;
+}
+
+/* send the collected values of a key as a single LPUSH/RPUSH. The
+ * entry is freed and removed in any case, because on failure the whole
+ * batch is retried anyway.
+ */
+static rsRetVal sendPush(wrkrInstanceData_t *pWrkrData, const int idx)
+{
+	pendingPush_t *const push = &pWrkrData->pushes[idx];
+	int rc;
+	DEFiRet;
+
+	if(pWrkrData->conns[push->shard].conn == NULL)
+		CHKiRet(initHiredis(pWrkrData, push->shard, 0));
+	rc = redisAppendCommandArgv(pWrkrData->conns[push->shard].conn, push->argc,
+		(const char**) push->argv, NULL);
+	CHKiRet(cmdAppended(pWrkrData, push->shard, rc));
+
+finalize_it:
+	freePush(push);
+	pWrkrData->pushes[idx] = pWrkrData->pushes[--pWrkrData->nPushes];
+	RETiRet;
+}
+
+static rsRetVal sendAllPushes(wrkrInstanceData_t *pWrkrData)
+{
+	rsRetVal localRet;
+	DEFiRet;
+
+	while(pWrkrData->nPushes > 0) {
+		localRet = sendPush(pWrkrData, pWrkrData->nPushes - 1);
+		if(localRet != RS_RET_OK)
+			iRet = localRet;
 	}
+	RETiRet;
+}
+
+/* queue mode with push.batchsize > 1: collect the message, it is
+ * pushed together with others for the same key.
+ */
+static rsRetVal addPush(uchar *key, uchar *message, wrkrInstanceData_t *pWrkrData)
+{
+	instanceData *const pData = pWrkrData->pData;
+	pendingPush_t *push = NULL;
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; i < pWrkrData->nPushes ; ++i) {
+		if(!strcmp(pWrkrData->pushes[i].argv[1], (char*) key)) {
+			push = &pWrkrData->pushes[i];
+			break;
+		}
+	}
+
+	if(push == NULL) {
+		if(pWrkrData->nPushes == OMHIREDIS_MAX_PUSH_KEYS)
+			CHKiRet(sendAllPushes(pWrkrData));
+		i = pWrkrData->nPushes;
+		push = &pWrkrData->pushes[i];
+		CHKmalloc(push->argv = malloc((pData->pushBatchSize + 2) * sizeof(char*)));
+		push->argv[0] = pData->useRPush ? (char*) "RPUSH" : (char*) "LPUSH";
+		if((push->argv[1] = strdup((char*) key)) == NULL) {
+			free(push->argv);
+			push->argv = NULL;
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		push->argc = 2;
+		push->shard = getShard(pData, key);
+		++pWrkrData->nPushes;
+	}
+
+	CHKmalloc(push->argv[push->argc] = strdup((char*) message));
+	if(++push->argc == pData->pushBatchSize + 2)
+		CHKiRet(sendPush(pWrkrData, i));
 
 finalize_it:
 	RETiRet;
 }
 
 /* called when resuming from suspended state.
- * try to restablish our connection to redis */
+ * try to restablish our connections to redis */
 BEGINtryResume
+	int i;
 CODESTARTtryResume
-	if(pWrkrData->conn == NULL)
-		iRet = initHiredis(pWrkrData, 0);
+	for(i = 0 ; i < pWrkrData->pData->nServers ; ++i) {
+		if(pWrkrData->conns[i].conn == NULL)
+			CHKiRet(initHiredis(pWrkrData, i, 0));
+	}
+finalize_it:
 ENDtryResume
 
 /* begin a transaction.
+ * values still collected for batched pushes
+ * belong to a failed batch, which the core
+ * now retries - so they must not be sent.
  * if I decide to use MULTI ... EXEC in the
  * future, this block should send the
  * MULTI command to redis. */
 BEGINbeginTransaction
 CODESTARTbeginTransaction
 	dbgprintf("omhiredis: beginTransaction called\n");
-	pWrkrData->count = 0;
+	discardPushes(pWrkrData);
 ENDbeginTransaction
 
 /* call writeHiredis for this log line,
  * which appends it as a command to the
  * current pipeline */
 BEGINdoAction
+	uchar *key;
 CODESTARTdoAction
-	if(pWrkrData->pData->dynaKey) { 
-		CHKiRet(writeHiredis(ppString[1], ppString[0], pWrkrData));
-	}
-	else {
-		CHKiRet(writeHiredis(pWrkrData->pData->key, ppString[0], pWrkrData));
+	key = pWrkrData->pData->dynaKey ? ppString[1] : pWrkrData->pData->key;
+	if(pWrkrData->pData->mode == OMHIREDIS_MODE_QUEUE && pWrkrData->pData->pushBatchSize > 1) {
+		CHKiRet(addPush(key, ppString[0], pWrkrData));
+	} else {
+		CHKiRet(writeHiredis(key, ppString[0], pWrkrData));
 	}
 	iRet = RS_RET_DEFER_COMMIT;
 finalize_it:
 ENDdoAction
 
 /* called when we have reached the end of a
- * batch (queue.dequeuebatchsize).  this
- * iterates over the replies, putting them
- * into the pData->replies buffer. we currently
- * don't really bother to check for errors
- * which should be fixed */
+ * batch (queue.dequeuebatchsize). sends what
+ * is left of batched pushes and then reads
+ * all outstanding replies from all servers.
+ * error replies are only logged to the
+ * debug log. if any server fails, the whole
+ * batch is retried, including what the other
+ * servers already executed (see README) */
 BEGINendTransaction
+	rsRetVal localRet;
+	int i;
 CODESTARTendTransaction
 	dbgprintf("omhiredis: endTransaction called\n");
-	redisReply *reply;
-	int i;
-	for ( i = 0; i < pWrkrData->count; i++ ) {
-		redisGetReply ( pWrkrData->conn, (void*)&reply);
-		if( pWrkrData->conn->err ){
-			dbgprintf("omhiredis: %s\n", pWrkrData->conn->errstr);
-			closeHiredis(pWrkrData);
-			ABORT_FINALIZE(RS_RET_SUSPENDED);
-		}
-		else {
-			freeReplyObject(reply);
-		}
+	iRet = sendAllPushes(pWrkrData);
+	for(i = 0 ; i < pWrkrData->pData->nServers ; ++i) {
+		localRet = readReplies(pWrkrData, i, 1);
+		if(localRet != RS_RET_OK)
+			iRet = RS_RET_SUSPENDED;
 	}
-
-finalize_it:
 ENDendTransaction
 
 /* set defaults. note server is set to NULL 
@@ -291,6 +582,37 @@ setInstParamDefaults(instanceData *pData)
 	pData->modeDescription = (char *)"template";
 	pData->key = NULL;
 	pData->useRPush = 0;
+	pData->servers = NULL;
+	pData->nServers = 1;
+	pData->pipelineMaxSize = 0;
+	pData->pipelineFlushInterval = 0;
+	pData->pushBatchSize = 1;
+}
+
+/* parse the "servers" array. Entries are "host" or "host:port", if
+ * the port is not given, serverport is used.
+ */
+static rsRetVal
+setServers(instanceData *pData, struct cnfarray *ar)
+{
+	char *entry;
+	char *colon;
+	int i;
+	DEFiRet;
+
+	CHKmalloc(pData->servers = calloc(ar->nmemb, sizeof(redisServer_t)));
+	pData->nServers = ar->nmemb;
+	for(i = 0 ; i < ar->nmemb ; ++i) {
+		CHKmalloc(entry = es_str2cstr(ar->arr[i], NULL));
+		colon = strrchr(entry, ':');
+		if(colon != NULL && colon[1] != '\0' && strspn(colon + 1, "0123456789") == strlen(colon + 1)) {
+			*colon = '\0';
+			pData->servers[i].port = atoi(colon + 1);
+		}
+		pData->servers[i].host = (uchar*) entry;
+	}
+finalize_it:
+	RETiRet;
 }
 
 /* here is where the work to set up a new instance
@@ -338,6 +660,14 @@ CODESTARTnewActInst
 			}
 		} else if(!strcmp(actpblk.descr[i].name, "key")) {
 			pData->key = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "servers")) {
+			CHKiRet(setServers(pData, pvals[i].val.d.ar));
+		} else if(!strcmp(actpblk.descr[i].name, "pipeline.maxsize")) {
+			pData->pipelineMaxSize = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "pipeline.flushinterval")) {
+			pData->pipelineFlushInterval = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "push.batchsize")) {
+			pData->pushBatchSize = (int) pvals[i].val.d.n;
 		} else {
 			dbgprintf("omhiredis: program error, non-handled "
 				"param '%s'\n", actpblk.descr[i].name);
@@ -346,6 +676,15 @@ CODESTARTnewActInst
 
 	dbgprintf("omhiredis: checking config sanity\n");
 
+	if(pData->servers != NULL && pData->server != NULL) {
+		errmsg.LogError(0, RS_RET_CONFIG_ERROR, "omhiredis: \"server\" and \"servers\" "
+			"are mutually exclusive, \"server\" is ignored");
+	}
+	if(pData->mode == OMHIREDIS_MODE_TEMPLATE && pData->nServers > 1) {
+		errmsg.LogError(0, RS_RET_CONFIG_ERROR, "omhiredis: template mode has no key "
+			"to shard by, only the first of the \"servers\" is used");
+	}
+
 	/* check config sanity for selected mode */
 	switch(pData->mode) {
 		case OMHIREDIS_MODE_QUEUE:
@@ -71,6 +71,8 @@ DEFobjCurrIf(datetime)
 
 #define HTTPFS_URL_BUFFER_LENGTH 2048
 
+#define HTTPFS_DEFAULT_MAXBYTES  8388608    /* default max size of data appended per batch */
+
 
 /*
 Examples: 
@@ -109,6 +111,8 @@ typedef struct _instanceData {
     sbool isDynFile;
 
     uchar* tplName;
+
+    size_t maxBytes;
 } instanceData;
 
 
@@ -121,6 +125,17 @@ typedef struct wrkrInstanceData {
 
     int replyLen;
     char* reply;
+
+    /* consecutive messages for the same file are collected and
+     * appended with a single request. A batch never spans multiple
+     * files: appends are not idempotent, so a failed batch must not
+     * contain data that has already been appended to another file */
+    struct {
+        uchar* file;
+        es_str_t* data;
+        int nMsgs;
+        size_t nBytes;
+    } batch;
 } wrkrInstanceData_t;
 
 
@@ -134,6 +149,7 @@ static struct cnfparamdescr actpdescr[] = {
     { "file", eCmdHdlrGetWord, CNFPARAM_REQUIRED },
     { "isdynfile", eCmdHdlrBinary, 0 },
     { "template", eCmdHdlrGetWord, 0 },
+    { "maxbytes", eCmdHdlrSize, 0 },
 };
 static struct cnfparamblk actpblk = {
     CNFPARAMBLK_VERSION,
@@ -160,6 +176,10 @@ httpfs_init_curl(wrkrInstanceData_t *pWrkrData, instanceData *pData)
 
         curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
 
+        /* the handle is kept for the lifetime of the worker, so the
+         * connection is reused across requests and batches */
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+
         if (pData->https) {
             DBGPRINTF("%s(): Enable HTTPS\n", __FUNCTION__);
             /* for ssl */
@@ -240,6 +260,7 @@ static void httpfs_set_url(wrkrInstanceData_t *pWrkrData, const char* op)
     char* url_cstr;
     httpfs_build_url(pWrkrData, op, &url);
     url_cstr = es_str2cstr(url, NULL);
+    es_deleteStr(url);
 
     curl_easy_setopt(pWrkrData->curl, CURLOPT_URL, url_cstr);
     free(url_cstr);
@@ -371,6 +392,7 @@ httpfs_curl_result_callback(void *contents, size_t size, size_t nmemb, void *use
  * used in httpfs related operation
  */
 #define HTTPFS_CURL_EXEC \
+    free(pWrkrData->reply); \
     pWrkrData->reply = NULL; \
     pWrkrData->replyLen = 0; \
     curl_easy_setopt(pWrkrData->curl, CURLOPT_WRITEDATA, pWrkrData); \
@@ -458,10 +480,11 @@ finalize_it:
  * 
  * @param wrkrInstanceData_t *pWrkrData
  * @param char*   buf
+ * @param size_t  len
  * @return rsRetVal
  */
 static rsRetVal
-httpfs_create_file(wrkrInstanceData_t *pWrkrData, uchar* buf)
+httpfs_create_file(wrkrInstanceData_t *pWrkrData, uchar* buf, size_t len)
 {
     /* httpfs.create automatically create folders, no mkdirs needed. */
 
@@ -482,9 +505,9 @@ replication - required block replication for the file.
     httpfs_set_url(pWrkrData, "&op=create&overwrite=false&data=true");
 
     curl_easy_setopt(pWrkrData->curl, CURLOPT_POSTFIELDS, (char*)buf);
-    curl_easy_setopt(pWrkrData->curl, CURLOPT_POSTFIELDSIZE, strlen((char*) buf));
+    curl_easy_setopt(pWrkrData->curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) len);
 
-    DBGPRINTF("%s(): msg=%s\n", __FUNCTION__, buf);
+    DBGPRINTF("%s(): msg=%.*s\n", __FUNCTION__, (int) len, buf);
 
     headers = httpfs_curl_add_header(headers, 1, HTTPFS_CONTENT_TYPE);
     curl_easy_setopt(pWrkrData->curl, CURLOPT_HTTPHEADER, headers);
@@ -511,10 +534,11 @@ HTTPFS_CURL_VARS_RELEASE
  *
  * @param wrkrInstanceData_t *pWrkrData
  * @param char*   buf
+ * @param size_t  len
  * @return rsRetVal
  */
 static rsRetVal
-httpfs_append_file(wrkrInstanceData_t *pWrkrData, uchar* buf)
+httpfs_append_file(wrkrInstanceData_t *pWrkrData, uchar* buf, size_t len)
 {
     /*
     curl -b /tmp/c.tmp -c /tmp/c.tmp  -d 'aaaaabbbbb' -i -H 'Content-Type: application/octet-stream' \
@@ -526,11 +550,11 @@ HTTPFS_CURL_VARS_INIT
     httpfs_set_url(pWrkrData, "&op=append&data=true");
 
     curl_easy_setopt(pWrkrData->curl, CURLOPT_POSTFIELDS, (char*)buf);
-    curl_easy_setopt(pWrkrData->curl, CURLOPT_POSTFIELDSIZE, strlen((char*) buf));
+    curl_easy_setopt(pWrkrData->curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) len);
 
     headers = httpfs_curl_add_header(headers, 1, HTTPFS_CONTENT_TYPE);
     curl_easy_setopt(pWrkrData->curl, CURLOPT_HTTPHEADER, headers);
-    DBGPRINTF("%s(): msg=%s\n", __FUNCTION__, buf);
+    DBGPRINTF("%s(): msg=%.*s\n", __FUNCTION__, (int) len, buf);
 
 HTTPFS_CURL_EXEC
 
@@ -556,10 +580,11 @@ HTTPFS_CURL_VARS_RELEASE
  *
  * @param wrkrInstanceData_t *pWrkrData
  * @param uchar* buf
+ * @param size_t len
  * @return rsRetVal
  */
 static rsRetVal
-httpfs_log(wrkrInstanceData_t *pWrkrData, uchar* buf)
+httpfs_log(wrkrInstanceData_t *pWrkrData, uchar* buf, size_t len)
 {
     /**
     append ? 200/end : (404 || ?)
@@ -573,7 +598,7 @@ httpfs_log(wrkrInstanceData_t *pWrkrData, uchar* buf)
     long response_code;
     httpfs_json_remote_exception jre;
 
-    iRet = httpfs_append_file(pWrkrData, buf);
+    iRet = httpfs_append_file(pWrkrData, buf, len);
     if (iRet == RS_RET_OK) {
         DBGPRINTF("omhttpfs: Append success: %s\n", pWrkrData->file);
         return RS_RET_OK;
@@ -586,7 +611,7 @@ httpfs_log(wrkrInstanceData_t *pWrkrData, uchar* buf)
         return RS_RET_FALSE;
     }
 
-    iRet = httpfs_create_file(pWrkrData, buf);
+    iRet = httpfs_create_file(pWrkrData, buf, len);
     if (iRet == RS_RET_OK) {
         DBGPRINTF("omhttpfs: Create file success: %s\n", pWrkrData->file);
         return RS_RET_OK;
@@ -605,7 +630,7 @@ httpfs_log(wrkrInstanceData_t *pWrkrData, uchar* buf)
             /* file exists, go to append */
             DBGPRINTF("omhttpfs: File already exists, append again: %s\n", pWrkrData->file);
 
-            iRet = httpfs_append_file(pWrkrData, buf);
+            iRet = httpfs_append_file(pWrkrData, buf, len);
             if (iRet == RS_RET_OK) {
                 DBGPRINTF("omhttpfs: Re-Append success: %s\n", pWrkrData->file);
                 return RS_RET_OK;
@@ -626,6 +651,84 @@ httpfs_log(wrkrInstanceData_t *pWrkrData, uchar* buf)
 }
 
 
+/**
+ * Discard the data of the current batch
+ *
+ * @param wrkrInstanceData_t *pWrkrData
+ * @return void
+ */
+static void
+httpfs_batch_init(wrkrInstanceData_t *pWrkrData)
+{
+    free(pWrkrData->batch.file);
+    if (pWrkrData->batch.data != NULL) {
+        es_deleteStr(pWrkrData->batch.data);
+    }
+    pWrkrData->batch.file = NULL;
+    pWrkrData->batch.data = NULL;
+    pWrkrData->batch.nMsgs = 0;
+    pWrkrData->batch.nBytes = 0;
+}
+
+/**
+ * Add a message to the batch
+ * the batch must be empty or belong to the same file
+ *
+ * @param wrkrInstanceData_t *pWrkrData
+ * @param uchar* file
+ * @param uchar* msg
+ * @param size_t len
+ * @return rsRetVal
+ */
+static rsRetVal
+httpfs_batch_add(wrkrInstanceData_t *pWrkrData, uchar* file, uchar* msg, size_t len)
+{
+    DEFiRet;
+
+    if (pWrkrData->batch.file == NULL) {
+        CHKmalloc(pWrkrData->batch.data = es_newStr(1024));
+        CHKmalloc(pWrkrData->batch.file = ustrdup(file));
+    }
+
+    if (es_addBuf(&pWrkrData->batch.data, (char*) msg, len) != 0) {
+        ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+    }
+    pWrkrData->batch.nMsgs++;
+    pWrkrData->batch.nBytes += len;
+
+finalize_it:
+    RETiRet;
+}
+
+/**
+ * Write the batch to httpfs with a single request (plus a create
+ * request if the file does not yet exist)
+ *
+ * @param wrkrInstanceData_t *pWrkrData
+ * @return rsRetVal
+ */
+static rsRetVal
+httpfs_batch_submit(wrkrInstanceData_t *pWrkrData)
+{
+    DEFiRet;
+
+    DBGPRINTF("omhttpfs: submitting batch of %d messages to %s\n",
+        pWrkrData->batch.nMsgs, pWrkrData->batch.file);
+    pWrkrData->file = pWrkrData->batch.file;
+    iRet = httpfs_log(pWrkrData, es_getBufAddr(pWrkrData->batch.data),
+        es_strlen(pWrkrData->batch.data));
+    if (iRet != RS_RET_OK) {
+        DBGPRINTF("omhttpfs: error writing httpfs, suspending\n");
+        ABORT_FINALIZE(RS_RET_SUSPENDED);
+    }
+
+finalize_it:
+    pWrkrData->file = NULL;
+    httpfs_batch_init(pWrkrData);
+    RETiRet;
+}
+
+
 BEGINinitConfVars
     CODESTARTinitConfVars
 ENDinitConfVars
@@ -641,6 +744,12 @@ BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
     DBGPRINTF("omhttpfs: createWrkrInstance\n");
     pWrkrData->curl = NULL;
+    pWrkrData->file = NULL;
+    pWrkrData->reply = NULL;
+    pWrkrData->batch.file = NULL;
+    pWrkrData->batch.data = NULL;
+    pWrkrData->batch.nMsgs = 0;
+    pWrkrData->batch.nBytes = 0;
     iRet = httpfs_init_curl(pWrkrData, pWrkrData->pData);
     DBGPRINTF("omhttpfs: createWrkrInstance,pData %p/%p, pWrkrData %p\n",
 	pData, pWrkrData->pData, pWrkrData);
@@ -665,7 +774,8 @@ ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
-    free(pWrkrData->file);
+    httpfs_batch_init(pWrkrData);
+    free(pWrkrData->reply);
 
     if(pWrkrData->curl) {
         curl_easy_cleanup(pWrkrData->curl);
@@ -692,29 +802,56 @@ CODESTARTtryResume
     iRet = RS_RET_OK;
 ENDtryResume
 
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+    DBGPRINTF("omhttpfs: beginTransaction\n");
+    httpfs_batch_init(pWrkrData);
+ENDbeginTransaction
+
 /**
 * Do Action
 */
 BEGINdoAction
+    uchar* file;
+    size_t len;
+    size_t maxBytes;
 CODESTARTdoAction
     DBGPRINTF("omhttpfs: doAction\n");
     /* dynamic file name */
     if (pWrkrData->pData->isDynFile) {
-        pWrkrData->file = ustrdup(ppString[1]);
+        file = ppString[1];
     } else {
-        pWrkrData->file = ustrdup(pWrkrData->pData->file);
+        file = pWrkrData->pData->file;
     }
 
     /* ppString[0] -> log content */
-    iRet = httpfs_log(pWrkrData, ppString[0]);
-
-    if(iRet != RS_RET_OK) {
-        DBGPRINTF("omhttpfs: error writing httpfs, suspending\n");
-        iRet = RS_RET_SUSPENDED;
+    len = strlen((char*) ppString[0]);
+    maxBytes = pWrkrData->pData->maxBytes;
+
+    /* submit what we have so far if this message is for another file
+     * or would exceed the size limit */
+    if (pWrkrData->batch.nMsgs > 0
+            && (ustrcmp(pWrkrData->batch.file, file)
+                || (maxBytes > 0 && pWrkrData->batch.nBytes + len > maxBytes))) {
+        CHKiRet(httpfs_batch_submit(pWrkrData));
     }
+    CHKiRet(httpfs_batch_add(pWrkrData, file, ppString[0], len));
+
+    /* if this is the only message in the batch, all previous ones have
+     * been written */
+    iRet = (pWrkrData->batch.nMsgs == 1) ? RS_RET_PREVIOUS_COMMITTED : RS_RET_DEFER_COMMIT;
+finalize_it:
 ENDdoAction
 
 
+BEGINendTransaction
+CODESTARTendTransaction
+    DBGPRINTF("omhttpfs: endTransaction\n");
+    if (pWrkrData->batch.nMsgs > 0) {
+        iRet = httpfs_batch_submit(pWrkrData);
+    }
+ENDendTransaction
+
 
 /**
  * Set default parameters
@@ -733,6 +870,7 @@ setInstParamDefaults(instanceData *pData)
     pData->file = NULL;
     pData->isDynFile = 0;
     pData->tplName = NULL;
+    pData->maxBytes = HTTPFS_DEFAULT_MAXBYTES;
 }
 
 
@@ -769,6 +907,8 @@ CODESTARTnewActInst
 
         } else if(!strcmp(actpblk.descr[i].name, "template")) {
             pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+        } else if(!strcmp(actpblk.descr[i].name, "maxbytes")) {
+            pData->maxBytes = (size_t) pvals[i].val.d.n;
         } else {
             DBGPRINTF("omhttpfs: program error, non-handled param '%s'\n", actpblk.descr[i].name);
         }
@@ -830,7 +970,8 @@ CODESTARTqueryEtryPt
     CODEqueryEtryPt_STD_OMOD_QUERIES
     CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
     CODEqueryEtryPt_STD_OMOD8_QUERIES
-    CODEqueryEtryPt_STD_CONF2_CNFNAME_QUERIES 
+    CODEqueryEtryPt_STD_CONF2_CNFNAME_QUERIES
+    CODEqueryEtryPt_TXIF_OMOD_QUERIES /* we support the transactional interface */
 ENDqueryEtryPt
 
 
@@ -63,6 +63,9 @@
 #include "ruleset.h"
 #include "ratelimit.h"
 #include "parserif.h"
+#include "statsobj.h"
+#include "startmatch.h"
+#include "statestore.h"
 
 #include <regex.h>
 
@@ -78,6 +81,7 @@ DEFobjCurrIf(glbl)
 DEFobjCurrIf(strm)
 DEFobjCurrIf(prop)
 DEFobjCurrIf(ruleset)
+DEFobjCurrIf(statsobj)
 
 static int bLegacyCnfModGlobalsPermitted;/* are legacy module-global config parameters permitted? */
 
@@ -126,7 +130,8 @@ struct instanceConf_s {
 	sbool bRMStateOnDel;
 	uint8_t readMode;
 	uchar *startRegex;
-	regex_t end_preg;	/* compiled version of startRegex */
+	startmatch_t *startMatch;	/* compiled version of startRegex */
+	statsobj_t *stats;	/* only present if startRegex is set */
 	sbool discardTruncatedMsg;
 	sbool msgDiscardingError;
 	sbool escapeLF;
@@ -167,6 +172,12 @@ struct act_obj_s {
 	int nRecords; /**< How many records did we process before persisting the stream? */
 	ratelimit_t *ratelimiter;
 	multi_submit_t multiSub;
+	sbool bMoreData;	/* last pollFile() stopped before EOF due to line limit */
+	/* reader pool scheduling, protected by readerPool.mut */
+	act_obj_t *qnext;	/* next object in reader queue */
+	sbool bQueued;		/* waiting in reader queue */
+	sbool bBusy;		/* currently being read by a reader thread */
+	sbool bPending;		/* new data notified while being read */
 };
 struct fs_edge_s {
 	fs_node_t *parent;
@@ -188,6 +199,8 @@ struct fs_node_s {
 static rsRetVal persistStrmState(act_obj_t *);
 static rsRetVal resetConfigVariables(uchar __attribute__((unused)) *pp, void __attribute__((unused)) *pVal);
 static rsRetVal ATTR_NONNULL(1) pollFile(act_obj_t *act);
+static void ATTR_NONNULL() scheduleFile(act_obj_t *const act);
+static void ATTR_NONNULL() readerPoolRelease(act_obj_t *const act);
 static int ATTR_NONNULL() getBasename(uchar *const __restrict__ basen, uchar *const __restrict__ path);
 static void ATTR_NONNULL() act_obj_unlink(act_obj_t *const act);
 static uchar * ATTR_NONNULL(1, 2) getStateFileName(const act_obj_t *, uchar *, const size_t);
@@ -202,8 +215,11 @@ static int ATTR_NONNULL() getFullStateFileName(const uchar *const, uchar *const
 struct modConfData_s {
 	rsconf_t *pConf;	/* our overall config object */
 	int iPollInterval;	/* number of seconds to sleep when there was no file activity */
+	int nReaders;		/* number of reader threads, 0 - read on input thread */
 	int readTimeout;
 	int timeoutGranularity;		/* value in ms */
+	uchar *stateStoreName;	/* shared state store to use instead of state files */
+	statestore_t *stateStore;
 	instanceConf_t *root, *tail;
 	fs_node_t *conf_tree;
 	uint8_t opMode;
@@ -254,10 +270,33 @@ static int glport; /* Static port handle for FEN api*/
 static prop_t *pInputName = NULL;
 /* there is only one global inputName for all messages generated by this input */
 
+/* The reader pool (inotify mode only). The input thread still handles all
+ * inotify events, but leaves reading to the reader threads. Files with new
+ * data are put into a FIFO queue. A file is never read by more than one
+ * thread at a time, so ordering and state file handling are the same as
+ * without the pool. To prevent a busy file from starving the others, it is
+ * put back at the end of the queue after READER_QUANTUM lines (or
+ * maxLinesAtOnce, if set).
+ */
+#define READER_QUANTUM 1024
+static struct {
+	pthread_mutex_t mut;
+	pthread_cond_t wakeup;	/* work available or pool to be stopped */
+	pthread_cond_t done;	/* a reader finished processing a file */
+	act_obj_t *head;
+	act_obj_t *tail;
+	pthread_t *tids;
+	int nReaders;		/* number of threads actually started */
+	sbool bRunning;
+	sbool bStop;
+} readerPool;
+
 /* module-global parameters */
 static struct cnfparamdescr modpdescr[] = {
 	{ "pollinginterval", eCmdHdlrPositiveInt, 0 },
+	{ "readerthreads", eCmdHdlrNonNegInt, 0 },
 	{ "readtimeout", eCmdHdlrPositiveInt, 0 },
+	{ "statestore", eCmdHdlrGetWord, 0 },
 	{ "timeoutgranularity", eCmdHdlrPositiveInt, 0 },
 	{ "sortfiles", eCmdHdlrBinary, 0 },
 	{ "normalizepath", eCmdHdlrBinary, 0 },
@@ -670,7 +709,6 @@ act_obj_add(fs_edge_t *const edge, const char *const name, const int is_file,
 		CHKmalloc(act->multiSub.ppMsgs = MALLOC(inst->nMultiSub * sizeof(smsg_t *)));
 		act->multiSub.maxElem = inst->nMultiSub;
 		act->multiSub.nElem = 0;
-		pollFile(act);
 	}
 
 	/* all well, add to active list */
@@ -679,6 +717,9 @@ act_obj_add(fs_edge_t *const edge, const char *const name, const int is_file,
 	}
 	act->next = edge->active;
 	edge->active = act;
+	if(is_file) {
+		scheduleFile(act);
+	}
 //dbgprintf("printout of fs tree after act_obj_add for '%s'\n", name);
 //fs_node_print(runModConf->conf_tree, 0);
 //dbg_wdmapPrint("wdmap after act_obj_add");
@@ -803,9 +844,19 @@ poll_timeouts(fs_edge_t *const edge)
 	if(edge->is_file) {
 		act_obj_t *act;
 		for(act = edge->active ; act != NULL ; act = act->next) {
-			if(strmReadMultiLine_isTimedOut(act->pStrm)) {
+			int bTimedOut;
+			if(readerPool.bRunning) {
+				/* a file in work will be checked next time */
+				pthread_mutex_lock(&readerPool.mut);
+				bTimedOut = !act->bBusy && !act->bQueued
+					&& strmReadMultiLine_isTimedOut(act->pStrm);
+				pthread_mutex_unlock(&readerPool.mut);
+			} else {
+				bTimedOut = strmReadMultiLine_isTimedOut(act->pStrm);
+			}
+			if(bTimedOut) {
 				DBGPRINTF("timeout occured on %s\n", act->name);
-				pollFile(act);
+				scheduleFile(act);
 			}
 		}
 	}
@@ -818,6 +869,7 @@ static void
 act_obj_destroy(act_obj_t *const act, const int is_deleted)
 {
 	uchar *statefn;
+	uchar *stateKey = NULL;
 	uchar statefile[MAXFNAME];
 	uchar toDel[MAXFNAME];
 
@@ -826,6 +878,7 @@ act_obj_destroy(act_obj_t *const act, const int is_deleted)
 
 	DBGPRINTF("act_obj_destroy: act %p '%s', wd %d, pStrm %p, is_deleted %d, in_move %d\n",
 		act, act->name, act->wd, act->pStrm, is_deleted, act->in_move);
+	readerPoolRelease(act);
 	if(act->ratelimiter != NULL) {
 		ratelimitDestruct(act->ratelimiter);
 	}
@@ -833,16 +886,21 @@ act_obj_destroy(act_obj_t *const act, const int is_deleted)
 		const instanceConf_t *const inst = act->edge->instarr[0];// TODO: same file, multiple instances?
 		pollFile(act); /* get any left-over data */
 		if(inst->bRMStateOnDel) {
-			statefn = getStateFileName(act, statefile, sizeof(statefile));
-			getFullStateFileName(statefn, toDel, sizeof(toDel));
+			stateKey = getStateFileName(act, statefile, sizeof(statefile));
+			getFullStateFileName(stateKey, toDel, sizeof(toDel));
 			statefn = toDel;
 		}
 		persistStrmState(act);
 		strm.Destruct(&act->pStrm);
 		/* we delete state file after destruct in case strm obj initiated a write */
 		if(is_deleted && !act->in_move && inst->bRMStateOnDel) {
-			DBGPRINTF("act_obj_destroy: deleting state file %s\n", statefn);
-			unlink((char*)statefn);
+			if(runModConf->stateStore != NULL) {
+				DBGPRINTF("act_obj_destroy: deleting state %s\n", stateKey);
+				statestoreDel(runModConf->stateStore, (char*)stateKey);
+			} else {
+				DBGPRINTF("act_obj_destroy: deleting state file %s\n", statefn);
+				unlink((char*)statefn);
+			}
 		}
 	}
 	#ifdef HAVE_INOTIFY_INIT
@@ -1180,31 +1238,45 @@ openFileWithStateFile(act_obj_t *const act)
 	int fd = -1;
 	const instanceConf_t *const inst = act->edge->instarr[0];// TODO: same file, multiple instances?
 
-	uchar *const statefn = getStateFileName(act, statefile, sizeof(statefile));
+	char *storedState;
+	int bMigrate = 0;
+	struct json_object *jval;
+	struct json_object *json;
 
-	getFullStateFileName(statefn, pszSFNam, sizeof(pszSFNam));
-	DBGPRINTF("trying to open state for '%s', state file '%s'\n", act->name, pszSFNam);
+	uchar *const statefn = getStateFileName(act, statefile, sizeof(statefile));
 
-	/* check if the file exists */
-	fd = open((char*)pszSFNam, O_CLOEXEC | O_NOCTTY | O_RDONLY, 0600);
-	if(fd < 0) {
-		if(errno == ENOENT) {
-			DBGPRINTF("NO state file (%s) exists for '%s' - trying to see if "
-				"old-style file exists\n", pszSFNam, act->name);
-			CHKiRet(OLD_openFileWithStateFile(act));
-			FINALIZE;
-		} else {
-			LogError(errno, RS_RET_IO_ERROR,
-				"imfile error trying to access state file for '%s'",
-			        act->name);
-			ABORT_FINALIZE(RS_RET_IO_ERROR);
+	if(runModConf->stateStore != NULL
+	   && statestoreGet(runModConf->stateStore, (char*)statefn, &storedState) == RS_RET_OK) {
+		DBGPRINTF("state for '%s' found in state store\n", act->name);
+		json = fjson_tokener_parse(storedState);
+		free(storedState);
+	} else {
+		/* if we use a state store, this still picks up state files
+		 * written before it was enabled */
+		getFullStateFileName(statefn, pszSFNam, sizeof(pszSFNam));
+		DBGPRINTF("trying to open state for '%s', state file '%s'\n", act->name, pszSFNam);
+
+		/* check if the file exists */
+		fd = open((char*)pszSFNam, O_CLOEXEC | O_NOCTTY | O_RDONLY, 0600);
+		if(fd < 0) {
+			if(errno == ENOENT) {
+				DBGPRINTF("NO state file (%s) exists for '%s' - trying to see if "
+					"old-style file exists\n", pszSFNam, act->name);
+				CHKiRet(OLD_openFileWithStateFile(act));
+				FINALIZE;
+			} else {
+				LogError(errno, RS_RET_IO_ERROR,
+					"imfile error trying to access state file for '%s'",
+					act->name);
+				ABORT_FINALIZE(RS_RET_IO_ERROR);
+			}
 		}
+		json = fjson_object_from_fd(fd);
+		bMigrate = (runModConf->stateStore != NULL);
 	}
 
 	CHKiRet(strm.Construct(&act->pStrm));
 
-	struct json_object *jval;
-	struct json_object *json = fjson_object_from_fd(fd);
 	if(json == NULL) {
 		LogError(0, RS_RET_ERR, "imfile: error reading state file for '%s'", act->name);
 	}
@@ -1251,6 +1323,14 @@ openFileWithStateFile(act_obj_t *const act)
 
 	CHKiRet(strm.SeekCurrOffs(act->pStrm));
 
+	if(bMigrate) {
+		/* move state into the store, so we will never have to deal with
+		 * the state file again */
+		persistStrmState(act);
+		statestoreSync(runModConf->stateStore);
+		unlink((char*)pszSFNam);
+	}
+
 finalize_it:
 	if(fd >= 0) {
 		close(fd);
@@ -1331,7 +1411,7 @@ static void pollFileCancelCleanup(void *pArg)
 
 /* pollFile needs to be split due to the unfortunate pthread_cancel_push() macros. */
 static rsRetVal ATTR_NONNULL()
-pollFileReal(act_obj_t *act, cstr_t **pCStr)
+pollFileReal(act_obj_t *act, cstr_t **pCStr, const int maxLines)
 {
 	int64 strtOffs;
 	DEFiRet;
@@ -1343,19 +1423,22 @@ pollFileReal(act_obj_t *act, cstr_t **pCStr)
 
 	instanceConf_t *const inst = act->edge->instarr[0];// TODO: same file, multiple instances?
 
+	act->bMoreData = 0;
 	if(act->pStrm == NULL) {
 		CHKiRet(openFile(act)); /* open file */
 	}
 
 	/* loop below will be exited when strmReadLine() returns EOF */
 	while(glbl.GetGlobalInputTermState() == 0) {
-		if(inst->maxLinesAtOnce != 0 && nProcessed >= inst->maxLinesAtOnce)
+		if(maxLines != 0 && nProcessed >= maxLines) {
+			act->bMoreData = 1;
 			break;
+		}
 		if(inst->startRegex == NULL) {
 			CHKiRet(strm.ReadLine(act->pStrm, pCStr, inst->readMode, inst->escapeLF,
 				inst->trimLineOverBytes, &strtOffs));
 		} else {
-			CHKiRet(strmReadMultiLine(act->pStrm, pCStr, &inst->end_preg,
+			CHKiRet(strmReadMultiLine(act->pStrm, pCStr, inst->startMatch,
 				inst->escapeLF, inst->discardTruncatedMsg, inst->msgDiscardingError, &strtOffs));
 		}
 		++nProcessed;
@@ -1378,9 +1461,9 @@ finalize_it:
 	RETiRet;
 }
 
-/* poll a file, need to check file rollover etc. open file if not open */
+/* read up to maxLines lines (0 - unlimited) from a file */
 static rsRetVal ATTR_NONNULL(1)
-pollFile(act_obj_t *const act)
+pollFileLines(act_obj_t *const act, const int maxLines)
 {
 	cstr_t *pCStr = NULL;
 	DEFiRet;
@@ -1388,11 +1471,173 @@ pollFile(act_obj_t *const act)
 	 * otherwise do not work if I include the _cleanup_pop() inside an if... -- rgerhards, 2008-08-14
 	 */
 	pthread_cleanup_push(pollFileCancelCleanup, &pCStr);
-	iRet = pollFileReal(act, &pCStr);
+	iRet = pollFileReal(act, &pCStr, maxLines);
 	pthread_cleanup_pop(0);
 	RETiRet;
 }
 
+/* poll a file, need to check file rollover etc. open file if not open */
+static rsRetVal ATTR_NONNULL(1)
+pollFile(act_obj_t *const act)
+{
+	return pollFileLines(act, act->edge->instarr[0]->maxLinesAtOnce);
+}
+
+
+/* append act to the reader queue. Caller must hold readerPool.mut. */
+static void ATTR_NONNULL()
+readerPoolEnq(act_obj_t *const act)
+{
+	act->qnext = NULL;
+	if(readerPool.tail == NULL) {
+		readerPool.head = act;
+	} else {
+		readerPool.tail->qnext = act;
+	}
+	readerPool.tail = act;
+	act->bQueued = 1;
+}
+
+/* read a file with new data - either via the reader pool or, if there
+ * is none, directly on the input thread.
+ */
+static void ATTR_NONNULL()
+scheduleFile(act_obj_t *const act)
+{
+	if(!readerPool.bRunning) {
+		pollFile(act);
+		return;
+	}
+	pthread_mutex_lock(&readerPool.mut);
+	if(act->bBusy) {
+		act->bPending = 1; /* reader re-queues it when done */
+	} else if(!act->bQueued) {
+		readerPoolEnq(act);
+		pthread_cond_signal(&readerPool.wakeup);
+	}
+	pthread_mutex_unlock(&readerPool.mut);
+}
+
+/* make sure act is neither being read nor queued any longer. Must be
+ * called before it is destructed.
+ */
+static void ATTR_NONNULL()
+readerPoolRelease(act_obj_t *const act)
+{
+	act_obj_t *prev = NULL;
+	act_obj_t *curr;
+
+	if(!readerPool.bRunning)
+		return;
+	pthread_mutex_lock(&readerPool.mut);
+	while(act->bBusy) {
+		pthread_cond_wait(&readerPool.done, &readerPool.mut);
+	}
+	if(act->bQueued) {
+		for(curr = readerPool.head ; curr != act ; curr = curr->qnext)
+			prev = curr;
+		if(prev == NULL) {
+			readerPool.head = act->qnext;
+		} else {
+			prev->qnext = act->qnext;
+		}
+		if(readerPool.tail == act) {
+			readerPool.tail = prev;
+		}
+		act->bQueued = 0;
+	}
+	pthread_mutex_unlock(&readerPool.mut);
+}
+
+static void *
+readerThread(void __attribute__((unused)) *arg)
+{
+	act_obj_t *act;
+	int maxLines;
+
+	pthread_mutex_lock(&readerPool.mut);
+	while(1) {
+		while(readerPool.head == NULL && !readerPool.bStop) {
+			pthread_cond_wait(&readerPool.wakeup, &readerPool.mut);
+		}
+		if(readerPool.bStop)
+			break;
+		act = readerPool.head;
+		readerPool.head = act->qnext;
+		if(readerPool.head == NULL)
+			readerPool.tail = NULL;
+		act->bQueued = 0;
+		act->bBusy = 1;
+		act->bPending = 0;
+		pthread_mutex_unlock(&readerPool.mut);
+
+		maxLines = act->edge->instarr[0]->maxLinesAtOnce;
+		DBGPRINTF("imfile reader: processing '%s'\n", act->name);
+		pollFileLines(act, (maxLines == 0) ? READER_QUANTUM : maxLines);
+
+		pthread_mutex_lock(&readerPool.mut);
+		act->bBusy = 0;
+		if(act->bPending || act->bMoreData) {
+			readerPoolEnq(act); /* others go first */
+		}
+		pthread_cond_broadcast(&readerPool.done);
+	}
+	pthread_mutex_unlock(&readerPool.mut);
+	return NULL;
+}
+
+static void
+startReaderPool(void)
+{
+	int i;
+
+	if(runModConf->nReaders == 0)
+		return;
+	readerPool.head = readerPool.tail = NULL;
+	readerPool.bStop = 0;
+	readerPool.nReaders = 0;
+	if((readerPool.tids = calloc(runModConf->nReaders, sizeof(pthread_t))) == NULL) {
+		LogError(errno, RS_RET_OUT_OF_MEMORY, "imfile: cannot create reader pool, "
+			"files are read by the input thread");
+		return;
+	}
+	for(i = 0 ; i < runModConf->nReaders ; ++i) {
+		if(pthread_create(&readerPool.tids[i], NULL, readerThread, NULL) != 0) {
+			LogError(errno, RS_RET_ERR, "imfile: cannot create reader thread");
+			break;
+		}
+		++readerPool.nReaders;
+	}
+	DBGPRINTF("imfile: started %d reader threads\n", readerPool.nReaders);
+	readerPool.bRunning = (readerPool.nReaders > 0);
+}
+
+static void
+stopReaderPool(void)
+{
+	int i;
+
+	if(readerPool.tids == NULL)
+		return;
+	DBGPRINTF("imfile: stopping reader pool\n");
+	pthread_mutex_lock(&readerPool.mut);
+	readerPool.bStop = 1;
+	pthread_cond_broadcast(&readerPool.wakeup);
+	pthread_mutex_unlock(&readerPool.mut);
+	for(i = 0 ; i < readerPool.nReaders ; ++i) {
+		pthread_join(readerPool.tids[i], NULL);
+	}
+	free(readerPool.tids);
+	readerPool.tids = NULL;
+	/* no reader runs any longer, so queue flags are no longer of interest */
+	while(readerPool.head != NULL) {
+		readerPool.head->bQueued = 0;
+		readerPool.head = readerPool.head->qnext;
+	}
+	readerPool.tail = NULL;
+	readerPool.bRunning = 0;
+}
+
 
 /* create input instance, set default parameters, and
  * add it to the list of instances.
@@ -1418,6 +1663,8 @@ createInstance(instanceConf_t **const pinst)
 	inst->iPersistStateInterval = 0;
 	inst->readMode = 0;
 	inst->startRegex = NULL;
+	inst->startMatch = NULL;
+	inst->stats = NULL;
 	inst->discardTruncatedMsg = 0;
 	inst->msgDiscardingError = 1;
 	inst->bRMStateOnDel = 1;
@@ -1673,10 +1920,9 @@ CODESTARTnewInpInst
 	}
 
 	if(inst->startRegex != NULL) {
-		const int errcode = regcomp(&inst->end_preg, (char*)inst->startRegex, REG_EXTENDED);
-		if(errcode != 0) {
-			char errbuff[512];
-			regerror(errcode, &inst->end_preg, errbuff, sizeof(errbuff));
+		char errbuff[512];
+		if(startmatchConstruct(&inst->startMatch, inst->startRegex, errbuff, sizeof(errbuff))
+		   != RS_RET_OK) {
 			parser_errmsg("imfile: error in regex expansion: %s", errbuff);
 			ABORT_FINALIZE(RS_RET_ERR);
 		}
@@ -1696,6 +1942,9 @@ CODESTARTbeginCnfLoad
 	/* init our settings */
 	loadModConf->opMode = OPMODE_POLLING;
 	loadModConf->iPollInterval = DFLT_PollInterval;
+	loadModConf->nReaders = 0;
+	loadModConf->stateStoreName = NULL;
+	loadModConf->stateStore = NULL;
 	loadModConf->configSetViaV2Method = 0;
 	loadModConf->readTimeout = 0; /* default: no timeout */
 	loadModConf->timeoutGranularity = 1000; /* default: 1 second */
@@ -1746,8 +1995,12 @@ CODESTARTsetModCnf
 			continue;
 		if(!strcmp(modpblk.descr[i].name, "pollinginterval")) {
 			loadModConf->iPollInterval = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "readerthreads")) {
+			loadModConf->nReaders = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "readtimeout")) {
 			loadModConf->readTimeout = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "statestore")) {
+			loadModConf->stateStoreName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(modpblk.descr[i].name, "timeoutgranularity")) {
 			/* note: we need ms, thus "* 1000" */
 			loadModConf->timeoutGranularity = (int) pvals[i].val.d.n * 1000;
@@ -1803,6 +2056,11 @@ CODESTARTendCnfLoad
 		/* persist module-specific settings from legacy config system */
 		loadModConf->iPollInterval = cs.iPollInterval;
 	}
+	if(loadModConf->nReaders > 0 && loadModConf->opMode != OPMODE_INOTIFY) {
+		LogMsg(0, RS_RET_PARAM_ERROR, LOG_WARNING, "imfile: readerThreads is only "
+			"supported in inotify mode - files are read by the input thread");
+		loadModConf->nReaders = 0;
+	}
 	DBGPRINTF("opmode is %d, polling interval is %d\n",
 		  loadModConf->opMode,
 		  loadModConf->iPollInterval);
@@ -1830,6 +2088,35 @@ CODESTARTcheckCnf
 ENDcheckCnf
 
 
+/* boundary detection counters for multi-line inputs. The "regexec" counter
+ * tells how many lines could not be handled by the fast start matcher.
+ */
+static rsRetVal ATTR_NONNULL()
+createStartMatchStats(instanceConf_t *const inst)
+{
+	uchar statname[MAXFNAME+16];
+	DEFiRet;
+
+	snprintf((char*)statname, sizeof(statname), "imfile(%s)", inst->pszFileName);
+	statname[sizeof(statname)-1] = '\0'; /* just to be on the save side... */
+	CHKiRet(statsobj.Construct(&inst->stats));
+	CHKiRet(statsobj.SetName(inst->stats, statname));
+	CHKiRet(statsobj.SetOrigin(inst->stats, (uchar*)"imfile"));
+	CHKiRet(statsobj.AddCounter(inst->stats, UCHAR_CONSTANT("startmsg.lines"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &inst->startMatch->ctrLines));
+	CHKiRet(statsobj.AddCounter(inst->stats, UCHAR_CONSTANT("startmsg.matched"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &inst->startMatch->ctrMatched));
+	CHKiRet(statsobj.AddCounter(inst->stats, UCHAR_CONSTANT("startmsg.regexec"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &inst->startMatch->ctrRegexec));
+	CHKiRet(statsobj.ConstructFinalize(inst->stats));
+	DBGPRINTF("imfile: startmsg.regex '%s' for '%s' uses %s matcher\n", inst->startRegex,
+		inst->pszFileName, startmatchModeName(inst->startMatch));
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* note: we do access files AFTER we have dropped privileges. This is
  * intentional, user must make sure the files have the right permissions.
  */
@@ -1855,6 +2142,8 @@ CODESTARTactivateCnf
 					"be processed. Reason", inst->pszFileName);
 			}
 		}
+		if(inst->startMatch != NULL)
+			CHKiRet(createStartMatchStats(inst));
 		fs_node_add(runModConf->conf_tree, inst->pszFileName, 0, inst);
 	}
 
@@ -1870,19 +2159,20 @@ BEGINfreeCnf
 	instanceConf_t *inst, *del;
 CODESTARTfreeCnf
 	fs_node_destroy(pModConf->conf_tree);
+	/* must be done after the file objects are gone, as they persist their state */
+	statestoreClose(&pModConf->stateStore);
+	free(pModConf->stateStoreName);
 	//move_list_destruct(pModConf);
 	for(inst = pModConf->root ; inst != NULL ; ) {
-		if(inst->startRegex != NULL)
-			regfree(&inst->end_preg);
 		free(inst->pszBindRuleset);
 		free(inst->pszFileName);
 		free(inst->pszTag);
 		free(inst->pszStateFile);
 		free(inst->pszFileName_forOldStateFile);
-		if(inst->startRegex != NULL) {
-			regfree(&inst->end_preg);
-			free(inst->startRegex);
-		}
+		if(inst->stats != NULL)
+			statsobj.Destruct(&inst->stats);
+		startmatchDestruct(&inst->startMatch);
+		free(inst->startRegex);
 		del = inst;
 		inst = inst->next;
 		free(del);
@@ -1973,7 +2263,7 @@ in_handleFileEvent(struct inotify_event *ev, const wd_map_t *const etry)
 {
 	if(ev->mask & IN_MODIFY) {
 		DBGPRINTF("fs_node_notify_file_update: act->name '%s'\n", etry->act->name);
-		pollFile(etry->act);
+		scheduleFile(etry->act);
 	} else {
 		DBGPRINTF("got non-expected inotify event:\n");
 		in_dbg_showEv(ev);
@@ -2058,6 +2348,7 @@ do_inotify(void)
 		return RS_RET_INOTIFY_INIT_FAILED;
 	}
 	DBGPRINTF("inotify fd %d\n", ino_fd);
+	startReaderPool();
 
 	/* do watch initialization */
 	fs_node_walk(runModConf->conf_tree, poll_tree);
@@ -2109,6 +2400,7 @@ do_inotify(void)
 	}
 
 finalize_it:
+	stopReaderPool();
 	close(ino_fd);
 	RETiRet;
 }
@@ -2274,6 +2566,11 @@ ENDrunInput
  */
 BEGINwillRun
 CODESTARTwillRun
+	if(runModConf->stateStoreName != NULL) {
+		uchar storefn[MAXFNAME];
+		getFullStateFileName(runModConf->stateStoreName, storefn, sizeof(storefn));
+		CHKiRet(statestoreOpen(&runModConf->stateStore, (char*)storefn));
+	}
 	/* we need to create the inputName property (only once during our lifetime) */
 	CHKiRet(prop.Construct(&pInputName));
 	CHKiRet(prop.SetString(pInputName, UCHAR_CONSTANT("imfile"), sizeof("imfile") - 1));
@@ -2359,7 +2656,11 @@ persistStrmState(act_obj_t *const act)
 
 	const char *jstr =  json_object_to_json_string_ext(json, JSON_C_TO_STRING_SPACED);
 
-	CHKiRet(atomicWriteStateFile((const char*)statefname, jstr));
+	if(runModConf->stateStore != NULL) {
+		CHKiRet(statestorePut(runModConf->stateStore, (const char*)statefn, jstr));
+	} else {
+		CHKiRet(atomicWriteStateFile((const char*)statefname, jstr));
+	}
 	json_object_put(json);
 
 finalize_it:
@@ -2401,10 +2702,14 @@ CODESTARTmodExit
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(prop, CORE_COMPONENT);
 	objRelease(ruleset, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
 
 	#ifdef HAVE_INOTIFY_INIT
 	free(wdmap);
 	#endif
+	pthread_cond_destroy(&readerPool.done);
+	pthread_cond_destroy(&readerPool.wakeup);
+	pthread_mutex_destroy(&readerPool.mut);
 ENDmodExit
 
 
@@ -2471,6 +2776,10 @@ CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(strm, CORE_COMPONENT));
 	CHKiRet(objUse(ruleset, CORE_COMPONENT));
 	CHKiRet(objUse(prop, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
+	pthread_mutex_init(&readerPool.mut, NULL);
+	pthread_cond_init(&readerPool.wakeup, NULL);
+	pthread_cond_init(&readerPool.done, NULL);
 
 	DBGPRINTF("version %s initializing\n", VERSION);
 	CHKiRet(omsdRegCFSLineHdlr((uchar *)"inputfilename", 0, eCmdHdlrGetWord,
@@ -49,6 +49,7 @@
 #include "srUtils.h"
 #include "unicode-helper.h"
 #include "ratelimit.h"
+#include "statestore.h"
 
 
 MODULE_TYPE_INPUT
@@ -69,6 +70,7 @@ struct modConfData_s {
 
 static struct configSettings_s {
 	char *stateFile;
+	char *stateStore;
 	int iPersistStateInterval;
 	int ratelimitInterval;
 	int ratelimitBurst;
@@ -78,6 +80,12 @@ static struct configSettings_s {
 	int iDfltFacility;
 	int bUseJnlPID;
 	char *usePid;
+	struct {	/* journal fields to add to $!, all if nFields == 0 */
+		char *name;
+		size_t len;
+		sbool bPrefix;	/* name ended in '*' */
+	} *fields;
+	int nFields;
 } cs;
 
 static rsRetVal facilityHdlr(uchar **pp, void *pVal);
@@ -85,6 +93,7 @@ static rsRetVal facilityHdlr(uchar **pp, void *pVal);
 /* module-global parameters */
 static struct cnfparamdescr modpdescr[] = {
 	{ "statefile", eCmdHdlrGetWord, 0 },
+	{ "statestore", eCmdHdlrGetWord, 0 },
 	{ "ratelimit.interval", eCmdHdlrInt, 0 },
 	{ "ratelimit.burst", eCmdHdlrInt, 0 },
 	{ "persiststateinterval", eCmdHdlrInt, 0 },
@@ -93,7 +102,8 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "defaultseverity", eCmdHdlrSeverity, 0 },
 	{ "defaultfacility", eCmdHdlrString, 0 },
 	{ "usepidfromsystem", eCmdHdlrBinary, 0 },
-	{ "usepid", eCmdHdlrString, 0 }
+	{ "usepid", eCmdHdlrString, 0 },
+	{ "fields", eCmdHdlrArray, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -115,11 +125,16 @@ static int bPidFallBack;
 static ratelimit_t *ratelimiter = NULL;
 static sd_journal *j;
 static int j_inotify_fd;
+static statestore_t *stateStore = NULL;	/* used instead of the state file, if set */
+static char stateStoreKey[MAXFNAME];
 
 #define J_PROCESS_PERIOD 1024  /* Call sd_journal_process() every 1,024 records */
+#define J_BATCH_SIZE 1024  /* max number of records submitted at once */
+static multi_submit_t multiSub;
 
 static rsRetVal persistJournalState(void);
 static rsRetVal loadJournalState(void);
+static rsRetVal initJournalState(void);
 
 static rsRetVal openJournal(void) {
 	int r;
@@ -205,33 +220,43 @@ finalize_it:
 }
 
 
-/* enqueue the the journal message into the message queue.
- * The provided msg string is not freed - thus must be done
- * by the caller.
+/* check if a journal field is to be added to the $! properties. If no
+ * field list is configured, all fields are added. List entries ending in
+ * '*' match all fields with that prefix (e.g. "_SYSTEMD_*").
+ */
+static int
+isFieldWanted(const char *const name, const size_t lenName)
+{
+	int i;
+
+	if(cs.nFields == 0)
+		return 1;
+	for(i = 0 ; i < cs.nFields ; ++i) {
+		const size_t len = cs.fields[i].len;
+		if(cs.fields[i].bPrefix) {
+			if(len <= lenName && !memcmp(name, cs.fields[i].name, len))
+				return 1;
+		} else if(len == lenName && !memcmp(name, cs.fields[i].name, len)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/* fill in the remaining message properties and add the message to the
+ * current batch. The raw message must already be set.
  */
 static rsRetVal
-enqMsg(uchar *msg, uchar *pszTag, int iFacility, int iSeverity, struct timeval *tp, struct json_object *json,
-int sharedJsonProperties)
+enqMsg(smsg_t *pMsg, uchar *pszTag, int iFacility, int iSeverity, struct json_object *json)
 {
-	struct syslogTime st;
-	smsg_t *pMsg;
-	size_t len;
 	DEFiRet;
 
-	assert(msg != NULL);
 	assert(pszTag != NULL);
 
-	if(tp == NULL) {
-		CHKiRet(msgConstruct(&pMsg));
-	} else {
-		datetime.timeval2syslogTime(tp, &st, TIME_IN_LOCALTIME);
-		CHKiRet(msgConstructWithTime(&pMsg, &st, tp->tv_sec));
-	}
 	MsgSetFlowControlType(pMsg, eFLOWCTL_LIGHT_DELAY);
 	MsgSetInputName(pMsg, pInputName);
-	len = strlen((char*)msg);
-	MsgSetRawMsg(pMsg, (char*)msg, len);
-	if(len > 0)
+	if(pMsg->iLenRawMsg > 0)
 		parser.SanitizeMsg(pMsg);
 	MsgSetMSGoffs(pMsg, 0);	/* we do not have a header... */
 	MsgSetRcvFrom(pMsg, glbl.GetLocalHostNameProp());
@@ -242,18 +267,21 @@ int sharedJsonProperties)
 	pMsg->iSeverity = iSeverity;
 
 	if(json != NULL) {
-		msgAddJSON(pMsg, (uchar*)"!", json, 0, sharedJsonProperties);
+		msgAddJSON(pMsg, (uchar*)"!", json, 0, 0);
 	}
 
-	CHKiRet(ratelimitAddMsg(ratelimiter, NULL, pMsg));
+	CHKiRet(ratelimitAddMsg(ratelimiter, &multiSub, pMsg));
 
 finalize_it:
 	RETiRet;
 }
 
 
-/* Read journal log while data are available, each read() reads one
- * record of printk buffer.
+/* Read the current journal entry and add it to the current batch.
+ * All fields are obtained in a single pass over the entry. Data returned
+ * by the journal is only valid until the next field is retrieved, so the
+ * message text is directly copied into the message object and field values
+ * are only copied if they are actually needed.
  */
 static rsRetVal
 readjournal(void)
@@ -261,164 +289,183 @@ readjournal(void)
 	DEFiRet;
 
 	struct timeval tv;
+	struct syslogTime st;
 	uint64_t timestamp;
+	smsg_t *pMsg = NULL;
 
 	struct json_object *json = NULL;
 	int r;
 
 	/* Information from messages */
-	char *message = NULL;
-	char *sys_iden;
+	char *sys_iden = NULL;
+	char *sys_pid = NULL;
+	char *sys_pid_fallback = NULL;
 	char *sys_iden_help = NULL;
+	char *heapName = NULL;
+	char namebuf[256];
+	int bHaveMsg = 0;
+	int bHaveSeverity = 0;
+	int bHaveFacility = 0;
 
 	const void *get;
-	const void *pidget;
-	size_t length;
-	size_t pidlength;
-
-	const void *equal_sign;
+	const char *equal_sign;
 	struct json_object *jval;
 	size_t l;
 
-	long prefixlen = 0;
+	const size_t lenPidFieldName = strlen(pidFieldName);
+	size_t prefixlen;
 
 	int severity = cs.iDfltSeverity;
 	int facility = cs.iDfltFacility;
 
-	/* Get message text */
-	if (sd_journal_get_data(j, "MESSAGE", &get, &length) < 0) {
-		message = strdup("");
-	} else {
-		CHKiRet(sanitizeValue(((const char *)get) + 8, length - 8, &message));
-	}
-
-	/* Get message severity ("priority" in journald's terminology) */
-	if (sd_journal_get_data(j, "PRIORITY", &get, &length) >= 0) {
-		if (length == 10) {
-			severity = ((char *)get)[9] - '0';
-			if (severity < 0 || 7 < severity) {
-				LogError(0, RS_RET_ERR, "imjournal: the value of the 'PRIORITY' field is "
-					"out of bounds: %d, resetting", severity);
-				severity = cs.iDfltSeverity;
-			}
-		} else {
-			LogError(0, RS_RET_ERR, "The value of the 'PRIORITY' field has an "
-				"unexpected length: %zu\n", length);
-		}
-	}
-
-	/* Get syslog facility */
-	if (sd_journal_get_data(j, "SYSLOG_FACILITY", &get, &length) >= 0) {
-		// Note: the journal frequently contains invalid facilities!
-		if (length == 17 || length == 18) {
-			facility = ((char *)get)[16] - '0';
-			if (length == 18) {
-				facility *= 10;
-				facility += ((char *)get)[17] - '0';
-			}
-			if (facility < 0 || 23 < facility) {
-				DBGPRINTF("The value of the 'FACILITY' field is "
-					"out of bounds: %d, resetting\n", facility);
-				facility = cs.iDfltFacility;
-			}
-		} else {
-			DBGPRINTF("The value of the 'FACILITY' field has an "
-				"unexpected length: %zu value: '%s'\n", length, (const char*)get);
-		}
-	}
-
-	/* Get message identifier, client pid and add ':' */
-	if (sd_journal_get_data(j, "SYSLOG_IDENTIFIER", &get, &length) >= 0) {
-		CHKiRet(sanitizeValue(((const char *)get) + 18, length - 18, &sys_iden));
-	} else {
-		CHKmalloc(sys_iden = strdup("journal"));
-	}
-
-	/* trying to get PID, default is "SYSLOG_PID" property */
-	if (sd_journal_get_data(j, pidFieldName, &pidget, &pidlength) >= 0) {
-		char *sys_pid;
-		int val_ofs;
-
-		val_ofs = strlen(pidFieldName) + 1; /* name + '=' */
-		CHKiRet_Hdlr(sanitizeValue(((const char *)pidget) + val_ofs, pidlength - val_ofs, &sys_pid)) {
-			free (sys_iden);
-			FINALIZE;
-		}
-		r = asprintf(&sys_iden_help, "%s[%s]:", sys_iden, sys_pid);
-		free (sys_pid);
+	if (sd_journal_get_realtime_usec(j, &timestamp) >= 0) {
+		tv.tv_sec = timestamp / 1000000;
+		tv.tv_usec = timestamp % 1000000;
+		datetime.timeval2syslogTime(&tv, &st, TIME_IN_LOCALTIME);
+		CHKiRet(msgConstructWithTime(&pMsg, &st, tv.tv_sec));
 	} else {
-		/* this is fallback, "SYSLOG_PID" doesn't exist so trying to get "_PID" property */
-		if (bPidFallBack && sd_journal_get_data(j, "_PID", &pidget, &pidlength) >= 0) {
-			char *sys_pid;
-			int val_ofs;
-
-			val_ofs = strlen("_PID") + 1; /* name + '=' */
-			CHKiRet_Hdlr(sanitizeValue(((const char *)pidget) + val_ofs, pidlength - val_ofs, &sys_pid)) {
-				free (sys_iden);
-				FINALIZE;
-			}
-			r = asprintf(&sys_iden_help, "%s[%s]:", sys_iden, sys_pid);
-			free (sys_pid);
-		} else {
-			/* there is no PID property available */
-			r = asprintf(&sys_iden_help, "%s:", sys_iden);
-		}
-	}
-
-	free (sys_iden);
-
-	if (-1 == r) {
-		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		CHKiRet(msgConstruct(&pMsg));
 	}
 
-	json = json_object_new_object();
-
 	SD_JOURNAL_FOREACH_DATA(j, get, l) {
-		char *data;
+		const char *const field = (const char *) get;
+		const char *value;
+		size_t lenValue;
 		char *name;
 
 		/* locate equal sign, this is always present */
-		equal_sign = memchr(get, '=', l);
+		equal_sign = memchr(field, '=', l);
 
 		/* ... but we know better than to trust the specs */
 		if (equal_sign == NULL) {
 			LogError(0, RS_RET_ERR, "SD_JOURNAL_FOREACH_DATA()"
-				"returned a malformed field (has no '='): '%s'", (char*)get);
+				"returned a malformed field (has no '='): '%.*s'", (int) l, field);
 			continue; /* skip the entry */
 		}
 
 		/* get length of journal data prefix */
-		prefixlen = ((char *)equal_sign - (char *)get);
+		prefixlen = equal_sign - field;
+		value = equal_sign + 1;
+		lenValue = l - prefixlen - 1;
+
+		/* the journal may contain the same field more than once - like
+		 * sd_journal_get_data(), we use the first one for our properties.
+		 */
+		if (!bHaveMsg && prefixlen == 7 && !memcmp(field, "MESSAGE", 7)) {
+			if (memchr(value, '\0', lenValue) == NULL) {
+				MsgSetRawMsg(pMsg, value, lenValue);
+			} else {
+				char *message;
+				CHKiRet(sanitizeValue(value, lenValue, &message));
+				MsgSetRawMsg(pMsg, message, lenValue);
+				free(message);
+			}
+			bHaveMsg = 1;
+		} else if (!bHaveSeverity && prefixlen == 8 && !memcmp(field, "PRIORITY", 8)) {
+			/* message severity ("priority" in journald's terminology) */
+			if (lenValue == 1) {
+				severity = value[0] - '0';
+				if (severity < 0 || 7 < severity) {
+					LogError(0, RS_RET_ERR, "imjournal: the value of the 'PRIORITY' field is "
+						"out of bounds: %d, resetting", severity);
+					severity = cs.iDfltSeverity;
+				}
+			} else {
+				LogError(0, RS_RET_ERR, "The value of the 'PRIORITY' field has an "
+					"unexpected length: %zu\n", l);
+			}
+			bHaveSeverity = 1;
+		} else if (!bHaveFacility && prefixlen == 15 && !memcmp(field, "SYSLOG_FACILITY", 15)) {
+			// Note: the journal frequently contains invalid facilities!
+			if (lenValue == 1 || lenValue == 2) {
+				facility = value[0] - '0';
+				if (lenValue == 2) {
+					facility *= 10;
+					facility += value[1] - '0';
+				}
+				if (facility < 0 || 23 < facility) {
+					DBGPRINTF("The value of the 'FACILITY' field is "
+						"out of bounds: %d, resetting\n", facility);
+					facility = cs.iDfltFacility;
+				}
+			} else {
+				DBGPRINTF("The value of the 'FACILITY' field has an "
+					"unexpected length: %zu value: '%.*s'\n", l, (int) l, field);
+			}
+			bHaveFacility = 1;
+		} else if (sys_iden == NULL && prefixlen == 17 && !memcmp(field, "SYSLOG_IDENTIFIER", 17)) {
+			CHKiRet(sanitizeValue(value, lenValue, &sys_iden));
+		} else if (sys_pid == NULL && prefixlen == lenPidFieldName
+			   && !memcmp(field, pidFieldName, prefixlen)) {
+			CHKiRet(sanitizeValue(value, lenValue, &sys_pid));
+		} else if (bPidFallBack && sys_pid_fallback == NULL && prefixlen == 4
+			   && !memcmp(field, "_PID", 4)) {
+			/* fallback in case "SYSLOG_PID" does not exist */
+			CHKiRet(sanitizeValue(value, lenValue, &sys_pid_fallback));
+		}
 
-		name = strndup(get, prefixlen);
-		CHKmalloc(name);
+		if (!isFieldWanted(field, prefixlen))
+			continue;
 
-		prefixlen++; /* remove '=' */
+		if (prefixlen < sizeof(namebuf)) {
+			memcpy(namebuf, field, prefixlen);
+			namebuf[prefixlen] = '\0';
+			name = namebuf;
+		} else {
+			CHKmalloc(name = heapName = strndup(field, prefixlen));
+		}
 
-		CHKiRet_Hdlr(sanitizeValue(((const char *)get) + prefixlen, l - prefixlen, &data)) {
-			free (name);
-			FINALIZE;
+		if (memchr(value, '\0', lenValue) == NULL) {
+			jval = json_object_new_string_len(value, lenValue);
+		} else {
+			char *data;
+			CHKiRet(sanitizeValue(value, lenValue, &data));
+			jval = json_object_new_string(data);
+			free(data);
 		}
 
 		/* and save them to json object */
-		jval = json_object_new_string((char *)data);
+		if (json == NULL)
+			json = json_object_new_object();
 		json_object_object_add(json, name, jval);
-		free (data);
-		free (name);
+		free(heapName);
+		heapName = NULL;
 	}
 
-	/* calculate timestamp */
-	if (sd_journal_get_realtime_usec(j, &timestamp) >= 0) {
-		tv.tv_sec = timestamp / 1000000;
-		tv.tv_usec = timestamp % 1000000;
+	if (!bHaveMsg)
+		MsgSetRawMsg(pMsg, "", 0);
+
+	/* message identifier, client pid and add ':' */
+	if (sys_pid == NULL) {
+		sys_pid = sys_pid_fallback;
+		sys_pid_fallback = NULL;
+	}
+	if (sys_pid != NULL) {
+		r = asprintf(&sys_iden_help, "%s[%s]:", sys_iden == NULL ? "journal" : sys_iden, sys_pid);
+	} else {
+		/* there is no PID property available */
+		r = asprintf(&sys_iden_help, "%s:", sys_iden == NULL ? "journal" : sys_iden);
+	}
+	if (-1 == r) {
+		sys_iden_help = NULL;
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
 
 	/* submit message */
-	enqMsg((uchar *)message, (uchar *) sys_iden_help, facility, severity, &tv, json, 0);
+	iRet = enqMsg(pMsg, (uchar *) sys_iden_help, facility, severity, json);
+	pMsg = NULL; /* now owned by the batch (or discarded) */
+	json = NULL;
 
 finalize_it:
+	if (pMsg != NULL)
+		msgDestruct(&pMsg);
+	if (json != NULL)
+		json_object_put(json);
+	free(heapName);
 	free(sys_iden_help);
-	free(message);
+	free(sys_iden);
+	free(sys_pid);
+	free(sys_pid_fallback);
 	RETiRet;
 }
 
@@ -436,7 +483,10 @@ persistJournalState(void)
 
 	/* On success, sd_journal_get_cursor() returns 1 in systemd
 	   197 or older and 0 in systemd 198 or newer */
-	if ((ret = sd_journal_get_cursor(j, &cursor)) >= 0) {
+	if ((ret = sd_journal_get_cursor(j, &cursor)) >= 0 && stateStore != NULL) {
+		iRet = statestorePut(stateStore, stateStoreKey, cursor);
+		free(cursor);
+	} else if (ret >= 0) {
                /* we create a temporary name by adding a ".tmp"
                 * suffix to the end of our state file's name
                 */
@@ -536,57 +586,63 @@ finalize_it:
 	RETiRet;
 }
 
-/* This function loads a journal cursor from the state file.
- */
+/* seek the journal to the given (saved) cursor */
 static rsRetVal
-loadJournalState(void)
+seekToCursor(const char *const cursor)
 {
 	DEFiRet;
 	int r;
-	FILE *r_sf;
 
-	if (cs.stateFile[0] != '/') {
-		char *new_stateFile;
-		if (-1 == asprintf(&new_stateFile, "%s/%s", (char *)glbl.GetWorkDir(), cs.stateFile)) {
-			LogError(0, RS_RET_OUT_OF_MEMORY, "imjournal: asprintf failed\n");
-			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	if (sd_journal_seek_cursor(j, cursor) != 0) {
+		LogError(0, RS_RET_ERR, "imjournal: "
+			"couldn't seek to cursor `%s'\n", cursor);
+		iRet = RS_RET_ERR;
+	} else {
+		char * tmp_cursor = NULL;
+		sd_journal_next(j);
+		/*
+		* This is resolving the situation when system is after reboot and boot_id
+		* doesn't match so cursor pointing into "future".
+		* Usually sd_journal_next jump to head of journal due to journal aproximation,
+		* but when system time goes backwards and cursor is still 
+		  invalid, rsyslog stops logging.
+		* We use sd_journal_get_cursor to validate our cursor.
+		* When cursor is invalid we are trying to jump to the head of journal
+		* This problem with time should not affect persistent journal,
+		* but if cursor has been intentionally compromised it could stop logging even
+		* with persistent journal.
+		* */
+		if ((r = sd_journal_get_cursor(j, &tmp_cursor)) < 0) {
+			LogError(-r, RS_RET_IO_ERROR, "imjournal: "
+			"loaded invalid cursor, seeking to the head of journal\n");
+			if ((r = sd_journal_seek_head(j)) < 0) {
+				LogError(-r, RS_RET_ERR, "imjournal: "
+				"sd_journal_seek_head() failed, when cursor is invalid\n");
+				iRet = RS_RET_ERR;
+			}
 		}
-		free (cs.stateFile);
-		cs.stateFile = new_stateFile;
+		free(tmp_cursor);
 	}
+	RETiRet;
+}
+
+/* This function loads a journal cursor from the state store or state file.
+ */
+static rsRetVal
+loadJournalState(void)
+{
+	DEFiRet;
+	FILE *r_sf;
+	char *storedCursor = NULL;
 
-	if ((r_sf = fopen(cs.stateFile, "rb")) != NULL) {
+	if (stateStore != NULL
+	    && statestoreGet(stateStore, stateStoreKey, &storedCursor) == RS_RET_OK) {
+		iRet = seekToCursor(storedCursor);
+		free(storedCursor);
+	} else if ((r_sf = fopen(cs.stateFile, "rb")) != NULL) {
 		char readCursor[128 + 1];
 		if (fscanf(r_sf, "%128s\n", readCursor) != EOF) {
-			if (sd_journal_seek_cursor(j, readCursor) != 0) {
-				LogError(0, RS_RET_ERR, "imjournal: "
-					"couldn't seek to cursor `%s'\n", readCursor);
-				iRet = RS_RET_ERR;
-			} else {
-				char * tmp_cursor = NULL;
-				sd_journal_next(j);
-				/*
-				* This is resolving the situation when system is after reboot and boot_id
-				* doesn't match so cursor pointing into "future".
-				* Usually sd_journal_next jump to head of journal due to journal aproximation,
-				* but when system time goes backwards and cursor is still 
-				  invalid, rsyslog stops logging.
-				* We use sd_journal_get_cursor to validate our cursor.
-				* When cursor is invalid we are trying to jump to the head of journal
-				* This problem with time should not affect persistent journal,
-				* but if cursor has been intentionally compromised it could stop logging even
-				* with persistent journal.
-				* */
-				if ((r = sd_journal_get_cursor(j, &tmp_cursor)) < 0) {
-					LogError(-r, RS_RET_IO_ERROR, "imjournal: "
-					"loaded invalid cursor, seeking to the head of journal\n");
-					if ((r = sd_journal_seek_head(j)) < 0) {
-						LogError(-r, RS_RET_ERR, "imjournal: "
-						"sd_journal_seek_head() failed, when cursor is invalid\n");
-						iRet = RS_RET_ERR;
-					}
-				}
-			}
+			iRet = seekToCursor(readCursor);
 		} else {
 			LogError(0, RS_RET_IO_ERROR, "imjournal: "
 				"fscanf on state file `%s' failed\n", cs.stateFile);
@@ -594,16 +650,6 @@ loadJournalState(void)
 		}
 
 		fclose(r_sf);
-
-		if (iRet != RS_RET_OK && cs.bIgnoreNonValidStatefile) {
-			/* ignore state file errors */
-			iRet = RS_RET_OK;
-			LogError(0, NO_ERRCODE, "imjournal: ignoring invalid state file %s",
-				cs.stateFile);
-			if (cs.bIgnorePrevious) {
-				skipOldMessages();
-			}
-		}
 	} else {
 		LogError(0, RS_RET_FOPEN_FAILURE, "imjournal: "
 				"open on state file `%s' failed\n", cs.stateFile);
@@ -612,6 +658,51 @@ loadJournalState(void)
 			 * older messages. */
 			skipOldMessages();
 		}
+		FINALIZE;
+	}
+
+	if (iRet != RS_RET_OK && cs.bIgnoreNonValidStatefile) {
+		/* ignore state file errors */
+		iRet = RS_RET_OK;
+		LogError(0, NO_ERRCODE, "imjournal: ignoring invalid state file %s",
+			cs.stateFile);
+		if (cs.bIgnorePrevious) {
+			skipOldMessages();
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+/* make the state file name absolute and, if requested, open the state
+ * store. Within the store, the state file name is used as key.
+ */
+static rsRetVal
+initJournalState(void)
+{
+	DEFiRet;
+
+	if (cs.stateFile[0] != '/') {
+		char *new_stateFile;
+		if (-1 == asprintf(&new_stateFile, "%s/%s", (char *)glbl.GetWorkDir(), cs.stateFile)) {
+			LogError(0, RS_RET_OUT_OF_MEMORY, "imjournal: asprintf failed\n");
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		free (cs.stateFile);
+		cs.stateFile = new_stateFile;
+	}
+
+	if (cs.stateStore != NULL && stateStore == NULL) {
+		char storefn[MAXFNAME];
+		if (cs.stateStore[0] == '/') {
+			snprintf(storefn, sizeof(storefn), "%s", cs.stateStore);
+		} else {
+			snprintf(storefn, sizeof(storefn), "%s/%s", (char *)glbl.GetWorkDir(),
+				cs.stateStore);
+		}
+		snprintf(stateStoreKey, sizeof(stateStoreKey), "imjournal:%s", cs.stateFile);
+		CHKiRet(statestoreOpen(&stateStore, storefn));
 	}
 
 finalize_it:
@@ -620,6 +711,7 @@ finalize_it:
 
 static void
 tryRecover(void) {
+	multiSubmitFlush(&multiSub);
 	LogMsg(0, RS_RET_OK, LOG_INFO, "imjournal: trying to recover from unexpected "
 		"journal error");
 	closeJournal();
@@ -636,9 +728,13 @@ CODESTARTrunInput
 		  cs.ratelimitInterval);
 	ratelimitSetLinuxLike(ratelimiter, cs.ratelimitInterval, cs.ratelimitBurst);
 	ratelimitSetNoTimeCache(ratelimiter);
+	CHKmalloc(multiSub.ppMsgs = malloc(J_BATCH_SIZE * sizeof(smsg_t *)));
+	multiSub.maxElem = J_BATCH_SIZE;
+	multiSub.nElem = 0;
 
 	if (cs.stateFile) {
 		/* Load our position in the journal from the state file. */
+		CHKiRet(initJournalState());
 		CHKiRet(loadJournalState());
 	} else if (cs.bIgnorePrevious) {
 		/* Seek to the very end of the journal and ignore all
@@ -683,7 +779,8 @@ CODESTARTrunInput
 		}
 
 		if (r == 0) {
-			/* No new messages, wait for activity. */
+			/* No new messages, submit what we have and wait for activity. */
+			multiSubmitFlush(&multiSub);
 			if (pollJournal() != RS_RET_OK) {
 				tryRecover();
 			}
@@ -710,12 +807,19 @@ CODESTARTrunInput
 		if (cs.stateFile) { /* can't persist without a state file */
 			/* TODO: This could use some finer metric. */
 			if ((count % cs.iPersistStateInterval) == 0) {
+				/* do not record a position beyond what was submitted */
+				multiSubmitFlush(&multiSub);
 				persistJournalState();
 			}
 		}
 	}
 
 finalize_it:
+	if (multiSub.ppMsgs != NULL) {
+		multiSubmitFlush(&multiSub);
+		free(multiSub.ppMsgs);
+		multiSub.ppMsgs = NULL;
+	}
 ENDrunInput
 
 
@@ -726,12 +830,15 @@ CODESTARTbeginCnfLoad
 	cs.bIgnoreNonValidStatefile = 1;
 	cs.iPersistStateInterval = DFLT_persiststateinterval;
 	cs.stateFile = NULL;
+	cs.stateStore = NULL;
 	cs.ratelimitBurst = 20000;
 	cs.ratelimitInterval = 600;
 	cs.iDfltSeverity = DFLT_SEVERITY;
 	cs.iDfltFacility = DFLT_FACILITY;
 	cs.bUseJnlPID = -1;
 	cs.usePid = NULL;
+	cs.fields = NULL;
+	cs.nFields = 0;
 ENDbeginCnfLoad
 
 
@@ -751,8 +858,13 @@ ENDactivateCnf
 
 
 BEGINfreeCnf
+	int i;
 CODESTARTfreeCnf
+	for (i = 0 ; i < cs.nFields ; ++i)
+		free(cs.fields[i].name);
+	free(cs.fields);
 	free(cs.stateFile);
+	free(cs.stateStore);
 	free(cs.usePid);
 ENDfreeCnf
 
@@ -766,6 +878,7 @@ ENDwillRun
 BEGINafterRun
 CODESTARTafterRun
 	closeJournal();
+	statestoreClose(&stateStore);
 	ratelimitDestruct(ratelimiter);
 ENDafterRun
 
@@ -809,6 +922,8 @@ CODESTARTsetModCnf
 			cs.iPersistStateInterval = (int) pvals[i].val.d.n;
 		} else if (!strcmp(modpblk.descr[i].name, "statefile")) {
 			cs.stateFile = (char *)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if (!strcmp(modpblk.descr[i].name, "statestore")) {
+			cs.stateStore = (char *)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(modpblk.descr[i].name, "ratelimit.burst")) {
 			cs.ratelimitBurst = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "ratelimit.interval")) {
@@ -832,6 +947,23 @@ CODESTARTsetModCnf
 			cs.bUseJnlPID = (int) pvals[i].val.d.n;
 		} else if (!strcmp(modpblk.descr[i].name, "usepid")) {
 			cs.usePid = (char *)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if (!strcmp(modpblk.descr[i].name, "fields")) {
+			const int nFields = pvals[i].val.d.ar->nmemb;
+			int k;
+			if (nFields == 0)
+				continue;
+			CHKmalloc(cs.fields = calloc(nFields, sizeof(*cs.fields)));
+			for (k = 0 ; k < nFields ; ++k) {
+				char *const name = es_str2cstr(pvals[i].val.d.ar->arr[k], NULL);
+				CHKmalloc(name);
+				cs.fields[cs.nFields].name = name;
+				cs.fields[cs.nFields].len = strlen(name);
+				++cs.nFields;
+				if (cs.fields[k].len > 0 && name[cs.fields[k].len - 1] == '*') {
+					cs.fields[k].bPrefix = 1;
+					--cs.fields[k].len;
+				}
+			}
 		} else {
 			dbgprintf("imjournal: program error, non-handled "
 				"param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
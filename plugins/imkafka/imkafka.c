@@ -4,7 +4,7 @@
  *
  * File begun on 2017-04-25 by alorbach
  *
- * Copyright 2008-2017 Adiscon GmbH.
+ * Copyright 2008-2018 Adiscon GmbH.
  *
  * This file is part of rsyslog.
  *
@@ -30,6 +30,7 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <sys/uio.h>
@@ -67,6 +68,26 @@ struct kafka_params {
 	const char *val;
 };
 
+#define IMKAFKA_DFLT_BATCHSIZE 1024	/* default max nbr of messages consumed in one go */
+
+/* a single kafka consumer handle of an input instance. Each of them
+ * runs on its own thread. As they all join the same consumer group,
+ * the broker assigns each one its own set of partitions.
+ */
+typedef struct kafkaConsumer_s {
+	instanceConf_t *inst;
+	int id;
+	rd_kafka_t *rk;
+#	if RD_KAFKA_VERSION >= 0x000b0000
+	rd_kafka_queue_t *rkqu;		/* consumer queue for batch consumption */
+#	endif
+	int bIsSubscribed;
+	pthread_t tid;
+	statsobj_t *stats;
+	STATSCOUNTER_DEF(ctrMsgsRcvd, mutCtrMsgsRcvd)
+	STATSCOUNTER_DEF(ctrCallConsume, mutCtrCallConsume)
+} kafkaConsumer_t;
+
 /* Module static data */
 static struct configSettings_s {
 	uchar *topic;
@@ -88,11 +109,13 @@ struct instanceConf_s {
 	int nConfParams;
 	struct kafka_params *confParams;
 	int bIsConnected;
-	rd_kafka_conf_t *conf;
-	rd_kafka_t *rk;
+	int nConsumers;			/* number of consumer threads */
+	int batchSize;			/* max nbr of messages to consume in one go */
+	int bStoreOffsets;		/* store offsets only after enqueue? */
+	rd_kafka_conf_t *conf;		/* template for all consumer handles */
 	rd_kafka_topic_conf_t *topic_conf;
 	int partition;
-	int bIsSubscribed;
+	kafkaConsumer_t *consumers;
 
 	struct instanceConf_s *next;
 };
@@ -131,6 +154,8 @@ static struct cnfparamdescr inppdescr[] = {
 	{ "confparam", eCmdHdlrArray, 0 },
 	{ "consumergroup", eCmdHdlrString, 0},
 	{ "ruleset", eCmdHdlrString, 0 },
+	{ "threads", eCmdHdlrPositiveInt, 0 },
+	{ "batchsize", eCmdHdlrPositiveInt, 0 },
 };
 static struct cnfparamblk inppblk =
 	{ CNFPARAMBLK_VERSION,
@@ -156,11 +181,15 @@ kafkaLogger(const rd_kafka_t __attribute__((unused)) *rk, int level,
 }
 
 
-/* enqueue the kafka message. The provided string is
- * not freed - thuis must be done by the caller.
+/* enqueue the kafka message. The message is added to the caller's
+ * multi-submit batch, which must have room for it. The kafka message
+ * is not freed - this must be done by the caller.
+ * Note: the payload must be copied, as it is owned by librdkafka and
+ * released together with the kafka message.
  */
 static rsRetVal enqMsg(instanceConf_t *const __restrict__ inst,
-			rd_kafka_message_t *const __restrict__ rkmessage)
+			rd_kafka_message_t *const __restrict__ rkmessage,
+			multi_submit_t *const __restrict__ pMultiSub)
 {
 	DEFiRet;
 	smsg_t *pMsg;
@@ -185,30 +214,123 @@ DBGPRINTF("imkafka: enqMsg: Msg: %.*s\n", (int)rkmessage->len, (char *)rkmessage
 	}
 	MsgSetMSGoffs(pMsg, 0);	/* we do not have a header... */
 
-	CHKiRet(submitMsg2(pMsg));
+	pMultiSub->ppMsgs[pMultiSub->nElem++] = pMsg;
+	if(pMultiSub->nElem == pMultiSub->maxElem)
+		CHKiRet(multiSubmitMsg2(pMultiSub));
 
-/* useful?
-	MsgSetHOSTNAME(pMsg, glbl.GetLocalHostName(), ustrlen(glbl.GetLocalHostName()));
-	ratelimitAddMsg(pLstn->ratelimiter, &pLstn->multiSub, pMsg);
-*/
 finalize_it:
 	RETiRet;
 }
 
-/**
- * Handle Kafka Consumer Loop until all msgs are processed
+/* fetch up to batchSize messages from the consumer. Blocks for at most
+ * one second if no message is available. Returns the number of messages
+ * obtained, which must be destroyed by the caller, or -1 on error.
+ */
+static ssize_t
+consumeBatch(kafkaConsumer_t *const cons, rd_kafka_message_t **const rkmessages)
+{
+#	if RD_KAFKA_VERSION >= 0x000b0000
+	return rd_kafka_consume_batch_queue(cons->rkqu, 1000, rkmessages,
+		cons->inst->batchSize);
+#	else
+	/* older librdkafka can only poll the consumer queue, so we emulate
+	 * the batch: wait for the first message, then take what is ready.
+	 */
+	ssize_t n = 0;
+	rd_kafka_message_t *rkmessage;
+
+	while(n < cons->inst->batchSize) {
+		rkmessage = rd_kafka_consumer_poll(cons->rk, (n == 0) ? 1000 : 0);
+		if(rkmessage == NULL)
+			break;
+		rkmessages[n++] = rkmessage;
+	}
+	return n;
+#	endif
+}
+
+/* After a failed submit, rewind each partition of the batch to its first
+ * message starting at index iFirst, so that these messages are consumed
+ * again instead of being skipped. Messages of a partition are delivered in
+ * offset order, so the first one we find has the lowest offset.
  */
-static void msgConsume (instanceConf_t *inst) {
-	rd_kafka_message_t *rkmessage = NULL;
-
-	do { /* Consume messages */
-		rkmessage = rd_kafka_consumer_poll(inst->rk, 1000); /* Block for 1000 ms max */
-		if(rkmessage == NULL) {
-			DBGPRINTF("imkafka: msgConsume EMPTY Loop on %s/%s/%s\n",
-				inst->topic, inst->consumergroup, inst->brokers);
-			goto done;
+static void
+seekBack(kafkaConsumer_t *const cons, rd_kafka_message_t **const rkmessages,
+	const ssize_t iFirst, const ssize_t nMsgs)
+{
+	rd_kafka_topic_partition_list_t *seen;
+	rd_kafka_message_t *rkmessage;
+	rd_kafka_resp_err_t err;
+	ssize_t i;
+
+	if((seen = rd_kafka_topic_partition_list_new(1)) == NULL) {
+		LogError(0, RS_RET_OUT_OF_MEMORY, "imkafka: cannot rewind topic \"%s\", "
+			"messages not enqueued will be lost", cons->inst->topic);
+		return;
+	}
+	for(i = iFirst ; i < nMsgs ; ++i) {
+		rkmessage = rkmessages[i];
+		if(rkmessage->err != RD_KAFKA_RESP_ERR_NO_ERROR
+		   || rd_kafka_topic_partition_list_find(seen,
+			rd_kafka_topic_name(rkmessage->rkt), rkmessage->partition) != NULL)
+			continue;
+		rd_kafka_topic_partition_list_add(seen, rd_kafka_topic_name(rkmessage->rkt),
+			rkmessage->partition);
+		DBGPRINTF("imkafka: rewinding topic \"%s\" [%"PRId32"] to offset %"PRId64"\n",
+			rd_kafka_topic_name(rkmessage->rkt), rkmessage->partition, rkmessage->offset);
+		err = rd_kafka_seek(rkmessage->rkt, rkmessage->partition, rkmessage->offset, 1000);
+		if(err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+			LogError(0, RS_RET_KAFKA_ERROR, "imkafka: cannot rewind topic \"%s\" "
+				"[%"PRId32"] to offset %"PRId64", messages not enqueued will "
+				"be lost: %s", rd_kafka_topic_name(rkmessage->rkt),
+				rkmessage->partition, rkmessage->offset, rd_kafka_err2str(err));
 		}
+	}
+	rd_kafka_topic_partition_list_destroy(seen);
+}
 
+/**
+ * Handle one batch of the Kafka Consumer. All messages obtained are
+ * submitted to the ruleset queue in one go. Only after they have been
+ * handed over successfully, their offsets are stored for the next
+ * commit. So the committed offset is aligned with the enqueue into the
+ * ruleset's (by default in-memory) queue: it never moves beyond what
+ * has been enqueued. Messages still in an in-memory queue are lost on a
+ * crash; use a disk-assisted queue if they must survive it.
+ * If the submit fails, the partitions are rewound to the first message
+ * that may not have been enqueued, so it is consumed again.
+ */
+static void msgConsume(kafkaConsumer_t *const cons,
+	rd_kafka_message_t **const rkmessages, multi_submit_t *const pMultiSub)
+{
+	instanceConf_t *const inst = cons->inst;
+	rd_kafka_message_t *rkmessage;
+	ssize_t nMsgs;
+	ssize_t i;
+	ssize_t iFailed;	/* first message that may not have been enqueued */
+	rsRetVal localRet;
+	rsRetVal flushRet;
+
+	nMsgs = consumeBatch(cons, rkmessages);
+	STATSCOUNTER_INC(cons->ctrCallConsume, cons->mutCtrCallConsume);
+	if(nMsgs < 0) {
+		LogError(0, RS_RET_KAFKA_ERROR, "imkafka: error consuming from "
+			"topic \"%s\": %s", inst->topic,
+			rd_kafka_err2str(rd_kafka_last_error()));
+		/* like failed subscriptions, do not hog the CPU while this persists */
+		srSleep(0, 100000);
+		return;
+	}
+	if(nMsgs == 0) {
+		DBGPRINTF("imkafka: msgConsume EMPTY Loop on %s/%s/%s\n",
+			inst->topic, inst->consumergroup, inst->brokers);
+		return;
+	}
+
+	localRet = RS_RET_OK;
+	iFailed = nMsgs;
+	for(i = 0 ; i < nMsgs ; ++i) {
+		rkmessage = rkmessages[i];
 		if (rkmessage->err) {
 			if (rkmessage->err == RD_KAFKA_RESP_ERR__PARTITION_EOF) {
 				/* not an error, just a regular status! */
@@ -218,7 +340,7 @@ static void msgConsume (instanceConf_t *inst) {
 					rd_kafka_topic_name(rkmessage->rkt),
 					rkmessage->partition,
 					rkmessage->offset);
-				goto done;
+				continue;
 			}
 			if (rkmessage->rkt) {
 				LogError(0, RS_RET_KAFKA_ERROR,
@@ -234,7 +356,7 @@ static void msgConsume (instanceConf_t *inst) {
 					rd_kafka_err2str(rkmessage->err),
 					rd_kafka_message_errstr(rkmessage));
 			}
-			goto done;
+			continue;
 		}
 
 		DBGPRINTF("imkafka: msgConsume Loop on %s/%s/%s: [%"PRId32"], "
@@ -245,17 +367,42 @@ static void msgConsume (instanceConf_t *inst) {
 					rkmessage->partition,
 					rkmessage->offset,
 					rkmessage->len);
-		enqMsg(inst, rkmessage);
-		/* Destroy message and continue */
-		rd_kafka_message_destroy(rkmessage);
-		rkmessage = NULL;
-	} while(1); /* loop broken inside */
-done:
-	/* Destroy message in case rkmessage->err was set */
-	if(rkmessage != NULL) {
-		rd_kafka_message_destroy(rkmessage);
+		STATSCOUNTER_INC(cons->ctrMsgsRcvd, cons->mutCtrMsgsRcvd);
+		if(localRet == RS_RET_OK) {
+			localRet = enqMsg(inst, rkmessage, pMultiSub);
+			if(localRet != RS_RET_OK)
+				iFailed = i;
+		}
+	}
+	flushRet = multiSubmitFlush(pMultiSub);
+	if(flushRet != RS_RET_OK) {
+		/* the queue may have taken part of the batch, but we cannot
+		 * tell which part - so all of it is consumed again */
+		iFailed = 0;
+		if(localRet == RS_RET_OK)
+			localRet = flushRet;
+	}
+	pMultiSub->nElem = 0; /* queue may already be gone during shutdown */
+
+	if(localRet != RS_RET_OK) {
+		LogError(0, localRet, "imkafka: error submitting %zd messages from topic "
+			"\"%s\" to the queue, they will be consumed again", nMsgs - iFailed,
+			inst->topic);
+		seekBack(cons, rkmessages, iFailed, nMsgs);
+	}
+	if(inst->bStoreOffsets) {
+		for(i = 0 ; i < iFailed ; ++i) {
+			rkmessage = rkmessages[i];
+			if(rkmessage->err == RD_KAFKA_RESP_ERR_NO_ERROR)
+				rd_kafka_offset_store(rkmessage->rkt, rkmessage->partition,
+					rkmessage->offset);
+		}
 	}
-	return;
+
+	for(i = 0 ; i < nMsgs ; ++i)
+		rd_kafka_message_destroy(rkmessages[i]);
+	if(localRet != RS_RET_OK)
+		srSleep(0, 100000); /* give the queue some time to recover */
 }
 
 
@@ -281,11 +428,13 @@ createInstance(instanceConf_t **pinst)
 	inst->pBindRuleset = NULL;
 	inst->bReportErrs = 1; /* Fixed for now */
 	inst->bIsConnected = 0;
-	inst->bIsSubscribed = 0;
+	inst->nConsumers = 1;
+	inst->batchSize = IMKAFKA_DFLT_BATCHSIZE;
+	inst->bStoreOffsets = 0;
 	/* Kafka objects */
 	inst->conf = NULL;
-	inst->rk = NULL;
 	inst->topic_conf = NULL;
+	inst->consumers = NULL;
 	inst->partition = RD_KAFKA_PARTITION_UA;
 
 	/* node created, let's add to config */
@@ -308,6 +457,9 @@ checkInstance(instanceConf_t *const inst)
 {
 	DEFiRet;
 	int nBrokers;
+	int i;
+	rd_kafka_conf_t *conf;
+	kafkaConsumer_t *cons;
 	char kafkaErrMsg[1024];
 
 	/* main kafka conf */
@@ -329,8 +481,23 @@ checkInstance(instanceConf_t *const inst)
 	}
 #	endif
 
+#	if RD_KAFKA_VERSION >= 0x00090100
+	/* offsets are stored by us after the messages have been enqueued into
+	 * the ruleset's (by default in-memory) queue, see msgConsume(). This
+	 * is done before the custom parameters are applied, so the user can
+	 * still ask for librdkafka's automatic (consume-time) offset store.
+	 * Older librdkafka versions do not know the property; then offsets
+	 * are stored at consume time as before.
+	 */
+	if(rd_kafka_conf_set(inst->conf, "enable.auto.offset.store", "false",
+		kafkaErrMsg, sizeof(kafkaErrMsg)) != RD_KAFKA_CONF_OK) {
+		DBGPRINTF("imkafka: cannot disable enable.auto.offset.store: %s\n",
+			kafkaErrMsg);
+	}
+#	endif
+
 	/* Set custom configuration parameters */
-	for(int i = 0 ; i < inst->nConfParams ; ++i) {
+	for(i = 0 ; i < inst->nConfParams ; ++i) {
 		assert(inst->confParams+i != NULL); /* invariant: nConfParams MUST exist! */
 		DBGPRINTF("imkafka: setting custom configuration parameter: %s:%s\n",
 			inst->confParams[i].name,
@@ -398,27 +565,50 @@ checkInstance(instanceConf_t *const inst)
 		rd_kafka_conf_set_log_cb(inst->conf, kafkaLogger);
 	#endif
 
-	/* Create Kafka Consumer */
-	inst->rk = rd_kafka_new(RD_KAFKA_CONSUMER, inst->conf,
-				     kafkaErrMsg, sizeof(kafkaErrMsg));
-	if(inst->rk == NULL) {
-		if(inst->bReportErrs) {
-			errmsg.LogError(0, RS_RET_KAFKA_ERROR,
-				"imkafka: error creating kafka handle: %s\n", kafkaErrMsg);
+#	if RD_KAFKA_VERSION >= 0x00090100
+	{
+		char val[16];
+		size_t lenVal = sizeof(val);
+		if(rd_kafka_conf_get(inst->conf, "enable.auto.offset.store", val, &lenVal)
+			== RD_KAFKA_CONF_OK) {
+			inst->bStoreOffsets = !strcmp(val, "false");
 		}
-		ABORT_FINALIZE(RS_RET_KAFKA_ERROR);
 	}
-	#if RD_KAFKA_VERSION < 0x00090001
-		rd_kafka_set_logger(inst->rk, kafkaLogger);
-	#endif
+#	endif
 
-   	DBGPRINTF("imkafka: setting brokers: '%s'\n", inst->brokers);
-	if((nBrokers = rd_kafka_brokers_add(inst->rk, (char*)inst->brokers)) == 0) {
-		if(inst->bReportErrs) {
-			errmsg.LogError(0, RS_RET_KAFKA_NO_VALID_BROKERS,
-				"imkafka: no valid brokers specified: %s", inst->brokers);
+	/* Create Kafka Consumers - one handle per consumer thread, all of them
+	 * built from the same configuration.
+	 */
+	CHKmalloc(inst->consumers = calloc(inst->nConsumers, sizeof(kafkaConsumer_t)));
+	for(i = 0 ; i < inst->nConsumers ; ++i) {
+		cons = inst->consumers + i;
+		cons->inst = inst;
+		cons->id = i;
+		if((conf = rd_kafka_conf_dup(inst->conf)) == NULL) {
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		cons->rk = rd_kafka_new(RD_KAFKA_CONSUMER, conf,
+					     kafkaErrMsg, sizeof(kafkaErrMsg));
+		if(cons->rk == NULL) {
+			rd_kafka_conf_destroy(conf);
+			if(inst->bReportErrs) {
+				errmsg.LogError(0, RS_RET_KAFKA_ERROR,
+					"imkafka: error creating kafka handle: %s\n", kafkaErrMsg);
+			}
+			ABORT_FINALIZE(RS_RET_KAFKA_ERROR);
+		}
+		#if RD_KAFKA_VERSION < 0x00090001
+			rd_kafka_set_logger(cons->rk, kafkaLogger);
+		#endif
+
+		DBGPRINTF("imkafka: setting brokers: '%s'\n", inst->brokers);
+		if((nBrokers = rd_kafka_brokers_add(cons->rk, (char*)inst->brokers)) == 0) {
+			if(inst->bReportErrs) {
+				errmsg.LogError(0, RS_RET_KAFKA_NO_VALID_BROKERS,
+					"imkafka: no valid brokers specified: %s", inst->brokers);
+			}
+			ABORT_FINALIZE(RS_RET_KAFKA_NO_VALID_BROKERS);
 		}
-		ABORT_FINALIZE(RS_RET_KAFKA_NO_VALID_BROKERS);
 	}
 
 	/* Kafka Consumer is opened */
@@ -426,14 +616,17 @@ checkInstance(instanceConf_t *const inst)
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
-		if(inst->rk == NULL) {
-			if(inst->conf != NULL) {
-				rd_kafka_conf_destroy(inst->conf);
-				inst->conf = NULL;
+		if(inst->consumers != NULL) {
+			for(i = 0 ; i < inst->nConsumers ; ++i) {
+				if(inst->consumers[i].rk != NULL)
+					rd_kafka_destroy(inst->consumers[i].rk);
 			}
-		} else { /* inst->rk != NULL ! */
-			rd_kafka_destroy(inst->rk);
-			inst->rk = NULL;
+			free(inst->consumers);
+			inst->consumers = NULL;
+		}
+		if(inst->conf != NULL) {
+			rd_kafka_conf_destroy(inst->conf);
+			inst->conf = NULL;
 		}
 	}
 
@@ -453,27 +646,32 @@ std_checkRuleset_genErrMsg(__attribute__((unused)) modConfData_t *modConf, insta
 
 
 static rsRetVal ATTR_NONNULL(2)
-addConsumer(modConfData_t __attribute__((unused)) *modConf, instanceConf_t *inst)
+addConsumer(modConfData_t __attribute__((unused)) *modConf, kafkaConsumer_t *cons)
 {
 	DEFiRet;
 	rd_kafka_resp_err_t err;
+	instanceConf_t *const inst = cons->inst;
 
 	assert(inst != NULL);
 
 	rd_kafka_topic_partition_list_t *topics = NULL;
-	DBGPRINTF("imkafka: creating kafka consumer on %s/%s/%s\n",
-		inst->topic, inst->consumergroup, inst->brokers);
+	DBGPRINTF("imkafka: creating kafka consumer %d on %s/%s/%s\n",
+		cons->id, inst->topic, inst->consumergroup, inst->brokers);
 
 	/* Redirect rd_kafka_poll() to consumer_poll() */
-	rd_kafka_poll_set_consumer(inst->rk);
+	rd_kafka_poll_set_consumer(cons->rk);
+#	if RD_KAFKA_VERSION >= 0x000b0000
+	if(cons->rkqu == NULL)
+		cons->rkqu = rd_kafka_queue_get_consumer(cons->rk);
+#	endif
 
 	topics = rd_kafka_topic_partition_list_new(1);
 	rd_kafka_topic_partition_list_add(topics, (const char*)inst->topic, inst->partition);
 	DBGPRINTF("imkafka: Created topics(%d) for %s)\n",
 		topics->cnt, inst->topic);
-	if ((err = rd_kafka_subscribe(inst->rk, topics))) {
+	if ((err = rd_kafka_subscribe(cons->rk, topics))) {
 		/* Subscription failed */
-		inst->bIsSubscribed = 0;
+		cons->bIsSubscribed = 0;
 		LogError(0, RS_RET_KAFKA_ERROR, "imkafka: Failed to start consuming "
 			"topics: %s\n", rd_kafka_err2str(err));
 		ABORT_FINALIZE(RS_RET_KAFKA_ERROR);
@@ -481,7 +679,7 @@ addConsumer(modConfData_t __attribute__((unused)) *modConf, instanceConf_t *inst
 		DBGPRINTF("imkafka: Successfully subscribed to %s/%s/%s\n",
 			inst->topic, inst->consumergroup, inst->brokers);
 		/* Subscription is working */
-		inst->bIsSubscribed = 1;
+		cons->bIsSubscribed = 1;
 	}
 finalize_it:
 	if(topics != NULL)
@@ -556,6 +754,15 @@ CODESTARTnewInpInst
 			inst->consumergroup = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(inppblk.descr[i].name, "ruleset")) {
 			inst->pszBindRuleset = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(inppblk.descr[i].name, "threads")) {
+			inst->nConsumers = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "batchsize")) {
+			inst->batchSize = (int) pvals[i].val.d.n;
+			if(inst->batchSize > SHRT_MAX) {
+				LogError(0, RS_RET_PARAM_ERROR, "imkafka: batchsize %d is too "
+					"large, using maximum of %d", inst->batchSize, SHRT_MAX);
+				inst->batchSize = SHRT_MAX;
+			}
 		} else {
 			dbgprintf("imkafka: program error, non-handled "
 			  "param '%s'\n", inppblk.descr[i].name);
@@ -568,8 +775,9 @@ CODESTARTnewInpInst
 			"using default of localhost:9092 -- this may not be what you want!");
 	}
 
-	DBGPRINTF("imkafka: newInpIns brokers=%s, topic=%s, consumergroup=%s\n",
-		inst->brokers, inst->topic, inst->consumergroup);
+	DBGPRINTF("imkafka: newInpIns brokers=%s, topic=%s, consumergroup=%s, "
+		"threads=%d, batchsize=%d\n", inst->brokers, inst->topic,
+		inst->consumergroup, inst->nConsumers, inst->batchSize);
 
 	iRet = checkInstance(inst);
 finalize_it:
@@ -668,6 +876,9 @@ CODESTARTfreeCnf
 			free((void*)inst->confParams[i].val);
 		}
 		free((void*)inst->confParams);
+		free(inst->consumers);
+		if(inst->conf != NULL)
+			rd_kafka_conf_destroy(inst->conf);
 		del = inst;
 		inst = inst->next;
 		free(del);
@@ -676,15 +887,82 @@ CODESTARTfreeCnf
 ENDfreeCnf
 
 
-/* This function is called to gather input.
+/* the consumer thread: keeps one kafka consumer handle subscribed and
+ * processes its messages in batches until rsyslog terminates.
+ */
+static void *
+consumerThread(void *myself)
+{
+	kafkaConsumer_t *const cons = (kafkaConsumer_t*) myself;
+	instanceConf_t *const inst = cons->inst;
+	rd_kafka_message_t **rkmessages = NULL;
+	smsg_t **ppMsgs = NULL;
+	multi_submit_t multiSub;
+	uchar statsName[64];
+
+	snprintf((char*)statsName, sizeof(statsName), "imkafka(%s,w%d)", inst->topic, cons->id);
+	statsobj.Construct(&(cons->stats));
+	statsobj.SetName(cons->stats, statsName);
+	statsobj.SetOrigin(cons->stats, (uchar*)"imkafka");
+	STATSCOUNTER_INIT(cons->ctrMsgsRcvd, cons->mutCtrMsgsRcvd);
+	statsobj.AddCounter(cons->stats, UCHAR_CONSTANT("msgs.received"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(cons->ctrMsgsRcvd));
+	STATSCOUNTER_INIT(cons->ctrCallConsume, cons->mutCtrCallConsume);
+	statsobj.AddCounter(cons->stats, UCHAR_CONSTANT("called.consume"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(cons->ctrCallConsume));
+	statsobj.ConstructFinalize(cons->stats);
+
+	rkmessages = malloc(inst->batchSize * sizeof(rd_kafka_message_t*));
+	ppMsgs = malloc(inst->batchSize * sizeof(smsg_t*));
+	if(rkmessages == NULL || ppMsgs == NULL) {
+		LogError(0, RS_RET_OUT_OF_MEMORY, "imkafka: cannot allocate batch "
+			"buffers for topic \"%s\", consumer %d not started",
+			inst->topic, cons->id);
+		goto done;
+	}
+	multiSub.ppMsgs = ppMsgs;
+	multiSub.maxElem = inst->batchSize;
+	multiSub.nElem = 0;
+
+	/* Start endless consumer loop - it is terminated when rsyslog
+	 * shuts down. The batch consumer blocks at most one second, so
+	 * we notice that in time.
+	 */
+	while(glbl.GetGlobalInputTermState() == 0) {
+		// Try to add consumer only if connected! */
+		if(inst->bIsConnected == 1 && cons->bIsSubscribed == 0) {
+			addConsumer(runModConf, cons);
+		}
+		if(cons->bIsSubscribed == 1) {
+			msgConsume(cons, rkmessages, &multiSub);
+		} else if(glbl.GetGlobalInputTermState() == 0) {
+			/* Note: the additional wait is vitally important. It guards rsyslog
+			 * against totally hogging the CPU while subscribing fails.
+			 */
+			srSleep(0, 100000);
+		}
+	}
+
+done:
+	free(rkmessages);
+	free(ppMsgs);
+	return NULL;
+}
+
+
+/* This function is called to gather input. It starts one thread per
+ * consumer. To save resources, the last consumer is run on our own thread.
  */
 BEGINrunInput
 	instanceConf_t *inst;
+	kafkaConsumer_t *lastCons = NULL;
+	pthread_attr_t wrkrThrdAttr;
+	int i;
 CODESTARTrunInput
 	DBGPRINTF("imkafka: runInput loop started ...\n");
 	int activeListeners = 0;
 	for(inst = runModConf->root ; inst != NULL ; inst = inst->next) {
-		if(inst->rk != NULL) {
+		if(inst->consumers != NULL) {
 			++activeListeners;
 		}
 	}
@@ -696,36 +974,36 @@ CODESTARTrunInput
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
 
-
-	/* Start endless consumer loop - it is terminated when the thread is
-	 * signalled to do so. This, however, is handled by the framework.
-	 */
-	do {
-		for(inst = runModConf->root ; inst != NULL ; inst = inst->next) {
-			if(glbl.GetGlobalInputTermState() == 1)
-				break; /* terminate input! */
-
-			if(inst->rk == NULL) {
-				continue;
-			}
-
-			// Try to add consumer only if connected! */
-			if(inst->bIsConnected == 1 && inst->bIsSubscribed == 0 ) {
-				addConsumer(runModConf, inst);
-			}
-			if(inst->bIsSubscribed == 1 ) {
-				msgConsume(inst);
+	pthread_attr_init(&wrkrThrdAttr);
+	pthread_attr_setstacksize(&wrkrThrdAttr, 4096*1024);
+	for(inst = runModConf->root ; inst != NULL ; inst = inst->next) {
+		if(inst->consumers == NULL)
+			continue;
+		for(i = 0 ; i < inst->nConsumers ; ++i) {
+			if(lastCons != NULL) {
+				if(pthread_create(&lastCons->tid, &wrkrThrdAttr, consumerThread,
+					lastCons) != 0) {
+					LogError(errno, RS_RET_ERR, "imkafka: cannot create consumer "
+						"thread %d for topic \"%s\"", lastCons->id,
+						lastCons->inst->topic);
+					lastCons->tid = 0;
+				}
 			}
+			lastCons = inst->consumers + i;
 		}
+	}
+	pthread_attr_destroy(&wrkrThrdAttr);
 
-		/* Note: the additional 10000ns wait is vitally important. It guards rsyslog
-		 * against totally hogging the CPU if the users selects a polling interval
-		 * of 0 seconds. It doesn't hurt any other valid scenario. So do not remove.
-		 * rgerhards, 2008-02-14
-		 */
-		if(glbl.GetGlobalInputTermState() == 0)
-			srSleep(0, 100000);
-	} while(glbl.GetGlobalInputTermState() == 0);
+	consumerThread(lastCons);
+
+	for(inst = runModConf->root ; inst != NULL ; inst = inst->next) {
+		if(inst->consumers == NULL)
+			continue;
+		for(i = 0 ; i < inst->nConsumers ; ++i) {
+			if(inst->consumers + i != lastCons && inst->consumers[i].tid != 0)
+				pthread_join(inst->consumers[i].tid, NULL);
+		}
+	}
 
 	DBGPRINTF("imkafka: terminating upon request of rsyslog core\n");
 finalize_it:
@@ -751,15 +1029,30 @@ CODESTARTafterRun
 
 	/* kafka cleanup */
 	instanceConf_t *inst;
+	kafkaConsumer_t *cons;
 	for(inst = runModConf->root ; inst != NULL ; inst = inst->next) {
+		if(inst->consumers == NULL)
+			continue;
 		DBGPRINTF("imkafka: afterRun stop consuming %s/%s/%s\n",
 			inst->topic, inst->consumergroup, inst->brokers);
 
-		/* 1) Close the consumer, committing final offsets, etc. */
-		rd_kafka_consumer_close(inst->rk);
+		for(int i = 0 ; i < inst->nConsumers ; ++i) {
+			cons = inst->consumers + i;
+			/* 1) Close the consumer, committing final offsets, etc. */
+			rd_kafka_consumer_close(cons->rk);
+
+			/* 2) Destroy handle object - all queue references must be gone */
+#			if RD_KAFKA_VERSION >= 0x000b0000
+			if(cons->rkqu != NULL)
+				rd_kafka_queue_destroy(cons->rkqu);
+#			endif
+			rd_kafka_destroy(cons->rk);
 
-		/* 2) Destroy handle object */
-		rd_kafka_destroy(inst->rk);
+			if(cons->stats != NULL)
+				statsobj.Destruct(&(cons->stats));
+		}
+		free(inst->consumers);
+		inst->consumers = NULL;
 
 		DBGPRINTF("imkafka: afterRun stopped consuming %s/%s/%s\n",
 			inst->topic, inst->consumergroup, inst->brokers);
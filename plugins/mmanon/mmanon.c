@@ -1,7 +1,7 @@
 /* mmanon.c
  * anonnymize IP addresses inside the syslog message part
  *
- * Copyright 2013 Adiscon GmbH.
+ * Copyright 2013-2018 Adiscon GmbH.
  *
  * This file is part of rsyslog.
  *
@@ -30,6 +30,10 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <pthread.h>
+#if defined(__GNUC__) && defined(__SSE2__)
+#	include <emmintrin.h>
+#endif
 #include "conf.h"
 #include "syslogd-types.h"
 #include "srUtils.h"
@@ -68,6 +72,37 @@ struct ipv6_int {
 	unsigned long long high;
 	unsigned long long low;
 	};
+
+/* per-worker cache for the random-consistent modes. It sits in front
+ * of the shared mappings, so that addresses seen before can be handled
+ * without taking the instance mutex. Direct-mapped, an empty address
+ * means the slot is unused.
+ */
+#define CONSIS_CACHE_BITS 10
+#define CONSIS_CACHE_SIZE (1 << CONSIS_CACHE_BITS)
+struct v4CacheEntry {
+	unsigned ip;
+	char address[16];
+};
+
+struct v6CacheEntry {
+	struct ipv6_int ip;
+	char address[46];
+};
+
+/* the anonymized message is assembled in a per-worker buffer which is
+ * kept across messages. Parts of the original message are only copied
+ * when an address is actually rewritten, so messages without addresses
+ * do not cause any copying at all.
+ */
+typedef struct anonBuf_s {
+	uchar *buf;
+	size_t len;
+	size_t size;
+	size_t srcCopied;	/* original message has been copied up to here */
+	int hasChanged;
+} anonBuf_t;
+
 /* define operation modes we have */
 #define SIMPLE_MODE 0	 /* just overwrite */
 #define REWRITE_MODE 1	 /* rewrite IP address, canoninized */
@@ -96,11 +131,16 @@ typedef struct _instanceData {
 		int randConsis;
 		struct hashtable* hash;
 	} embeddedIPv4;
+	pthread_mutex_t mutConsis;	/* guards the random-consistent mappings above */
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
 	unsigned randstatus;
+	anonBuf_t out;
+	struct v4CacheEntry *v4Cache;
+	struct v6CacheEntry *v6Cache;
+	struct v6CacheEntry *embeddedCache;
 } wrkrInstanceData_t;
 
 struct modConfData_s {
@@ -158,11 +198,28 @@ ENDfreeCnf
 
 BEGINcreateInstance
 CODESTARTcreateInstance
+	pthread_mutex_init(&pData->mutConsis, NULL);
 ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
 	pWrkrData->randstatus = time(NULL);
+	if(pData->ipv4.randConsis) {
+		CHKmalloc(pWrkrData->v4Cache = calloc(CONSIS_CACHE_SIZE, sizeof(struct v4CacheEntry)));
+	}
+	if(pData->ipv6.randConsis) {
+		CHKmalloc(pWrkrData->v6Cache = calloc(CONSIS_CACHE_SIZE, sizeof(struct v6CacheEntry)));
+	}
+	if(pData->embeddedIPv4.randConsis) {
+		CHKmalloc(pWrkrData->embeddedCache = calloc(CONSIS_CACHE_SIZE, sizeof(struct v6CacheEntry)));
+	}
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		free(pWrkrData->v4Cache);
+		free(pWrkrData->v6Cache);
+		free(pWrkrData);
+		pWrkrData = NULL;
+	}
 ENDcreateWrkrInstance
 
 
@@ -196,11 +253,16 @@ CODESTARTfreeInstance
 	if(pData->embeddedIPv4.hash != NULL) {
 		hashtable_destroy(pData->embeddedIPv4.hash, 1);
 	}
+	pthread_mutex_destroy(&pData->mutConsis);
 ENDfreeInstance
 
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	free(pWrkrData->out.buf);
+	free(pWrkrData->v4Cache);
+	free(pWrkrData->v6Cache);
+	free(pWrkrData->embeddedCache);
 ENDfreeWrkrInstance
 
 
@@ -373,6 +435,107 @@ CODESTARTtryResume
 ENDtryResume
 
 
+static rsRetVal
+anonBufAppend(anonBuf_t *const ab, const uchar *const data, const size_t len)
+{
+	uchar *newBuf;
+	size_t newSize;
+	DEFiRet;
+
+	if(ab->len + len > ab->size) {
+		for(newSize = (ab->size == 0) ? 256 : ab->size ; newSize < ab->len + len ; newSize *= 2)
+			/* just search size */;
+		CHKmalloc(newBuf = realloc(ab->buf, newSize));
+		ab->buf = newBuf;
+		ab->size = newSize;
+	}
+	memcpy(ab->buf + ab->len, data, len);
+	ab->len += len;
+finalize_it:
+	RETiRet;
+}
+
+/* copy the original message up to the end of the address at idx
+ * into the output buffer. Used for in-place rewriting.
+ */
+static rsRetVal
+anonBufCopyUpTo(anonBuf_t *const ab, const uchar *const msg, const size_t idx, const size_t iplen)
+{
+	DEFiRet;
+
+	CHKiRet(anonBufAppend(ab, msg + ab->srcCopied, idx + iplen - ab->srcCopied));
+	ab->srcCopied = idx + iplen;
+finalize_it:
+	RETiRet;
+}
+
+/* replace the address of length iplen at msg[idx] by repl */
+static rsRetVal
+anonBufReplace(anonBuf_t *const ab, const uchar *const msg, const size_t idx, const size_t iplen,
+	const char *const repl, const size_t lenRepl)
+{
+	DEFiRet;
+
+	CHKiRet(anonBufAppend(ab, msg + ab->srcCopied, idx - ab->srcCopied));
+	CHKiRet(anonBufAppend(ab, (const uchar*) repl, lenRepl));
+	ab->srcCopied = idx + iplen;
+	ab->hasChanged = 1;
+finalize_it:
+	RETiRet;
+}
+
+
+/* Every address contains a '.' or ':', and the syntax checks only look
+ * forward from their start position, up to the first char that is not
+ * a hex digit, '.' or ':'. So an address can only start at a position
+ * from which a separator is reachable without leaving that character
+ * class. We use this to skip everything else without calling the syntax
+ * checks at all: find the next separator (16 bytes at a time if SSE2 is
+ * available) and go back to the start of its run of address chars.
+ */
+static inline int
+isIPChar(const uchar c)
+{
+	return ('0' <= c && c <= ':') || c == '.' || ('a' <= (c | 0x20) && (c | 0x20) <= 'f');
+}
+
+#define BCAST(c) (UINT64_C(0x0101010101010101) * (uint8_t) (c))
+#define HASZERO(w) (((w) - BCAST(0x01)) & ~(w) & BCAST(0x80))
+
+/* return offset of the next '.' or ':' or len if there is none */
+static size_t
+findSep(const uchar *const buf, const size_t len)
+{
+	size_t i = 0;
+#if defined(__GNUC__) && defined(__SSE2__)
+	const __m128i dot = _mm_set1_epi8('.');
+	const __m128i colon = _mm_set1_epi8(':');
+	__m128i v;
+	int mask;
+
+	for( ; i + 16 <= len ; i += 16) {
+		v = _mm_loadu_si128((const __m128i*) (buf + i));
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, dot), _mm_cmpeq_epi8(v, colon)));
+		if(mask != 0)
+			return i + __builtin_ctz((unsigned) mask);
+	}
+#else
+	uint64_t w;
+
+	for( ; i + 8 <= len ; i += 8) {
+		memcpy(&w, buf + i, sizeof(w));
+		if((HASZERO(w ^ BCAST('.')) | HASZERO(w ^ BCAST(':'))) != 0)
+			break;
+	}
+#endif
+	for( ; i < len ; ++i) {
+		if(buf[i] == '.' || buf[i] == ':')
+			return i;
+	}
+	return len;
+}
+
+
 static int
 getHexVal(char c)
 {
@@ -721,13 +884,34 @@ finalize_it:
 }
 
 
+static inline unsigned
+cacheSlotIPv4(const unsigned num)
+{
+	return (num * 2654435761u) >> (32 - CONSIS_CACHE_BITS);
+}
+
+
 static void
 process_IPv4 (char* address, wrkrInstanceData_t *pWrkrData)
 {
 	unsigned num;
+	struct v4CacheEntry *entry;
+	rsRetVal localRet;
 
 	if(pWrkrData->pData->ipv4.randConsis){
-		findip(address, pWrkrData);
+		num = ipv42num(address);
+		entry = &pWrkrData->v4Cache[cacheSlotIPv4(num)];
+		if(entry->address[0] != '\0' && entry->ip == num) {
+			strcpy(address, entry->address);
+			return;
+		}
+		pthread_mutex_lock(&pWrkrData->pData->mutConsis);
+		localRet = findip(address, pWrkrData);
+		pthread_mutex_unlock(&pWrkrData->pData->mutConsis);
+		if(localRet == RS_RET_OK) {
+			entry->ip = num;
+			strcpy(entry->address, address);
+		}
 	}else {
 		num = ipv42num(address);
 		num = code_int(num, pWrkrData);
@@ -736,17 +920,18 @@ process_IPv4 (char* address, wrkrInstanceData_t *pWrkrData)
 }
 
 
+/* ipEnd is the offset right after the address in buf */
 static void
-simpleAnon(wrkrInstanceData_t *const pWrkrData, uchar *const msg, int *const hasChanged, int iplen)
+simpleAnon(wrkrInstanceData_t *const pWrkrData, uchar *const buf, int *const hasChanged, const int ipEnd)
 {
-	int maxidx = iplen - 1;
+	int maxidx = ipEnd - 1;
 
 	int j = -1;
 	for(int i = (pWrkrData->pData->ipv4.bits / 8); i > 0; i--) {
 		j++;
-		while('0' <= msg[maxidx - j] && msg[maxidx - j] <= '9') {
-			if(msg[maxidx - j] != pWrkrData->pData->ipv4.replaceChar) {
-				msg[maxidx - j] = pWrkrData->pData->ipv4.replaceChar;
+		while(maxidx - j >= 0 && '0' <= buf[maxidx - j] && buf[maxidx - j] <= '9') {
+			if(buf[maxidx - j] != pWrkrData->pData->ipv4.replaceChar) {
+				buf[maxidx - j] = pWrkrData->pData->ipv4.replaceChar;
 				*hasChanged = 1;
 			}
 			j++;
@@ -755,46 +940,30 @@ simpleAnon(wrkrInstanceData_t *const pWrkrData, uchar *const msg, int *const has
 }
 
 
-static void
-anonipv4(wrkrInstanceData_t *pWrkrData, uchar **msg, int *pLenMsg, int *idx, int *hasChanged)
+static rsRetVal
+anonipv4(wrkrInstanceData_t *pWrkrData, const uchar *const msg, const int lenMsg, int *idx)
 {
 	char address[16];
-	char caddress[16];
-	int offset = *idx;
-	uchar* msgcpy = *msg;
 	size_t iplen;
-	size_t caddresslen;
-	int oldLen = *pLenMsg;
+	anonBuf_t *const out = &pWrkrData->out;
+	DEFiRet;
 
-	if(syntax_ipv4((*msg) + offset, *pLenMsg - offset, &iplen)) {
+	if(syntax_ipv4(msg + *idx, lenMsg - *idx, &iplen)) {
 		if(pWrkrData->pData->ipv4.mode == SIMPLE) {
-			simpleAnon(pWrkrData, *msg + *idx, hasChanged, iplen);
+			CHKiRet(anonBufCopyUpTo(out, msg, *idx, iplen));
+			simpleAnon(pWrkrData, out->buf, &out->hasChanged, out->len);
 			*idx += iplen;
-			return;
+			FINALIZE;
 		}
 
 		assert(iplen < sizeof(address));
-		getip(*msg + offset, iplen, address);
-		offset += iplen;
-		strcpy(caddress, address);
-		process_IPv4(caddress, pWrkrData);
-		caddresslen = strlen(caddress);
-		*hasChanged = 1;
-
-		if(caddresslen != strlen(address)) {
-			*pLenMsg = *pLenMsg + ((int)caddresslen - (int)strlen(address));
-			*msg = (uchar*) malloc(*pLenMsg);
-			memcpy(*msg, msgcpy, *idx);
-		}
-		memcpy(*msg + *idx, caddress, caddresslen);
-		*idx = *idx + caddresslen;
-		if(*idx < *pLenMsg) {
-			memcpy(*msg + *idx, msgcpy + offset, oldLen - offset);
-		}
-		if(msgcpy != *msg) {
-			free(msgcpy);
-		}
+		getip((uchar*) msg + *idx, iplen, address);
+		process_IPv4(address, pWrkrData);
+		CHKiRet(anonBufReplace(out, msg, *idx, iplen, address, strlen(address)));
+		*idx += iplen;
 	}
+finalize_it:
+	RETiRet;
 }
 
 
@@ -1057,6 +1226,40 @@ finalize_it:
 }
 
 
+static inline unsigned
+cacheSlotIPv6(const struct ipv6_int *const ip)
+{
+	const unsigned long long folded = ip->high ^ ip->low;
+	return ((unsigned) (folded ^ (folded >> 32)) * 2654435761u) >> (32 - CONSIS_CACHE_BITS);
+}
+
+
+/* random-consistent mapping for IPv6 and embedded IPv4 addresses, with
+ * the per-worker cache in front of the shared hash table.
+ */
+static void
+findIPv6Cached(struct ipv6_int* num, char* address, wrkrInstanceData_t *const pWrkrData,
+	int useEmbedded)
+{
+	struct v6CacheEntry *const entry = (useEmbedded ? pWrkrData->embeddedCache : pWrkrData->v6Cache)
+		+ cacheSlotIPv6(num);
+	const struct ipv6_int key = *num;
+	rsRetVal localRet;
+
+	if(entry->address[0] != '\0' && keys_equal_fn(&entry->ip, num)) {
+		strcpy(address, entry->address);
+		return;
+	}
+	pthread_mutex_lock(&pWrkrData->pData->mutConsis);
+	localRet = findIPv6(num, address, pWrkrData, useEmbedded);
+	pthread_mutex_unlock(&pWrkrData->pData->mutConsis);
+	if(localRet == RS_RET_OK) {
+		entry->ip = key;
+		strcpy(entry->address, address);
+	}
+}
+
+
 static void
 process_IPv6 (char* address, wrkrInstanceData_t *pWrkrData, const size_t iplen)
 {
@@ -1065,7 +1268,7 @@ process_IPv6 (char* address, wrkrInstanceData_t *pWrkrData, const size_t iplen)
 	ipv62num(address, iplen, &num);
 
 	if(pWrkrData->pData->ipv6.randConsis) {
-		findIPv6(&num, address, pWrkrData, 0);
+		findIPv6Cached(&num, address, pWrkrData, 0);
 	} else {
 		code_ipv6_int(&num, pWrkrData, 0);
 		num2ipv6(&num, address);
@@ -1073,40 +1276,23 @@ process_IPv6 (char* address, wrkrInstanceData_t *pWrkrData, const size_t iplen)
 }
 
 
-static void
-anonipv6(wrkrInstanceData_t *pWrkrData, uchar **msg, int *pLenMsg, int *idx, int *hasChanged)
+static rsRetVal
+anonipv6(wrkrInstanceData_t *pWrkrData, const uchar *const msg, const int lenMsg, int *idx)
 {
 	size_t iplen = 0;
-	int offset = *idx;
 	char address[40];
-	uchar* msgcpy = *msg;
-	size_t caddresslen;
-	size_t oldLen = *pLenMsg;
+	DEFiRet;
 
-	int syn = syntax_ipv6(*msg + offset, *pLenMsg - offset, &iplen);
+	int syn = syntax_ipv6(msg + *idx, lenMsg - *idx, &iplen);
 	if(syn) {
 		assert(iplen < sizeof(address));  //has to be < instead of <= since address includes space for a '\0'
-		getip(*msg + offset, iplen, address);
-		offset += iplen;
+		getip((uchar*) msg + *idx, iplen, address);
 		process_IPv6(address, pWrkrData, iplen);
-
-		caddresslen = strlen(address);
-		*hasChanged = 1;
-
-		if(caddresslen != iplen) {
-			*pLenMsg = *pLenMsg + ((int)caddresslen - (int)iplen);
-			*msg = (uchar*) malloc(*pLenMsg);
-			memcpy(*msg, msgcpy, *idx);
-		}
-		memcpy(*msg + *idx, address, caddresslen);
-		*idx = *idx + caddresslen;
-		if(*idx < *pLenMsg) {
-			memcpy(*msg + *idx, msgcpy + offset, oldLen - offset);
-		}
-		if(msgcpy != *msg) {
-			free(msgcpy);
-		}
+		CHKiRet(anonBufReplace(&pWrkrData->out, msg, *idx, iplen, address, strlen(address)));
+		*idx += iplen;
 	}
+finalize_it:
+	RETiRet;
 }
 
 
@@ -1166,7 +1352,7 @@ syntax_embedded(const uchar *const __restrict__ buf,
 				goto done;
 			}
 			*v4Start = findV4Start(buf, (*nprocessed) - 1);
-			if(syntax_ipv4(buf + (*v4Start), buflen, &ipv4Len)) {
+			if(syntax_ipv4(buf + (*v4Start), buflen - (*v4Start), &ipv4Len)) {
 				*nprocessed += (ipv4Len - ((*nprocessed) - (*v4Start)));
 				isIP = 1;
 				goto done;
@@ -1255,7 +1441,7 @@ process_embedded (char* address, wrkrInstanceData_t *pWrkrData, size_t v4Start)
 	embedded2num(address, v4Start, &num);
 
 	if(pWrkrData->pData->embeddedIPv4.randConsis) {
-		findIPv6(&num, address, pWrkrData, 1);
+		findIPv6Cached(&num, address, pWrkrData, 1);
 	} else {
 		code_ipv6_int(&num, pWrkrData, 1);
 		num2embedded(&num, address);
@@ -1263,69 +1449,69 @@ process_embedded (char* address, wrkrInstanceData_t *pWrkrData, size_t v4Start)
 }
 
 
-static void
-anonEmbedded(wrkrInstanceData_t *pWrkrData, uchar **msg, int *pLenMsg, int *idx, int *hasChanged)
+static rsRetVal
+anonEmbedded(wrkrInstanceData_t *pWrkrData, const uchar *const msg, const int lenMsg, int *idx)
 {
 	size_t iplen = 0;
-	int offset = *idx;
 	char address[46];
-	uchar* msgcpy = *msg;
-	unsigned caddresslen;
-	size_t oldLen = *pLenMsg;
 	size_t v4Start;
+	DEFiRet;
 
-	int syn = syntax_embedded(*msg + offset, *pLenMsg - offset, &iplen, &v4Start);
+	int syn = syntax_embedded(msg + *idx, lenMsg - *idx, &iplen, &v4Start);
 	if(syn) {
 		assert(iplen < sizeof(address));
-		getip(*msg + offset, iplen, address);
-		offset += iplen;
+		getip((uchar*) msg + *idx, iplen, address);
 		process_embedded(address, pWrkrData, v4Start);
-
-		caddresslen = strlen(address);
-		*hasChanged = 1;
-
-		if(caddresslen != iplen) {
-			*pLenMsg = *pLenMsg + ((int)caddresslen - (int)iplen);
-			*msg = (uchar*) malloc(*pLenMsg);
-			memcpy(*msg, msgcpy, *idx);
-		}
-		memcpy(*msg + *idx, address, caddresslen);
-		*idx = *idx + caddresslen;
-		if(*idx < *pLenMsg) {
-			memcpy(*msg + *idx, msgcpy + offset, oldLen - offset);
-		}
-		if(msgcpy != *msg) {
-			free(msgcpy);
-		}
+		CHKiRet(anonBufReplace(&pWrkrData->out, msg, *idx, iplen, address, strlen(address)));
+		*idx += iplen;
 	}
+finalize_it:
+	RETiRet;
 }
 
 BEGINdoAction_NoStrings
 	smsg_t **ppMsg = (smsg_t **) pMsgData;
 	smsg_t *pMsg = ppMsg[0];
-	uchar *msg;
+	const uchar *msg;
 	int lenMsg;
 	int i;
-	int hasChanged = 0;
+	int j;
+	int iSep = -1;
+	anonBuf_t *const out = &pWrkrData->out;
 CODESTARTdoAction
 	lenMsg = getMSGLen(pMsg);
-	msg = (uchar*)strdup((char*)getMSG(pMsg));
+	msg = getMSG(pMsg);
+	out->len = 0;
+	out->srcCopied = 0;
+	out->hasChanged = 0;
 
 	for(i = 0 ; i <= lenMsg - 2 ; i++) {
+		if(i > iSep) {
+			/* skip to the next position an address may start at */
+			iSep = i + (int) findSep(msg + i, lenMsg - i);
+			if(iSep >= lenMsg)
+				break;
+			for(j = iSep ; j > i && isIPChar(msg[j - 1]) ; --j)
+				/* just search start */;
+			i = j;
+			if(i > lenMsg - 2)
+				break;
+		}
 		if(pWrkrData->pData->embeddedIPv4.enable) {
-			anonEmbedded(pWrkrData, &msg, &lenMsg, &i, &hasChanged);
+			CHKiRet(anonEmbedded(pWrkrData, msg, lenMsg, &i));
 		}
 		if(pWrkrData->pData->ipv4.enable) {
-			anonipv4(pWrkrData, &msg, &lenMsg, &i, &hasChanged);
+			CHKiRet(anonipv4(pWrkrData, msg, lenMsg, &i));
 		}
 		if(pWrkrData->pData->ipv6.enable) {
-			anonipv6(pWrkrData, &msg, &lenMsg, &i, &hasChanged);
+			CHKiRet(anonipv6(pWrkrData, msg, lenMsg, &i));
 		}
 	}
-	if(hasChanged) {
-		MsgReplaceMSG(pMsg, msg, lenMsg);
+	if(out->hasChanged) {
+		CHKiRet(anonBufAppend(out, msg + out->srcCopied, lenMsg - out->srcCopied));
+		MsgReplaceMSG(pMsg, out->buf, out->len);
 	}
-	free(msg);
+finalize_it:
 ENDdoAction
 
 
@@ -3,7 +3,7 @@
  * MaxMindDB.
  *
  * Copyright 2013 Rao Chenlin.
- * Copyright 2017 Rainer Gerhards and Adiscon GmbH.
+ * Copyright 2017-2018 Rainer Gerhards and Adiscon GmbH.
  *
  * This file is part of rsyslog.
  *
@@ -40,10 +40,13 @@
 #include "module-template.h"
 #include "errmsg.h"
 #include "parserif.h"
+#include "statsobj.h"
 
 #include "maxminddb.h"
 
 #define JSON_IPLOOKUP_NAME "!iplocation"
+#define DFLT_CACHE_SIZE 4096
+#define CACHE_KEY_MAXLEN 48	/* longest textual IPv6 address (incl. scope) fits */
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -51,8 +54,15 @@ MODULE_CNFNAME("mmdblookup")
 
 
 DEFobjCurrIf(errmsg);
+DEFobjCurrIf(statsobj)
 DEF_OMOD_STATIC_DATA
 
+static statsobj_t *lookupStats;
+STATSCOUNTER_DEF(ctrLookups, mutCtrLookups)
+STATSCOUNTER_DEF(ctrCacheHits, mutCtrCacheHits)
+STATSCOUNTER_DEF(ctrCacheMisses, mutCtrCacheMisses)
+STATSCOUNTER_DEF(ctrCacheEvictions, mutCtrCacheEvictions)
+
 /* config variables */
 typedef struct _instanceData {
 	char *pszKey;
@@ -61,12 +71,41 @@ typedef struct _instanceData {
 		int     nmemb;
 		char **name;
 		char **varname;
+		const char ***path;	/* name split at '!', NULL-terminated, for MMDB_aget_value() */
 	} fieldList;
+	int cacheSize;
 } instanceData;
 
+/* Each worker keeps a LRU cache of lookup results, keyed by the address
+ * string. We only cache the position of the record inside the (mmap()ed)
+ * database, so the fields are still extracted per message. That is cheap
+ * compared to the tree search and keeps json objects out of the cache.
+ * Entries live in a fixed array, indexes are used to link them.
+ */
+typedef struct lookupCacheEntry_s {
+	char key[CACHE_KEY_MAXLEN];
+	unsigned hash;
+	int nextInBucket;	/* -1 terminates the hash chain */
+	int lruPrev;		/* -1 terminates the LRU list */
+	int lruNext;
+	sbool bFound;		/* was the address found in the database? */
+	MMDB_entry_s entry;
+} lookupCacheEntry_t;
+
+typedef struct lookupCache_s {
+	lookupCacheEntry_t *entries;
+	int *buckets;
+	unsigned nBuckets;	/* always a power of 2 */
+	int nEntries;		/* entries currently in use */
+	int maxEntries;		/* 0 means caching is disabled */
+	int lruHead;		/* most recently used entry */
+	int lruTail;		/* least recently used entry, evicted first */
+} lookupCache_t;
+
 typedef struct wrkrInstanceData {
 	instanceData *pData;
 	MMDB_s        mmdb;
+	lookupCache_t cache;
 } wrkrInstanceData_t;
 
 struct modConfData_s {
@@ -97,6 +136,7 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "key",      eCmdHdlrGetWord, CNFPARAM_REQUIRED },
 	{ "mmdbfile", eCmdHdlrGetWord, CNFPARAM_REQUIRED },
 	{ "fields",   eCmdHdlrArray,   CNFPARAM_REQUIRED },
+	{ "cache.size", eCmdHdlrNonNegInt, 0 },
 };
 static struct cnfparamblk actpblk = {
 	CNFPARAMBLK_VERSION,
@@ -105,8 +145,169 @@ static struct cnfparamblk actpblk = {
 };
 
 
-/* protype functions */
-void str_split(char **membuf);
+/* split a field name like "city!names!en" into the NULL-terminated
+ * path array MMDB_aget_value() expects. Array and strings are placed
+ * in a single memory block, so a simple free() releases the path.
+ * Empty components are skipped, as the old json-based lookup did.
+ */
+static rsRetVal
+buildFieldPath(const char *const name, const char ***const ppPath)
+{
+	const char **path;
+	char *buf;
+	char *comp;
+	char *strtok_save;
+	size_t nComps = 1;
+	int i = 0;
+	DEFiRet;
+
+	for(const char *s = name ; *s != '\0' ; ++s) {
+		if(*s == '!')
+			++nComps;
+	}
+	CHKmalloc(path = malloc((nComps + 1) * sizeof(char*) + strlen(name) + 1));
+	buf = (char*) (path + nComps + 1);
+	strcpy(buf, name);
+	for(comp = strtok_r(buf, "!", &strtok_save) ; comp != NULL ; comp = strtok_r(NULL, "!", &strtok_save))
+		path[i++] = comp;
+	path[i] = NULL;
+	*ppPath = path;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* FNV-1a, good enough for address strings */
+static unsigned
+cacheHash(const char *key)
+{
+	unsigned hash = 2166136261u;
+	for( ; *key != '\0' ; ++key) {
+		hash ^= (unsigned char) *key;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static rsRetVal
+cacheConstruct(lookupCache_t *const pCache, const int maxEntries)
+{
+	DEFiRet;
+
+	pCache->entries = NULL;
+	pCache->buckets = NULL;
+	pCache->nEntries = 0;
+	pCache->maxEntries = 0;
+	pCache->lruHead = pCache->lruTail = -1;
+	if(maxEntries == 0)
+		FINALIZE; /* caching disabled */
+
+	for(pCache->nBuckets = 16 ; pCache->nBuckets < (unsigned) maxEntries ; pCache->nBuckets *= 2)
+		/* just size it */;
+	CHKmalloc(pCache->entries = calloc(maxEntries, sizeof(lookupCacheEntry_t)));
+	CHKmalloc(pCache->buckets = malloc(pCache->nBuckets * sizeof(int)));
+	for(unsigned i = 0 ; i < pCache->nBuckets ; ++i)
+		pCache->buckets[i] = -1;
+	pCache->maxEntries = maxEntries;
+
+finalize_it:
+	RETiRet;
+}
+
+static void
+cacheDestruct(lookupCache_t *const pCache)
+{
+	free(pCache->entries);
+	free(pCache->buckets);
+	pCache->entries = NULL;
+	pCache->buckets = NULL;
+	pCache->maxEntries = 0;
+}
+
+static void
+cacheLruUnlink(lookupCache_t *const pCache, const int idx)
+{
+	lookupCacheEntry_t *const e = &pCache->entries[idx];
+	if(e->lruPrev == -1)
+		pCache->lruHead = e->lruNext;
+	else
+		pCache->entries[e->lruPrev].lruNext = e->lruNext;
+	if(e->lruNext == -1)
+		pCache->lruTail = e->lruPrev;
+	else
+		pCache->entries[e->lruNext].lruPrev = e->lruPrev;
+}
+
+static void
+cacheLruPushFront(lookupCache_t *const pCache, const int idx)
+{
+	lookupCacheEntry_t *const e = &pCache->entries[idx];
+	e->lruPrev = -1;
+	e->lruNext = pCache->lruHead;
+	if(pCache->lruHead == -1)
+		pCache->lruTail = idx;
+	else
+		pCache->entries[pCache->lruHead].lruPrev = idx;
+	pCache->lruHead = idx;
+}
+
+/* returns the cached entry for key (and marks it most recently used)
+ * or NULL if the key is not cached.
+ */
+static lookupCacheEntry_t *
+cacheFind(lookupCache_t *const pCache, const char *const key, const unsigned hash)
+{
+	int idx;
+
+	for(idx = pCache->buckets[hash & (pCache->nBuckets - 1)] ; idx != -1 ;
+	    idx = pCache->entries[idx].nextInBucket) {
+		lookupCacheEntry_t *const e = &pCache->entries[idx];
+		if(e->hash == hash && !strcmp(e->key, key)) {
+			if(pCache->lruHead != idx) {
+				cacheLruUnlink(pCache, idx);
+				cacheLruPushFront(pCache, idx);
+			}
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/* add a lookup result to the cache, evicting the least recently used
+ * entry if the cache is full. The caller must make sure that key is
+ * not yet cached and fits into CACHE_KEY_MAXLEN.
+ */
+static void
+cacheAdd(lookupCache_t *const pCache, const char *const key, const unsigned hash,
+	const sbool bFound, const MMDB_entry_s *const pEntry)
+{
+	lookupCacheEntry_t *e;
+	int *pIdx;
+	int idx;
+
+	if(pCache->nEntries < pCache->maxEntries) {
+		idx = pCache->nEntries++;
+	} else {
+		idx = pCache->lruTail;
+		cacheLruUnlink(pCache, idx);
+		for(pIdx = &pCache->buckets[pCache->entries[idx].hash & (pCache->nBuckets - 1)] ;
+		    *pIdx != idx ; pIdx = &pCache->entries[*pIdx].nextInBucket)
+			/* just search */;
+		*pIdx = pCache->entries[idx].nextInBucket;
+		STATSCOUNTER_INC(ctrCacheEvictions, mutCtrCacheEvictions);
+	}
+
+	e = &pCache->entries[idx];
+	strcpy(e->key, key);
+	e->hash = hash;
+	e->bFound = bFound;
+	e->entry = *pEntry;
+	pIdx = &pCache->buckets[hash & (pCache->nBuckets - 1)];
+	e->nextInBucket = *pIdx;
+	*pIdx = idx;
+	cacheLruPushFront(pCache, idx);
+}
 
 
 BEGINbeginCnfLoad
@@ -149,6 +350,8 @@ CODESTARTcreateWrkrInstance
 		errmsg.LogError(0, RS_RET_SUSPENDED, "can not initialize maxminddb");
 		/* ABORT_FINALIZE(RS_RET_SUSPENDED); */
 	}
+	CHKiRet(cacheConstruct(&pWrkrData->cache, pData->cacheSize));
+finalize_it:
 ENDcreateWrkrInstance
 
 
@@ -163,9 +366,11 @@ CODESTARTfreeInstance
 		for(int i = 0 ; i < pData->fieldList.nmemb ; ++i) {
 			free(pData->fieldList.name[i]);
 			free(pData->fieldList.varname[i]);
+			free(pData->fieldList.path[i]);
 		}
 		free(pData->fieldList.name);
 		free(pData->fieldList.varname);
+		free(pData->fieldList.path);
 	}
 	free(pData->pszKey);
 	free(pData->pszMmdbFile);
@@ -175,6 +380,7 @@ ENDfreeInstance
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
 	MMDB_close(&pWrkrData->mmdb);
+	cacheDestruct(&pWrkrData->cache);
 ENDfreeWrkrInstance
 
 
@@ -221,6 +427,7 @@ setInstParamDefaults(instanceData *pData)
 	pData->pszKey = NULL;
 	pData->pszMmdbFile = NULL;
 	pData->fieldList.nmemb = 0;
+	pData->cacheSize = DFLT_CACHE_SIZE;
 }
 
 BEGINnewActInst
@@ -248,6 +455,7 @@ CODESTARTnewActInst
 			pData->fieldList.nmemb = pvals[i].val.d.ar->nmemb;
 			CHKmalloc(pData->fieldList.name = calloc(pData->fieldList.nmemb, sizeof(char *)));
 			CHKmalloc(pData->fieldList.varname = calloc(pData->fieldList.nmemb, sizeof(char *)));
+			CHKmalloc(pData->fieldList.path = calloc(pData->fieldList.nmemb, sizeof(char **)));
 			for (int j = 0; j <  pvals[i].val.d.ar->nmemb; ++j) {
 				char *const param = es_str2cstr(pvals[i].val.d.ar->arr[j], NULL);
 				char *varname = NULL;
@@ -267,6 +475,7 @@ CODESTARTnewActInst
 				if(*name == '!')
 					++name;
 				CHKmalloc(pData->fieldList.name[j] = strdup(name));
+				CHKiRet(buildFieldPath(name, &pData->fieldList.path[j]));
 				char vnamebuf[1024];
 				snprintf(vnamebuf, sizeof(vnamebuf),
 					"%s!%s", loadModConf->container, 
@@ -274,6 +483,8 @@ CODESTARTnewActInst
 				CHKmalloc(pData->fieldList.varname[j] = strdup(vnamebuf));
 				free(param);
 			}
+		} else if (!strcmp(actpblk.descr[i].name, "cache.size")) {
+			pData->cacheSize = (int) pvals[i].val.d.n;
 		} else {
 			dbgprintf("mmdblookup: program error, non-handled"
 				" param '%s'\n", actpblk.descr[i].name);
@@ -295,30 +506,149 @@ CODESTARTtryResume
 ENDtryResume
 
 
-void
-str_split(char **membuf)
+/* json has no type for raw bytes and 128 bit integers, so these are
+ * represented as a string of hex digits. uint128 values are prefixed
+ * with "0x", as the mmdblookup utility of libmaxminddb prints them.
+ */
+static json_object *
+mmdbHexToJson(const char *const prefix, const uint8_t *const bytes, const size_t len)
 {
-	char *buf  = *membuf;
-	char tempbuf[strlen(buf)];
-	memset(tempbuf, 0, strlen(buf));
+	static const char hexdigits[] = "0123456789abcdef";
+	const size_t lenPrefix = strlen(prefix);
+	json_object *json;
+	char *buf;
+
+	if((buf = malloc(lenPrefix + 2 * len + 1)) == NULL)
+		return NULL;
+	memcpy(buf, prefix, lenPrefix);
+	for(size_t i = 0 ; i < len ; ++i) {
+		buf[lenPrefix + 2 * i] = hexdigits[bytes[i] >> 4];
+		buf[lenPrefix + 2 * i + 1] = hexdigits[bytes[i] & 0x0f];
+	}
+	buf[lenPrefix + 2 * len] = '\0';
+	json = json_object_new_string(buf);
+	free(buf);
+	return json;
+}
 
-	while (*buf++ != '\0') {
-		if (*buf == '\n' || *buf == '\t' || *buf == ' ')
-			continue;
-		else {
-			if (*buf == '<') {
-				char *p = strchr(buf, '>');
-				buf = buf + (int)(p - buf);
-				strcat(tempbuf, ",");
-			} else if (*buf == '}')
-				strcat(tempbuf, "},");
+static json_object *
+mmdbUint128ToJson(const MMDB_entry_data_s *const data)
+{
+#if MMDB_UINT128_IS_BYTE_ARRAY
+	/* already in network byte order */
+	return mmdbHexToJson("0x", data->uint128, 16);
+#else
+	uint8_t bytes[16];
+	mmdb_uint128_t val = data->uint128;
+	for(int i = 15 ; i >= 0 ; --i) {
+		bytes[i] = (uint8_t) (val & 0xff);
+		val >>= 8;
+	}
+	return mmdbHexToJson("0x", bytes, sizeof(bytes));
+#endif
+}
+
+/* convert a single (non-container) MMDB value to json. The remaining
+ * types (pointers, markers) never show up in decoded data and yield NULL.
+ */
+static json_object *
+mmdbValueToJson(const MMDB_entry_data_s *const data)
+{
+	switch(data->type) {
+	case MMDB_DATA_TYPE_UTF8_STRING:
+		return json_object_new_string_len(data->utf8_string, (int) data->data_size);
+	case MMDB_DATA_TYPE_DOUBLE:
+		return json_object_new_double(data->double_value);
+	case MMDB_DATA_TYPE_FLOAT:
+		return json_object_new_double(data->float_value);
+	case MMDB_DATA_TYPE_UINT16:
+		return json_object_new_int(data->uint16);
+	case MMDB_DATA_TYPE_INT32:
+		return json_object_new_int(data->int32);
+	case MMDB_DATA_TYPE_UINT32:
+		return json_object_new_int64(data->uint32);
+	case MMDB_DATA_TYPE_UINT64:
+		return json_object_new_int64((int64_t) data->uint64);
+	case MMDB_DATA_TYPE_BOOLEAN:
+		return json_object_new_boolean(data->boolean);
+	case MMDB_DATA_TYPE_UINT128:
+		return mmdbUint128ToJson(data);
+	case MMDB_DATA_TYPE_BYTES:
+		return mmdbHexToJson("", data->bytes, data->data_size);
+	default:
+		return NULL;
+	}
+}
+
+/* convert the data list item at *ppList to json, including all members
+ * if it is a map or array. *ppList is advanced past the item.
+ */
+static json_object *
+mmdbListToJson(MMDB_entry_data_list_s **const ppList)
+{
+	MMDB_entry_data_list_s *const item = *ppList;
+	json_object *json;
+	uint32_t i;
+
+	*ppList = item->next;
+	switch(item->entry_data.type) {
+	case MMDB_DATA_TYPE_MAP:
+		json = json_object_new_object();
+		for(i = 0 ; i < item->entry_data.data_size && *ppList != NULL ; ++i) {
+			const MMDB_entry_data_s *const key = &(*ppList)->entry_data;
+			*ppList = (*ppList)->next;
+			if(*ppList == NULL)
+				break;
+			char *const keyname = strndup(key->utf8_string, key->data_size);
+			json_object *const val = mmdbListToJson(ppList);
+			if(json != NULL && keyname != NULL)
+				json_object_object_add(json, keyname, val);
 			else
-				strncat(tempbuf, buf, 1);
+				json_object_put(val);
+			free(keyname);
 		}
+		break;
+	case MMDB_DATA_TYPE_ARRAY:
+		json = json_object_new_array();
+		for(i = 0 ; i < item->entry_data.data_size && *ppList != NULL ; ++i) {
+			json_object *const val = mmdbListToJson(ppList);
+			if(json != NULL)
+				json_object_array_add(json, val);
+			else
+				json_object_put(val);
+		}
+		break;
+	default:
+		json = mmdbValueToJson(&item->entry_data);
+		break;
 	}
+	return json;
+}
 
-	tempbuf[strlen(tempbuf) + 1] = '\n';
-	memcpy(*membuf, tempbuf, strlen(tempbuf));
+/* obtain the value of a configured field from the record at pEntry */
+static json_object *
+getFieldJson(MMDB_entry_s *const pEntry, const char *const *const path)
+{
+	MMDB_entry_data_s data;
+	MMDB_entry_data_list_s *list = NULL;
+	MMDB_entry_data_list_s *item;
+	json_object *json = NULL;
+
+	if(MMDB_aget_value(pEntry, &data, path) != MMDB_SUCCESS || !data.has_data)
+		return NULL;
+
+	if(data.type != MMDB_DATA_TYPE_MAP && data.type != MMDB_DATA_TYPE_ARRAY)
+		return mmdbValueToJson(&data);
+
+	/* containers are decoded as a whole */
+	MMDB_entry_s sub = { .mmdb = pEntry->mmdb, .offset = data.offset };
+	if(MMDB_get_entry_data_list(&sub, &list) == MMDB_SUCCESS && list != NULL) {
+		item = list;
+		json = mmdbListToJson(&item);
+	}
+	if(list != NULL)
+		MMDB_free_entry_data_list(list);
+	return json;
 }
 
 
@@ -328,8 +658,11 @@ BEGINdoAction_NoStrings
 	struct json_object *keyjson = NULL;
 	const char *pszValue;
 	instanceData *const pData = pWrkrData->pData;
-	json_object *total_json = NULL;
-	MMDB_entry_data_list_s *entry_data_list = NULL;
+	lookupCacheEntry_t *cached = NULL;
+	MMDB_entry_s entry;
+	sbool bFound;
+	sbool bCacheable;
+	unsigned hash = 0;
 CODESTARTdoAction
 	/* key is given, so get the property json */
 	msgPropDescr_t pProp;
@@ -347,70 +680,50 @@ CODESTARTdoAction
 		pszValue = "";
 	}
 
-	int gai_err, mmdb_err;
-	MMDB_lookup_result_s result = MMDB_lookup_string(&pWrkrData->mmdb, pszValue, &gai_err, &mmdb_err);
-
-	if (0 != gai_err) {
-		dbgprintf("Error from call to getaddrinfo for %s - %s\n", pszValue, gai_strerror(gai_err));
-		ABORT_FINALIZE(RS_RET_OK);
+	bCacheable = pWrkrData->cache.maxEntries > 0 && strlen(pszValue) < CACHE_KEY_MAXLEN;
+	if(bCacheable) {
+		hash = cacheHash(pszValue);
+		cached = cacheFind(&pWrkrData->cache, pszValue, hash);
 	}
-	if (MMDB_SUCCESS != mmdb_err) {
-		dbgprintf("Got an error from the maxminddb library: %s\n", MMDB_strerror(mmdb_err));
-		ABORT_FINALIZE(RS_RET_OK);
-	}
-
-	int status  = MMDB_get_entry_data_list(&result.entry, &entry_data_list);
 
-	if (MMDB_SUCCESS != status) {
-		dbgprintf("Got an error looking up the entry data - %s\n", MMDB_strerror(status));
-		ABORT_FINALIZE(RS_RET_OK);
+	if(cached != NULL) {
+		STATSCOUNTER_INC(ctrCacheHits, mutCtrCacheHits);
+		bFound = cached->bFound;
+		entry = cached->entry;
+	} else {
+		if(bCacheable)
+			STATSCOUNTER_INC(ctrCacheMisses, mutCtrCacheMisses);
+		STATSCOUNTER_INC(ctrLookups, mutCtrLookups);
+		int gai_err, mmdb_err;
+		MMDB_lookup_result_s result = MMDB_lookup_string(&pWrkrData->mmdb, pszValue, &gai_err, &mmdb_err);
+
+		if (0 != gai_err) {
+			/* not an address - remember that, too */
+			dbgprintf("Error from call to getaddrinfo for %s - %s\n", pszValue, gai_strerror(gai_err));
+			result.found_entry = 0;
+		} else if (MMDB_SUCCESS != mmdb_err) {
+			dbgprintf("Got an error from the maxminddb library: %s\n", MMDB_strerror(mmdb_err));
+			ABORT_FINALIZE(RS_RET_OK);
+		}
+		bFound = result.found_entry;
+		entry = result.entry;
+		if(bCacheable)
+			cacheAdd(&pWrkrData->cache, pszValue, hash, bFound, &entry);
 	}
 
-	size_t  memlen;
-	char   *membuf;
-	FILE   *memstream;
-	CHKmalloc(memstream = open_memstream(&membuf, &memlen));
-
-	if (entry_data_list != NULL && memstream != NULL) {
-		MMDB_dump_entry_data_list(memstream, entry_data_list, 2);
-		fflush(memstream);
-		str_split(&membuf);
+	if(!bFound) {
+		DBGPRINTF("mmdblookup: no database record for '%s'\n", pszValue);
+		FINALIZE;
 	}
 
-	DBGPRINTF("maxmindb returns: '%s'\n", membuf);
-	total_json = json_tokener_parse(membuf);
-	fclose(memstream);
-	free(membuf);
-
 	/* extract and amend fields (to message) as configured */
 	for (int i = 0 ; i <  pData->fieldList.nmemb; ++i) {
-		char *strtok_save;
-		char buf[(strlen((char *)(pData->fieldList.name[i])))+1];
-		strcpy(buf, (char *)pData->fieldList.name[i]);
-
-		json_object *temp_json = total_json;
-		json_object *sub_obj   = temp_json;
-		int j = 0;
-		const char *SEP = "!";
-
-		/* find lowest level JSON object */
-		char *s = strtok_r(buf, SEP, &strtok_save);
-		for (; s != NULL; j++) {
-			json_object_object_get_ex(temp_json, s, &sub_obj);
-			temp_json = sub_obj;
-			s = strtok_r(NULL, SEP, &strtok_save);
-		}
-		/* temp_json now contains the value we want to have, so set it */
-		json_object_get(temp_json);
-		msgAddJSON(pMsg, (uchar *)pData->fieldList.varname[i], temp_json, 0, 0);
+		json_object *const fieldjson = getFieldJson(&entry, pData->fieldList.path[i]);
+		msgAddJSON(pMsg, (uchar *)pData->fieldList.varname[i], fieldjson, 0, 0);
 	}
 
 finalize_it:
-	if(entry_data_list != NULL)
-		MMDB_free_entry_data_list(entry_data_list);
 	json_object_put(keyjson);
-	if(total_json != NULL)
-		json_object_put(total_json);
 ENDdoAction
 
 
@@ -419,6 +732,8 @@ NO_LEGACY_CONF_parseSelectorAct
 
 BEGINmodExit
 CODESTARTmodExit
+	statsobj.Destruct(&lookupStats);
+	objRelease(statsobj, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
 ENDmodExit
 
@@ -440,4 +755,23 @@ CODESTARTmodInit
 CODEmodInit_QueryRegCFSLineHdlr
 	dbgprintf("mmdblookup: module compiled with rsyslog version %s.\n", VERSION);
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
+
+	/* support statistics gathering */
+	CHKiRet(statsobj.Construct(&lookupStats));
+	CHKiRet(statsobj.SetName(lookupStats, (uchar *)"mmdblookup"));
+	CHKiRet(statsobj.SetOrigin(lookupStats, (uchar *)"mmdblookup"));
+	STATSCOUNTER_INIT(ctrLookups, mutCtrLookups);
+	CHKiRet(statsobj.AddCounter(lookupStats, (uchar *)"lookups",
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrLookups));
+	STATSCOUNTER_INIT(ctrCacheHits, mutCtrCacheHits);
+	CHKiRet(statsobj.AddCounter(lookupStats, (uchar *)"cache.hits",
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrCacheHits));
+	STATSCOUNTER_INIT(ctrCacheMisses, mutCtrCacheMisses);
+	CHKiRet(statsobj.AddCounter(lookupStats, (uchar *)"cache.misses",
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrCacheMisses));
+	STATSCOUNTER_INIT(ctrCacheEvictions, mutCtrCacheEvictions);
+	CHKiRet(statsobj.AddCounter(lookupStats, (uchar *)"cache.evictions",
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrCacheEvictions));
+	CHKiRet(statsobj.ConstructFinalize(lookupStats));
 ENDmodInit
@@ -60,6 +60,7 @@ DEF_OMOD_STATIC_DATA
 
 typedef struct _instanceData {
 	sbool bUseRawMsg;     /**< use %rawmsg% instead of %msg% */
+	sbool bLazyParsing;   /**< keep JSON text and extract values on demand */
 	char *cookie;
 	uchar *container;
 	int lenCookie;
@@ -82,7 +83,8 @@ static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current ex
 static struct cnfparamdescr actpdescr[] = {
 	{ "cookie", eCmdHdlrString, 0 },
 	{ "container", eCmdHdlrString, 0 },
-	{ "userawmsg", eCmdHdlrBinary, 0 }
+	{ "userawmsg", eCmdHdlrBinary, 0 },
+	{ "lazyparsing", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -240,6 +242,19 @@ CODESTARTdoAction
 		ABORT_FINALIZE(RS_RET_NO_CEE_MSG);
 	}
 	buf += pData->lenCookie;
+	if(pData->bLazyParsing) {
+		/* if the text is not strictly valid, we let json-c decide, as it
+		 * is more lenient and we must not change what is accepted.
+		 */
+		iRet = msgAddLazyJSON(pMsg, buf, strlen((char*)buf));
+		if(iRet == RS_RET_OK) {
+			bSuccess = 1;
+			FINALIZE;
+		} else if(iRet != RS_RET_JSON_PARSE_ERR) {
+			FINALIZE;
+		}
+		iRet = RS_RET_OK;
+	}
 	CHKiRet(processJSON(pWrkrData, pMsg, (char*) buf, strlen((char*)buf)));
 	bSuccess = 1;
 finalize_it:
@@ -258,6 +273,7 @@ static inline void
 setInstParamDefaults(instanceData *pData)
 {
 	pData->bUseRawMsg = 0;
+	pData->bLazyParsing = 0;
 }
 
 BEGINnewActInst
@@ -306,6 +322,8 @@ CODESTARTnewActInst
 		}
 		} else if(!strcmp(actpblk.descr[i].name, "userawmsg")) {
 			pData->bUseRawMsg = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "lazyparsing")) {
+			pData->bLazyParsing = (int) pvals[i].val.d.n;
 		} else {
 			dbgprintf("mmjsonparse: program error, non-handled param '%s'\n", actpblk.descr[i].name);
 		}
@@ -313,6 +331,11 @@ CODESTARTnewActInst
 
 	if(pData->container == NULL)
 		CHKmalloc(pData->container = (uchar*) strdup("!"));
+	if(pData->bLazyParsing && strcmp((char*)pData->container, "!")) {
+		parser_warnmsg("mmjsonparse: lazyparsing is only supported "
+			"for container '$!', it is ignored for '$%s'", pData->container);
+		pData->bLazyParsing = 0;
+	}
 	pData->lenCookie = strlen(pData->cookie);
 CODE_STD_FINALIZERnewActInst
 	cnfparamvalsDestruct(pvals, &actpblk);
@@ -6,7 +6,7 @@
  * it could also be evolved into an any-charset-to-UTF8 converter. But
  * first let's see if it really gets into widespread enough use.
  *
- * Copyright 2013-2016 Adiscon GmbH.
+ * Copyright 2013-2018 Adiscon GmbH.
  *
  * This file is part of rsyslog.
  *
@@ -41,6 +41,7 @@
 #include "template.h"
 #include "module-template.h"
 #include "errmsg.h"
+#include "utf8valid.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -220,16 +221,19 @@ fixInvldMBSeq(instanceData *pData, uchar *msg, int lenMsg, int strtIdx, int *end
 		msg[i] = pData->replChar;
 }
 
-static void
-doUTF8(instanceData *pData, uchar *msg, int lenMsg)
+/* repair the character starting at index i, which is known not to be
+ * valid UTF-8. Returns the index where processing can continue, that is
+ * the next character boundary after the repaired bytes.
+ */
+static int
+fixUTF8Char(instanceData *pData, uchar *msg, int lenMsg, int i)
 {
 	uchar c;
 	int8_t seqLen = 0, bytesLeft = 0;
 	uint32_t codepoint;
 	int strtIdx = 0, endIdx = 0;
-	int i;
 
-	for(i = 0 ; i < lenMsg ; ++i) {
+	for( ; i < lenMsg ; ++i) {
 		c = msg[i];
 		if(bytesLeft) {
 			if((c & 0xc0) != 0x80) {
@@ -287,6 +291,25 @@ doUTF8(instanceData *pData, uchar *msg, int lenMsg)
 				i = lenMsg - 1;
 			}
 		}
+		if(bytesLeft == 0)
+			return i + 1; /* back at a character boundary */
+	}
+	return lenMsg;
+}
+
+/* The bulk of messages is valid UTF-8 (most often even pure ASCII), so
+ * we let the (vectorized) validator skip over valid parts and only run
+ * the bytewise repair code for the characters it stopped at.
+ */
+static void
+doUTF8(instanceData *pData, uchar *msg, int lenMsg)
+{
+	int i = 0;
+
+	while(i < lenMsg) {
+		i += (int) utf8validPrefix(msg + i, lenMsg - i);
+		if(i < lenMsg)
+			i = fixUTF8Char(pData, msg, lenMsg, i);
 	}
 }
 
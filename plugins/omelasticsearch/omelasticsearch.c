@@ -72,6 +72,7 @@ STATSCOUNTER_DEF(indexHTTPFail, mutIndexHTTPFail)
 STATSCOUNTER_DEF(indexHTTPReqFail, mutIndexHTTPReqFail)
 STATSCOUNTER_DEF(checkConnFail, mutCheckConnFail)
 STATSCOUNTER_DEF(indexESFail, mutIndexESFail)
+STATSCOUNTER_DEF(indexRetries, mutIndexRetries)
 
 
 #	define META_STRT "{\"index\":{\"_index\": \""
@@ -114,6 +115,8 @@ typedef struct _instanceData {
 	sbool dynPipelineName;
 	sbool bulkmode;
 	size_t maxbytes;
+	int maxInFlight;	/* max number of concurrent bulk requests per worker, 1 = synchronous */
+	int maxRetries;		/* max retries for items rejected with a temporary error */
 	sbool useHttps;
 	sbool allowUnsignedCerts;
 	uchar *caCertFile;
@@ -121,6 +124,74 @@ typedef struct _instanceData {
 	uchar *myPrivKeyFile;
 } instanceData;
 
+/* Incremental parser for bulk replies. It is fed the reply as curl
+ * delivers it and only keeps what we need: the number of items as well
+ * as index, status and (optionally) text of the failed ones. So we need
+ * neither the full reply text nor a json-c tree for it.
+ */
+#define ES_PARSER_MAX_DEPTH 8
+typedef struct esFailedItem_s {
+	int idx;		/* index of item inside request */
+	int status;		/* HTTP status for item, -1 if not present */
+	sbool bRetry;		/* item is to be resubmitted */
+	char *text;		/* item as received, NULL if not captured */
+} esFailedItem_t;
+
+typedef struct esReplyParser_s {
+	sbool bKeepReply;	/* caller keeps the full reply text */
+	sbool bCapture;		/* keep text of failed items */
+	sbool bError;		/* not a valid JSON object */
+	sbool bSawRoot;
+	sbool bSawItems;
+	sbool bNoErrors;	/* ES told us "errors":false, nothing else to look at */
+	sbool bInString;
+	sbool bEscape;
+	sbool bIsKey;
+	sbool bInScalar;
+	sbool bInItems;
+	sbool bInAction;
+	sbool bInStatus;
+	int depth;
+	uint8_t isObj[ES_PARSER_MAX_DEPTH];
+	uint8_t expectKey[ES_PARSER_MAX_DEPTH];
+	char key[16];
+	int lenKey;
+	int pending;		/* value we are interested in, one of ES_VAL_* */
+	int nItems;
+	int itemStatus;
+	es_str_t *itemText;	/* text of current item, if capturing */
+	esFailedItem_t *failed;
+	int nFailed;
+	int maxFailed;
+} esReplyParser_t;
+
+/* describes a bulk request body and where its items start */
+typedef struct esBulkData_s {
+	const char *buf;
+	size_t len;
+	const size_t *offsets;
+	int nmemb;
+} esBulkData_t;
+
+/* a bulk request processed asynchronously via the curl multi interface */
+typedef struct esRequest_s {
+	CURL *curl;
+	sbool bInUse;
+	es_str_t *data;		/* request body, '\0'-terminated (not included in POST size) */
+	size_t *offsets;	/* start of each message inside data */
+	int maxOffsets;
+	int nmemb;		/* number of messages in request */
+	int serverIndex;	/* server currently used */
+	int nServerTries;	/* servers tried after transport errors */
+	int nRetries;		/* number of times failed items have been resubmitted */
+	long long retryAt;	/* != 0: waiting for backoff, resubmit at this time (ms) */
+	uchar *restURL;
+	char *reply;		/* only kept as long as needed, see curlResultAsync() */
+	size_t replyLen;
+	esReplyParser_t parser;
+	char errbuf[CURL_ERROR_SIZE];
+} esRequest_t;
+
 typedef struct wrkrInstanceData {
 	PTR_ASSERT_DEF
 	instanceData *pData;
@@ -131,12 +202,21 @@ typedef struct wrkrInstanceData {
 	CURL	*curlPostHandle;	/* libcurl session handle for posting data to the server */
 	HEADER	*curlHeader;	/* json POST request info */
 	uchar *restURL;		/* last used URL for error reporting */
+	esReplyParser_t parser;	/* for bulk replies */
 	struct {
 		es_str_t *data;
+		size_t *offsets;	/* start of each message inside data */
+		int maxOffsets;
 		int nmemb;	/* number of messages in batch (for statistics counting) */
 		uchar *currTpl1;
 		uchar *currTpl2;
 	} batch;
+	struct {
+		CURLM *multi;
+		esRequest_t *reqs;	/* maxInFlight entries */
+		int nInFlight;
+		rsRetVal iRet;		/* first error inside current transaction */
+	} async;
 } wrkrInstanceData_t;
 
 /* tables for interfacing with the v6 config system */
@@ -156,6 +236,8 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "dynparent", eCmdHdlrBinary, 0 },
 	{ "bulkmode", eCmdHdlrBinary, 0 },
 	{ "maxbytes", eCmdHdlrSize, 0 },
+	{ "maxinflight", eCmdHdlrPositiveInt, 0 },
+	{ "maxretries", eCmdHdlrNonNegInt, 0 },
 	{ "asyncrepl", eCmdHdlrGoneAway, 0 },
 	{ "usehttps", eCmdHdlrBinary, 0 },
 	{ "timeout", eCmdHdlrGetWord, 0 },
@@ -178,6 +260,11 @@ static struct cnfparamblk actpblk =
 	};
 
 static rsRetVal curlSetup(wrkrInstanceData_t *pWrkrData);
+static rsRetVal asyncSetup(wrkrInstanceData_t *pWrkrData);
+static void curlSetupCommon(wrkrInstanceData_t *pWrkrData, CURL *handle);
+static rsRetVal submitBatchAsync(wrkrInstanceData_t *pWrkrData);
+static void asyncCleanup(wrkrInstanceData_t *pWrkrData);
+static void esReplyParserDestruct(esReplyParser_t *parser);
 
 BEGINcreateInstance
 CODESTARTcreateInstance
@@ -196,6 +283,10 @@ CODESTARTcreateWrkrInstance
 	pWrkrData->curlCheckConnHandle = NULL;
 	pWrkrData->serverIndex = 0;
 	pWrkrData->restURL = NULL;
+	pWrkrData->async.multi = NULL;
+	pWrkrData->async.reqs = NULL;
+	pWrkrData->async.nInFlight = 0;
+	pWrkrData->async.iRet = RS_RET_OK;
 	if(pData->bulkmode) {
 		pWrkrData->batch.currTpl1 = NULL;
 		pWrkrData->batch.currTpl2 = NULL;
@@ -207,6 +298,8 @@ CODESTARTcreateWrkrInstance
 		}
 	}
 	iRet = curlSetup(pWrkrData);
+	if(iRet == RS_RET_OK && pData->bulkmode && pData->maxInFlight > 1)
+		iRet = asyncSetup(pWrkrData);
 ENDcreateWrkrInstance
 
 BEGINisCompatibleWithFeature
@@ -243,6 +336,7 @@ ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	asyncCleanup(pWrkrData);
 	if(pWrkrData->curlHeader != NULL) {
 		curl_slist_free_all(pWrkrData->curlHeader);
 		pWrkrData->curlHeader = NULL;
@@ -260,6 +354,8 @@ CODESTARTfreeWrkrInstance
 		pWrkrData->restURL = NULL;
 	}
 	es_deleteStr(pWrkrData->batch.data);
+	free(pWrkrData->batch.offsets);
+	esReplyParserDestruct(&pWrkrData->parser);
 ENDfreeWrkrInstance
 
 BEGINdbgPrintInstInfo
@@ -288,6 +384,8 @@ CODESTARTdbgPrintInstInfo
 	dbgprintf("\tuse https=%d\n", pData->useHttps);
 	dbgprintf("\tbulkmode=%d\n", pData->bulkmode);
 	dbgprintf("\tmaxbytes=%zu\n", pData->maxbytes);
+	dbgprintf("\tmaxinflight=%d\n", pData->maxInFlight);
+	dbgprintf("\tmaxretries=%d\n", pData->maxRetries);
 	dbgprintf("\tallowUnsignedCerts=%d\n", pData->allowUnsignedCerts);
 	dbgprintf("\terrorfile='%s'\n", pData->errorFile == NULL ?
 		(uchar*)"(not configured)" : pData->errorFile);
@@ -301,6 +399,253 @@ CODESTARTdbgPrintInstInfo
 ENDdbgPrintInstInfo
 
 
+#define ES_VAL_NONE 0
+#define ES_VAL_ITEMS 1
+#define ES_VAL_ERRORS 2
+#define ES_VAL_ACTION 3
+#define ES_VAL_STATUS 4
+
+/* prepare parser for a new reply */
+static void
+esReplyParserReset(esReplyParser_t *const parser, const sbool bKeepReply, const sbool bCapture)
+{
+	int i;
+
+	for(i = 0 ; i < parser->nFailed ; ++i)
+		free(parser->failed[i].text);
+	parser->bKeepReply = bKeepReply;
+	parser->bCapture = bCapture;
+	parser->bError = 0;
+	parser->bSawRoot = 0;
+	parser->bSawItems = 0;
+	parser->bNoErrors = 0;
+	parser->bInString = 0;
+	parser->bEscape = 0;
+	parser->bIsKey = 0;
+	parser->bInScalar = 0;
+	parser->bInItems = 0;
+	parser->bInAction = 0;
+	parser->bInStatus = 0;
+	parser->depth = 0;
+	parser->lenKey = 0;
+	parser->pending = ES_VAL_NONE;
+	parser->nItems = 0;
+	parser->itemStatus = -1;
+	parser->nFailed = 0;
+	if(parser->itemText != NULL)
+		es_emptyStr(parser->itemText);
+}
+
+static void
+esReplyParserDestruct(esReplyParser_t *const parser)
+{
+	esReplyParserReset(parser, 0, 0);
+	free(parser->failed);
+	parser->failed = NULL;
+	parser->maxFailed = 0;
+	if(parser->itemText != NULL) {
+		es_deleteStr(parser->itemText);
+		parser->itemText = NULL;
+	}
+}
+
+static void
+esReplyParserItemDone(esReplyParser_t *const parser)
+{
+	esFailedItem_t *newFailed;
+	esFailedItem_t *item;
+	int newMax;
+
+	if(parser->itemStatus >= 0 && parser->itemStatus <= 299)
+		return;
+	if(parser->nFailed == parser->maxFailed) {
+		newMax = (parser->maxFailed == 0) ? 16 : parser->maxFailed * 2;
+		if((newFailed = realloc(parser->failed, newMax * sizeof(esFailedItem_t))) == NULL) {
+			parser->bError = 1;
+			return;
+		}
+		parser->failed = newFailed;
+		parser->maxFailed = newMax;
+	}
+	item = &parser->failed[parser->nFailed++];
+	item->idx = parser->nItems - 1;
+	item->status = parser->itemStatus;
+	item->bRetry = 0;
+	item->text = NULL;
+	if(parser->bCapture && parser->itemText != NULL)
+		item->text = es_str2cstr(parser->itemText, NULL);
+}
+
+/* a key string has been completed */
+static void
+esReplyParserKey(esReplyParser_t *const parser)
+{
+	const int depth = parser->depth;
+
+	parser->pending = ES_VAL_NONE;
+	if(depth == 1) {
+		if(parser->lenKey == 5 && !strncmp(parser->key, "items", 5))
+			parser->pending = ES_VAL_ITEMS;
+		else if(parser->lenKey == 6 && !strncmp(parser->key, "errors", 6))
+			parser->pending = ES_VAL_ERRORS;
+	} else if(depth == 3 && parser->bInItems) {
+		parser->pending = ES_VAL_ACTION; /* "index", "create", ... */
+	} else if(depth == 4 && parser->bInAction) {
+		if(parser->lenKey == 6 && !strncmp(parser->key, "status", 6))
+			parser->pending = ES_VAL_STATUS;
+	}
+}
+
+/* a value starts with char c at the current depth */
+static void
+esReplyParserValue(esReplyParser_t *const parser, const char c)
+{
+	switch(parser->pending) {
+	case ES_VAL_ITEMS:
+		if(c == '[') {
+			parser->bInItems = 1;
+			parser->bSawItems = 1;
+		}
+		break;
+	case ES_VAL_ERRORS:
+		if(c == 'f')
+			parser->bNoErrors = 1;
+		break;
+	case ES_VAL_ACTION:
+		if(c == '{')
+			parser->bInAction = 1;
+		break;
+	case ES_VAL_STATUS:
+		if(c >= '0' && c <= '9') {
+			parser->bInStatus = 1;
+			parser->itemStatus = c - '0';
+		}
+		break;
+	default:
+		break;
+	}
+	parser->pending = ES_VAL_NONE;
+}
+
+/* feed the next part of the reply into the parser */
+static void
+esReplyParserFeed(esReplyParser_t *const parser, const char *const buf, const size_t len)
+{
+	size_t captureStart = 0;
+	size_t i;
+	char c;
+
+	for(i = 0 ; i < len && !parser->bNoErrors && !parser->bError ; ++i) {
+		c = buf[i];
+		if(parser->bInString) {
+			if(parser->bEscape) {
+				parser->bEscape = 0;
+			} else if(c == '\\') {
+				parser->bEscape = 1;
+			} else if(c == '"') {
+				parser->bInString = 0;
+				if(parser->bIsKey)
+					esReplyParserKey(parser);
+			} else if(parser->bIsKey && parser->lenKey < (int) sizeof(parser->key)) {
+				parser->key[parser->lenKey++] = c;
+			}
+			continue;
+		}
+		if(parser->bInScalar) {
+			if((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '.'
+			   || c == '-' || c == '+' || c == 'E') {
+				if(parser->bInStatus)
+					parser->itemStatus = (c >= '0' && c <= '9')
+						? parser->itemStatus * 10 + c - '0' : -1;
+				continue;
+			}
+			parser->bInScalar = 0;
+			parser->bInStatus = 0;
+		}
+		switch(c) {
+		case ' ':
+		case '\t':
+		case '\r':
+		case '\n':
+			break;
+		case '"':
+			if(parser->depth > 0 && parser->depth < ES_PARSER_MAX_DEPTH
+			   && parser->isObj[parser->depth] && parser->expectKey[parser->depth]) {
+				parser->bIsKey = 1;
+				parser->lenKey = 0;
+			} else {
+				parser->bIsKey = 0;
+				esReplyParserValue(parser, c);
+			}
+			parser->bInString = 1;
+			break;
+		case '{':
+		case '[':
+			if(parser->depth == 0) {
+				if(c != '{' || parser->bSawRoot) {
+					parser->bError = 1;
+					break;
+				}
+				parser->bSawRoot = 1;
+			}
+			esReplyParserValue(parser, c);
+			if(parser->depth == 2 && parser->bInItems && c == '{') {
+				/* a new item begins */
+				++parser->nItems;
+				parser->itemStatus = -1;
+				if(parser->bCapture) {
+					captureStart = i;
+					if(parser->itemText == NULL)
+						parser->itemText = es_newStr(256);
+					else
+						es_emptyStr(parser->itemText);
+				}
+			}
+			++parser->depth;
+			if(parser->depth < ES_PARSER_MAX_DEPTH) {
+				parser->isObj[parser->depth] = (c == '{');
+				parser->expectKey[parser->depth] = 1;
+			}
+			break;
+		case '}':
+		case ']':
+			if(parser->depth == 0) {
+				parser->bError = 1;
+				break;
+			}
+			if(parser->depth == 4 && parser->bInAction) {
+				parser->bInAction = 0;
+			} else if(parser->depth == 3 && parser->bInItems) {
+				if(parser->bCapture && parser->itemText != NULL)
+					es_addBuf(&parser->itemText, buf + captureStart, i - captureStart + 1);
+				esReplyParserItemDone(parser);
+			} else if(parser->depth == 2 && parser->bInItems) {
+				parser->bInItems = 0;
+			}
+			--parser->depth;
+			parser->pending = ES_VAL_NONE;
+			break;
+		case ':':
+			if(parser->depth < ES_PARSER_MAX_DEPTH)
+				parser->expectKey[parser->depth] = 0;
+			break;
+		case ',':
+			if(parser->depth < ES_PARSER_MAX_DEPTH)
+				parser->expectKey[parser->depth] = 1;
+			parser->pending = ES_VAL_NONE;
+			break;
+		default: /* start of number or literal */
+			esReplyParserValue(parser, c);
+			parser->bInScalar = 1;
+			break;
+		}
+	}
+	/* item continues in next part of reply */
+	if(parser->bCapture && parser->bInItems && parser->depth >= 3
+	   && parser->itemText != NULL && !parser->bNoErrors)
+		es_addBuf(&parser->itemText, buf + captureStart, len - captureStart);
+}
+
 /* elasticsearch POST result string ... useful for debugging */
 static size_t
 curlResult(void *ptr, size_t size, size_t nmemb, void *userdata)
@@ -321,6 +666,24 @@ curlResult(void *ptr, size_t size, size_t nmemb, void *userdata)
 	return size*nmemb;
 }
 
+/* result callback for bulk requests. The reply is parsed while it is
+ * being received. We keep the text only if it is needed for the error
+ * file or it is not a regular bulk reply (then checkResult() needs it).
+ * Note that "errors" usually precedes "items", so a successful reply is
+ * recognized by "errors":false before any item has been seen.
+ */
+static size_t
+curlResultBulk(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	wrkrInstanceData_t *pWrkrData = (wrkrInstanceData_t*) userdata;
+	PTR_ASSERT_CHK(pWrkrData, WRKR_DATA_TYPE_ES);
+	esReplyParserFeed(&pWrkrData->parser, (char*) ptr, size*nmemb);
+	if(pWrkrData->parser.bKeepReply
+	   || !(pWrkrData->parser.bNoErrors || pWrkrData->parser.bSawItems))
+		return curlResult(ptr, size, nmemb, userdata);
+	return size*nmemb;
+}
+
 /* Build basic URL part, which includes hostname and port as follows:
  * http://hostname:port/ based on a server param
  * Newly creates a cstr for this purpose.
@@ -508,8 +871,10 @@ done:
 }
 
 
-static rsRetVal ATTR_NONNULL(1)
-setPostURL(wrkrInstanceData_t *const pWrkrData, uchar **const tpls)
+/* build the URL to post to for the server with index serverIndex */
+static rsRetVal ATTR_NONNULL(1, 4)
+buildPostURL(wrkrInstanceData_t *const pWrkrData, const int serverIndex, uchar **const tpls,
+	uchar **const pRestURL)
 {
 	uchar *searchIndex = NULL;
 	uchar *searchType;
@@ -524,7 +889,7 @@ setPostURL(wrkrInstanceData_t *const pWrkrData, uchar **const tpls)
 	char separator;
 	const int bulkmode = pData->bulkmode;
 
-	baseUrl = (char*)pData->serverBaseUrls[pWrkrData->serverIndex];
+	baseUrl = (char*)pData->serverBaseUrls[serverIndex];
 	url = es_newStrFromCStr(baseUrl, strlen(baseUrl));
 	if (url == NULL) {
 		LogError(0, RS_RET_OUT_OF_MEMORY,
@@ -563,16 +928,32 @@ setPostURL(wrkrInstanceData_t *const pWrkrData, uchar **const tpls)
 		if(r == 0) es_addBuf(&url, (char*)parent, ustrlen(parent));
 	}
 
-	if(pWrkrData->restURL != NULL)
-		free(pWrkrData->restURL);
+	if(r != 0 || (*pRestURL = (uchar*)es_str2cstr(url, NULL)) == NULL) {
+		LogError(0, RS_RET_OUT_OF_MEMORY,
+			"omelasticsearch: error building POST url.");
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+
+finalize_it:
+	if (url != NULL)
+		es_deleteStr(url);
+	RETiRet;
+}
+
+
+static rsRetVal ATTR_NONNULL(1)
+setPostURL(wrkrInstanceData_t *const pWrkrData, uchar **const tpls)
+{
+	uchar *restURL;
+	DEFiRet;
 
-	pWrkrData->restURL = (uchar*)es_str2cstr(url, NULL);
+	CHKiRet(buildPostURL(pWrkrData, pWrkrData->serverIndex, tpls, &restURL));
+	free(pWrkrData->restURL);
+	pWrkrData->restURL = restURL;
 	curl_easy_setopt(pWrkrData->curlPostHandle, CURLOPT_URL, pWrkrData->restURL);
 	DBGPRINTF("omelasticsearch: using REST URL: '%s'\n", pWrkrData->restURL);
 
 finalize_it:
-	if (url != NULL)
-		es_deleteStr(url);
 	RETiRet;
 }
 
@@ -624,8 +1005,21 @@ buildBatch(wrkrInstanceData_t *pWrkrData, uchar *message, uchar **tpls)
 	uchar *parent = NULL;
 	uchar *bulkId = NULL;
 	uchar *pipelineName;
+	size_t *newOffsets;
+	int newMax;
 	DEFiRet;
 
+	/* remember where this message starts, so that we can find it again
+	 * if ES reports an error for it.
+	 */
+	if(pWrkrData->batch.nmemb == pWrkrData->batch.maxOffsets) {
+		newMax = (pWrkrData->batch.maxOffsets == 0) ? 64 : pWrkrData->batch.maxOffsets * 2;
+		CHKmalloc(newOffsets = realloc(pWrkrData->batch.offsets, newMax * sizeof(size_t)));
+		pWrkrData->batch.offsets = newOffsets;
+		pWrkrData->batch.maxOffsets = newMax;
+	}
+	pWrkrData->batch.offsets[pWrkrData->batch.nmemb] = es_strlen(pWrkrData->batch.data);
+
 	getIndexTypeAndParent(pWrkrData->pData, tpls, &searchIndex, &searchType, &parent, &bulkId, &pipelineName);
 	r = es_addBuf(&pWrkrData->batch.data, META_STRT, sizeof(META_STRT)-1);
 	if(r == 0) r = es_addBuf(&pWrkrData->batch.data, (char*)searchIndex,
@@ -1179,6 +1573,123 @@ finalize_it:
 	RETiRet;
 }
 
+/* Evaluate a bulk reply after it was fed into the parser. Items that
+ * failed with a temporary error (429, 5xx) are flagged for retry if
+ * bCanRetry is set, their number is returned in *pnRetry. All other
+ * failed items are reported via the error file. If the full reply was
+ * kept, we use it for that. Otherwise, the error file content is built
+ * from the captured items and the matching part of the request, which
+ * we locate via the message offsets.
+ */
+static rsRetVal ATTR_NONNULL(1, 2, 5, 7)
+checkBulkReply(wrkrInstanceData_t *const pWrkrData, esReplyParser_t *const parser,
+	char *const reply, uchar *const restURL, const esBulkData_t *const bulk,
+	const sbool bCanRetry, int *const pnRetry)
+{
+	instanceData *const pData = pWrkrData->pData;
+	esFailedItem_t *failed;
+	fjson_object *root = NULL;
+	fjson_object *failItems = NULL;
+	fjson_object *item;
+	es_str_t *failReq = NULL;
+	char *failReqStr = NULL;
+	char *savedReply;
+	size_t end;
+	int nPermanent = 0;
+	int i;
+	DEFiRet;
+
+	*pnRetry = 0;
+	if(parser->bNoErrors)
+		FINALIZE;
+	if(parser->bError || !parser->bSawItems) {
+		if(parser->bSawItems) {
+			/* we did not keep the reply, so there is nothing else we can do */
+			LogMsg(0, RS_RET_ERR, LOG_WARNING,
+				"omelasticsearch: could not parse JSON result");
+			STATSCOUNTER_INC(indexESFail, mutIndexESFail);
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
+		if(reply == NULL)
+			FINALIZE;
+		/* not a regular bulk reply, let the traditional code handle it */
+		savedReply = pWrkrData->reply;
+		pWrkrData->reply = reply;
+		iRet = checkResult(pWrkrData, (uchar*) bulk->buf);
+		pWrkrData->reply = savedReply;
+		FINALIZE;
+	}
+
+	DBGPRINTF("omelasticsearch: %d items in reply, %d failed\n", parser->nItems, parser->nFailed);
+	for(i = 0 ; i < parser->nFailed ; ++i) {
+		failed = &parser->failed[i];
+		if(failed->idx >= bulk->nmemb) {
+			LogError(0, RS_RET_DATAFAIL, "omelasticsearch: error in elasticsearch reply: "
+				"more items in reply than in request");
+			STATSCOUNTER_INC(indexESFail, mutIndexESFail);
+			ABORT_FINALIZE(RS_RET_DATAFAIL);
+		}
+		if(bCanRetry && (failed->status == 429 || failed->status >= 500)) {
+			failed->bRetry = 1;
+			++*pnRetry;
+			STATSCOUNTER_INC(indexRetries, mutIndexRetries);
+		} else {
+			DBGPRINTF("omelasticsearch: error in elasticsearch reply: item %d, "
+				"status is %d\n", failed->idx, failed->status);
+			++nPermanent;
+		}
+	}
+	if(nPermanent == 0)
+		FINALIZE;
+
+	STATSCOUNTER_INC(indexESFail, mutIndexESFail);
+	if(pData->errorFile == NULL)
+		FINALIZE;
+	if(restURL != pWrkrData->restURL) {
+		free(pWrkrData->restURL);
+		pWrkrData->restURL = (uchar*) strdup((char*)restURL);
+	}
+	if(parser->bKeepReply && reply != NULL) {
+		/* the error file needs the complete reply */
+		if((root = fjson_tokener_parse(reply)) == NULL) {
+			LogMsg(0, RS_RET_ERR, LOG_WARNING,
+				"omelasticsearch: could not parse JSON result");
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
+		writeDataError(pWrkrData, pData, &root, (uchar*) bulk->buf);
+		FINALIZE;
+	}
+
+	/* report only the items that finally failed */
+	CHKmalloc(failReq = es_newStr(1024));
+	CHKmalloc(failItems = fjson_object_new_array());
+	for(i = 0 ; i < parser->nFailed ; ++i) {
+		failed = &parser->failed[i];
+		if(failed->bRetry || failed->text == NULL
+		   || (item = fjson_tokener_parse(failed->text)) == NULL)
+			continue;
+		fjson_object_array_add(failItems, item);
+		end = (failed->idx + 1 < bulk->nmemb) ? bulk->offsets[failed->idx + 1] : bulk->len;
+		if(es_addBuf(&failReq, (char*) bulk->buf + bulk->offsets[failed->idx],
+		             end - bulk->offsets[failed->idx]) != 0)
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	CHKmalloc(root = fjson_object_new_object());
+	fjson_object_object_add(root, "errors", fjson_object_new_boolean(1));
+	fjson_object_object_add(root, "items", failItems);
+	failItems = NULL;
+	CHKmalloc(failReqStr = es_str2cstr(failReq, NULL));
+	writeDataError(pWrkrData, pData, &root, (uchar*) failReqStr);
+
+finalize_it:
+	if(failReq != NULL)
+		es_deleteStr(failReq);
+	free(failReqStr);
+	fjson_object_put(failItems);
+	fjson_object_put(root);
+	RETiRet;
+}
+
 static void ATTR_NONNULL()
 initializeBatch(wrkrInstanceData_t *pWrkrData)
 {
@@ -1192,6 +1703,9 @@ curlPost(wrkrInstanceData_t *pWrkrData, uchar *message, int msglen, uchar **tpls
 	CURLcode code;
 	CURL *const curl = pWrkrData->curlPostHandle;
 	char errbuf[CURL_ERROR_SIZE] = "";
+	instanceData *const pData = pWrkrData->pData;
+	esBulkData_t bulk;
+	int nRetry;
 	DEFiRet;
 
 	PTR_ASSERT_SET_TYPE(pWrkrData, WRKR_DATA_TYPE_ES);
@@ -1207,6 +1721,12 @@ curlPost(wrkrInstanceData_t *pWrkrData, uchar *message, int msglen, uchar **tpls
 
 	pWrkrData->reply = NULL;
 	pWrkrData->replyLen = 0;
+	if(pData->bulkmode) {
+		/* keep the full reply only if the error file needs all items */
+		esReplyParserReset(&pWrkrData->parser,
+			pData->errorFile != NULL && !pData->errorOnly,
+			pData->errorFile != NULL && pData->errorOnly);
+	}
 
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (char *)message);
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, msglen);
@@ -1222,7 +1742,18 @@ curlPost(wrkrInstanceData_t *pWrkrData, uchar *message, int msglen, uchar **tpls
 		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
 
-	if(pWrkrData->reply == NULL) {
+	if(pData->bulkmode) {
+		DBGPRINTF("omelasticsearch: bulk reply received, %d bytes kept\n",
+			pWrkrData->replyLen);
+		if(pWrkrData->reply != NULL)
+			pWrkrData->reply[pWrkrData->replyLen] = '\0';
+		bulk.buf = (char*) message;
+		bulk.len = msglen;
+		bulk.offsets = pWrkrData->batch.offsets;
+		bulk.nmemb = nmsgs;
+		CHKiRet(checkBulkReply(pWrkrData, &pWrkrData->parser, pWrkrData->reply,
+			pWrkrData->restURL, &bulk, 0, &nRetry));
+	} else if(pWrkrData->reply == NULL) {
 		DBGPRINTF("omelasticsearch: pWrkrData reply==NULL, replyLen = '%d'\n",
 			pWrkrData->replyLen);
 	} else {
@@ -1245,19 +1776,437 @@ finalize_it:
 static rsRetVal
 submitBatch(wrkrInstanceData_t *pWrkrData)
 {
-	char *cstr = NULL;
+	uchar *batch;
+	DEFiRet;
+
+	if(pWrkrData->async.multi != NULL) {
+		iRet = submitBatchAsync(pWrkrData);
+		FINALIZE;
+	}
+
+	/* we post the batch buffer directly, the terminator is just for debug output */
+	if(es_addChar(&pWrkrData->batch.data, '\0') != 0)
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	batch = (uchar*) es_getBufAddr(pWrkrData->batch.data);
+	dbgprintf("omelasticsearch: submitBatch, batch: '%s'\n", batch);
+
+	CHKiRet(curlPost(pWrkrData, batch, es_strlen(pWrkrData->batch.data) - 1, NULL,
+		pWrkrData->batch.nmemb));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* The async mode (maxinflight > 1) keeps up to maxinflight bulk requests
+ * in flight per worker via the curl multi interface. Each request gets
+ * its own easy handle (and thus connection) and requests are spread
+ * round-robin over the configured servers. A transaction is only
+ * complete after all of its requests have been answered.
+ */
+
+/* backoff before items rejected with a temporary error are resubmitted:
+ * doubled with each retry of the same request, up to the maximum
+ */
+#define ES_RETRY_BACKOFF_MIN 200	/* ms */
+#define ES_RETRY_BACKOFF_MAX 30000	/* ms */
+
+/* reply callback for async requests, see curlResultBulk() */
+static size_t
+curlResultAsync(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	esRequest_t *const req = (esRequest_t*) userdata;
+	char *buf;
+	const size_t newlen = req->replyLen + size*nmemb;
+
+	esReplyParserFeed(&req->parser, (char*) ptr, size*nmemb);
+	if(!req->parser.bKeepReply && (req->parser.bNoErrors || req->parser.bSawItems))
+		return size*nmemb;
+	if((buf = realloc(req->reply, newlen + 1)) == NULL) {
+		LogError(errno, RS_RET_ERR, "omelasticsearch: realloc failed in curlResultAsync");
+		return 0; /* abort due to failure */
+	}
+	memcpy(buf+req->replyLen, ptr, size*nmemb);
+	req->replyLen = newlen;
+	req->reply = buf;
+	return size*nmemb;
+}
+
+static void
+asyncRequestRelease(wrkrInstanceData_t *const pWrkrData, esRequest_t *const req)
+{
+	if(req->data != NULL) {
+		es_deleteStr(req->data);
+		req->data = NULL;
+	}
+	free(req->offsets);
+	req->offsets = NULL;
+	req->maxOffsets = 0;
+	free(req->reply);
+	req->reply = NULL;
+	req->replyLen = 0;
+	free(req->restURL);
+	req->restURL = NULL;
+	req->retryAt = 0;
+	req->bInUse = 0;
+	--pWrkrData->async.nInFlight;
+}
+
+/* record the first error that occured inside the current transaction */
+static void
+asyncSetError(wrkrInstanceData_t *const pWrkrData, const rsRetVal iRet)
+{
+	if(pWrkrData->async.iRet == RS_RET_OK)
+		pWrkrData->async.iRet = iRet;
+}
+
+/* (re-)start a request on its current server */
+static rsRetVal
+asyncRequestStart(wrkrInstanceData_t *const pWrkrData, esRequest_t *const req)
+{
+	CURLMcode mcode;
+	DEFiRet;
+
+	req->retryAt = 0;
+	free(req->restURL);
+	req->restURL = NULL;
+	free(req->reply);
+	req->reply = NULL;
+	req->replyLen = 0;
+	req->errbuf[0] = '\0';
+	esReplyParserReset(&req->parser, 0, pWrkrData->pData->errorFile != NULL);
+	CHKiRet(buildPostURL(pWrkrData, req->serverIndex, NULL, &req->restURL));
+	DBGPRINTF("omelasticsearch: async request with %d messages to '%s'\n",
+		req->nmemb, req->restURL);
+
+	curl_easy_setopt(req->curl, CURLOPT_URL, req->restURL);
+	curl_easy_setopt(req->curl, CURLOPT_POSTFIELDS, (char*) es_getBufAddr(req->data));
+	curl_easy_setopt(req->curl, CURLOPT_POSTFIELDSIZE, (long) es_strlen(req->data) - 1);
+	mcode = curl_multi_add_handle(pWrkrData->async.multi, req->curl);
+	if(mcode != CURLM_OK) {
+		LogError(0, RS_RET_ERR, "omelasticsearch: curl_multi_add_handle failed: %s",
+			curl_multi_strerror(mcode));
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+/* Build the body for resubmitting those items of a request that
+ * were flagged for retry by checkBulkReply().
+ */
+static rsRetVal
+asyncBuildRetry(esRequest_t *const req, const int nRetry, es_str_t **const pData,
+	size_t **const pOffsets)
+{
+	const char *const buf = (char*) es_getBufAddr(req->data);
+	const size_t len = es_strlen(req->data) - 1; /* without '\0' */
+	esFailedItem_t *failed;
+	es_str_t *data = NULL;
+	size_t *offsets = NULL;
+	size_t end;
+	int n = 0;
+	int i;
+	DEFiRet;
+
+	CHKmalloc(data = es_newStr(1024));
+	CHKmalloc(offsets = malloc(nRetry * sizeof(size_t)));
+	for(i = 0 ; i < req->parser.nFailed ; ++i) {
+		failed = &req->parser.failed[i];
+		if(!failed->bRetry)
+			continue;
+		end = (failed->idx + 1 < req->nmemb) ? req->offsets[failed->idx + 1] : len;
+		offsets[n++] = es_strlen(data);
+		if(es_addBuf(&data, (char*) buf + req->offsets[failed->idx],
+		             end - req->offsets[failed->idx]) != 0)
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	if(es_addChar(&data, '\0') != 0)
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	*pData = data;
+	*pOffsets = offsets;
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		if(data != NULL)
+			es_deleteStr(data);
+		free(offsets);
+	}
+	RETiRet;
+}
+
+/* backoff (ms) before the given retry of a request */
+static long
+asyncRetryBackoff(const int nRetries)
+{
+	long backoff = ES_RETRY_BACKOFF_MIN;
+	int i;
+
+	for(i = 0 ; i < nRetries && backoff < ES_RETRY_BACKOFF_MAX ; ++i)
+		backoff *= 2;
+	return (backoff < ES_RETRY_BACKOFF_MAX) ? backoff : ES_RETRY_BACKOFF_MAX;
+}
+
+/* process a completed async request. Depending on the outcome, the
+ * request is restarted on the next server, partially resubmitted, or
+ * released.
+ */
+static void
+asyncRequestDone(wrkrInstanceData_t *const pWrkrData, esRequest_t *const req, const CURLcode code)
+{
+	instanceData *const pData = pWrkrData->pData;
+	es_str_t *retry;
+	size_t *retryOffsets;
+	esBulkData_t bulk;
+	int nRetry;
+	rsRetVal localRet;
+
+	DBGPRINTF("omelasticsearch: async request to '%s' returned %lld\n",
+		req->restURL, (long long) code);
+	if(code != CURLE_OK && code != CURLE_HTTP_RETURNED_ERROR) {
+		STATSCOUNTER_INC(indexHTTPReqFail, mutIndexHTTPReqFail);
+		if(++req->nServerTries < pData->numServers) {
+			DBGPRINTF("omelasticsearch: request to '%s' failed: %s - trying next server\n",
+				req->restURL, req->errbuf);
+			req->serverIndex = (req->serverIndex + 1) % pData->numServers;
+			if(asyncRequestStart(pWrkrData, req) == RS_RET_OK)
+				return;
+		}
+		indexHTTPFail += req->nmemb;
+		LogError(0, RS_RET_SUSPENDED,
+			"omelasticsearch: we are suspending ourselfs due "
+			"to server failure %lld: %s", (long long) code, req->errbuf);
+		asyncSetError(pWrkrData, RS_RET_SUSPENDED);
+		asyncRequestRelease(pWrkrData, req);
+		return;
+	}
+
+	DBGPRINTF("omelasticsearch: bulk reply received, %d bytes kept\n",
+		(int) req->replyLen);
+	if(req->reply != NULL) {
+		req->reply[req->replyLen] = '\0';
+		DBGPRINTF("omelasticsearch: async reply: '%s'\n", req->reply);
+	}
+	bulk.buf = (char*) es_getBufAddr(req->data);
+	bulk.len = es_strlen(req->data) - 1;
+	bulk.offsets = req->offsets;
+	bulk.nmemb = req->nmemb;
+	localRet = checkBulkReply(pWrkrData, &req->parser, req->reply, req->restURL, &bulk,
+		req->nRetries < pData->maxRetries, &nRetry);
+	if(localRet != RS_RET_OK) {
+		asyncSetError(pWrkrData, localRet);
+	} else if(nRetry > 0) {
+		/* resubmit the temporarily failed items only, but give an overloaded
+		 * cluster some time to recover first. asyncStartRetries() picks the
+		 * request up when the backoff has expired.
+		 */
+		if(asyncBuildRetry(req, nRetry, &retry, &retryOffsets) == RS_RET_OK) {
+			es_deleteStr(req->data);
+			free(req->offsets);
+			req->data = retry;
+			req->offsets = retryOffsets;
+			req->maxOffsets = nRetry;
+			req->nmemb = nRetry;
+			req->nServerTries = 0;
+			req->retryAt = currentTimeMills() + asyncRetryBackoff(req->nRetries);
+			++req->nRetries;
+			DBGPRINTF("omelasticsearch: resubmitting %d items in %lld ms\n",
+				nRetry, req->retryAt - currentTimeMills());
+			return;
+		}
+		asyncSetError(pWrkrData, RS_RET_SUSPENDED);
+	}
+	asyncRequestRelease(pWrkrData, req);
+}
+
+/* start the requests whose retry backoff has expired. Returns the number
+ * of ms until the next backoff expires, or -1 if no request is waiting.
+ * The number of requests still waiting is stored in *pnWaiting.
+ */
+static long
+asyncStartRetries(wrkrInstanceData_t *const pWrkrData, int *const pnWaiting)
+{
+	esRequest_t *req;
+	long long now;
+	long timeout = -1;
+	int i;
+
+	*pnWaiting = 0;
+	now = currentTimeMills();
+	for(i = 0 ; i < pWrkrData->pData->maxInFlight ; ++i) {
+		req = &pWrkrData->async.reqs[i];
+		if(!req->bInUse || req->retryAt == 0)
+			continue;
+		if(req->retryAt <= now) {
+			if(asyncRequestStart(pWrkrData, req) != RS_RET_OK) {
+				asyncSetError(pWrkrData, RS_RET_SUSPENDED);
+				asyncRequestRelease(pWrkrData, req);
+			}
+		} else {
+			++(*pnWaiting);
+			if(timeout == -1 || req->retryAt - now < timeout)
+				timeout = (long) (req->retryAt - now);
+		}
+	}
+	return timeout;
+}
+
+/* process whatever the transfers have to offer right now, without waiting */
+static void
+asyncPoll(wrkrInstanceData_t *const pWrkrData)
+{
+	CURLM *const multi = pWrkrData->async.multi;
+	CURLMsg *msg;
+	CURL *curl;
+	CURLcode code;
+	esRequest_t *req;
+	int nRunning;
+	int nMsgs;
+
+	curl_multi_perform(multi, &nRunning);
+	while((msg = curl_multi_info_read(multi, &nMsgs)) != NULL) {
+		if(msg->msg != CURLMSG_DONE)
+			continue;
+		/* note: msg is invalid after the handle was removed */
+		curl = msg->easy_handle;
+		code = msg->data.result;
+		req = NULL;
+		curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**) &req);
+		curl_multi_remove_handle(multi, curl);
+		asyncRequestDone(pWrkrData, req, code);
+	}
+}
+
+/* drive the transfers until a request slot is free (bAll == 0) or
+ * all requests have been completed (bAll == 1).
+ */
+static void
+asyncWait(wrkrInstanceData_t *const pWrkrData, const int bAll)
+{
+	int nWaiting;
+	long timeout;
+
+	while(pWrkrData->async.nInFlight > 0) {
+		asyncPoll(pWrkrData);
+		timeout = asyncStartRetries(pWrkrData, &nWaiting);
+		if(!bAll && pWrkrData->async.nInFlight < pWrkrData->pData->maxInFlight)
+			break;
+		if(pWrkrData->async.nInFlight == 0)
+			break;
+		if(timeout == -1 || timeout > 1000)
+			timeout = 1000;
+		if(pWrkrData->async.nInFlight > nWaiting) {
+			curl_multi_wait(pWrkrData->async.multi, NULL, 0, (int) timeout, NULL);
+		} else {
+			/* all requests wait for their backoff, so curl_multi_wait()
+			 * has nothing to wait for and would return immediately */
+			srSleep(timeout / 1000, (timeout % 1000) * 1000);
+		}
+	}
+}
+
+/* hand the current batch over to a free request slot and start it */
+static rsRetVal
+submitBatchAsync(wrkrInstanceData_t *const pWrkrData)
+{
+	esRequest_t *req = NULL;
+	es_str_t *newBatch;
+	int i;
 	DEFiRet;
 
-	cstr = es_str2cstr(pWrkrData->batch.data, NULL);
-	dbgprintf("omelasticsearch: submitBatch, batch: '%s'\n", cstr);
+	asyncWait(pWrkrData, 0);
+	for(i = 0 ; i < pWrkrData->pData->maxInFlight ; ++i) {
+		if(!pWrkrData->async.reqs[i].bInUse) {
+			req = &pWrkrData->async.reqs[i];
+			break;
+		}
+	}
+	assert(req != NULL);
 
-	CHKiRet(curlPost(pWrkrData, (uchar*) cstr, strlen(cstr), NULL, pWrkrData->batch.nmemb));
+	CHKmalloc(newBatch = es_newStr(1024));
+	if(es_addChar(&pWrkrData->batch.data, '\0') != 0) {
+		es_deleteStr(newBatch);
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	req->data = pWrkrData->batch.data;
+	req->offsets = pWrkrData->batch.offsets;
+	req->maxOffsets = pWrkrData->batch.maxOffsets;
+	req->nmemb = pWrkrData->batch.nmemb;
+	pWrkrData->batch.data = newBatch;
+	pWrkrData->batch.offsets = NULL;
+	pWrkrData->batch.maxOffsets = 0;
+	pWrkrData->batch.nmemb = 0;
+
+	req->bInUse = 1;
+	++pWrkrData->async.nInFlight;
+	req->nRetries = 0;
+	req->nServerTries = 0;
+	req->serverIndex = pWrkrData->serverIndex;
+	incrementServerIndex(pWrkrData);
+	if(asyncRequestStart(pWrkrData, req) != RS_RET_OK) {
+		asyncRequestRelease(pWrkrData, req);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+asyncSetup(wrkrInstanceData_t *const pWrkrData)
+{
+	const int maxInFlight = pWrkrData->pData->maxInFlight;
+	esRequest_t *req;
+	int i;
+	DEFiRet;
+
+	CHKmalloc(pWrkrData->async.multi = curl_multi_init());
+	CHKmalloc(pWrkrData->async.reqs = calloc(maxInFlight, sizeof(esRequest_t)));
+	for(i = 0 ; i < maxInFlight ; ++i) {
+		req = &pWrkrData->async.reqs[i];
+		CHKmalloc(req->curl = curl_easy_init());
+		curlSetupCommon(pWrkrData, req->curl);
+		curl_easy_setopt(req->curl, CURLOPT_POST, 1);
+		curl_easy_setopt(req->curl, CURLOPT_WRITEFUNCTION, curlResultAsync);
+		curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, req);
+		curl_easy_setopt(req->curl, CURLOPT_PRIVATE, req);
+		curl_easy_setopt(req->curl, CURLOPT_ERRORBUFFER, req->errbuf);
+	}
 
 finalize_it:
-	free(cstr);
+	if(iRet != RS_RET_OK)
+		asyncCleanup(pWrkrData);
 	RETiRet;
 }
 
+static void
+asyncCleanup(wrkrInstanceData_t *const pWrkrData)
+{
+	esRequest_t *req;
+	int i;
+
+	if(pWrkrData->async.reqs != NULL) {
+		for(i = 0 ; i < pWrkrData->pData->maxInFlight ; ++i) {
+			req = &pWrkrData->async.reqs[i];
+			if(req->curl == NULL)
+				continue;
+			if(req->bInUse) {
+				curl_multi_remove_handle(pWrkrData->async.multi, req->curl);
+				asyncRequestRelease(pWrkrData, req);
+			}
+			esReplyParserDestruct(&req->parser);
+			curl_easy_cleanup(req->curl);
+		}
+		free(pWrkrData->async.reqs);
+		pWrkrData->async.reqs = NULL;
+	}
+	if(pWrkrData->async.multi != NULL) {
+		curl_multi_cleanup(pWrkrData->async.multi);
+		pWrkrData->async.multi = NULL;
+	}
+}
+
 BEGINbeginTransaction
 CODESTARTbeginTransaction
 	if(!pWrkrData->pData->bulkmode) {
@@ -1265,6 +2214,7 @@ CODESTARTbeginTransaction
 	}
 
 	initializeBatch(pWrkrData);
+	pWrkrData->async.iRet = RS_RET_OK;
 finalize_it:
 ENDbeginTransaction
 
@@ -1289,8 +2239,20 @@ CODESTARTdoAction
 		/* If there is only one item in the batch, all previous items have been
 	 	 * submitted or this is the first item for this transaction. Return previous
 		 * committed so that all items leading up to the current (exclusive)
-		 * are not replayed should a failure occur anywhere else in the transaction. */
-		iRet = pWrkrData->batch.nmemb == 1 ? RS_RET_PREVIOUS_COMMITTED : RS_RET_DEFER_COMMIT;
+		 * are not replayed should a failure occur anywhere else in the transaction.
+		 * In async mode, the previous items are only committed once all requests
+		 * carrying them have been answered successfully, so we collect what has
+		 * completed so far and commit only if nothing is left in flight. */
+		iRet = RS_RET_DEFER_COMMIT;
+		if(pWrkrData->batch.nmemb == 1) {
+			if(pWrkrData->async.multi == NULL) {
+				iRet = RS_RET_PREVIOUS_COMMITTED;
+			} else {
+				asyncPoll(pWrkrData);
+				if(pWrkrData->async.nInFlight == 0 && pWrkrData->async.iRet == RS_RET_OK)
+					iRet = RS_RET_PREVIOUS_COMMITTED;
+			}
+		}
 	} else {
 		CHKiRet(curlPost(pWrkrData, ppString[0], strlen((char*)ppString[0]),
 		                 ppString, 1));
@@ -1309,6 +2271,12 @@ CODESTARTendTransaction
 			"nothing to send. \n");
 	}
 finalize_it:
+	if(pWrkrData->async.multi != NULL) {
+		/* the transaction is only done when all requests are done */
+		asyncWait(pWrkrData, 1);
+		if(iRet == RS_RET_OK)
+			iRet = pWrkrData->async.iRet;
+	}
 ENDendTransaction
 
 static rsRetVal
@@ -1378,6 +2346,8 @@ curlPostSetup(wrkrInstanceData_t *const pWrkrData)
 	PTR_ASSERT_SET_TYPE(pWrkrData, WRKR_DATA_TYPE_ES);
 	curlSetupCommon(pWrkrData, pWrkrData->curlPostHandle);
 	curl_easy_setopt(pWrkrData->curlPostHandle, CURLOPT_POST, 1);
+	if(pWrkrData->pData->bulkmode)
+		curl_easy_setopt(pWrkrData->curlPostHandle, CURLOPT_WRITEFUNCTION, curlResultBulk);
 }
 
 #define CONTENT_JSON "Content-Type: application/json; charset=utf-8"
@@ -1422,6 +2392,8 @@ setInstParamDefaults(instanceData *const pData)
 	pData->useHttps = 0;
 	pData->bulkmode = 0;
 	pData->maxbytes = 104857600; //100 MB Is the default max message size that ships with ElasticSearch
+	pData->maxInFlight = 1;
+	pData->maxRetries = 3;
 	pData->allowUnsignedCerts = 0;
 	pData->tplName = NULL;
 	pData->errorFile = NULL;
@@ -1489,6 +2461,10 @@ CODESTARTnewActInst
 			pData->bulkmode = pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "maxbytes")) {
 			pData->maxbytes = (size_t) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "maxinflight")) {
+			pData->maxInFlight = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "maxretries")) {
+			pData->maxRetries = (int) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "allowunsignedcerts")) {
 			pData->allowUnsignedCerts = pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "timeout")) {
@@ -1577,6 +2553,13 @@ CODESTARTnewActInst
 		ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
 	}
 
+	if(pData->maxInFlight > 1 && !pData->bulkmode) {
+		LogMsg(0, RS_RET_OK, LOG_WARNING,
+			"omelasticsearch: maxinflight is only supported in bulkmode "
+			"- requests will be sent synchronously");
+		pData->maxInFlight = 1;
+	}
+
 	if (pData->uid != NULL)
 		CHKiRet(computeAuthHeader((char*) pData->uid, (char*) pData->pwd, &pData->authBuf));
 
@@ -1738,6 +2721,9 @@ CODEmodInit_QueryRegCFSLineHdlr
 	STATSCOUNTER_INIT(indexESFail, mutIndexESFail);
 	CHKiRet(statsobj.AddCounter(indexStats, (uchar *)"failed.es",
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &indexESFail));
+	STATSCOUNTER_INIT(indexRetries, mutIndexRetries);
+	CHKiRet(statsobj.AddCounter(indexStats, (uchar *)"retries",
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &indexRetries));
 	CHKiRet(statsobj.ConstructFinalize(indexStats));
 ENDmodInit
 
@@ -1,7 +1,7 @@
 /* omkafka.c
  * This output plugin make rsyslog talk to Apache Kafka.
  *
- * Copyright 2014-2017 by Adiscon GmbH.
+ * Copyright 2014-2018 by Adiscon GmbH.
  *
  * This file is part of rsyslog.
  *
@@ -47,6 +47,8 @@
 #include "statsobj.h"
 #include "unicode-helper.h"
 #include "datetime.h"
+#include "hashtable.h"
+#include "hashtable_itr.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -92,6 +94,7 @@ static unsigned clockTopicAccess = 0;
 /* and the "tick" function */
 #ifndef HAVE_ATOMIC_BUILTINS
 static pthread_mutex_t mutClock;
+static pthread_mutex_t mutBatchRefs;
 #endif
 static uint64
 getClockTopicAccess(void)
@@ -109,15 +112,29 @@ getClockTopicAccess(void)
 static int closeTimeout = 1000;
 static pthread_mutex_t closeTimeoutMut = PTHREAD_MUTEX_INITIALIZER;
 
-/* dynamic topic cache */
+/* dynamic topic cache entry. The cache is a hash table keyed by topic
+ * name. Entries are reference counted: the cache holds one reference,
+ * and every user one more while it produces to the topic. So an entry
+ * evicted while still in use is destroyed by its last user.
+ */
 struct s_dynaTopicCacheEntry {
-	uchar *pName;
 	rd_kafka_topic_t *pTopic;
 	uint64 clkTickAccessed;
-	pthread_rwlock_t lock;
+	int nRefs;
 };
 typedef struct s_dynaTopicCacheEntry dynaTopicCacheEntry;
 
+/* payloads of a transaction. They are copied into a single block, which
+ * librdkafka references instead of copying each message itself. Every
+ * message produced holds a reference, which is dropped in the delivery
+ * callback; the last one frees the block.
+ */
+struct s_kafkaBatch {
+	int nRefs;
+	char data[];
+};
+typedef struct s_kafkaBatch kafkaBatch_t;
+
 /* Struct for Failed Messages Listitems */
 struct s_failedmsg_entry {
 	uchar* payload;
@@ -129,16 +146,16 @@ typedef struct s_failedmsg_entry failedmsg_entry;
 typedef struct _instanceData {
 	uchar *topic;
 	sbool dynaTopic;
-	dynaTopicCacheEntry **dynCache;
-	pthread_mutex_t mutDynCache;
+	struct hashtable *dynCache;
+	pthread_rwlock_t rwDynCache;	/* guards the hash table, not the entries */
+	DEF_ATOMIC_HELPER_MUT(mutDynCacheRefs);
 	rd_kafka_topic_t *pTopic;
-	int iCurrElt;
-	int iCurrCacheSize;
 	int bReportErrs;
 	int iDynaTopicCacheSize;
 	uchar *tplName;		/* assigned output template */
 	char *brokers;
 	sbool autoPartition;
+	sbool bProduceBatch;	/* use rd_kafka_produce_batch() for transactions */
 	int fixedPartition;
 	int nPartitions;
 	uint32_t currPartition;
@@ -191,7 +208,8 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "reopenonhup", eCmdHdlrBinary, 0 },
 	{ "resubmitonfailure", eCmdHdlrBinary, 0 },	/* Resubmit message into kafaj queue on failure */
 	{ "keepfailedmessages", eCmdHdlrBinary, 0 },
-	{ "failedmsgfile", eCmdHdlrGetWord, 0 }
+	{ "failedmsgfile", eCmdHdlrGetWord, 0 },
+	{ "produce.batch", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -267,61 +285,69 @@ closeTopic(instanceData *__restrict__ const pData)
 	d_free_topic(&pData->pTopic);
 }
 
-/* these dynaTopic* functions are only slightly modified versions of those found in omfile.c.
- * check the sources in omfile.c for more descriptive comments about each of these functions.
- * i will only put the bare descriptions in this one. 2015-01-09 - Tait Clarridge
+/* drop a reference to a dynamic topic cache entry, destroying the
+ * entry if it was the last one.
+ * must be called with _atleast_ read(rkLock)
  */
-
-/* delete a cache entry from the dynamic topic cache */
-/* must be called with lock(mutDynCache) */
-static rsRetVal
-dynaTopicDelCacheEntry(instanceData *__restrict__ const pData, const int iEntry, const int bFreeEntry)
+static void
+dynaTopicRelease(instanceData *__restrict__ const pData, dynaTopicCacheEntry *const entry)
 {
-	dynaTopicCacheEntry **pCache = pData->dynCache;
-	DEFiRet;
-	ASSERT(pCache != NULL);
-
-	if(pCache[iEntry] == NULL)
-		FINALIZE;
-	pthread_rwlock_wrlock(&pCache[iEntry]->lock);
-
-	DBGPRINTF("Removing entry %d for topic '%s' from dynaCache.\n", iEntry,
-		pCache[iEntry]->pName == NULL ? UCHAR_CONSTANT("[OPEN FAILED]") : pCache[iEntry]->pName);
-
-	if(pCache[iEntry]->pName != NULL) {
-		d_free(pCache[iEntry]->pName);
-		pCache[iEntry]->pName = NULL;
+	if(ATOMIC_DEC_AND_FETCH(&entry->nRefs, &pData->mutDynCacheRefs) == 0) {
+		d_free_topic(&entry->pTopic);
+		free(entry);
 	}
-
-	pthread_rwlock_unlock(&pCache[iEntry]->lock);
-
-	if(bFreeEntry) {
-		pthread_rwlock_destroy(&pCache[iEntry]->lock);
-		d_free(pCache[iEntry]);
-		pCache[iEntry] = NULL;
-	}
-
-finalize_it:
-	RETiRet;
 }
 
 /* clear the entire dynamic topic cache */
+/* must be called with write(rkLock) */
 static void
 dynaTopicFreeCacheEntries(instanceData *__restrict__ const pData)
 {
-	register int i;
+	struct hashtable_itr *itr;
 	ASSERT(pData != NULL);
 
 	BEGINfunc;
-	pthread_mutex_lock(&pData->mutDynCache);
-	for(i = 0 ; i < pData->iCurrCacheSize ; ++i) {
-		dynaTopicDelCacheEntry(pData, i, 1);
+	pthread_rwlock_wrlock(&pData->rwDynCache);
+	if(pData->dynCache != NULL && hashtable_count(pData->dynCache) > 0) {
+		if((itr = hashtable_iterator(pData->dynCache)) != NULL) {
+			do {
+				dynaTopicRelease(pData, hashtable_iterator_value(itr));
+			} while(hashtable_iterator_remove(itr));
+			free(itr);
+		}
 	}
-	pData->iCurrElt = -1; /* invalidate current element */
-	pthread_mutex_unlock(&pData->mutDynCache);
+	pthread_rwlock_unlock(&pData->rwDynCache);
 	ENDfunc;
 }
 
+/* remove the least recently used entry from the dynamic topic cache */
+/* must be called with write(rwDynCache) */
+static void
+dynaTopicEvictOldest(instanceData *__restrict__ const pData)
+{
+	struct hashtable_itr *itr;
+	dynaTopicCacheEntry *entry;
+	dynaTopicCacheEntry *oldest = NULL;
+	char *oldestKey = NULL;
+
+	if(hashtable_count(pData->dynCache) == 0
+	   || (itr = hashtable_iterator(pData->dynCache)) == NULL)
+		return;
+	do {
+		entry = hashtable_iterator_value(itr);
+		if(oldest == NULL || entry->clkTickAccessed < oldest->clkTickAccessed) {
+			oldest = entry;
+			oldestKey = hashtable_iterator_key(itr);
+		}
+	} while(hashtable_iterator_advance(itr));
+	free(itr);
+
+	DBGPRINTF("omkafka: removing topic '%s' from dynaCache.\n", oldestKey);
+	hashtable_remove(pData->dynCache, oldestKey);
+	dynaTopicRelease(pData, oldest);
+	STATSCOUNTER_INC(ctrCacheEvict, mutCtrCacheEvict);
+}
+
 /* create the topic object */
 /* must be called with _atleast_ read(rkLock) */
 static rsRetVal
@@ -384,92 +410,52 @@ prepareTopic(instanceData *__restrict__ const pData, const uchar *__restrict__ c
 }
 
 /* check dynamic topic cache for existence of the already created topic.
- * if it does not exist, create a new one, or if we are currently using it
- * as of the last message, keep using it.
+ * if it does not exist, create a new one. Lookups only need a read lock
+ * on the cache, so they do not block each other. On success, the caller
+ * receives a reference to the entry, which it must drop with
+ * dynaTopicRelease() when done with the topic.
  *
  * must be called with read(rkLock)
- * must be called with mutDynCache locked
  */
 static rsRetVal ATTR_NONNULL()
 prepareDynTopic(instanceData *__restrict__ const pData, const uchar *__restrict__ const newTopicName,
-				rd_kafka_topic_t** topic, pthread_rwlock_t** lock)
+				dynaTopicCacheEntry **const pEntry)
 {
-	uint64 ctOldest;
-	int iOldest;
-	int i;
-	int iFirstFree;
 	rsRetVal localRet;
-	dynaTopicCacheEntry **pCache;
 	dynaTopicCacheEntry *entry = NULL;
 	rd_kafka_topic_t *tmpTopic = NULL;
+	char *key = NULL;
+	int bLocked = 0;
 	DEFiRet;
 	ASSERT(pData != NULL);
 	ASSERT(newTopicName != NULL);
 
-	pCache = pData->dynCache;
-	/* first check, if we still have the current topic */
-	if ((pData->iCurrElt != -1)
-		&& !ustrcmp(newTopicName, pCache[pData->iCurrElt]->pName)) {
-			/* great, we are all set */
-			pCache[pData->iCurrElt]->clkTickAccessed = getClockTopicAccess();
-			entry = pCache[pData->iCurrElt];
-			STATSCOUNTER_INC(ctrCacheSkip, mutCtrCacheSkip);
-			FINALIZE;
+	pthread_rwlock_rdlock(&pData->rwDynCache);
+	entry = hashtable_search(pData->dynCache, (void*) newTopicName);
+	if(entry != NULL) {
+		/* update "timestamp" for LRU */
+		entry->clkTickAccessed = getClockTopicAccess();
+		ATOMIC_INC(&entry->nRefs, &pData->mutDynCacheRefs);
 	}
+	pthread_rwlock_unlock(&pData->rwDynCache);
+	if(entry != NULL)
+		FINALIZE;
 
-	/* ok, no luck. Now let's search the table if we find a matching spot.
-	 * While doing so, we also prepare for creation of a new one.
+	/* ok, no luck. We need to create the topic. Someone else may have
+	 * done so while we did not hold the lock, so we need to re-check.
 	 */
-	pData->iCurrElt = -1;
-	iFirstFree = -1;
-	iOldest = 0;
-	ctOldest = getClockTopicAccess();
-	for(i = 0 ; i < pData->iCurrCacheSize ; ++i) {
-		if(pCache[i] == NULL || pCache[i]->pName == NULL) {
-			if(iFirstFree == -1)
-				iFirstFree = i;
-		} else { /*got an element, let's see if it matches */
-			if(!ustrcmp(newTopicName, pCache[i]->pName)) {
-				/* we found our element! */
-				entry = pCache[i];
-				pData->iCurrElt = i;
-				/* update "timestamp" for LRU */
-				pCache[i]->clkTickAccessed = getClockTopicAccess();
-				FINALIZE;
-			}
-			/* did not find it - so lets keep track of the counters for LRU */
-			if(pCache[i]->clkTickAccessed < ctOldest) {
-				ctOldest = pCache[i]->clkTickAccessed;
-				iOldest = i;
-			}
-		}
+	pthread_rwlock_wrlock(&pData->rwDynCache);
+	bLocked = 1;
+	entry = hashtable_search(pData->dynCache, (void*) newTopicName);
+	if(entry != NULL) {
+		entry->clkTickAccessed = getClockTopicAccess();
+		ATOMIC_INC(&entry->nRefs, &pData->mutDynCacheRefs);
+		FINALIZE;
 	}
 	STATSCOUNTER_INC(ctrCacheMiss, mutCtrCacheMiss);
 
-	/* invalidate iCurrElt as we may error-exit out of this function when the currrent
-	 * iCurrElt has been freed or otherwise become unusable. This is a precaution, and
-	 * performance-wise it may be better to do that in each of the exits. However, that
-	 * is error-prone, so I prefer to do it here. -- rgerhards, 2010-03-02
-	 */
-	pData->iCurrElt = -1;
-
-	if(iFirstFree == -1 && (pData->iCurrCacheSize < pData->iDynaTopicCacheSize)) {
-		/* there is space left, so set it to that index */
-		iFirstFree = pData->iCurrCacheSize++;
-	}
-
-	if(iFirstFree == -1) {
-		dynaTopicDelCacheEntry(pData, iOldest, 0);
-		STATSCOUNTER_INC(ctrCacheEvict, mutCtrCacheEvict);
-		iFirstFree = iOldest; /* this one *is* now free ;) */
-	} else {
-		pCache[iFirstFree] = NULL;
-	}
-	/* we need to allocate memory for the cache structure */
-	if(pCache[iFirstFree] == NULL) {
-		CHKmalloc(pCache[iFirstFree] =
-			(dynaTopicCacheEntry*) calloc(1, sizeof(dynaTopicCacheEntry)));
-		CHKiRet(pthread_rwlock_init(&pCache[iFirstFree]->lock, NULL));
+	if((int) hashtable_count(pData->dynCache) >= pData->iDynaTopicCacheSize) {
+		dynaTopicEvictOldest(pData);
 	}
 
 	/* Ok, we finally can open the topic */
@@ -482,20 +468,30 @@ prepareDynTopic(instanceData *__restrict__ const pData, const uchar *__restrict_
 		ABORT_FINALIZE(localRet);
 	}
 
-	if((pCache[iFirstFree]->pName = ustrdup(newTopicName)) == NULL) {
-		d_free_topic(&tmpTopic);
+	CHKmalloc(entry = calloc(1, sizeof(dynaTopicCacheEntry)));
+	entry->pTopic = tmpTopic;
+	tmpTopic = NULL;
+	entry->clkTickAccessed = getClockTopicAccess();
+	entry->nRefs = 2; /* one for the cache, one for our caller */
+	CHKmalloc(key = strdup((char*) newTopicName));
+	if(!hashtable_insert(pData->dynCache, key, entry)) {
 		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
-	pCache[iFirstFree]->pTopic = tmpTopic;
-	pCache[iFirstFree]->clkTickAccessed = getClockTopicAccess();
-	entry = pCache[iFirstFree];
-	pData->iCurrElt = iFirstFree;
-	DBGPRINTF("Added new entry %d for topic cache, topic '%s'.\n", iFirstFree, newTopicName);
+	key = NULL; /* now owned by the hash table */
+	DBGPRINTF("Added new entry for topic cache, topic '%s'.\n", newTopicName);
 
 finalize_it:
-	if (iRet == RS_RET_OK) {
-		*topic = entry->pTopic;
-		*lock = &entry->lock;
+	if(bLocked)
+		pthread_rwlock_unlock(&pData->rwDynCache);
+	if(iRet == RS_RET_OK) {
+		*pEntry = entry;
+	} else {
+		free(key);
+		if(entry != NULL) {
+			d_free_topic(&entry->pTopic);
+			free(entry);
+		}
+		d_free_topic(&tmpTopic);
 	}
 	RETiRet;
 }
@@ -579,9 +575,8 @@ writeKafka(instanceData *const pData, uchar *const msg,
 	DEFiRet;
 	const int partition = getPartition(pData);
 	rd_kafka_topic_t *rkt = NULL;
-	pthread_rwlock_t *dynTopicLock = NULL;
+	dynaTopicCacheEntry *dynTopicEntry = NULL;
 	failedmsg_entry* fmsgEntry;
-	int topic_mut_locked = 0;
 #if RD_KAFKA_VERSION >= 0x00090400
 	rd_kafka_resp_err_t msg_kafka_response;
 	int64_t ttMsgTimestamp;
@@ -594,15 +589,8 @@ writeKafka(instanceData *const pData, uchar *const msg,
 
 	if(pData->dynaTopic) {
 		DBGPRINTF("omkafka: topic to insert to: %s\n", topic);
-		/* ensure locking happens all inside this function */
-		pthread_mutex_lock(&pData->mutDynCache);
-		const rsRetVal localRet = prepareDynTopic(pData, topic, &rkt, &dynTopicLock);
-		if (localRet == RS_RET_OK) {
-			pthread_rwlock_rdlock(dynTopicLock);
-			topic_mut_locked = 1;
-		}
-		pthread_mutex_unlock(&pData->mutDynCache);
-		CHKiRet(localRet);
+		CHKiRet(prepareDynTopic(pData, topic, &dynTopicEntry));
+		rkt = dynTopicEntry->pTopic;
 	} else {
 		rkt = pData->pTopic;
 	}
@@ -700,8 +688,8 @@ writeKafka(instanceData *const pData, uchar *const msg,
 	}
 
 finalize_it:
-	if(topic_mut_locked) {
-		pthread_rwlock_unlock(dynTopicLock);
+	if(dynTopicEntry != NULL) {
+		dynaTopicRelease(pData, dynTopicEntry);
 	}
 	DBGPRINTF("omkafka: writeKafka returned %d\n", iRet);
 	if(iRet != RS_RET_OK) {
@@ -712,6 +700,227 @@ finalize_it:
 	RETiRet;
 }
 
+/* drop a reference to a transaction's payload block */
+static void
+batchRelease(kafkaBatch_t *const batch)
+{
+	if(ATOMIC_DEC_AND_FETCH(&batch->nRefs, &mutBatchRefs) == 0) {
+		free(batch);
+	}
+}
+
+/* handle a message librdkafka did not accept. Depending on config, it is
+ * kept for resubmission or reported (and written to the error file) and
+ * discarded. We never fail here: other messages of the transaction may
+ * already be produced, so the transaction must not be retried.
+ * must be called with read(rkLock)
+ */
+static void
+produceFailed(instanceData *const pData, rd_kafka_topic_t *const rkt, const int32_t partition,
+	const char *const payload, const size_t len, const rd_kafka_resp_err_t err)
+{
+	failedmsg_entry* fmsgEntry;
+
+	STATSCOUNTER_INC(ctrKafkaFail, mutCtrKafkaFail);
+	if(pData->bResubmitOnFailure) {
+		DBGPRINTF("omkafka: Failed to produce to topic '%s' partition %d: '%d/%s' "
+			"- adding MSG '%.*s' to failed for RETRY!\n",
+			rd_kafka_topic_name(rkt), partition, err, rd_kafka_err2str(err),
+			(int) len, payload);
+		fmsgEntry = failedmsg_entry_construct(payload, len, rd_kafka_topic_name(rkt));
+		if(fmsgEntry == NULL) {
+			LogError(0, RS_RET_OUT_OF_MEMORY, "omkafka: out of memory, cannot keep "
+				"message for topic '%s' for resubmission - discarding it",
+				rd_kafka_topic_name(rkt));
+			return;
+		}
+		SLIST_INSERT_HEAD(&pData->failedmsg_head, fmsgEntry, entries);
+	} else {
+		LogError(0, RS_RET_KAFKA_PRODUCE_ERR,
+			"omkafka: Failed to produce to topic '%s' partition %d: %d/%s "
+			"- discarding message\n",
+			rd_kafka_topic_name(rkt), partition, err, rd_kafka_err2str(err));
+		writeDataError(pData, payload, len, err);
+	}
+}
+
+/* produce the messages of a transaction one by one. This keeps the
+ * message timestamp, which rd_kafka_produce_batch() does not support.
+ * must be called with read(rkLock)
+ */
+static rsRetVal
+produceSingle(instanceData *const pData, rd_kafka_message_t *const rkmsgs,
+	actWrkrIParams_t *const pParams, const int nTpls, const unsigned nMsgs,
+	kafkaBatch_t *const batch)
+{
+	unsigned i;
+#if RD_KAFKA_VERSION >= 0x00090400
+	uchar *msgTimestamp;
+	int64_t ttMsgTimestamp;
+#endif
+	DEFiRet;
+
+	for(i = 0 ; i < nMsgs ; ++i) {
+		ATOMIC_INC(&batch->nRefs, &mutBatchRefs);
+#if RD_KAFKA_VERSION >= 0x00090400
+		msgTimestamp = actParam(pParams, nTpls, i, 1).param;
+		ttMsgTimestamp = atoi((char*)msgTimestamp); /* Convert timestamp into int */
+		ttMsgTimestamp *= 1000; /* Timestamp in Milliseconds for kafka */
+		rkmsgs[i].err = rd_kafka_producev(pData->rk,
+					RD_KAFKA_V_RKT(rkmsgs[i].rkt),
+					RD_KAFKA_V_PARTITION(rkmsgs[i].partition),
+					RD_KAFKA_V_VALUE(rkmsgs[i].payload, rkmsgs[i].len),
+					RD_KAFKA_V_MSGFLAGS(0),
+					RD_KAFKA_V_TIMESTAMP(ttMsgTimestamp),
+					RD_KAFKA_V_KEY(rkmsgs[i].key, rkmsgs[i].key_len),
+					RD_KAFKA_V_OPAQUE(batch),
+					RD_KAFKA_V_END);
+#else
+		if(rd_kafka_produce(rkmsgs[i].rkt, rkmsgs[i].partition, 0,
+		   rkmsgs[i].payload, rkmsgs[i].len, rkmsgs[i].key, rkmsgs[i].key_len,
+		   batch) == -1) {
+			rkmsgs[i].err = rd_kafka_errno2err(errno);
+		}
+#endif
+		if(rkmsgs[i].err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+			batchRelease(batch);
+			produceFailed(pData, rkmsgs[i].rkt, rkmsgs[i].partition,
+				rkmsgs[i].payload, rkmsgs[i].len, rkmsgs[i].err);
+		}
+		STATSCOUNTER_INC(ctrTopicSubmit, mutCtrTopicSubmit);
+	}
+	RETiRet;
+}
+
+/* produce the messages of a transaction with one rd_kafka_produce_batch()
+ * call per topic and partition. Kafka assigns the produce time as message
+ * timestamp in this mode.
+ * must be called with read(rkLock)
+ */
+static rsRetVal
+produceBatch(instanceData *const pData, rd_kafka_message_t *const rkmsgs,
+	const unsigned nMsgs, kafkaBatch_t *const batch)
+{
+	rd_kafka_message_t *grp = NULL;
+	rd_kafka_topic_t *rkt;
+	int32_t partition;
+	unsigned i, j;
+	int nGrp;
+	int k;
+	DEFiRet;
+
+	CHKmalloc(grp = malloc(nMsgs * sizeof(rd_kafka_message_t)));
+	/* rkt == NULL marks messages already produced */
+	for(i = 0 ; i < nMsgs ; ++i) {
+		if(rkmsgs[i].rkt == NULL)
+			continue;
+		rkt = rkmsgs[i].rkt;
+		partition = rkmsgs[i].partition;
+		nGrp = 0;
+		for(j = i ; j < nMsgs ; ++j) {
+			if(rkmsgs[j].rkt == rkt && rkmsgs[j].partition == partition) {
+				grp[nGrp++] = rkmsgs[j];
+				rkmsgs[j].rkt = NULL;
+				ATOMIC_INC(&batch->nRefs, &mutBatchRefs);
+			}
+		}
+		const int nProduced = rd_kafka_produce_batch(rkt, partition, 0, grp, nGrp);
+		DBGPRINTF("omkafka: produced %d of %d messages to topic '%s' partition %d\n",
+			nProduced, nGrp, rd_kafka_topic_name(rkt), partition);
+		for(k = 0 ; k < nGrp ; ++k) {
+			if(grp[k].err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+				batchRelease(batch);
+				produceFailed(pData, rkt, partition,
+					grp[k].payload, grp[k].len, grp[k].err);
+			}
+		}
+		STATSCOUNTER_ADD(ctrTopicSubmit, mutCtrTopicSubmit, nGrp);
+	}
+
+finalize_it:
+	free(grp);
+	RETiRet;
+}
+
+/* write all messages of a transaction to kafka. The payloads are copied
+ * once into a batch block, which librdkafka then references until the
+ * delivery callback. Topics are resolved once per run of messages to
+ * the same topic. An error is only returned if nothing was produced.
+ * must be called with read(rkLock)
+ */
+static rsRetVal
+writeKafkaBatch(instanceData *const pData, actWrkrIParams_t *const pParams, const unsigned nMsgs)
+{
+	const int nTpls = pData->dynaTopic ? 3 : 2;
+	kafkaBatch_t *batch = NULL;
+	rd_kafka_message_t *rkmsgs = NULL;
+	dynaTopicCacheEntry **topics = NULL;
+	unsigned nTopics = 0;
+	const uchar *topic;
+	const uchar *lastTopic = NULL;
+	rd_kafka_topic_t *rkt = pData->pTopic;
+	size_t lenTotal = 0;
+	size_t offs = 0;
+	unsigned i;
+	DEFiRet;
+
+	/* note: not all template types maintain lenStr, so we need strlen() */
+	CHKmalloc(rkmsgs = calloc(nMsgs, sizeof(rd_kafka_message_t)));
+	for(i = 0 ; i < nMsgs ; ++i) {
+		rkmsgs[i].len = strlen((char*) actParam(pParams, nTpls, i, 0).param);
+		lenTotal += rkmsgs[i].len;
+	}
+	CHKmalloc(batch = malloc(sizeof(kafkaBatch_t) + lenTotal));
+	batch->nRefs = 1; /* our own, dropped when done */
+	if(pData->dynaTopic)
+		CHKmalloc(topics = malloc(nMsgs * sizeof(dynaTopicCacheEntry*)));
+
+	for(i = 0 ; i < nMsgs ; ++i) {
+		if(pData->dynaTopic) {
+			topic = actParam(pParams, nTpls, i, 2).param;
+			if(lastTopic != NULL && !ustrcmp(topic, lastTopic)) {
+				STATSCOUNTER_INC(ctrCacheSkip, mutCtrCacheSkip);
+			} else {
+				CHKiRet(prepareDynTopic(pData, topic, &topics[nTopics]));
+				rkt = topics[nTopics++]->pTopic;
+				lastTopic = topic;
+			}
+		}
+		memcpy(batch->data + offs, actParam(pParams, nTpls, i, 0).param, rkmsgs[i].len);
+		rkmsgs[i].rkt = rkt;
+		rkmsgs[i].partition = getPartition(pData);
+		rkmsgs[i].payload = batch->data + offs;
+		rkmsgs[i].key = pData->key;
+		rkmsgs[i].key_len = (pData->key == NULL) ? 0 : ustrlen(pData->key);
+		rkmsgs[i]._private = batch;
+		offs += rkmsgs[i].len;
+	}
+
+	if(pData->bProduceBatch) {
+		iRet = produceBatch(pData, rkmsgs, nMsgs, batch);
+	} else {
+		iRet = produceSingle(pData, rkmsgs, pParams, nTpls, nMsgs, batch);
+	}
+
+	const int callbacksCalled = rd_kafka_poll(pData->rk, 0); /* call callbacks */
+	DBGPRINTF("omkafka: writeKafkaBatch %u msgs, kafka outqueue length: %d, "
+		"callbacks called %d\n", nMsgs, rd_kafka_outq_len(pData->rk), callbacksCalled);
+	STATSCOUNTER_SETMAX_NOMUT(ctrQueueSize, (unsigned) rd_kafka_outq_len(pData->rk));
+
+finalize_it:
+	for(i = 0 ; i < nTopics ; ++i)
+		dynaTopicRelease(pData, topics[i]);
+	free(topics);
+	free(rkmsgs);
+	if(batch != NULL)
+		batchRelease(batch);
+	if(iRet != RS_RET_OK) {
+		DBGPRINTF("omkafka: writeKafkaBatch returned %d\n", iRet);
+		iRet = RS_RET_SUSPENDED;
+	}
+	RETiRet;
+}
+
 static void
 deliveryCallback(rd_kafka_t __attribute__((unused)) *rk,
 	const rd_kafka_message_t *rkmessage,
@@ -746,6 +955,10 @@ deliveryCallback(rd_kafka_t __attribute__((unused)) *rk,
 			(char*)rkmessage->payload);
 	}
 finalize_it:
+	/* the payload is no longer referenced by librdkafka */
+	if(rkmessage->_private != NULL) {
+		batchRelease((kafkaBatch_t*) rkmessage->_private);
+	}
 	if(iRet != RS_RET_OK) {
 		DBGPRINTF("omkafka: deliveryCallback returned failure %d\n", iRet);
 	}
@@ -1216,7 +1429,8 @@ CODESTARTcreateInstance
 	CHKiRet(pthread_mutex_init(&pData->mut_doAction, NULL));
 	CHKiRet(pthread_mutex_init(&pData->mutErrFile, NULL));
 	CHKiRet(pthread_rwlock_init(&pData->rkLock, NULL));
-	CHKiRet(pthread_mutex_init(&pData->mutDynCache, NULL));
+	CHKiRet(pthread_rwlock_init(&pData->rwDynCache, NULL));
+	INIT_ATOMIC_HELPER_MUT(pData->mutDynCacheRefs);
 	INIT_ATOMIC_HELPER_MUT(pData->mutCurrPartition);
 finalize_it:
 ENDcreateInstance
@@ -1243,7 +1457,7 @@ CODESTARTfreeInstance
 	pthread_rwlock_wrlock(&pData->rkLock);
 	closeKafka(pData);
 	if(pData->dynaTopic && pData->dynCache != NULL) {
-		d_free(pData->dynCache);
+		hashtable_destroy(pData->dynCache, 0); /* entries released on close */
 		pData->dynCache = NULL;
 	}
 	/* Persist failed messages */
@@ -1280,7 +1494,8 @@ CODESTARTfreeInstance
 	pthread_rwlock_destroy(&pData->rkLock);
 	pthread_mutex_destroy(&pData->mut_doAction);
 	pthread_mutex_destroy(&pData->mutErrFile);
-	pthread_mutex_destroy(&pData->mutDynCache);
+	pthread_rwlock_destroy(&pData->rwDynCache);
+	DESTROY_ATOMIC_HELPER_MUT(pData->mutDynCacheRefs);
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
@@ -1318,24 +1533,32 @@ finalize_it:
 ENDtryResume
 
 
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+	/* we have nothing to do to begin a transaction */
+ENDbeginTransaction
+
+
 /* IMPORTANT NOTE on multithreading:
  * librdkafka creates background threads itself. So omkafka basically needs to move
  * memory buffers over to librdkafka, which then does the heavy hauling. As such, we
  * think that it is best to run max one wrkr instance of omkafka -- otherwise we just
  * get additional locking (contention) overhead without any real gain. As such,
- * we use a global mutex for doAction which ensures only one worker can be active
+ * we use a global mutex for commitTransaction which ensures only one worker can be active
  * at any given time. That mutex is also used to guard utility functions (like
  * tryResume) which may also be accessed by multiple workers in parallel.
  * Note: shall this method be changed, the kafka connection/suspension handling needs
  * to be refactored. The current code assumes that all workers share state information
  * including librdkafka handles.
+ * A transaction is only suspended before any of its messages is produced.
+ * Messages librdkafka does not accept are kept for resubmission or, if
+ * resubmitonfailure is off, reported and discarded - retrying the whole
+ * transaction would send the other messages twice.
  */
-BEGINdoAction
-CODESTARTdoAction
-	failedmsg_entry* fmsgEntry;
+BEGINcommitTransaction
 	instanceData *const pData = pWrkrData->pData;
 	int need_unlock = 0;
-
+CODESTARTcommitTransaction
 	pthread_mutex_lock(&pData->mut_doAction);
 	if (! pData->bIsOpen)
 		CHKiRet(setupKafkaHandle(pData, 0));
@@ -1346,30 +1569,28 @@ CODESTARTdoAction
 
 	/* We need to trigger callbacks first in order to suspend the Action properly on failure */
 	const int callbacksCalled = rd_kafka_poll(pData->rk, 0); /* call callbacks */
-	DBGPRINTF("omkafka: doAction kafka outqueue length: %d, callbacks called %d\n",
+	DBGPRINTF("omkafka: commitTransaction kafka outqueue length: %d, callbacks called %d\n",
 		rd_kafka_outq_len(pData->rk), callbacksCalled);
 
-	/* Reprocess failed messages! */
+	/* Suspend Action if broker problems were reported in error callback */
+	if (pData->bIsSuspended) {
+		DBGPRINTF("omkafka: commitTransaction broker failure detected, suspending action\n");
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+
+	/* Reprocess failed messages! The messages of this transaction are
+	 * kept by the rsyslog core if we need to suspend.
+	 */
 	if (pData->bResubmitOnFailure) {
 		iRet = checkFailedMessages(pData);
 		if(iRet != RS_RET_OK) {
-			DBGPRINTF("omkafka: doAction failed to submit FAILED messages with status %d\n", iRet);
-
-			if (pData->bResubmitOnFailure) {
-				DBGPRINTF("omkafka: also adding MSG '%.*s' for topic '%s' to failed for RETRY!\n",
-					(int)(strlen((char*)ppString[0])-1), ppString[0],
-					pData->dynaTopic ? ppString[2] : pData->topic);
-				CHKmalloc(fmsgEntry = failedmsg_entry_construct((char*)ppString[0],
-					strlen((char*)ppString[0]),
-					(char*) (pData->dynaTopic ? ppString[2] : pData->topic)));
-				SLIST_INSERT_HEAD(&pData->failedmsg_head, fmsgEntry, entries);
-			}
+			DBGPRINTF("omkafka: commitTransaction failed to submit FAILED messages "
+				"with status %d\n", iRet);
 			ABORT_FINALIZE(iRet);
 		}
 	}
 
-	/* support dynamic topic */
-	iRet = writeKafka(pData, ppString[0], ppString[1], pData->dynaTopic ? ppString[2] : pData->topic, RESUBMIT);
+	iRet = writeKafkaBatch(pData, pParams, nParams);
 
 finalize_it:
 	if(need_unlock) {
@@ -1377,16 +1598,10 @@ finalize_it:
 	}
 
 	if(iRet != RS_RET_OK) {
-		DBGPRINTF("omkafka: doAction failed with status %d\n", iRet);
-	}
-
-	/* Suspend Action if broker problems were reported in error callback */
-	if (pData->bIsSuspended) {
-		DBGPRINTF("omkafka: doAction broker failure detected, suspending action\n");
-		iRet = RS_RET_SUSPENDED;
+		DBGPRINTF("omkafka: commitTransaction failed with status %d\n", iRet);
 	}
 	pthread_mutex_unlock(&pData->mut_doAction); /* must be after last pData access! */
-ENDdoAction
+ENDcommitTransaction
 
 
 static void
@@ -1397,6 +1612,7 @@ setInstParamDefaults(instanceData *pData)
 	pData->iDynaTopicCacheSize = 50;
 	pData->brokers = NULL;
 	pData->autoPartition = 0;
+	pData->bProduceBatch = 0;
 	pData->fixedPartition = NO_FIXED_PARTITION;
 	pData->nPartitions = 1;
 	pData->nConfParams = 0;
@@ -1503,6 +1719,8 @@ CODESTARTnewActInst
 			pData->bKeepFailedMessages = pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "failedmsgfile")) {
 			pData->failedMsgFile = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "produce.batch")) {
+			pData->bProduceBatch = pvals[i].val.d.n;
 		} else {
 			LogError(0, RS_RET_INTERNAL_ERROR,
 				"omkafka: program error, non-handled param '%s'\n", actpblk.descr[i].name);
@@ -1533,9 +1751,8 @@ CODESTARTnewActInst
 						OMSR_NO_RQD_TPL_OPTS));
 	if(pData->dynaTopic) {
 		CHKiRet(OMSRsetEntry(*ppOMSR, 2, ustrdup(pData->topic), OMSR_NO_RQD_TPL_OPTS));
-		CHKmalloc(pData->dynCache = (dynaTopicCacheEntry**)
-			calloc(pData->iDynaTopicCacheSize, sizeof(dynaTopicCacheEntry*)));
-		pData->iCurrElt = -1;
+		CHKmalloc(pData->dynCache = create_hashtable(pData->iDynaTopicCacheSize,
+			hash_from_string, key_equals_string, NULL));
 	}
 
 	pthread_mutex_lock(&closeTimeoutMut);
@@ -1559,6 +1776,7 @@ CODESTARTmodExit
 	statsobj.Destruct(&kafkaStats);
 	CHKiRet(objRelease(statsobj, CORE_COMPONENT));
 	DESTROY_ATOMIC_HELPER_MUT(mutClock);
+	DESTROY_ATOMIC_HELPER_MUT(mutBatchRefs);
 
 	pthread_mutex_lock(&closeTimeoutMut);
 	int timeout = closeTimeout;
@@ -1576,7 +1794,7 @@ ENDmodExit
 NO_LEGACY_CONF_parseSelectorAct
 BEGINqueryEtryPt
 CODESTARTqueryEtryPt
-CODEqueryEtryPt_STD_OMOD_QUERIES
+CODEqueryEtryPt_STD_OMODTX_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_STD_CONF2_CNFNAME_QUERIES
 CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
@@ -1595,6 +1813,7 @@ CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
 	INIT_ATOMIC_HELPER_MUT(mutClock);
+	INIT_ATOMIC_HELPER_MUT(mutBatchRefs);
 
 	DBGPRINTF("omkafka %s using librdkafka version %s, 0x%x\n",
 	          VERSION, rd_kafka_version_str(), rd_kafka_version());
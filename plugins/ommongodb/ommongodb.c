@@ -57,7 +57,6 @@
 #include "srUtils.h"
 #include "template.h"
 #include "module-template.h"
-#include "datetime.h"
 #include "errmsg.h"
 #include "cfsysline.h"
 #include "unicode-helper.h"
@@ -69,10 +68,8 @@ MODULE_CNFNAME("ommongodb")
  */
 DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
-DEFobjCurrIf(datetime)
 
 typedef struct _instanceData {
-	struct json_tokener *json_tokener; /* only if (tplName != NULL) */
 	mongoc_client_t *client;
    	mongoc_collection_t *collection;
    	bson_error_t error;
@@ -86,11 +83,15 @@ typedef struct _instanceData {
    	char *db;
    	char *collection_name;
 	char *tplName;
+	mongoc_write_concern_t *write_concern;	/* NULL: collection default */
 	int bErrMsgPermitted;	/* only one errmsg permitted per connection */
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	struct json_tokener *json_tokener;
+	bson_t **docs;		/* documents of the current batch */
+	unsigned maxDocs;
 } wrkrInstanceData_t;
 
 
@@ -106,7 +107,8 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "pwd", eCmdHdlrGetWord, 0 },
 	{ "db", eCmdHdlrGetWord, 0 },
 	{ "collection", eCmdHdlrGetWord, 0 },
-	{ "template", eCmdHdlrGetWord, 0 }
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "writeconcern", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -122,6 +124,10 @@ ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->docs = NULL;
+	pWrkrData->maxDocs = 0;
+	CHKmalloc(pWrkrData->json_tokener = json_tokener_new());
+finalize_it:
 ENDcreateWrkrInstance
 
 BEGINisCompatibleWithFeature
@@ -143,6 +149,8 @@ static void closeMongoDB(instanceData *pData)
 
    		mongoc_client_destroy (pData->client);
    		mongoc_cleanup ();
+		pData->client = NULL;
+		pData->collection = NULL;
 	}
 }
 
@@ -151,8 +159,8 @@ BEGINfreeInstance
 CODESTARTfreeInstance
 	closeMongoDB(pData);
 
-	if (pData->json_tokener != NULL)
-		json_tokener_free(pData->json_tokener);
+	if(pData->write_concern != NULL)
+		mongoc_write_concern_destroy(pData->write_concern);
 	free(pData->server);
 	free(pData->port);
 	free(pData->ssl_ca);
@@ -167,6 +175,9 @@ ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	if(pWrkrData->json_tokener != NULL)
+		json_tokener_free(pWrkrData->json_tokener);
+	free(pWrkrData->docs);
 ENDfreeWrkrInstance
 
 
@@ -243,95 +254,71 @@ getLumberjackLevel(short severity)
 }
 
 
-/* small helper: get integer power of 10 */
-static int
-i10pow(int exp)
+/* convert a time stamp as generated by the default template (unix
+ * timestamp and subseconds, e.g. "1526638321.123456") to milliseconds
+ * since the epoch.
+ */
+static int64
+defaultTimeToMs(const char *ts)
 {
-	int r = 1;
-	while(exp > 0) {
-		r *= 10;
-		exp--;
+	char *end;
+	int64 ms;
+	int i;
+
+	ms = (int64) strtoll(ts, &end, 10) * 1000;
+	if(*end == '.') {
+		++end;
+		for(i = 100 ; i > 0 && isdigit((unsigned char) *end) ; i /= 10)
+			ms += (*end++ - '0') * i;
 	}
-	return r;
+	return ms;
+}
+
+
+static const char *
+getDefaultField(struct json_object *json, const char *name)
+{
+	struct json_object *val;
+
+	if(!json_object_object_get_ex(json, name, &val) || val == NULL)
+		return "";
+	return json_object_get_string(val);
 }
+
+
 /* Return a BSON document when an user hasn't specified a template.
  * In this mode, we use the standard document format, which is somewhat
  * aligned to cee (as described in project lumberjack). Note that this is
  * a moving target, so we may run out of sync (and stay so to retain
  * backward compatibility, which we consider pretty important).
+ * The message properties are obtained via the " StdMongoDocFmt" template,
+ * which is then converted into properly typed BSON.
  */
-static bson_t *getDefaultBSON(smsg_t *pMsg)
+static bson_t *getDefaultBSON(struct json_object *json)
 {
 	bson_t *doc = NULL;
-	char *procid; short unsigned procid_free; rs_size_t procid_len;
-	char *tag; short unsigned tag_free; rs_size_t tag_len;
-	char *pid; short unsigned pid_free; rs_size_t pid_len;
-	char *sys; short unsigned sys_free; rs_size_t sys_len;
-	char *msg; short unsigned msg_free; rs_size_t msg_len;
-	int severity, facil;
-	int64 ts_gen, ts_rcv; /* timestamps: generated, received */
-	int secfrac;
-	msgPropDescr_t cProp; /* we use internal implementation knowledge... */
-
-	cProp.id = PROP_PROGRAMNAME;
-	procid = (char*)MsgGetProp(pMsg, NULL, &cProp, &procid_len, &procid_free, NULL);
-	cProp.id = PROP_SYSLOGTAG;
-	tag = (char*)MsgGetProp(pMsg, NULL, &cProp, &tag_len, &tag_free, NULL);
-	cProp.id = PROP_PROCID;
-	pid = (char*)MsgGetProp(pMsg, NULL, &cProp, &pid_len, &pid_free, NULL);
-	cProp.id = PROP_HOSTNAME;
-	sys = (char*)MsgGetProp(pMsg, NULL, &cProp, &sys_len, &sys_free, NULL);
-	cProp.id = PROP_MSG;
-	msg = (char*)MsgGetProp(pMsg, NULL, &cProp, &msg_len, &msg_free, NULL);
-
-	/* TODO: move to datetime? Refactor in any case! rgerhards, 2012-03-30 */
-	ts_gen = (int64) datetime.syslogTime2time_t(&pMsg->tTIMESTAMP) * 1000; /* ms! */
-	DBGPRINTF("ommongodb: ts_gen is %lld\n", (long long) ts_gen);
-	DBGPRINTF("ommongodb: secfrac is %d, precision %d\n",
-			pMsg->tTIMESTAMP.secfrac,
-			pMsg->tTIMESTAMP.secfracPrecision);
-	if(pMsg->tTIMESTAMP.secfracPrecision > 3) {
-		secfrac = pMsg->tTIMESTAMP.secfrac / i10pow(pMsg->tTIMESTAMP.secfracPrecision - 3);
-	} else if(pMsg->tTIMESTAMP.secfracPrecision < 3) {
-		secfrac = pMsg->tTIMESTAMP.secfrac * i10pow(3 - pMsg->tTIMESTAMP.secfracPrecision);
-	} else {
-		secfrac = pMsg->tTIMESTAMP.secfrac;
-	}
-	ts_gen += secfrac;
-	ts_rcv = (int64) datetime.syslogTime2time_t(&pMsg->tRcvdAt) * 1000; /* ms! */
-	if(pMsg->tRcvdAt.secfracPrecision > 3) {
-		secfrac = pMsg->tRcvdAt.secfrac / i10pow(pMsg->tRcvdAt.secfracPrecision - 3);
-	} else if(pMsg->tRcvdAt.secfracPrecision < 3) {
-		secfrac = pMsg->tRcvdAt.secfrac * i10pow(3 - pMsg->tRcvdAt.secfracPrecision);
-	} else {
-		secfrac = pMsg->tRcvdAt.secfrac;
-	}
-	ts_rcv += secfrac;
+	struct json_object *val;
+	int severity = 0, facil = 0;
 
-	/* the following need to be int, but are short, so we need to xlat */
-	severity = pMsg->iSeverity;
-	facil = pMsg->iFacility;
+	if(json_object_object_get_ex(json, "syslog_sever", &val))
+		severity = json_object_get_int(val);
+	if(json_object_object_get_ex(json, "syslog_fac", &val))
+		facil = json_object_get_int(val);
 
 	doc = bson_new ();
 	bson_oid_t oid;
    	bson_oid_init (&oid, NULL);
    	BSON_APPEND_OID (doc, "_id", &oid);
-   	BSON_APPEND_UTF8 (doc, "sys", sys);
-   	BSON_APPEND_DATE_TIME (doc, "time", ts_gen);
-   	BSON_APPEND_DATE_TIME (doc, "time_rcvd", ts_rcv);
-   	BSON_APPEND_UTF8 (doc, "msg", msg);
+   	BSON_APPEND_UTF8 (doc, "sys", getDefaultField(json, "sys"));
+   	BSON_APPEND_DATE_TIME (doc, "time", defaultTimeToMs(getDefaultField(json, "time")));
+   	BSON_APPEND_DATE_TIME (doc, "time_rcvd", defaultTimeToMs(getDefaultField(json, "time_rcvd")));
+   	BSON_APPEND_UTF8 (doc, "msg", getDefaultField(json, "msg"));
    	BSON_APPEND_INT32 (doc, "syslog_fac", facil);
    	BSON_APPEND_INT32 (doc, "syslog_sever", severity);
-   	BSON_APPEND_UTF8 (doc, "syslog_tag", tag);
-   	BSON_APPEND_UTF8 (doc, "procid", procid);
-   	BSON_APPEND_UTF8 (doc, "pid", pid);
-   	BSON_APPEND_UTF8 (doc, "level", getLumberjackLevel(pMsg->iSeverity));
-
-	if(procid_free) free(procid);
-	if(tag_free) free(tag);
-	if(pid_free) free(pid);
-	if(sys_free) free(sys);
-	if(msg_free) free(msg);
+   	BSON_APPEND_UTF8 (doc, "syslog_tag", getDefaultField(json, "syslog_tag"));
+   	BSON_APPEND_UTF8 (doc, "procid", getDefaultField(json, "procid"));
+   	BSON_APPEND_UTF8 (doc, "pid", getDefaultField(json, "pid"));
+   	BSON_APPEND_UTF8 (doc, "level", getLumberjackLevel(severity));
 
 	return doc;
 }
@@ -503,42 +490,176 @@ CODESTARTtryResume
 	}
 ENDtryResume
 
-BEGINdoAction_NoStrings
+/* the template output of a message as text, for error messages. User
+ * templates are passed as JSON object, our default template as string.
+ */
+static const char *
+paramToString(const instanceData *const pData, void *const param)
+{
+	if(pData->tplName == NULL)
+		return (const char*) param;
+	return json_object_to_json_string((struct json_object*) param);
+}
+
+/* convert the template output of a message into a BSON document.
+ * Returns NULL if that is not possible.
+ */
+static bson_t *
+docFromParam(wrkrInstanceData_t *pWrkrData, void *const param)
+{
+	struct json_object *json;
 	bson_t *doc = NULL;
-	instanceData *pData;
-CODESTARTdoAction
-	pthread_mutex_lock(&mutDoAct);
-	pData = pWrkrData->pData;
-	/* see if we are ready to proceed */
-	if(pData->client == NULL) {
-		CHKiRet(initMongoDB(pData, 0));
+
+	if(pWrkrData->pData->tplName != NULL) {
+		/* the core passes the JSON object built from the template */
+		json = (struct json_object*) param;
+		if(json == NULL || !json_object_is_type(json, json_type_object))
+			return NULL;
+		return BSONFromJSONObject(json);
 	}
 
-	if(pData->tplName == NULL) {
-		doc = getDefaultBSON(*(smsg_t**)pMsgData);
+	json_tokener_reset(pWrkrData->json_tokener);
+	json = json_tokener_parse_ex(pWrkrData->json_tokener, (char*) param, strlen((char*) param));
+	if(json == NULL || !json_object_is_type(json, json_type_object)) {
+		DBGPRINTF("ommongodb: template output is no JSON object: %s\n", (char*) param);
 	} else {
-		doc = BSONFromJSONObject(*(struct json_object **)pMsgData);
+		doc = getDefaultBSON(json);
+	}
+	if(json != NULL)
+		json_object_put(json);
+	return doc;
+}
+
+
+/* report the errors contained in the reply to an unordered bulk insert.
+ * Documents with write errors have been rejected and are discarded (e.g.
+ * a duplicate _id or failed validation), all others have been written.
+ * Returns the number of errors found; if there are none, the bulk
+ * operation failed as a whole, e.g. because the connection was lost.
+ */
+static int
+reportBulkErrors(const instanceData *const pData, const bson_t *reply, actWrkrIParams_t *const pParams,
+	const unsigned *const msgIdx, const unsigned nDocs)
+{
+	bson_iter_t iter, errs, err;
+	const char *errText;
+	int64_t idx;
+	int nErrs = 0;
+
+	if(bson_iter_init_find(&iter, reply, "writeErrors") && BSON_ITER_HOLDS_ARRAY(&iter)
+	   && bson_iter_recurse(&iter, &errs)) {
+		while(bson_iter_next(&errs)) {
+			if(!BSON_ITER_HOLDS_DOCUMENT(&errs) || !bson_iter_recurse(&errs, &err))
+				continue;
+			idx = -1;
+			errText = "unknown error";
+			while(bson_iter_next(&err)) {
+				if(!strcmp(bson_iter_key(&err), "index") && BSON_ITER_HOLDS_NUMBER(&err))
+					idx = bson_iter_as_int64(&err);
+				else if(!strcmp(bson_iter_key(&err), "errmsg") && BSON_ITER_HOLDS_UTF8(&err))
+					errText = bson_iter_utf8(&err, NULL);
+			}
+			++nErrs;
+			if(idx >= 0 && idx < (int64_t) nDocs) {
+				errmsg.LogError(0, RS_RET_DATAFAIL, "ommongodb: discarding message, "
+					"document rejected: %s - message was: %s", errText,
+					paramToString(pData, actParam(pParams, 1, msgIdx[idx], 0).param));
+			} else {
+				errmsg.LogError(0, RS_RET_DATAFAIL, "ommongodb: bulk insert error: %s", errText);
+			}
+		}
 	}
-	if(doc == NULL) {
-		dbgprintf("ommongodb: error creating BSON doc\n");
-		/* FIXME: is this a correct return code? */
-		ABORT_FINALIZE(RS_RET_ERR);
+
+	/* the documents have been written, but not as safely as requested */
+	if(bson_iter_init_find(&iter, reply, "writeConcernErrors") && BSON_ITER_HOLDS_ARRAY(&iter)
+	   && bson_iter_recurse(&iter, &errs)) {
+		while(bson_iter_next(&errs)) {
+			if(!BSON_ITER_HOLDS_DOCUMENT(&errs) || !bson_iter_recurse(&errs, &err))
+				continue;
+			errText = "unknown error";
+			if(bson_iter_find(&err, "errmsg") && BSON_ITER_HOLDS_UTF8(&err))
+				errText = bson_iter_utf8(&err, NULL);
+			++nErrs;
+			LogMsg(0, RS_RET_OK, LOG_WARNING, "ommongodb: write concern not satisfied: %s", errText);
+		}
 	}
-	if (mongoc_collection_insert (pData->collection, MONGOC_INSERT_NONE, doc, NULL, &(pData->error) ) ) {
-		pData->bErrMsgPermitted = 1;
-	} else {
-		dbgprintf("ommongodb: insert error\n");
-		reportMongoError(pData);
-		/* close on insert error to permit resume */
-		closeMongoDB(pData);
-		ABORT_FINALIZE(RS_RET_SUSPENDED);
+
+	return nErrs;
+}
+
+
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+	/* we have nothing to do to begin a transaction */
+ENDbeginTransaction
+
+
+/* all documents of the batch are written by a single unordered bulk
+ * operation, so one document failing does not affect the others.
+ */
+BEGINcommitTransaction
+	instanceData *const pData = pWrkrData->pData;
+	mongoc_bulk_operation_t *bulk = NULL;
+	bson_t reply;
+	int bHaveReply = 0;
+	int bMustClose = 0;
+	unsigned *msgIdx = NULL;	/* bulk op index -> message index */
+	unsigned nDocs = 0;
+	unsigned i;
+	bson_t **newDocs;
+CODESTARTcommitTransaction
+	if(nParams > pWrkrData->maxDocs) {
+		CHKmalloc(newDocs = realloc(pWrkrData->docs, nParams * sizeof(bson_t*)));
+		pWrkrData->docs = newDocs;
+		pWrkrData->maxDocs = nParams;
+	}
+	CHKmalloc(msgIdx = malloc(nParams * sizeof(unsigned)));
+
+	/* conversion does not need the connection, so do it before locking */
+	for(i = 0 ; i < nParams ; ++i) {
+		void *const param = actParam(pParams, 1, i, 0).param;
+		if((pWrkrData->docs[nDocs] = docFromParam(pWrkrData, param)) == NULL) {
+			errmsg.LogError(0, RS_RET_DATAFAIL, "ommongodb: discarding message, "
+				"cannot convert it to a BSON document: %s", paramToString(pData, param));
+			continue;
+		}
+		msgIdx[nDocs++] = i;
 	}
+	if(nDocs == 0)
+		FINALIZE;
 
-finalize_it:
+	pthread_mutex_lock(&mutDoAct);
+	/* see if we are ready to proceed */
+	if(pData->client == NULL) {
+		iRet = initMongoDB(pData, 0);
+	}
+	if(iRet == RS_RET_OK) {
+		bulk = mongoc_collection_create_bulk_operation(pData->collection, false, pData->write_concern);
+		for(i = 0 ; i < nDocs ; ++i)
+			mongoc_bulk_operation_insert(bulk, pWrkrData->docs[i]);
+		bHaveReply = 1;
+		if(mongoc_bulk_operation_execute(bulk, &reply, &(pData->error))) {
+			pData->bErrMsgPermitted = 1;
+		} else if(reportBulkErrors(pData, &reply, pParams, msgIdx, nDocs) == 0) {
+			dbgprintf("ommongodb: bulk insert error\n");
+			reportMongoError(pData);
+			/* close on insert error to permit resume */
+			bMustClose = 1;
+			iRet = RS_RET_SUSPENDED;
+		}
+		mongoc_bulk_operation_destroy(bulk);
+		if(bMustClose)
+			closeMongoDB(pData);
+	}
 	pthread_mutex_unlock(&mutDoAct);
-	if(doc != NULL)
-		bson_destroy(doc);
-ENDdoAction
+
+finalize_it:
+	if(bHaveReply)
+		bson_destroy(&reply);
+	for(i = 0 ; i < nDocs ; ++i)
+		bson_destroy(pWrkrData->docs[i]);
+	free(msgIdx);
+ENDcommitTransaction
 
 
 static void setInstParamDefaults(instanceData *pData)
@@ -553,6 +674,7 @@ static void setInstParamDefaults(instanceData *pData)
 	pData->db = NULL;
 	pData->collection = NULL;
 	pData->tplName = NULL;
+	pData->write_concern = NULL;
 }
 
 BEGINnewActInst
@@ -592,18 +714,35 @@ CODESTARTnewActInst
 			pData->pwd = (char*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (char*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "writeconcern")) {
+			char *const wc = es_str2cstr(pvals[i].val.d.estr, NULL);
+			CHKmalloc(wc);
+			pData->write_concern = mongoc_write_concern_new();
+			if(!strcmp(wc, "majority")) {
+				mongoc_write_concern_set_wmajority(pData->write_concern, 0);
+			} else if(isdigit((unsigned char) wc[0])) {
+				mongoc_write_concern_set_w(pData->write_concern, atoi(wc));
+			} else {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "ommongodb: invalid writeconcern "
+					"'%s', must be \"majority\" or the number of nodes", wc);
+				free(wc);
+				ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+			}
+			free(wc);
 		} else {
 			dbgprintf("ommongodb: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
 		}
 	}
 
+	/* user templates are passed as JSON object, so plain list and property
+	 * templates work as before. Only our default template renders JSON text
+	 * itself.
+	 */
 	if(pData->tplName == NULL) {
-		CHKiRet(OMSRsetEntry(*ppOMSR, 0, NULL, OMSR_TPL_AS_MSG));
+		CHKiRet(OMSRsetEntry(*ppOMSR, 0, ustrdup(" StdMongoDocFmt"), OMSR_NO_RQD_TPL_OPTS));
 	} else {
-		CHKiRet(OMSRsetEntry(*ppOMSR, 0, ustrdup(pData->tplName),
-				     OMSR_TPL_AS_JSON));
-		CHKmalloc(pData->json_tokener = json_tokener_new());
+		CHKiRet(OMSRsetEntry(*ppOMSR, 0, ustrdup(pData->tplName), OMSR_TPL_AS_JSON));
 	}
 
 	if(pData->db == NULL)
@@ -685,45 +824,21 @@ NO_LEGACY_CONF_parseSelectorAct
 BEGINmodExit
 CODESTARTmodExit
 	objRelease(errmsg, CORE_COMPONENT);
-	objRelease(datetime, CORE_COMPONENT);
 ENDmodExit
 
 
 BEGINqueryEtryPt
 CODESTARTqueryEtryPt
-CODEqueryEtryPt_STD_OMOD_QUERIES
+CODEqueryEtryPt_STD_OMODTX_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
 ENDqueryEtryPt
 
 BEGINmodInit()
-	rsRetVal localRet;
-	rsRetVal (*pomsrGetSupportedTplOpts)(unsigned long *pOpts);
-	unsigned long opts;
-	int bJSONPassingSupported;
 CODESTARTmodInit
 	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
 CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
-	CHKiRet(objUse(datetime, CORE_COMPONENT));
 	INITChkCoreFeature(bCoreSupportsBatching, CORE_FEATURE_BATCHING);
 	DBGPRINTF("ommongodb: module compiled with rsyslog version %s.\n", VERSION);
-
-	/* check if the rsyslog core supports parameter passing code */
-	bJSONPassingSupported = 0;
-	localRet = pHostQueryEtryPt((uchar*)"OMSRgetSupportedTplOpts",
-				    &pomsrGetSupportedTplOpts);
-	if(localRet == RS_RET_OK) {
-		/* found entry point, so let's see if core supports msg passing */
-		CHKiRet((*pomsrGetSupportedTplOpts)(&opts));
-		if(opts & OMSR_TPL_AS_JSON)
-			bJSONPassingSupported = 1;
-	} else if(localRet != RS_RET_ENTRY_POINT_NOT_FOUND) {
-		ABORT_FINALIZE(localRet); /* Something else went wrong, not acceptable */
-	}
-	if(!bJSONPassingSupported) {
-		DBGPRINTF("ommongodb: JSON-passing is not supported by rsyslog core, "
-			  "can not continue.\n");
-		ABORT_FINALIZE(RS_RET_NO_JSON_PASSING);
-	}
 ENDmodInit
@@ -29,6 +29,7 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 #include <signal.h>
 #include <errno.h>
@@ -64,12 +65,17 @@ typedef struct _instanceData {
 	uchar   *configfile;			/* MySQL Client Configuration File */
 	uchar   *configsection;		/* MySQL Client Configuration Section */
 	uchar	*tplName;			/* format template to use */
+	sbool	bBulkMode;		/* combine INSERTs of a batch into multi-row INSERTs? */
+	size_t	bulkMaxSize;		/* max size of a combined statement */
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
 	MYSQL	*hmysql;			/* handle to MySQL */
 	unsigned uLastMySQLErrno;		/* last errno returned by MySQL or 0 if all is well */
+	char	*bulkBuf;			/* statement currently being combined (bulk mode) */
+	size_t	lenBulkBuf;
+	size_t	sizeBulkBuf;
 } wrkrInstanceData_t;
 
 typedef struct configSettings_s {
@@ -89,7 +95,9 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "serverport", eCmdHdlrInt, 0 },
 	{ "mysqlconfig.file", eCmdHdlrGetWord, 0 },
 	{ "mysqlconfig.section", eCmdHdlrGetWord, 0 },
-	{ "template", eCmdHdlrGetWord, 0 }
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "bulkmode", eCmdHdlrBinary, 0 },
+	{ "bulk.maxsize", eCmdHdlrSize, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -112,6 +120,9 @@ ENDcreateInstance
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
 	pWrkrData->hmysql = NULL;
+	pWrkrData->bulkBuf = NULL;
+	pWrkrData->lenBulkBuf = 0;
+	pWrkrData->sizeBulkBuf = 0;
 ENDcreateWrkrInstance
 
 
@@ -146,6 +157,7 @@ BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
 	closeMySQL(pWrkrData);
 	mysql_thread_end();
+	free(pWrkrData->bulkBuf);
 ENDfreeWrkrInstance
 
 
@@ -299,22 +311,254 @@ CODESTARTbeginTransaction
 	// NOTHING TO DO IN HERE
 ENDbeginTransaction
 
+/* check if a statement has the form "INSERT ... VALUES (...)" with
+ * exactly one value tuple, so that it can be combined with other such
+ * statements. On success, the length of the part up to and including
+ * VALUES as well as the tuple are returned. We do not need to fully parse
+ * SQL here: if we get it wrong, the server rejects the combined statement
+ * and we fall back to single statements.
+ */
+static int
+splitInsert(const uchar *const psz, size_t *const lenPrefix, const uchar **const tuple, size_t *const lenTuple)
+{
+	const uchar *p = psz;
+	const uchar *end;
+	uchar inQuote = '\0';
+	int depth = 0;
+
+	while(isspace(*p))
+		++p;
+	if(strncasecmp((char*)p, "insert", 6) || !isspace(p[6]))
+		return 0;
+	/* locate VALUES; table and column names must not contain quoted strings */
+	for(p += 6 ; *p != '\0' ; ++p) {
+		if(*p == '\'' || *p == '"')
+			return 0;
+		if((*p == 'v' || *p == 'V') && (isspace(p[-1]) || p[-1] == ')')
+		   && !strncasecmp((char*)p, "values", 6) && (isspace(p[6]) || p[6] == '('))
+			break;
+	}
+	if(*p == '\0')
+		return 0;
+	p += 6;
+	*lenPrefix = p - psz;
+
+	while(isspace(*p))
+		++p;
+	if(*p != '(')
+		return 0;
+	*tuple = p;
+	for( ; *p != '\0' ; ++p) {
+		if(inQuote) {
+			if(*p == '\\' && p[1] != '\0')
+				++p;
+			else if(*p == inQuote)
+				inQuote = '\0';
+		} else if(*p == '\'' || *p == '"') {
+			inQuote = *p;
+		} else if(*p == '(') {
+			++depth;
+		} else if(*p == ')' && --depth == 0) {
+			break;
+		}
+	}
+	if(*p != ')')
+		return 0;
+	end = ++p;
+	/* nothing but the tuple, e.g. no ON DUPLICATE KEY UPDATE ... */
+	while(isspace(*p) || *p == ';')
+		++p;
+	if(*p != '\0')
+		return 0;
+	*lenTuple = end - *tuple;
+	return 1;
+}
+
+
+static rsRetVal
+bulkAppend(wrkrInstanceData_t *pWrkrData, const uchar *const p, const size_t len)
+{
+	char *newBuf;
+	size_t newSize;
+	DEFiRet;
+
+	if(pWrkrData->lenBulkBuf + len > pWrkrData->sizeBulkBuf) {
+		newSize = pWrkrData->sizeBulkBuf == 0 ? 16 * 1024 : pWrkrData->sizeBulkBuf;
+		while(pWrkrData->lenBulkBuf + len > newSize)
+			newSize *= 2;
+		CHKmalloc(newBuf = realloc(pWrkrData->bulkBuf, newSize));
+		pWrkrData->bulkBuf = newBuf;
+		pWrkrData->sizeBulkBuf = newSize;
+	}
+	memcpy(pWrkrData->bulkBuf + pWrkrData->lenBulkBuf, p, len);
+	pWrkrData->lenBulkBuf += len;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* check if a server error is caused by the statement's data, so that
+ * only the statement failed. Other errors are temporary and may have
+ * rolled back the whole transaction, e.g. InnoDB rolls back the
+ * transaction on a deadlock (and, if innodb_rollback_on_timeout is set,
+ * on a lock wait timeout). Client errors (2000..2999) are connection
+ * problems.
+ */
+static int
+isDataError(const int mysql_err)
+{
+	if(mysql_err >= 2000 && mysql_err <= 2999)
+		return 0;
+	switch(mysql_err) {
+	case ER_LOCK_DEADLOCK:
+	case ER_LOCK_WAIT_TIMEOUT:
+	case ER_LOCK_TABLE_FULL:
+	case ER_QUERY_INTERRUPTED:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+
+/* execute a statement as part of a bulk transaction. Other than
+ * writeMySQL(), we do not try to reconnect, as that would lose the
+ * transaction. Returns RS_RET_DATAFAIL if the server rejected the
+ * statement due to its data and RS_RET_SUSPENDED on connection problems
+ * and errors that may have aborted the transaction, so that the core
+ * retries the whole batch.
+ */
+static rsRetVal
+execBulk(wrkrInstanceData_t *pWrkrData, const char *const stmt, const size_t len)
+{
+	int mysql_err;
+	DEFiRet;
+
+	if(mysql_real_query(pWrkrData->hmysql, stmt, len)) {
+		mysql_err = mysql_errno(pWrkrData->hmysql);
+		if(isDataError(mysql_err)) {
+			DBGPRINTF("ommysql: server rejected bulk statement: %s\n",
+				mysql_error(pWrkrData->hmysql));
+			ABORT_FINALIZE(RS_RET_DATAFAIL);
+		}
+		reportDBError(pWrkrData, 0);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* write the batch, combining consecutive INSERTs into the same table and
+ * columns into multi-row INSERTs of up to bulkMaxSize bytes. Statements
+ * that cannot be combined are executed as they are.
+ */
+static rsRetVal
+writeBulk(wrkrInstanceData_t *pWrkrData, actWrkrIParams_t *const pParams, const unsigned nParams)
+{
+	const size_t maxSize = pWrkrData->pData->bulkMaxSize;
+	const uchar *psz, *tuple;
+	size_t lenPrefix, lenNextPrefix, lenTuple;
+	unsigned i, nRows;
+	DEFiRet;
+
+	CHKiRet(writeMySQL(pWrkrData, (uchar*)"START TRANSACTION"));
+	i = 0;
+	while(i < nParams) {
+		psz = actParam(pParams, 1, i, 0).param;
+		++i;
+		if(!splitInsert(psz, &lenPrefix, &tuple, &lenTuple)) {
+			CHKiRet(execBulk(pWrkrData, (char*) psz, strlen((char*)psz)));
+			continue;
+		}
+		pWrkrData->lenBulkBuf = 0;
+		CHKiRet(bulkAppend(pWrkrData, psz, lenPrefix));
+		CHKiRet(bulkAppend(pWrkrData, (uchar*)" ", 1));
+		CHKiRet(bulkAppend(pWrkrData, tuple, lenTuple));
+		for(nRows = 1 ; i < nParams ; ++i, ++nRows) {
+			const uchar *const next = actParam(pParams, 1, i, 0).param;
+			if(!splitInsert(next, &lenNextPrefix, &tuple, &lenTuple)
+			   || lenNextPrefix != lenPrefix || memcmp(next, psz, lenPrefix)
+			   || pWrkrData->lenBulkBuf + 1 + lenTuple > maxSize)
+				break;
+			CHKiRet(bulkAppend(pWrkrData, (uchar*)",", 1));
+			CHKiRet(bulkAppend(pWrkrData, tuple, lenTuple));
+		}
+		DBGPRINTF("ommysql: multi-row insert with %u rows, %zu bytes\n",
+			nRows, pWrkrData->lenBulkBuf);
+		CHKiRet(execBulk(pWrkrData, pWrkrData->bulkBuf, pWrkrData->lenBulkBuf));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* write the batch one statement at a time. This is used if a combined
+ * statement failed. A statement the server rejects due to its data is
+ * reported and discarded, without affecting the other messages of the
+ * batch (the server only rolls back the failed statement, not the
+ * transaction). Any other error suspends the action, so that the core
+ * retries the whole batch.
+ */
+static rsRetVal
+writeRowByRow(wrkrInstanceData_t *pWrkrData, actWrkrIParams_t *const pParams, const unsigned nParams)
+{
+	const uchar *psz;
+	unsigned i;
+	DEFiRet;
+
+	CHKiRet(writeMySQL(pWrkrData, (uchar*)"START TRANSACTION"));
+	for(i = 0 ; i < nParams ; ++i) {
+		psz = actParam(pParams, 1, i, 0).param;
+		iRet = execBulk(pWrkrData, (char*) psz, strlen((char*)psz));
+		if(iRet == RS_RET_DATAFAIL) {
+			reportDBError(pWrkrData, 0);
+			LogError(0, RS_RET_DATAFAIL, "ommysql: discarding message, the error "
+				"statement was: %s", psz);
+			iRet = RS_RET_OK;
+		}
+		CHKiRet(iRet);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 BEGINcommitTransaction
 CODESTARTcommitTransaction
 	DBGPRINTF("ommysql: commitTransaction\n");
-	CHKiRet(writeMySQL(pWrkrData, (uchar*)"START TRANSACTION"));
-
-	for(unsigned i = 0 ; i < nParams ; ++i) {
-		iRet = writeMySQL(pWrkrData, actParam(pParams, 1, i, 0).param);
-		if(iRet != RS_RET_OK
-			&& iRet != RS_RET_DEFER_COMMIT
-			&& iRet != RS_RET_PREVIOUS_COMMITTED) {
+	if(pWrkrData->pData->bBulkMode) {
+		iRet = writeBulk(pWrkrData, pParams, nParams);
+		if(iRet == RS_RET_DATAFAIL) {
+			DBGPRINTF("ommysql: bulk insert failed, retrying row by row\n");
 			if(mysql_rollback(pWrkrData->hmysql) != 0) {
 				DBGPRINTF("ommysql: server error: transaction could not be rolled back\n");
 			}
+			iRet = writeRowByRow(pWrkrData, pParams, nParams);
+		}
+		if(iRet != RS_RET_OK) {
 			closeMySQL(pWrkrData);
 			FINALIZE;
 		}
+	} else {
+		CHKiRet(writeMySQL(pWrkrData, (uchar*)"START TRANSACTION"));
+
+		for(unsigned i = 0 ; i < nParams ; ++i) {
+			iRet = writeMySQL(pWrkrData, actParam(pParams, 1, i, 0).param);
+			if(iRet != RS_RET_OK
+				&& iRet != RS_RET_DEFER_COMMIT
+				&& iRet != RS_RET_PREVIOUS_COMMITTED) {
+				if(mysql_rollback(pWrkrData->hmysql) != 0) {
+					DBGPRINTF("ommysql: server error: transaction could not be rolled back\n");
+				}
+				closeMySQL(pWrkrData);
+				FINALIZE;
+			}
+		}
 	}
 
 	if(mysql_commit(pWrkrData->hmysql) != 0) {
@@ -333,6 +577,8 @@ setInstParamDefaults(instanceData *pData)
 	pData->configfile = NULL;
 	pData->configsection = NULL;
 	pData->tplName = NULL;
+	pData->bBulkMode = 0;
+	pData->bulkMaxSize = 1024 * 1024;
 }
 
 
@@ -379,6 +625,10 @@ CODESTARTnewActInst
 			pData->configsection = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "bulkmode")) {
+			pData->bBulkMode = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "bulk.maxsize")) {
+			pData->bulkMaxSize = (size_t) pvals[i].val.d.n;
 		} else {
 			dbgprintf("ommysql: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
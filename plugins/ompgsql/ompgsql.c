@@ -74,6 +74,9 @@ typedef struct wrkrInstanceData {
 	instanceData   *pData;
 	PGconn         *f_hpgsql;                /* handle to PgSQL */
 	ConnStatusType  eLastPgSQLStatus;        /* last status from postgres */
+	char           *bulkBuf;                 /* statements of current bulk request */
+	size_t          lenBulkBuf;
+	size_t          sizeBulkBuf;
 } wrkrInstanceData_t;
 
 /* action (instance) parameters */
@@ -114,6 +117,9 @@ ENDcreateInstance
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
 	pWrkrData->f_hpgsql = NULL;
+	pWrkrData->bulkBuf = NULL;
+	pWrkrData->lenBulkBuf = 0;
+	pWrkrData->sizeBulkBuf = 0;
 ENDcreateWrkrInstance
 
 
@@ -145,6 +151,7 @@ ENDfreeInstance
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
 	closePgSQL(pWrkrData);
+	free(pWrkrData->bulkBuf);
 ENDfreeWrkrInstance
 
 BEGINdbgPrintInstInfo
@@ -318,11 +325,157 @@ CODESTARTbeginTransaction
 ENDbeginTransaction
 
 
+/* append a statement to the bulk request buffer, separated by ";\n" from
+ * what is already in there. The line break ends a trailing "--" comment
+ * of the previous statement, which would otherwise swallow this one.
+ */
+static rsRetVal
+bulkAppend(wrkrInstanceData_t *pWrkrData, const char *psz)
+{
+	const size_t len = strlen(psz);
+	char *newBuf;
+	size_t newSize;
+	DEFiRet;
+
+	if (pWrkrData->lenBulkBuf + len + 3 > pWrkrData->sizeBulkBuf) {
+		newSize = pWrkrData->sizeBulkBuf == 0 ? 16 * 1024 : pWrkrData->sizeBulkBuf;
+		while (pWrkrData->lenBulkBuf + len + 3 > newSize)
+			newSize *= 2;
+		CHKmalloc(newBuf = realloc(pWrkrData->bulkBuf, newSize));
+		pWrkrData->bulkBuf = newBuf;
+		pWrkrData->sizeBulkBuf = newSize;
+	}
+	if (pWrkrData->lenBulkBuf > 0) {
+		pWrkrData->bulkBuf[pWrkrData->lenBulkBuf++] = ';';
+		pWrkrData->bulkBuf[pWrkrData->lenBulkBuf++] = '\n';
+	}
+	memcpy(pWrkrData->bulkBuf + pWrkrData->lenBulkBuf, psz, len + 1);
+	pWrkrData->lenBulkBuf += len;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* end the transaction of a failed batch. If that is not possible, the
+ * connection is closed, which makes postgres discard the transaction.
+ */
+static void
+rollbackPgSQL(wrkrInstanceData_t *pWrkrData)
+{
+	if (pWrkrData->f_hpgsql == NULL)
+		return;
+	if (PQstatus(pWrkrData->f_hpgsql) != CONNECTION_OK
+	    || tryExec((uchar*) "ROLLBACK", pWrkrData)) {
+		DBGPRINTF("ompgsql: rollback failed, closing connection\n");
+		closePgSQL(pWrkrData);
+	}
+}
+
+
+/* write the whole batch inside a single transaction. Up to multi_row
+ * statements are sent as one multi-statement query, so a batch of n
+ * messages needs about n/multi_row round trips instead of n + 2.
+ * Returns RS_RET_ERR if postgres rejected any part of the batch. On any
+ * error, nothing has been committed and the transaction has been rolled
+ * back (or the connection closed).
+ */
+static rsRetVal
+commitBulk(wrkrInstanceData_t *pWrkrData, actWrkrIParams_t *const pParams, const unsigned nParams)
+{
+	const unsigned multi_row = pWrkrData->pData->multi_row;
+	unsigned i, n;
+	sbool bInTransaction = 0;
+	DEFiRet;
+
+	if (tryExec((uchar*) "BEGIN", pWrkrData))
+		ABORT_FINALIZE(RS_RET_ERR);
+	bInTransaction = 1;
+	for (i = 0 ; i < nParams ; i += n) {
+		pWrkrData->lenBulkBuf = 0;
+		for (n = 0 ; n < multi_row && i + n < nParams ; ++n)
+			CHKiRet(bulkAppend(pWrkrData, (char*) actParam(pParams, 1, i + n, 0).param));
+		dbgprintf("ompgsql: bulk request with %u statements\n", n);
+		if (tryExec((uchar*) pWrkrData->bulkBuf, pWrkrData))
+			ABORT_FINALIZE(RS_RET_ERR);
+	}
+	if (tryExec((uchar*) "COMMIT", pWrkrData))
+		ABORT_FINALIZE(RS_RET_ERR);
+
+finalize_it:
+	if (iRet != RS_RET_OK && bInTransaction)
+		rollbackPgSQL(pWrkrData);
+	RETiRet;
+}
+
+
+/* write the batch statement by statement, each one guarded by a savepoint.
+ * This is the fallback if the bulk request failed: a statement postgres
+ * rejects (e.g. due to bad data) is reported and discarded, while all
+ * others are still committed. Connection failures suspend the action, in
+ * which case nothing is committed and the core retries the whole batch.
+ * On any error, the transaction is rolled back.
+ */
+static rsRetVal
+commitRowByRow(wrkrInstanceData_t *pWrkrData, actWrkrIParams_t *const pParams, const unsigned nParams)
+{
+	unsigned i;
+	sbool bInTransaction = 0;
+	DEFiRet;
+
+	if (tryExec((uchar*) "BEGIN", pWrkrData))
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	bInTransaction = 1;
+	for (i = 0 ; i < nParams ; ++i) {
+		pWrkrData->lenBulkBuf = 0;
+		CHKiRet(bulkAppend(pWrkrData, "SAVEPOINT ompgsql_row"));
+		CHKiRet(bulkAppend(pWrkrData, (char*) actParam(pParams, 1, i, 0).param));
+		CHKiRet(bulkAppend(pWrkrData, "RELEASE SAVEPOINT ompgsql_row"));
+		if (tryExec((uchar*) pWrkrData->bulkBuf, pWrkrData)) {
+			if (PQstatus(pWrkrData->f_hpgsql) != CONNECTION_OK)
+				ABORT_FINALIZE(RS_RET_SUSPENDED);
+			errmsg.LogError(0, RS_RET_DATAFAIL, "ompgsql: discarding message, postgres "
+				"rejected statement '%s': %s", (char*) actParam(pParams, 1, i, 0).param,
+				PQerrorMessage(pWrkrData->f_hpgsql));
+			if (tryExec((uchar*) "ROLLBACK TO SAVEPOINT ompgsql_row", pWrkrData))
+				ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+	}
+	if (tryExec((uchar*) "COMMIT", pWrkrData))
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+
+finalize_it:
+	if (iRet != RS_RET_OK) {
+		if (iRet == RS_RET_SUSPENDED)
+			reportDBError(pWrkrData, 0);
+		if (bInTransaction)
+			rollbackPgSQL(pWrkrData);
+		if (iRet == RS_RET_SUSPENDED)
+			closePgSQL(pWrkrData);
+	}
+	RETiRet;
+}
+
+
 BEGINcommitTransaction
 CODESTARTcommitTransaction
 	dbgprintf("ompgsql: beginTransaction\n");
 	if (pWrkrData->f_hpgsql == NULL)
 		initPgSQL(pWrkrData, 0);
+
+	if (pWrkrData->pData->multi_row > 1) {
+		iRet = commitBulk(pWrkrData, pParams, nParams);
+		if (iRet == RS_RET_ERR) {
+			DBGPRINTF("ompgsql: bulk request failed, retrying row by row\n");
+			if (PQstatus(pWrkrData->f_hpgsql) != CONNECTION_OK) {
+				closePgSQL(pWrkrData);
+				CHKiRet(initPgSQL(pWrkrData, 0));
+			}
+			iRet = commitRowByRow(pWrkrData, pParams, nParams);
+		}
+		FINALIZE;
+	}
+
 	CHKiRet(writePgSQL((uchar*) "BEGIN", pWrkrData)); /* TODO: make user-configurable */
 
 	for (unsigned i = 0 ; i < nParams ; ++i) {
@@ -6,7 +6,7 @@
  *
  * File begun on 2009-04-01 by RGerhards
  *
- * Copyright 2009-2017 Adiscon GmbH.
+ * Copyright 2009-2018 Adiscon GmbH.
  *
  * This file is part of rsyslog.
  *
@@ -37,6 +37,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
 #include <pthread.h>
 #include "conf.h"
 #include "syslogd-types.h"
@@ -59,6 +60,8 @@ DEFobjCurrIf(errmsg)
 #define DEFAULT_CLOSE_TIMEOUT_MS 5000
 #define READLINE_BUFFER_SIZE 1024
 #define MAX_FD_TO_CLOSE 65535
+#define FRAMING_LF 0		/* messages are sent as-is (the template provides the LF) */
+#define FRAMING_OCTET_COUNTED 1	/* each record is preceded by its length and a space */
 
 typedef struct _instanceData {
 	uchar *szBinary;		/* name of external program to call */
@@ -75,17 +78,31 @@ typedef struct _instanceData {
 	long lCloseTimeout;		/* how long to wait for program to terminate after closing pipe (ms) */
 	int bKillUnresponsive;	/* should send SIGKILL if closeTimeout is reached? */
 	uchar *szOutputFileName;	/* name of file to write the program output to, or NULL */
+	int bSendBatches;		/* send whole transactions at once, confirm once per batch? */
+	int iFraming;			/* FRAMING_LF or FRAMING_OCTET_COUNTED */
+	int iProcesses;			/* number of program instances per worker (batch mode only) */
 	pthread_mutex_t mut;	/* make sure only one instance is active */
 } instanceData;
 
-typedef struct wrkrInstanceData {
-	instanceData *pData;
+typedef struct childProcessCtx {
 	pid_t pid;			/* pid of currently running child process */
 	int fdPipeOut;		/* fd for sending messages to the program */
 	int fdPipeIn;		/* fd for receiving status messages from the program */
 	int fdPipeErr;		/* fd for receiving error output from the program */
-	int fdOutputFile;	/* fd to write the program output to (-1 if to discard) */
 	int bIsRunning;		/* is program currently running? 0-no, 1-yes */
+} childProcessCtx_t;
+
+typedef struct wrkrInstanceData {
+	instanceData *pData;
+	childProcessCtx_t *children;	/* program instances, pData->iProcesses entries */
+	int fdOutputFile;	/* fd to write the program output to (-1 if to discard) */
+	/* batch mode: messages of the current transaction, already framed */
+	char *batchBuf;
+	size_t lenBatchBuf;
+	size_t sizeBatchBuf;
+	size_t *msgEnd;		/* offset of the end of each message in batchBuf */
+	unsigned nBatchMsgs;
+	unsigned maxBatchMsgs;
 } wrkrInstanceData_t;
 
 typedef struct configSettings_s {
@@ -107,7 +124,10 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "template", eCmdHdlrGetWord, 0 },
 	{ "signalOnClose", eCmdHdlrBinary, 0 },
 	{ "closeTimeout", eCmdHdlrInt, 0 },
-	{ "killUnresponsive", eCmdHdlrBinary, 0 }
+	{ "killUnresponsive", eCmdHdlrBinary, 0 },
+	{ "batch", eCmdHdlrBinary, 0 },
+	{ "framing", eCmdHdlrGetWord, 0 },
+	{ "processes", eCmdHdlrPositiveInt, 0 }
 };
 
 static struct cnfparamblk actpblk =
@@ -120,7 +140,7 @@ static struct cnfparamblk actpblk =
  * after fork).
  */
 static __attribute__((noreturn)) void
-execBinary(wrkrInstanceData_t *pWrkrData, int fdStdin, int fdStdout, int fdStderr)
+execBinary(const instanceData *const pData, int fdStdin, int fdStdout, int fdStderr)
 {
 	int i, maxFd, iRet;
 	struct sigaction sigAct;
@@ -135,20 +155,20 @@ execBinary(wrkrInstanceData_t *pWrkrData, int fdStdin, int fdStdout, int fdStder
 		 */
 	}
 
-	if(pWrkrData->pData->bConfirmMessages) {
+	if(pData->bConfirmMessages) {
 		/* send message confirmations via stdout */
 		if(dup2(fdStdout, STDOUT_FILENO) == -1) {
 			DBGPRINTF("omprog: dup() stdout failed\n");
 		}
 		/* redirect stderr to the output file, if specified */
-		if (pWrkrData->pData->szOutputFileName != NULL) {
+		if (pData->szOutputFileName != NULL) {
 			if(dup2(fdStderr, STDERR_FILENO) == -1) {
 				DBGPRINTF("omprog: dup() stderr failed\n");
 			}
 		} else {
 			close(fdStderr);
 		}
-	} else if (pWrkrData->pData->szOutputFileName != NULL) {
+	} else if (pData->szOutputFileName != NULL) {
 		/* redirect both stdout and stderr to the output file */
 		if(dup2(fdStderr, STDOUT_FILENO) == -1) {
 			DBGPRINTF("omprog: dup() stdout failed\n");
@@ -199,7 +219,7 @@ execBinary(wrkrInstanceData_t *pWrkrData, int fdStdin, int fdStdout, int fdStder
 	alarm(0);
 
 	/* finally exec child */
-	iRet = execve((char*)pWrkrData->pData->szBinary, pWrkrData->pData->aParams, newenviron);
+	iRet = execve((char*)pData->szBinary, pData->aParams, newenviron);
 	if(iRet == -1) {
 		/* Note: this will go to stdout of the **child**, so rsyslog will never
 		 * see it except when stdout is captured. If we use the plugin interface,
@@ -207,10 +227,10 @@ execBinary(wrkrInstanceData_t *pWrkrData, int fdStdin, int fdStdout, int fdStder
 		 */
 		rs_strerror_r(errno, errStr, sizeof(errStr));
 		DBGPRINTF("omprog: failed to execute program '%s': %s\n",
-			  pWrkrData->pData->szBinary, errStr);
+			  pData->szBinary, errStr);
 		openlog("rsyslogd", 0, LOG_SYSLOG);
 		syslog(LOG_ERR, "omprog: failed to execute program '%s': %s\n",
-			  pWrkrData->pData->szBinary, errStr);
+			  pData->szBinary, errStr);
 	}
 
 	/* we should never reach this point, but if we do, we terminate */
@@ -221,7 +241,7 @@ execBinary(wrkrInstanceData_t *pWrkrData, int fdStdin, int fdStdout, int fdStder
  * rgerhards, 2009-04-01
  */
 static rsRetVal
-openPipe(wrkrInstanceData_t *pWrkrData)
+openPipe(wrkrInstanceData_t *pWrkrData, childProcessCtx_t *pChild)
 {
 	int pipeStdin[2];
 	int pipeStdout[2];
@@ -256,14 +276,14 @@ openPipe(wrkrInstanceData_t *pWrkrData)
 	if(cpid == -1) {
 		ABORT_FINALIZE(RS_RET_ERR_FORK);
 	}
-	pWrkrData->pid = cpid;
+	pChild->pid = cpid;
 
 	if(cpid == 0) {
 		/* we are now the child, just exec the binary. */
 		close(pipeStdin[1]); /* close those pipe "ports" that */
 		close(pipeStdout[0]); /* ... we don't need */
 		close(pipeStderr[0]);
-		execBinary(pWrkrData, pipeStdin[0], pipeStdout[1], pipeStderr[1]);
+		execBinary(pWrkrData->pData, pipeStdin[0], pipeStdout[1], pipeStderr[1]);
 		/*NO CODE HERE - WILL NEVER BE REACHED!*/
 	}
 
@@ -274,44 +294,44 @@ openPipe(wrkrInstanceData_t *pWrkrData)
 	close(pipeStderr[1]);
 
 	/* we'll send messages to the program via fdPipeOut */
-	pWrkrData->fdPipeOut = pipeStdin[1];
+	pChild->fdPipeOut = pipeStdin[1];
 
 	if(pWrkrData->pData->bConfirmMessages) {
 		/* we'll receive message confirmations via fdPipeIn */
-		pWrkrData->fdPipeIn = pipeStdout[0];
+		pChild->fdPipeIn = pipeStdout[0];
 		/* we'll capture stderr to the output file, if specified */
 		if (pWrkrData->pData->szOutputFileName != NULL) {
-			pWrkrData->fdPipeErr = pipeStderr[0];
+			pChild->fdPipeErr = pipeStderr[0];
 		}
 		else {
 			close(pipeStderr[0]);
-			pWrkrData->fdPipeErr = -1;
+			pChild->fdPipeErr = -1;
 		}
 	} else if (pWrkrData->pData->szOutputFileName != NULL) {
 		/* we'll capture both stdout and stderr via fdPipeErr */
 		close(pipeStdout[0]);
-		pWrkrData->fdPipeIn = -1;
-		pWrkrData->fdPipeErr = pipeStderr[0];
+		pChild->fdPipeIn = -1;
+		pChild->fdPipeErr = pipeStderr[0];
 	} else {
 		/* no need to read the program stdout or stderr */
 		close(pipeStdout[0]);
 		close(pipeStderr[0]);
-		pWrkrData->fdPipeIn = -1;
-		pWrkrData->fdPipeErr = -1;
+		pChild->fdPipeIn = -1;
+		pChild->fdPipeErr = -1;
 	}
 
-	if(pWrkrData->fdPipeErr != -1) {
+	if(pChild->fdPipeErr != -1) {
 		/* set our fd to be non-blocking */
-		flags = fcntl(pWrkrData->fdPipeErr, F_GETFL);
+		flags = fcntl(pChild->fdPipeErr, F_GETFL);
 		flags |= O_NONBLOCK;
-		if(fcntl(pWrkrData->fdPipeErr, F_SETFL, flags) == -1) {
+		if(fcntl(pChild->fdPipeErr, F_SETFL, flags) == -1) {
 			LogError(errno, RS_RET_ERR, "omprog: set pipe fd to "
 				"nonblocking failed");
 			ABORT_FINALIZE(RS_RET_ERR);
 		}
 	}
 
-	pWrkrData->bIsRunning = 1;
+	pChild->bIsRunning = 1;
 finalize_it:
 	RETiRet;
 }
@@ -354,16 +374,17 @@ done:	return;
  * if so, properly handle it.
  */
 static void
-checkProgramOutput(wrkrInstanceData_t *__restrict__ const pWrkrData)
+checkProgramOutput(wrkrInstanceData_t *__restrict__ const pWrkrData,
+	const childProcessCtx_t *__restrict__ const pChild)
 {
 	char buf[4096];
 	ssize_t r;
 
-	if(pWrkrData->fdPipeErr == -1)
+	if(pChild->fdPipeErr == -1)
 		goto done;
 
 	do {
-		r = read(pWrkrData->fdPipeErr, buf, sizeof(buf));
+		r = read(pChild->fdPipeErr, buf, sizeof(buf));
 		if(r > 0) {
 			writeProgramOutput(pWrkrData, buf, r);
 		}
@@ -373,14 +394,14 @@ done:	return;
 }
 
 static void
-waitForChild(wrkrInstanceData_t *pWrkrData)
+waitForChild(wrkrInstanceData_t *pWrkrData, childProcessCtx_t *pChild)
 {
 	int status;
 	int ret;
 	long counter;
 
 	counter = pWrkrData->pData->lCloseTimeout / 10;
-	while ((ret = waitpid(pWrkrData->pid, &status, WNOHANG)) == 0 && counter > 0) {
+	while ((ret = waitpid(pChild->pid, &status, WNOHANG)) == 0 && counter > 0) {
 		srSleep(0, 10000);  /* 0 seconds, 10 milliseconds */
 		--counter;
 	}
@@ -389,38 +410,38 @@ waitForChild(wrkrInstanceData_t *pWrkrData)
 		if (!pWrkrData->pData->bKillUnresponsive) {
 			errmsg.LogError(0, NO_ERRCODE, "omprog: program '%s' (pid %d) did not terminate "
 					"within timeout (%ld ms); ignoring it", pWrkrData->pData->szBinary,
-					pWrkrData->pid, pWrkrData->pData->lCloseTimeout);
+					pChild->pid, pWrkrData->pData->lCloseTimeout);
 			return;
 		}
 
 		errmsg.LogError(0, NO_ERRCODE, "omprog: program '%s' (pid %d) did not terminate "
 				"within timeout (%ld ms); killing it", pWrkrData->pData->szBinary,
-				pWrkrData->pid, pWrkrData->pData->lCloseTimeout);
-		if (kill(pWrkrData->pid, SIGKILL) == -1) {
+				pChild->pid, pWrkrData->pData->lCloseTimeout);
+		if (kill(pChild->pid, SIGKILL) == -1) {
 			errmsg.LogError(errno, RS_RET_SYS_ERR, "omprog: could not send SIGKILL to child process");
 			return;
 		}
-		ret = waitpid(pWrkrData->pid, &status, 0);
+		ret = waitpid(pChild->pid, &status, 0);
 	}
 
-	if (ret != pWrkrData->pid) {
+	if (ret != pChild->pid) {
 		if (errno == ECHILD) {  /* child reaped by the rsyslogd main loop (see rsyslogd.c) */
 			errmsg.LogError(0, NO_ERRCODE, "omprog: program '%s' (pid %d) exited; reaped by main loop",
-					pWrkrData->pData->szBinary, pWrkrData->pid);
+					pWrkrData->pData->szBinary, pChild->pid);
 		} else {
 			errmsg.LogError(errno, RS_RET_SYS_ERR, "omprog: waitpid failed for program '%s' (pid %d)",
-					pWrkrData->pData->szBinary, pWrkrData->pid);
+					pWrkrData->pData->szBinary, pChild->pid);
 		}
 	} else {
 		/* check if we should print out some diagnostic information */
 		DBGPRINTF("omprog: waitpid status return for program '%s' (pid %d): %2.2x\n",
-				pWrkrData->pData->szBinary, pWrkrData->pid, status);
+				pWrkrData->pData->szBinary, pChild->pid, status);
 		if(WIFEXITED(status)) {
 			errmsg.LogError(0, NO_ERRCODE, "omprog: program '%s' (pid %d) exited normally, status %d",
-					pWrkrData->pData->szBinary, pWrkrData->pid, WEXITSTATUS(status));
+					pWrkrData->pData->szBinary, pChild->pid, WEXITSTATUS(status));
 		} else if(WIFSIGNALED(status)) {
 			errmsg.LogError(0, NO_ERRCODE, "omprog: program '%s' (pid %d) terminated by signal %d",
-					pWrkrData->pData->szBinary, pWrkrData->pid, WTERMSIG(status));
+					pWrkrData->pData->szBinary, pChild->pid, WTERMSIG(status));
 		}
 	}
 }
@@ -428,91 +449,106 @@ waitForChild(wrkrInstanceData_t *pWrkrData)
 /* close pipe and wait for child to terminate
  */
 static void
-cleanupChild(wrkrInstanceData_t *pWrkrData)
+cleanupChild(wrkrInstanceData_t *pWrkrData, childProcessCtx_t *pChild)
 {
-	assert(pWrkrData->bIsRunning == 1);
+	assert(pChild->bIsRunning == 1);
 
-	checkProgramOutput(pWrkrData);  /* try to catch any late messages */
+	checkProgramOutput(pWrkrData, pChild);  /* try to catch any late messages */
 
 	if(pWrkrData->fdOutputFile != -1) {
 		close(pWrkrData->fdOutputFile);
 		pWrkrData->fdOutputFile = -1;
 	}
-	if(pWrkrData->fdPipeErr != -1) {
-		close(pWrkrData->fdPipeErr);
-		pWrkrData->fdPipeErr = -1;
+	if(pChild->fdPipeErr != -1) {
+		close(pChild->fdPipeErr);
+		pChild->fdPipeErr = -1;
 	}
-	if(pWrkrData->fdPipeIn != -1) {
-		close(pWrkrData->fdPipeIn);
-		pWrkrData->fdPipeIn = -1;
+	if(pChild->fdPipeIn != -1) {
+		close(pChild->fdPipeIn);
+		pChild->fdPipeIn = -1;
 	}
-	if(pWrkrData->fdPipeOut != -1) {
-		close(pWrkrData->fdPipeOut);
-		pWrkrData->fdPipeOut = -1;
+	if(pChild->fdPipeOut != -1) {
+		close(pChild->fdPipeOut);
+		pChild->fdPipeOut = -1;
 	}
 
 	/* wait for the child AFTER closing the pipe, so it receives EOF */
-	waitForChild(pWrkrData);
+	waitForChild(pWrkrData, pChild);
 
-	pWrkrData->bIsRunning = 0;
+	pChild->bIsRunning = 0;
 }
 
 /* Send SIGTERM to child process if configured to do so, close pipe
  * and wait for child to terminate.
  */
 static void
-terminateChild(wrkrInstanceData_t *pWrkrData)
+terminateChild(wrkrInstanceData_t *pWrkrData, childProcessCtx_t *pChild)
 {
-	assert(pWrkrData->bIsRunning == 1);
+	assert(pChild->bIsRunning == 1);
 
 	if (pWrkrData->pData->bSignalOnClose) {
-		kill(pWrkrData->pid, SIGTERM);
+		kill(pChild->pid, SIGTERM);
 	}
 
-	cleanupChild(pWrkrData);
+	cleanupChild(pWrkrData, pChild);
 }
 
 /* write to pipe
  * note that we do not try to run block-free. If the users fears something
  * may block (and this not be acceptable), the action should be run on its
  * own action queue.
+ * Note that the iovec array is modified if writev() writes only part of it.
  */
 static rsRetVal
-writePipe(wrkrInstanceData_t *pWrkrData, uchar *szMsg)
+writevPipe(wrkrInstanceData_t *pWrkrData, childProcessCtx_t *pChild, struct iovec *iov, int iovcnt)
 {
-	int lenWritten;
-	int lenWrite;
-	int writeOffset;
+	ssize_t lenWritten;
 	char errStr[1024];
 	DEFiRet;
 
-	lenWrite = strlen((char*)szMsg);
-	writeOffset = 0;
-
-	do {
-		checkProgramOutput(pWrkrData);
-		lenWritten = write(pWrkrData->fdPipeOut, ((char*)szMsg)+writeOffset, lenWrite);
+	while(iovcnt > 0) {
+		checkProgramOutput(pWrkrData, pChild);
+		lenWritten = writev(pChild->fdPipeOut, iov, iovcnt);
 		if(lenWritten == -1) {
 			if(errno == EPIPE) {
 				DBGPRINTF("omprog: program '%s' terminated, will be restarted\n",
 					  pWrkrData->pData->szBinary);
 				/* force restart in tryResume() */
-				cleanupChild(pWrkrData);
+				cleanupChild(pWrkrData, pChild);
 			} else {
 				DBGPRINTF("omprog: error %d writing to pipe: %s\n", errno,
 					   rs_strerror_r(errno, errStr, sizeof(errStr)));
 			}
 			ABORT_FINALIZE(RS_RET_SUSPENDED);
 		}
-		writeOffset += lenWritten;
-	} while(lenWritten != lenWrite);
+		/* skip what has been written, then continue with the rest */
+		while(iovcnt > 0 && (size_t) lenWritten >= iov->iov_len) {
+			lenWritten -= iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+		if(iovcnt > 0) {
+			iov->iov_base = (char*) iov->iov_base + lenWritten;
+			iov->iov_len -= lenWritten;
+		}
+	}
 
-	checkProgramOutput(pWrkrData);
+	checkProgramOutput(pWrkrData, pChild);
 
 finalize_it:
 	RETiRet;
 }
 
+static rsRetVal
+writePipe(wrkrInstanceData_t *pWrkrData, childProcessCtx_t *pChild, uchar *szMsg)
+{
+	struct iovec iov;
+
+	iov.iov_base = szMsg;
+	iov.iov_len = strlen((char*)szMsg);
+	return writevPipe(pWrkrData, pChild, &iov, 1);
+}
+
 /* Reads a line from a blocking pipe, using the unistd.h read() function.
  * Returns the line as a null-terminated string in *lineptr, not including
  * the \n or \r\n terminator.
@@ -601,20 +637,20 @@ lineToStatusCode(wrkrInstanceData_t *pWrkrData, const char* line)
 }
 
 static rsRetVal
-readPipe(wrkrInstanceData_t *pWrkrData)
+readPipe(wrkrInstanceData_t *pWrkrData, childProcessCtx_t *pChild)
 {
 	char *line;
 	ssize_t lineLen;
 	char errStr[1024];
 	DEFiRet;
 
-	lineLen = readline(pWrkrData->fdPipeIn, &line);
+	lineLen = readline(pChild->fdPipeIn, &line);
 	if (lineLen == -1) {
 		if (errno == EPIPE) {
 			DBGPRINTF("omprog: program '%s' terminated, will be restarted\n",
 				  pWrkrData->pData->szBinary);
 			/* force restart in tryResume() */
-			cleanupChild(pWrkrData);
+			cleanupChild(pWrkrData, pChild);
 		} else {
 			DBGPRINTF("omprog: error %d reading from pipe: %s\n", errno,
 				   rs_strerror_r(errno, errStr, sizeof(errStr)));
@@ -629,24 +665,187 @@ finalize_it:
 }
 
 static rsRetVal
-startChild(wrkrInstanceData_t *pWrkrData)
+startChild(wrkrInstanceData_t *pWrkrData, childProcessCtx_t *pChild)
 {
 	DEFiRet;
 
-	assert(pWrkrData->bIsRunning == 0);
+	assert(pChild->bIsRunning == 0);
 
-	CHKiRet(openPipe(pWrkrData));
+	CHKiRet(openPipe(pWrkrData, pChild));
 
 	if(pWrkrData->pData->bConfirmMessages) {
 		/* wait for program to confirm successful initialization */
-		CHKiRet(readPipe(pWrkrData));
+		CHKiRet(readPipe(pWrkrData, pChild));
 	}
 
 finalize_it:
-	if (iRet != RS_RET_OK && pWrkrData->bIsRunning) {
+	if (iRet != RS_RET_OK && pChild->bIsRunning) {
 		/* if initialization has failed, terminate program */
-		terminateChild(pWrkrData);
+		terminateChild(pWrkrData, pChild);
+	}
+	RETiRet;
+}
+
+
+/* fill in the length header of a record if octet-counted framing is
+ * used. Returns the number of iovec entries used (0 or 1).
+ */
+static int
+frameRecord(const instanceData *const pData, struct iovec *const iov, const size_t lenRecord,
+	char *const lenHdr, const size_t sizeLenHdr)
+{
+	if(pData->iFraming != FRAMING_OCTET_COUNTED)
+		return 0;
+	iov->iov_base = lenHdr;
+	iov->iov_len = snprintf(lenHdr, sizeLenHdr, "%zu ", lenRecord);
+	return 1;
+}
+
+/* add a transaction mark (plus its LF) to an iovec array.
+ * Returns the number of iovec entries used (at most 3).
+ */
+static int
+addMarkToIov(const instanceData *const pData, struct iovec *const iov, uchar *const mark,
+	char *const lenHdr, const size_t sizeLenHdr)
+{
+	const size_t lenMark = strlen((char*)mark);
+	int n;
+
+	n = frameRecord(pData, iov, lenMark + 1, lenHdr, sizeLenHdr);
+	iov[n].iov_base = mark;
+	iov[n++].iov_len = lenMark;
+	iov[n].iov_base = (char*) "\n";
+	iov[n++].iov_len = 1;
+	return n;
+}
+
+/* send a transaction mark to the program and read its status, if configured */
+static rsRetVal
+sendMark(wrkrInstanceData_t *pWrkrData, childProcessCtx_t *pChild, uchar *mark)
+{
+	struct iovec iov[3];
+	char lenHdr[32];
+	int iovcnt;
+	DEFiRet;
+
+	iovcnt = addMarkToIov(pWrkrData->pData, iov, mark, lenHdr, sizeof(lenHdr));
+	CHKiRet(writevPipe(pWrkrData, pChild, iov, iovcnt));
+
+	if(pWrkrData->pData->bConfirmMessages) {
+		CHKiRet(readPipe(pWrkrData, pChild));
+	}
+finalize_it:
+	RETiRet;
+}
+
+/* batch mode: add a message to the current batch */
+static rsRetVal
+appendBatch(wrkrInstanceData_t *const pWrkrData, const uchar *const msg)
+{
+	const size_t lenMsg = strlen((const char*)msg);
+	char lenHdr[32];
+	size_t lenLenHdr = 0;
+	size_t newSize;
+	char *newBuf;
+	size_t *newMsgEnd;
+	DEFiRet;
+
+	if(pWrkrData->pData->iFraming == FRAMING_OCTET_COUNTED) {
+		lenLenHdr = snprintf(lenHdr, sizeof(lenHdr), "%zu ", lenMsg);
+	}
+
+	if(pWrkrData->lenBatchBuf + lenLenHdr + lenMsg > pWrkrData->sizeBatchBuf) {
+		newSize = (pWrkrData->sizeBatchBuf == 0) ? 4096 : pWrkrData->sizeBatchBuf * 2;
+		if(newSize < pWrkrData->lenBatchBuf + lenLenHdr + lenMsg)
+			newSize = pWrkrData->lenBatchBuf + lenLenHdr + lenMsg;
+		CHKmalloc(newBuf = realloc(pWrkrData->batchBuf, newSize));
+		pWrkrData->batchBuf = newBuf;
+		pWrkrData->sizeBatchBuf = newSize;
+	}
+	if(pWrkrData->nBatchMsgs == pWrkrData->maxBatchMsgs) {
+		newSize = (pWrkrData->maxBatchMsgs == 0) ? 128 : pWrkrData->maxBatchMsgs * 2;
+		CHKmalloc(newMsgEnd = realloc(pWrkrData->msgEnd, newSize * sizeof(size_t)));
+		pWrkrData->msgEnd = newMsgEnd;
+		pWrkrData->maxBatchMsgs = newSize;
+	}
+
+	memcpy(pWrkrData->batchBuf + pWrkrData->lenBatchBuf, lenHdr, lenLenHdr);
+	memcpy(pWrkrData->batchBuf + pWrkrData->lenBatchBuf + lenLenHdr, msg, lenMsg);
+	pWrkrData->lenBatchBuf += lenLenHdr + lenMsg;
+	pWrkrData->msgEnd[pWrkrData->nBatchMsgs++] = pWrkrData->lenBatchBuf;
+
+finalize_it:
+	RETiRet;
+}
+
+/* batch mode: send the current batch to the program(s) and wait for the
+ * confirmations. The batch is split into one contiguous shard per program
+ * instance. All shards are written (each with a single writev) before the
+ * first confirmation is read, so the programs process them in parallel.
+ * Each program confirms its whole shard with a single status line.
+ */
+static rsRetVal
+sendBatch(wrkrInstanceData_t *const pWrkrData)
+{
+	instanceData *const pData = pWrkrData->pData;
+	struct iovec iov[7];
+	char beginHdr[32];
+	char commitHdr[32];
+	unsigned nShards;
+	unsigned nSent;
+	unsigned first, last;
+	unsigned i;
+	size_t start;
+	int iovcnt;
+	rsRetVal localRet;
+	DEFiRet;
+
+	if(pWrkrData->nBatchMsgs == 0)
+		FINALIZE;
+
+	nShards = (unsigned) pData->iProcesses;
+	if(nShards > pWrkrData->nBatchMsgs)
+		nShards = pWrkrData->nBatchMsgs;
+	for(i = 0 ; i < nShards ; ++i) {
+		if(pWrkrData->children[i].bIsRunning == 0) {  /* should not occur */
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
 	}
+
+	for(nSent = 0 ; nSent < nShards ; ++nSent) {
+		first = nSent * pWrkrData->nBatchMsgs / nShards;
+		last = (nSent + 1) * pWrkrData->nBatchMsgs / nShards;
+		start = (first == 0) ? 0 : pWrkrData->msgEnd[first - 1];
+		iovcnt = 0;
+		if(pData->bUseTransactions) {
+			iovcnt += addMarkToIov(pData, iov + iovcnt, pData->szBeginTransactionMark,
+				beginHdr, sizeof(beginHdr));
+		}
+		iov[iovcnt].iov_base = pWrkrData->batchBuf + start;
+		iov[iovcnt++].iov_len = pWrkrData->msgEnd[last - 1] - start;
+		if(pData->bUseTransactions) {
+			iovcnt += addMarkToIov(pData, iov + iovcnt, pData->szCommitTransactionMark,
+				commitHdr, sizeof(commitHdr));
+		}
+		localRet = writevPipe(pWrkrData, &pWrkrData->children[nSent], iov, iovcnt);
+		if(localRet != RS_RET_OK) {
+			iRet = localRet;
+			break;
+		}
+	}
+
+	/* read the status of every program we have sent a shard to, even if a
+	 * later write failed, so that requests and replies stay in sync.
+	 */
+	if(pData->bConfirmMessages) {
+		for(i = 0 ; i < nSent ; ++i) {
+			localRet = readPipe(pWrkrData, &pWrkrData->children[i]);
+			if(localRet == RS_RET_SUSPENDED)
+				iRet = RS_RET_SUSPENDED;
+		}
+	}
+
+finalize_it:
 	RETiRet;
 }
 
@@ -664,14 +863,24 @@ ENDcreateInstance
 
 
 BEGINcreateWrkrInstance
+	int i;
+	rsRetVal localRet;
 CODESTARTcreateWrkrInstance
-	pWrkrData->fdPipeOut = -1;
-	pWrkrData->fdPipeIn = -1;
-	pWrkrData->fdPipeErr = -1;
 	pWrkrData->fdOutputFile = -1;
-	pWrkrData->bIsRunning = 0;
+	CHKmalloc(pWrkrData->children = calloc(pData->iProcesses, sizeof(childProcessCtx_t)));
+	for(i = 0 ; i < pData->iProcesses ; ++i) {
+		pWrkrData->children[i].fdPipeOut = -1;
+		pWrkrData->children[i].fdPipeIn = -1;
+		pWrkrData->children[i].fdPipeErr = -1;
+		pWrkrData->children[i].bIsRunning = 0;
+	}
 
-	iRet = startChild(pWrkrData);
+	for(i = 0 ; i < pData->iProcesses ; ++i) {
+		localRet = startChild(pWrkrData, &pWrkrData->children[i]);
+		if(localRet != RS_RET_OK)
+			iRet = localRet;
+	}
+finalize_it:
 ENDcreateWrkrInstance
 
 
@@ -688,9 +897,12 @@ ENDdbgPrintInstInfo
 
 
 BEGINtryResume
+	int i;
 CODESTARTtryResume
-	if (pWrkrData->bIsRunning == 0) {
-		CHKiRet(startChild(pWrkrData));
+	for(i = 0 ; i < pWrkrData->pData->iProcesses ; ++i) {
+		if (pWrkrData->children[i].bIsRunning == 0) {
+			CHKiRet(startChild(pWrkrData, &pWrkrData->children[i]));
+		}
 	}
 finalize_it:
 ENDtryResume
@@ -698,33 +910,49 @@ ENDtryResume
 
 BEGINbeginTransaction
 CODESTARTbeginTransaction
+	if(pWrkrData->pData->bSendBatches) {
+		/* the batch is sent as a whole by endTransaction() */
+		pWrkrData->lenBatchBuf = 0;
+		pWrkrData->nBatchMsgs = 0;
+		FINALIZE;
+	}
 	if(!pWrkrData->pData->bUseTransactions) {
 		FINALIZE;
 	}
 
-	CHKiRet(writePipe(pWrkrData, pWrkrData->pData->szBeginTransactionMark));
-	CHKiRet(writePipe(pWrkrData, (uchar*) "\n"));
-
-	if(pWrkrData->pData->bConfirmMessages) {
-		CHKiRet(readPipe(pWrkrData));
-	}
+	CHKiRet(sendMark(pWrkrData, &pWrkrData->children[0], pWrkrData->pData->szBeginTransactionMark));
 finalize_it:
 ENDbeginTransaction
 
 
 BEGINdoAction
+	childProcessCtx_t *const pChild = &pWrkrData->children[0];
+	struct iovec iov[2];
+	char lenHdr[32];
+	size_t lenMsg;
+	int iovcnt;
 CODESTARTdoAction
 	if(pWrkrData->pData->bForceSingleInst) {
 		pthread_mutex_lock(&pWrkrData->pData->mut);
 	}
-	if(pWrkrData->bIsRunning == 0) {  /* should not occur */
+	if(pWrkrData->pData->bSendBatches) {
+		/* just collect the message, the batch is sent by endTransaction() */
+		CHKiRet(appendBatch(pWrkrData, ppString[0]));
+		iRet = RS_RET_DEFER_COMMIT;
+		FINALIZE;
+	}
+	if(pChild->bIsRunning == 0) {  /* should not occur */
 		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
 
-	CHKiRet(writePipe(pWrkrData, ppString[0]));
+	lenMsg = strlen((char*)ppString[0]);
+	iovcnt = frameRecord(pWrkrData->pData, iov, lenMsg, lenHdr, sizeof(lenHdr));
+	iov[iovcnt].iov_base = ppString[0];
+	iov[iovcnt++].iov_len = lenMsg;
+	CHKiRet(writevPipe(pWrkrData, pChild, iov, iovcnt));
 
 	if(pWrkrData->pData->bConfirmMessages) {
-		CHKiRet(readPipe(pWrkrData));
+		CHKiRet(readPipe(pWrkrData, pChild));
 	} else if(pWrkrData->pData->bUseTransactions) {
 		/* ensure endTransaction will be called */
 		iRet = RS_RET_DEFER_COMMIT;
@@ -739,25 +967,40 @@ ENDdoAction
 
 BEGINendTransaction
 CODESTARTendTransaction
+	if(pWrkrData->pData->bSendBatches) {
+		if(pWrkrData->pData->bForceSingleInst) {
+			pthread_mutex_lock(&pWrkrData->pData->mut);
+		}
+		iRet = sendBatch(pWrkrData);
+		if(pWrkrData->pData->bForceSingleInst) {
+			pthread_mutex_unlock(&pWrkrData->pData->mut);
+		}
+		pWrkrData->lenBatchBuf = 0;
+		pWrkrData->nBatchMsgs = 0;
+		FINALIZE;
+	}
 	if(!pWrkrData->pData->bUseTransactions) {
 		FINALIZE;
 	}
 
-	CHKiRet(writePipe(pWrkrData, pWrkrData->pData->szCommitTransactionMark));
-	CHKiRet(writePipe(pWrkrData, (uchar*) "\n"));
-
-	if(pWrkrData->pData->bConfirmMessages) {
-		CHKiRet(readPipe(pWrkrData));
-	}
+	CHKiRet(sendMark(pWrkrData, &pWrkrData->children[0], pWrkrData->pData->szCommitTransactionMark));
 finalize_it:
 ENDendTransaction
 
 
 BEGINfreeWrkrInstance
+	int i;
 CODESTARTfreeWrkrInstance
-	if (pWrkrData->bIsRunning) {
-		terminateChild(pWrkrData);
+	if(pWrkrData->children != NULL) {
+		for(i = 0 ; i < pWrkrData->pData->iProcesses ; ++i) {
+			if (pWrkrData->children[i].bIsRunning) {
+				terminateChild(pWrkrData, &pWrkrData->children[i]);
+			}
+		}
+		free(pWrkrData->children);
 	}
+	free(pWrkrData->batchBuf);
+	free(pWrkrData->msgEnd);
 ENDfreeWrkrInstance
 
 
@@ -798,6 +1041,9 @@ setInstParamDefaults(instanceData *pData)
 	pData->lCloseTimeout = DEFAULT_CLOSE_TIMEOUT_MS;
 	pData->bKillUnresponsive = -1;
 	pData->szOutputFileName = NULL;
+	pData->bSendBatches = 0;
+	pData->iFraming = FRAMING_LF;
+	pData->iProcesses = 1;
 }
 
 
@@ -872,11 +1118,34 @@ CODESTARTnewActInst
 			free((void*)sig);
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->szTemplateName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "batch")) {
+			pData->bSendBatches = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "framing")) {
+			if(!es_strcasebufcmp(pvals[i].val.d.estr, (uchar*)"traditional", 11)) {
+				pData->iFraming = FRAMING_LF;
+			} else if(!es_strcasebufcmp(pvals[i].val.d.estr, (uchar*)"octet-counted", 13)) {
+				pData->iFraming = FRAMING_OCTET_COUNTED;
+			} else {
+				uchar *str;
+				str = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+				errmsg.LogError(0, RS_RET_CNF_INVLD_FRAMING,
+					"omprog: invalid framing \"%s\"", str);
+				free(str);
+				ABORT_FINALIZE(RS_RET_CNF_INVLD_FRAMING);
+			}
+		} else if(!strcmp(actpblk.descr[i].name, "processes")) {
+			pData->iProcesses = (int) pvals[i].val.d.n;
 		} else {
 			DBGPRINTF("omprog: program error, non-handled param '%s'\n", actpblk.descr[i].name);
 		}
 	}
 
+	if(pData->iProcesses > 1 && !pData->bSendBatches) {
+		errmsg.LogError(0, RS_RET_CONF_PARAM_INVLD,
+			"omprog: processes > 1 is only supported together with batch=\"on\"");
+		ABORT_FINALIZE(RS_RET_CONF_PARAM_INVLD);
+	}
+
 	setInstParamCalcDefaults(pData);
 	CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*)strdup((pData->szTemplateName == NULL) ?
 						"RSYSLOG_FileFormat" : (char*)pData->szTemplateName),
@@ -910,6 +1179,7 @@ CODE_STD_STRING_REQUESTparseSelectorAct(1)
 		ABORT_FINALIZE(RS_RET_CONF_RQRD_PARAM_MISSING);
 	}
 
+	pData->iProcesses = 1;
 	CHKmalloc(pData->szBinary = (uchar*) strdup((char*)cs.szBinary));
 	/* check if a non-standard template is to be applied */
 	if(*(p-1) == ';')
@@ -920,11 +1190,14 @@ ENDparseSelectorAct
 
 
 BEGINdoHUPWrkr
+	int i;
 CODESTARTdoHUPWrkr
-	DBGPRINTF("omprog: processing HUP for work instance %p, pid %d, forward: %d\n",
-		pWrkrData, (int) pWrkrData->pid, pWrkrData->pData->iHUPForward);
-	if(pWrkrData->pData->iHUPForward != NO_HUP_FORWARD)
-		kill(pWrkrData->pid, pWrkrData->pData->iHUPForward);
+	for(i = 0 ; i < pWrkrData->pData->iProcesses ; ++i) {
+		DBGPRINTF("omprog: processing HUP for work instance %p, pid %d, forward: %d\n",
+			pWrkrData, (int) pWrkrData->children[i].pid, pWrkrData->pData->iHUPForward);
+		if(pWrkrData->pData->iHUPForward != NO_HUP_FORWARD && pWrkrData->children[i].bIsRunning)
+			kill(pWrkrData->children[i].pid, pWrkrData->pData->iHUPForward);
+	}
 ENDdoHUPWrkr
 
 
@@ -13,10 +13,15 @@
  *       performance implications (and given the fact that message
  *       loss is pretty unlikely in usual cases).
  *
+ * Each worker can use multiple RELP sessions ("sessions" parameter),
+ * batches are then distributed round-robin over them. As every session
+ * has its own RELP window, this permits to have more messages in
+ * flight, which is needed to saturate high-latency links.
+ *
  *
  * File begun on 2008-03-13 by RGerhards
  *
- * Copyright 2008-2016 Adiscon GmbH.
+ * Copyright 2008-2018 Adiscon GmbH.
  *
  * This file is part of rsyslog.
  *
@@ -53,6 +58,7 @@
 #include "errmsg.h"
 #include "debug.h"
 #include "unicode-helper.h"
+#include "statsobj.h"
 
 #ifndef RELP_DFLT_PT
 #	define RELP_DFLT_PT "514"
@@ -67,16 +73,30 @@ MODULE_CNFNAME("omrelp")
 DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
 DEFobjCurrIf(glbl)
+DEFobjCurrIf(statsobj)
 
 #define DFLT_ENABLE_TLS 0
 #define DFLT_ENABLE_TLSZIP 0
 
 static relpEngine_t *pRelpEngine;	/* our relp engine */
 
+/* counters for one session slot of an action. They are shared by all
+ * workers of the action, as the slot number is what matters to the user.
+ */
+typedef struct sessStats_s {
+	statsobj_t *stats;
+	STATSCOUNTER_DEF(ctrSent, mutCtrSent)
+	STATSCOUNTER_DEF(ctrBatches, mutCtrBatches)
+	STATSCOUNTER_DEF(ctrFail, mutCtrFail)
+	STATSCOUNTER_DEF(ctrConnect, mutCtrConnect)
+} sessStats_t;
+
 typedef struct _instanceData {
 	uchar *target;
 	uchar *port;
 	int sizeWindow;		/**< the RELP window size - 0=use default */
+	int nSessions;		/**< number of RELP sessions per worker */
+	sessStats_t *sessStats;	/**< one entry per session slot */
 	unsigned timeout;
 	int connTimeout;
 	unsigned rebindInterval;
@@ -96,12 +116,22 @@ typedef struct _instanceData {
 	} permittedPeers;
 } instanceData;
 
-typedef struct wrkrInstanceData {
-	instanceData *pData;
+/* a single RELP session of a worker. Each session has its own RELP
+ * window, so with multiple sessions a worker can have more messages in
+ * flight, which is what matters on high-latency links.
+ */
+typedef struct omrelpSess_s {
 	int bInitialConnect; /* is this the initial connection request of our module? (0-no, 1-yes) */
 	int bIsConnected; /* currently connected to server? 0 - no, 1 - yes */
-	relpClt_t *pRelpClt; /* relp client for this instance */
+	relpClt_t *pRelpClt; /* relp client for this session */
 	unsigned nSent; /* number msgs sent - for rebind support */
+	sessStats_t *pStats;
+} omrelpSess_t;
+
+typedef struct wrkrInstanceData {
+	instanceData *pData;
+	omrelpSess_t *sess;
+	int currSess; /* session used by the current batch */
 } wrkrInstanceData_t;
 
 typedef struct configSettings_s {
@@ -109,7 +139,7 @@ typedef struct configSettings_s {
 } configSettings_t;
 static configSettings_t __attribute__((unused)) cs;
 
-static rsRetVal doCreateRelpClient(wrkrInstanceData_t *pWrkrData);
+static rsRetVal doCreateRelpClient(wrkrInstanceData_t *pWrkrData, omrelpSess_t *pSess);
 
 /* tables for interfacing with the v6 config system */
 /* action (instance) parameters */
@@ -126,6 +156,7 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "port", eCmdHdlrGetWord, 0 },
 	{ "rebindinterval", eCmdHdlrInt, 0 },
 	{ "windowsize", eCmdHdlrInt, 0 },
+	{ "sessions", eCmdHdlrPositiveInt, 0 },
 	{ "timeout", eCmdHdlrInt, 0 },
 	{ "conn.timeout", eCmdHdlrInt, 0 },
 	{ "localclientip", eCmdHdlrGetWord, 0 },
@@ -206,54 +237,54 @@ onAuthErr(void *pUsr, char *authinfo, char* errmesg, __attribute__((unused)) rel
 }
 
 static rsRetVal
-doCreateRelpClient(wrkrInstanceData_t *pWrkrData)
+doCreateRelpClient(wrkrInstanceData_t *pWrkrData, omrelpSess_t *const pSess)
 {
 	int i;
 	instanceData *pData;
 	DEFiRet;
 
 	pData = pWrkrData->pData;
-	if(relpEngineCltConstruct(pRelpEngine, &pWrkrData->pRelpClt) != RELP_RET_OK)
+	if(relpEngineCltConstruct(pRelpEngine, &pSess->pRelpClt) != RELP_RET_OK)
 		ABORT_FINALIZE(RS_RET_RELP_ERR);
-	if(relpCltSetTimeout(pWrkrData->pRelpClt, pData->timeout) != RELP_RET_OK)
+	if(relpCltSetTimeout(pSess->pRelpClt, pData->timeout) != RELP_RET_OK)
 		ABORT_FINALIZE(RS_RET_RELP_ERR);
-	if(relpCltSetConnTimeout(pWrkrData->pRelpClt, pData->connTimeout) != RELP_RET_OK) {
+	if(relpCltSetConnTimeout(pSess->pRelpClt, pData->connTimeout) != RELP_RET_OK) {
 		ABORT_FINALIZE(RS_RET_RELP_ERR);
 	}
-	if(relpCltSetWindowSize(pWrkrData->pRelpClt, pData->sizeWindow) != RELP_RET_OK)
+	if(relpCltSetWindowSize(pSess->pRelpClt, pData->sizeWindow) != RELP_RET_OK)
 		ABORT_FINALIZE(RS_RET_RELP_ERR);
-	if(relpCltSetUsrPtr(pWrkrData->pRelpClt, pWrkrData) != RELP_RET_OK)
+	if(relpCltSetUsrPtr(pSess->pRelpClt, pWrkrData) != RELP_RET_OK)
 		ABORT_FINALIZE(RS_RET_RELP_ERR);
 	if(pData->bEnableTLS) {
-		if(relpCltEnableTLS(pWrkrData->pRelpClt) != RELP_RET_OK)
+		if(relpCltEnableTLS(pSess->pRelpClt) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
 		if(pData->bEnableTLSZip) {
-			if(relpCltEnableTLSZip(pWrkrData->pRelpClt) != RELP_RET_OK)
+			if(relpCltEnableTLSZip(pSess->pRelpClt) != RELP_RET_OK)
 				ABORT_FINALIZE(RS_RET_RELP_ERR);
 		}
-		if(relpCltSetGnuTLSPriString(pWrkrData->pRelpClt, (char*) pData->pristring) != RELP_RET_OK)
+		if(relpCltSetGnuTLSPriString(pSess->pRelpClt, (char*) pData->pristring) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
-		if(relpCltSetAuthMode(pWrkrData->pRelpClt, (char*) pData->authmode) != RELP_RET_OK) {
+		if(relpCltSetAuthMode(pSess->pRelpClt, (char*) pData->authmode) != RELP_RET_OK) {
 			errmsg.LogError(0, RS_RET_RELP_ERR,
 					"omrelp: invalid auth mode '%s'\n", pData->authmode);
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
 		}
-		if(relpCltSetCACert(pWrkrData->pRelpClt, (char*) pData->caCertFile) != RELP_RET_OK)
+		if(relpCltSetCACert(pSess->pRelpClt, (char*) pData->caCertFile) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
-		if(relpCltSetOwnCert(pWrkrData->pRelpClt, (char*) pData->myCertFile) != RELP_RET_OK)
+		if(relpCltSetOwnCert(pSess->pRelpClt, (char*) pData->myCertFile) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
-		if(relpCltSetPrivKey(pWrkrData->pRelpClt, (char*) pData->myPrivKeyFile) != RELP_RET_OK)
+		if(relpCltSetPrivKey(pSess->pRelpClt, (char*) pData->myPrivKeyFile) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
 		for(i = 0 ; i <  pData->permittedPeers.nmemb ; ++i) {
-			relpCltAddPermittedPeer(pWrkrData->pRelpClt, (char*)pData->permittedPeers.name[i]);
+			relpCltAddPermittedPeer(pSess->pRelpClt, (char*)pData->permittedPeers.name[i]);
 		}
 	}
 	if(pData->localClientIP != NULL) {
-		if(relpCltSetClientIP(pWrkrData->pRelpClt, pData->localClientIP) != RELP_RET_OK)
+		if(relpCltSetClientIP(pSess->pRelpClt, pData->localClientIP) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
 	}
-	pWrkrData->bInitialConnect = 1;
-	pWrkrData->nSent = 0;
+	pSess->bInitialConnect = 1;
+	pSess->nSent = 0;
 finalize_it:
 	RETiRet;
 }
@@ -261,6 +292,8 @@ finalize_it:
 BEGINcreateInstance
 CODESTARTcreateInstance
 	pData->sizeWindow = 0;
+	pData->nSessions = 1;
+	pData->sessStats = NULL;
 	pData->timeout = 90;
 	pData->connTimeout = 10;
 	pData->rebindInterval = 0;
@@ -276,10 +309,33 @@ CODESTARTcreateInstance
 	pData->permittedPeers.nmemb = 0;
 ENDcreateInstance
 
+static void
+freeSessions(wrkrInstanceData_t *const pWrkrData)
+{
+	int i;
+
+	if(pWrkrData->sess == NULL)
+		return;
+	for(i = 0 ; i < pWrkrData->pData->nSessions ; ++i) {
+		if(pWrkrData->sess[i].pRelpClt != NULL)
+			relpEngineCltDestruct(pRelpEngine, &pWrkrData->sess[i].pRelpClt);
+	}
+	free(pWrkrData->sess);
+	pWrkrData->sess = NULL;
+}
+
 BEGINcreateWrkrInstance
+	int i;
 CODESTARTcreateWrkrInstance
-	pWrkrData->pRelpClt = NULL;
-	iRet = doCreateRelpClient(pWrkrData);
+	pWrkrData->currSess = 0;
+	CHKmalloc(pWrkrData->sess = calloc(pData->nSessions, sizeof(omrelpSess_t)));
+	for(i = 0 ; i < pData->nSessions ; ++i) {
+		pWrkrData->sess[i].pStats = &pData->sessStats[i];
+		CHKiRet(doCreateRelpClient(pWrkrData, &pWrkrData->sess[i]));
+	}
+finalize_it:
+	if(iRet != RS_RET_OK)
+		freeSessions(pWrkrData);
 ENDcreateWrkrInstance
 
 BEGINfreeInstance
@@ -299,14 +355,59 @@ CODESTARTfreeInstance
 			free(pData->permittedPeers.name[i]);
 		}
 	}
+	if(pData->sessStats != NULL) {
+		for(i = 0 ; i < pData->nSessions ; ++i) {
+			if(pData->sessStats[i].stats != NULL)
+				statsobj.Destruct(&pData->sessStats[i].stats);
+		}
+		free(pData->sessStats);
+	}
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
-	if(pWrkrData->pRelpClt != NULL)
-		relpEngineCltDestruct(pRelpEngine, &pWrkrData->pRelpClt);
+	freeSessions(pWrkrData);
 ENDfreeWrkrInstance
 
+
+/* set up the per-session statistics counters. Must be called after
+ * the config is known, as the target is part of the counter name.
+ */
+static rsRetVal
+setupSessStats(instanceData *const pData)
+{
+	uchar statname[256];
+	sessStats_t *pStats;
+	int i;
+	DEFiRet;
+
+	CHKmalloc(pData->sessStats = calloc(pData->nSessions, sizeof(sessStats_t)));
+	for(i = 0 ; i < pData->nSessions ; ++i) {
+		pStats = &pData->sessStats[i];
+		CHKiRet(statsobj.Construct(&pStats->stats));
+		snprintf((char*)statname, sizeof(statname), "omrelp(%s:%s/%d)",
+			pData->target, getRelpPt(pData), i);
+		statname[sizeof(statname)-1] = '\0'; /* just to be on the save side... */
+		CHKiRet(statsobj.SetName(pStats->stats, statname));
+		CHKiRet(statsobj.SetOrigin(pStats->stats, (uchar*)"omrelp"));
+		STATSCOUNTER_INIT(pStats->ctrSent, pStats->mutCtrSent);
+		CHKiRet(statsobj.AddCounter(pStats->stats, UCHAR_CONSTANT("sent"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pStats->ctrSent));
+		STATSCOUNTER_INIT(pStats->ctrBatches, pStats->mutCtrBatches);
+		CHKiRet(statsobj.AddCounter(pStats->stats, UCHAR_CONSTANT("batches"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pStats->ctrBatches));
+		STATSCOUNTER_INIT(pStats->ctrFail, pStats->mutCtrFail);
+		CHKiRet(statsobj.AddCounter(pStats->stats, UCHAR_CONSTANT("failures"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pStats->ctrFail));
+		STATSCOUNTER_INIT(pStats->ctrConnect, pStats->mutCtrConnect);
+		CHKiRet(statsobj.AddCounter(pStats->stats, UCHAR_CONSTANT("connects"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pStats->ctrConnect));
+		CHKiRet(statsobj.ConstructFinalize(pStats->stats));
+	}
+finalize_it:
+	RETiRet;
+}
+
 static void
 setInstParamDefaults(instanceData *pData)
 {
@@ -316,6 +417,7 @@ setInstParamDefaults(instanceData *pData)
 	pData->timeout = 90;
 	pData->connTimeout = 10;
 	pData->sizeWindow = 0;
+	pData->nSessions = 1;
 	pData->rebindInterval = 0;
 	pData->bEnableTLS = DFLT_ENABLE_TLS;
 	pData->bEnableTLSZip = DFLT_ENABLE_TLSZIP;
@@ -364,6 +466,8 @@ CODESTARTnewActInst
 			pData->rebindInterval = (unsigned) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "windowsize")) {
 			pData->sizeWindow = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "sessions")) {
+			pData->nSessions = (int) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "tls")) {
 			pData->bEnableTLS = (unsigned) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "tls.compression")) {
@@ -420,7 +524,9 @@ CODESTARTnewActInst
 			  "param '%s'\n", actpblk.descr[i].name);
 		}
 	}
-	
+
+	CHKiRet(setupSessStats(pData));
+
 	CODE_STD_STRING_REQUESTnewActInst(1)
 
 	CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*)strdup((pData->tplName == NULL) ?
@@ -455,21 +561,22 @@ ENDdbgPrintInstInfo
  * rgerhards, 2008-03-21
  */
 static rsRetVal ATTR_NONNULL()
-doConnect(wrkrInstanceData_t *const pWrkrData)
+doConnect(wrkrInstanceData_t *const pWrkrData, omrelpSess_t *const pSess)
 {
 	DEFiRet;
 
-	if(pWrkrData->bInitialConnect) {
-		iRet = relpCltConnect(pWrkrData->pRelpClt, glbl.GetDefPFFamily(),
+	if(pSess->bInitialConnect) {
+		iRet = relpCltConnect(pSess->pRelpClt, glbl.GetDefPFFamily(),
 				      getRelpPt(pWrkrData->pData), pWrkrData->pData->target);
 		if(iRet == RELP_RET_OK)
-			pWrkrData->bInitialConnect = 0;
+			pSess->bInitialConnect = 0;
 	} else {
-		iRet = relpCltReconnect(pWrkrData->pRelpClt);
+		iRet = relpCltReconnect(pSess->pRelpClt);
 	}
 
 	if(iRet == RELP_RET_OK) {
-		pWrkrData->bIsConnected = 1;
+		pSess->bIsConnected = 1;
+		STATSCOUNTER_INC(pSess->pStats->ctrConnect, pSess->pStats->mutCtrConnect);
 	} else if(iRet == RELP_RET_ERR_NO_TLS) {
 		errmsg.LogError(0, iRet, "omrelp: Could not connect, librelp does NOT "
 				"does not support TLS (most probably GnuTLS lib "
@@ -483,7 +590,7 @@ doConnect(wrkrInstanceData_t *const pWrkrData)
 				"Note: anonymous TLS is probably supported.");
 		FINALIZE;
 	} else {
-		pWrkrData->bIsConnected = 0;
+		pSess->bIsConnected = 0;
 		iRet = RS_RET_SUSPENDED;
 	}
 
@@ -492,34 +599,69 @@ finalize_it:
 }
 
 
+/* reconnect all sessions which are currently down. We can resume if
+ * at least one of them is usable, the others are retried when it is
+ * their turn.
+ */
 BEGINtryResume
+	int i;
+	int bHaveConn = 0;
+	rsRetVal localRet = RS_RET_SUSPENDED;
 CODESTARTtryResume
 	if(pWrkrData->pData->bHadAuthFail) {
 		ABORT_FINALIZE(RS_RET_DISABLE_ACTION);
 	}
-	iRet = doConnect(pWrkrData);
+	for(i = 0 ; i < pWrkrData->pData->nSessions ; ++i) {
+		if(!pWrkrData->sess[i].bIsConnected) {
+			localRet = doConnect(pWrkrData, &pWrkrData->sess[i]);
+			if(localRet != RS_RET_OK && localRet != RS_RET_SUSPENDED)
+				ABORT_FINALIZE(localRet);
+		}
+		if(pWrkrData->sess[i].bIsConnected)
+			bHaveConn = 1;
+	}
+	iRet = bHaveConn ? RS_RET_OK : localRet;
 finalize_it:
 ENDtryResume
 
 static rsRetVal
-doRebind(wrkrInstanceData_t *pWrkrData)
+doRebind(wrkrInstanceData_t *pWrkrData, omrelpSess_t *const pSess)
 {
 	DEFiRet;
 	DBGPRINTF("omrelp: destructing relp client due to rebindInterval\n");
-	CHKiRet(relpEngineCltDestruct(pRelpEngine, &pWrkrData->pRelpClt));
-	pWrkrData->bIsConnected = 0;
-	CHKiRet(doCreateRelpClient(pWrkrData));
+	CHKiRet(relpEngineCltDestruct(pRelpEngine, &pSess->pRelpClt));
+	pSess->bIsConnected = 0;
+	CHKiRet(doCreateRelpClient(pWrkrData, pSess));
 finalize_it:
 	RETiRet;
 }
 
+/* batches are distributed round-robin over the sessions. If the next
+ * session is down and cannot be reconnected, we move on to the one
+ * after it, so a single broken connection does not stall the action.
+ */
 BEGINbeginTransaction
+	int i;
+	omrelpSess_t *pSess = NULL;
 CODESTARTbeginTransaction
 	DBGPRINTF("omrelp: beginTransaction\n");
-	if(!pWrkrData->bIsConnected) {
-		CHKiRet(doConnect(pWrkrData));
+	for(i = 0 ; i < pWrkrData->pData->nSessions ; ++i) {
+		pWrkrData->currSess = (pWrkrData->currSess + 1) % pWrkrData->pData->nSessions;
+		pSess = &pWrkrData->sess[pWrkrData->currSess];
+		if(!pSess->bIsConnected) {
+			iRet = doConnect(pWrkrData, pSess);
+			if(iRet != RS_RET_OK && iRet != RS_RET_SUSPENDED)
+				FINALIZE;
+		}
+		if(pSess->bIsConnected)
+			break;
+	}
+	if(!pSess->bIsConnected) {
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
-	relpCltHintBurstBegin(pWrkrData->pRelpClt);
+	iRet = RS_RET_OK;
+	STATSCOUNTER_INC(pSess->pStats->ctrBatches, pSess->pStats->mutCtrBatches);
+	relpCltHintBurstBegin(pSess->pRelpClt);
 finalize_it:
 ENDbeginTransaction
 
@@ -528,12 +670,14 @@ BEGINdoAction
 	size_t lenMsg;
 	relpRetVal ret;
 	instanceData *pData;
+	omrelpSess_t *pSess;
 CODESTARTdoAction
 	pData = pWrkrData->pData;
-	dbgprintf(" %s:%s/RELP\n", pData->target, getRelpPt(pData));
+	pSess = &pWrkrData->sess[pWrkrData->currSess];
+	dbgprintf(" %s:%s/RELP session %d\n", pData->target, getRelpPt(pData), pWrkrData->currSess);
 
-	if(!pWrkrData->bIsConnected) {
-		CHKiRet(doConnect(pWrkrData));
+	if(!pSess->bIsConnected) {
+		CHKiRet(doConnect(pWrkrData, pSess));
 	}
 
 	pMsg = ppString[0];
@@ -544,16 +688,19 @@ CODESTARTdoAction
 		lenMsg = glbl.GetMaxLine();
 
 	/* forward */
-	ret = relpCltSendSyslog(pWrkrData->pRelpClt, (uchar*) pMsg, lenMsg);
+	ret = relpCltSendSyslog(pSess->pRelpClt, (uchar*) pMsg, lenMsg);
 	if(ret != RELP_RET_OK) {
 		/* error! */
 		dbgprintf("error forwarding via relp, suspending\n");
+		pSess->bIsConnected = 0;
+		STATSCOUNTER_INC(pSess->pStats->ctrFail, pSess->pStats->mutCtrFail);
 		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
+	STATSCOUNTER_INC(pSess->pStats->ctrSent, pSess->pStats->mutCtrSent);
 
 	if(pData->rebindInterval != 0 &&
-	   (++pWrkrData->nSent >= pData->rebindInterval)) {
-	   	doRebind(pWrkrData);
+	   (++pSess->nSent >= pData->rebindInterval)) {
+	   	doRebind(pWrkrData, pSess);
 	}
 finalize_it:
 	if(pData->bHadAuthFail)
@@ -570,10 +717,13 @@ ENDdoAction
 
 
 BEGINendTransaction
+	omrelpSess_t *pSess;
 CODESTARTendTransaction
-	DBGPRINTF("omrelp: endTransaction, connected %d\n", pWrkrData->bIsConnected);
-	if(pWrkrData->bIsConnected) {
-		relpCltHintBurstEnd(pWrkrData->pRelpClt);
+	pSess = &pWrkrData->sess[pWrkrData->currSess];
+	DBGPRINTF("omrelp: endTransaction, session %d, connected %d\n",
+		pWrkrData->currSess, pSess->bIsConnected);
+	if(pSess->bIsConnected) {
+		relpCltHintBurstEnd(pSess->pRelpClt);
 	}
 ENDendTransaction
 
@@ -652,6 +802,7 @@ CODE_STD_STRING_REQUESTparseSelectorAct(1)
 
 	/* process template */
 	CHKiRet(cflineParseTemplateName(&p, *ppOMSR, 0, OMSR_NO_RQD_TPL_OPTS, (uchar*) "RSYSLOG_ForwardFormat"));
+	CHKiRet(setupSessStats(pData));
 
 CODE_STD_FINALIZERparseSelectorAct
 ENDparseSelectorAct
@@ -664,6 +815,7 @@ CODESTARTmodExit
 	/* release what we no longer need */
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
 ENDmodExit
 
 
@@ -694,4 +846,5 @@ CODEmodInit_QueryRegCFSLineHdlr
 	/* tell which objects we need */
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 ENDmodInit
@@ -0,0 +1,270 @@
+/* The concurrent counter map.
+ *
+ * The map is an array of buckets, each holding a singly linked list of
+ * entries. New entries are always prepended and only after they have
+ * been fully initialized, and no entry is ever removed while the map is
+ * in use. Thus readers can walk a bucket without any lock; only writers
+ * need to synchronize with each other, which is done via a small array
+ * of mutexes ("stripes") instead of a single global one. If the platform
+ * has no atomic builtins, readers take the stripe lock as well.
+ *
+ * The bucket count passed at construction is just the initial size.
+ * When the entries outgrow it, the bucket array is replaced by a larger
+ * one while all stripes are locked. The entries themselves are relinked,
+ * not moved, so counters stay where they are. A lock-free reader that
+ * walks a chain while it is being relinked may miss its key; it then
+ * retries under the stripe lock, which waits for the resize to finish.
+ * Old bucket arrays may still be in use by such readers, so they are
+ * only freed together with the map.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "rsyslog.h"
+#include "hashtable.h"
+#include "ctrmap.h"
+
+#define CTRMAP_MAX_LOAD 2	/* grow when there are more entries per bucket */
+#define CTRMAP_MAX_BUCKETS (1u << 24)
+
+typedef struct ctrmapEntry_s ctrmapEntry_t;
+struct ctrmapEntry_s {
+	ctrmapEntry_t *next;
+	unsigned hash;
+	ctrmapCounter_t ctr;
+	char key[];
+};
+
+/* a bucket array. mask and buckets must be read from the same table,
+ * so the table is published as a whole.
+ */
+typedef struct ctrmapTable_s ctrmapTable_t;
+struct ctrmapTable_s {
+	ctrmapTable_t *prev;		/* retired tables, freed on destruct */
+	unsigned mask;			/* number of buckets - 1 */
+	ctrmapEntry_t *buckets[];
+};
+
+struct ctrmap_s {
+	ctrmapTable_t *table;		/* current table */
+	pthread_mutex_t mutStripes[CTRMAP_STRIPES];
+	ctrmapCounter_t nEntries;	/* only changed while holding a stripe lock */
+};
+
+
+static ctrmapTable_t *
+newTable(const unsigned size)
+{
+	ctrmapTable_t *table;
+
+	if((table = calloc(1, sizeof(ctrmapTable_t) + size * sizeof(ctrmapEntry_t*))) == NULL)
+		return NULL;
+	table->mask = size - 1;
+	return table;
+}
+
+rsRetVal
+ctrmapConstruct(ctrmap_t **const ppThis, const unsigned nBuckets)
+{
+	ctrmap_t *pThis = NULL;
+	unsigned size;
+	int i;
+	DEFiRet;
+
+	for(size = 1 ; size < nBuckets && size < CTRMAP_MAX_BUCKETS ; size <<= 1)
+		/* just search power of 2 */;
+
+	CHKmalloc(pThis = calloc(1, sizeof(ctrmap_t)));
+	CHKmalloc(pThis->table = newTable(size));
+	ctrmapCounterInit(&pThis->nEntries, 0);
+	for(i = 0 ; i < CTRMAP_STRIPES ; ++i)
+		pthread_mutex_init(&pThis->mutStripes[i], NULL);
+	*ppThis = pThis;
+
+finalize_it:
+	if(iRet != RS_RET_OK && pThis != NULL) {
+		free(pThis->table);
+		free(pThis);
+	}
+	RETiRet;
+}
+
+void
+ctrmapDestruct(ctrmap_t **const ppThis)
+{
+	ctrmap_t *const pThis = *ppThis;
+	ctrmapTable_t *table;
+	ctrmapTable_t *pDelTable;
+	ctrmapEntry_t *pEntry;
+	ctrmapEntry_t *pDel;
+	unsigned i;
+
+	if(pThis == NULL)
+		return;
+	table = pThis->table;
+	for(i = 0 ; i <= table->mask ; ++i) {
+		for(pEntry = table->buckets[i] ; pEntry != NULL ; ) {
+			pDel = pEntry;
+			pEntry = pEntry->next;
+			ctrmapCounterDestruct(&pDel->ctr);
+			free(pDel);
+		}
+	}
+	while(table != NULL) {
+		pDelTable = table;
+		table = table->prev;
+		free(pDelTable);
+	}
+	ctrmapCounterDestruct(&pThis->nEntries);
+	for(i = 0 ; i < CTRMAP_STRIPES ; ++i)
+		pthread_mutex_destroy(&pThis->mutStripes[i]);
+	free(pThis);
+	*ppThis = NULL;
+}
+
+static ctrmapEntry_t *
+findEntry(ctrmapEntry_t *pEntry, const unsigned hash, const char *const key)
+{
+	for( ; pEntry != NULL ; pEntry = pEntry->next) {
+		if(pEntry->hash == hash && !strcmp(pEntry->key, key))
+			return pEntry;
+	}
+	return NULL;
+}
+
+/* grow the bucket array if the entries have outgrown it. Must be called
+ * without holding any stripe lock. A failed allocation is not an error,
+ * it just means longer chains.
+ */
+static void
+growTable(ctrmap_t *const pThis)
+{
+	ctrmapTable_t *const table = pThis->table;
+	ctrmapTable_t *newTbl = NULL;
+	ctrmapEntry_t *pEntry;
+	ctrmapEntry_t *pNext;
+	unsigned nEntries;
+	unsigned size;
+	unsigned idx;
+	unsigned i;
+
+	/* always lock in the same order, so concurrent resizes cannot deadlock */
+	for(i = 0 ; i < CTRMAP_STRIPES ; ++i)
+		pthread_mutex_lock(&pThis->mutStripes[i]);
+	if(pThis->table != table)
+		goto done; /* someone else was faster */
+	nEntries = (unsigned) pThis->nEntries.val; /* stable, we hold all stripes */
+	size = table->mask + 1;
+	if(nEntries <= size * CTRMAP_MAX_LOAD || size >= CTRMAP_MAX_BUCKETS)
+		goto done;
+	while(size < nEntries / CTRMAP_MAX_LOAD * 2 && size < CTRMAP_MAX_BUCKETS)
+		size <<= 1;
+	if((newTbl = newTable(size)) == NULL)
+		goto done;
+
+	for(i = 0 ; i <= table->mask ; ++i) {
+		for(pEntry = table->buckets[i] ; pEntry != NULL ; pEntry = pNext) {
+			pNext = pEntry->next;
+			idx = pEntry->hash & newTbl->mask;
+			pEntry->next = newTbl->buckets[idx];
+			newTbl->buckets[idx] = pEntry;
+		}
+	}
+	newTbl->prev = table;
+#	ifdef HAVE_ATOMIC_BUILTINS
+	__sync_synchronize(); /* table must be complete before lock-free readers see it */
+#	endif
+	pThis->table = newTbl;
+
+done:
+	for(i = CTRMAP_STRIPES ; i > 0 ; --i)
+		pthread_mutex_unlock(&pThis->mutStripes[i - 1]);
+}
+
+/* obtain the counter for key. If the key does not yet exist, it is
+ * added with the counter set to initVal.
+ */
+rsRetVal
+ctrmapGet(ctrmap_t *const pThis, const char *const key, const int initVal, ctrmapCounter_t **const ppCtr)
+{
+	const unsigned hash = hash_from_string((void*) key);
+	ctrmapTable_t *table;
+	unsigned idx;
+	pthread_mutex_t *mut;
+	ctrmapEntry_t *pEntry;
+	size_t lenKey;
+	unsigned nEntries;
+	sbool bGrow = 0;
+	DEFiRet;
+
+#	ifdef HAVE_ATOMIC_BUILTINS
+	/* entries are published fully initialized and never removed,
+	 * so existing keys can be found without any lock.
+	 */
+	table = *(ctrmapTable_t *volatile*) &pThis->table;
+	idx = hash & table->mask;
+	pEntry = findEntry(*(ctrmapEntry_t *volatile*) &table->buckets[idx], hash, key);
+	if(pEntry != NULL) {
+		*ppCtr = &pEntry->ctr;
+		FINALIZE;
+	}
+#	endif
+
+	/* the table can only be replaced while all stripes are locked, so
+	 * once we hold the stripe of the current table, it stays current.
+	 */
+	while(1) {
+		table = *(ctrmapTable_t *volatile*) &pThis->table;
+		idx = hash & table->mask;
+		mut = &pThis->mutStripes[idx & (CTRMAP_STRIPES - 1)];
+		pthread_mutex_lock(mut);
+		if(pThis->table == table)
+			break;
+		pthread_mutex_unlock(mut);
+	}
+	pEntry = findEntry(table->buckets[idx], hash, key);
+	if(pEntry == NULL) {
+		lenKey = strlen(key);
+		if((pEntry = malloc(sizeof(ctrmapEntry_t) + lenKey + 1)) == NULL) {
+			pthread_mutex_unlock(mut);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		memcpy(pEntry->key, key, lenKey + 1);
+		pEntry->hash = hash;
+		ctrmapCounterInit(&pEntry->ctr, initVal);
+		pEntry->next = table->buckets[idx];
+#		ifdef HAVE_ATOMIC_BUILTINS
+		__sync_synchronize(); /* entry must be complete before lock-free readers see it */
+#		endif
+		table->buckets[idx] = pEntry;
+		nEntries = (unsigned) ctrmapIncAndFetch(&pThis->nEntries);
+		bGrow = nEntries > (table->mask + 1) * CTRMAP_MAX_LOAD
+			&& table->mask + 1 < CTRMAP_MAX_BUCKETS;
+	}
+	pthread_mutex_unlock(mut);
+	*ppCtr = &pEntry->ctr;
+	if(bGrow)
+		growTable(pThis);
+
+finalize_it:
+	RETiRet;
+}
@@ -0,0 +1,98 @@
+/* Definitions for the concurrent counter map.
+ *
+ * The counter map associates string keys with integer counters that
+ * can be updated by many worker threads at the same time. Lookups of
+ * existing keys do not lock (if the platform has atomic builtins),
+ * inserts of new keys only lock a single stripe of the bucket array and
+ * the counters themselves are updated atomically. Entries are never
+ * removed before the whole map is destructed, so a counter obtained
+ * via ctrmapGet() may be cached by the caller for the map's lifetime.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_CTRMAP_H
+#define INCLUDED_CTRMAP_H
+
+#include <pthread.h>
+#include "atomic.h"
+
+#define CTRMAP_STRIPES 64	/* number of insert locks, must be a power of 2 */
+
+/* a single counter. It can also be used stand-alone, but must then be
+ * initialized via ctrmapCounterInit() and destructed via
+ * ctrmapCounterDestruct().
+ */
+typedef struct ctrmapCounter_s {
+	int val;
+	DEF_ATOMIC_HELPER_MUT(mut)
+} ctrmapCounter_t;
+
+typedef struct ctrmap_s ctrmap_t;
+
+rsRetVal ctrmapConstruct(ctrmap_t **ppThis, unsigned nBuckets);
+void ctrmapDestruct(ctrmap_t **ppThis);
+rsRetVal ctrmapGet(ctrmap_t *pThis, const char *key, int initVal, ctrmapCounter_t **ppCtr);
+
+static inline void
+ctrmapCounterInit(ctrmapCounter_t *const pCtr, const int initVal)
+{
+	pCtr->val = initVal;
+	INIT_ATOMIC_HELPER_MUT(pCtr->mut);
+}
+
+static inline void
+ctrmapCounterDestruct(ctrmapCounter_t *const pCtr)
+{
+	(void) pCtr; /* unused if we have atomic builtins */
+	DESTROY_ATOMIC_HELPER_MUT(pCtr->mut);
+}
+
+/* increment the counter and return the new value */
+static inline int
+ctrmapIncAndFetch(ctrmapCounter_t *const pCtr)
+{
+#ifdef HAVE_ATOMIC_BUILTINS
+	return __sync_add_and_fetch(&pCtr->val, 1);
+#else
+	int val;
+	pthread_mutex_lock(&pCtr->mut);
+	val = ++pCtr->val;
+	pthread_mutex_unlock(&pCtr->mut);
+	return val;
+#endif
+}
+
+/* advance the counter by step inside the range [from, to), wrapping
+ * around to from (also if the current value is below from). Returns the
+ * new value.
+ */
+static inline int
+ctrmapStepAndFetch(ctrmapCounter_t *const pCtr, const int from, const int to, const int step)
+{
+	int oldVal;
+	int newVal;
+
+	do {
+		oldVal = ATOMIC_FETCH_32BIT(&pCtr->val, &pCtr->mut);
+		newVal = (oldVal >= to - step || oldVal < from) ? from : oldVal + step;
+	} while(!ATOMIC_CAS(&pCtr->val, oldVal, newVal, &pCtr->mut));
+	return newVal;
+}
+
+#endif /* #ifndef INCLUDED_CTRMAP_H */
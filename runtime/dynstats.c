@@ -45,6 +45,41 @@ DEFobjCurrIf(statsobj)
 #define DYNSTATS_METRIC_NAME_SEPARATOR '.'
 #define DYNSTATS_HASHTABLE_SIZE_OVERPROVISIONING 1.25
 
+/* per-thread counter cache: each thread that increments dyn-stats counters keeps
+ * a small direct-mapped cache of the counters it recently used. Increments that
+ * hit the cache are only accumulated locally and are folded into the shared counter
+ * when the bucket is read, reset or the cache slot is evicted. This keeps hot
+ * metrics from bouncing the shard lock and counter cache lines between workers.
+ */
+#define DYNSTATS_TCACHE_SIZE 64 /* MUST be a power of two */
+
+#define DYNSTATS_SHARD_IDX(hash) (((hash) ^ ((hash) >> 16)) & (DYNSTATS_SHARD_COUNT - 1))
+#define DYNSTATS_TCACHE_SLOT(b, hash) \
+	(((hash) ^ (unsigned) (((uintptr_t) (b)) >> 4)) & (DYNSTATS_TCACHE_SIZE - 1))
+
+typedef struct dynstats_tcache_entry_s {
+	dynstats_bucket_t *bucket;	/* NULL if slot is not in use */
+	dynstats_ctr_t *ctr;
+	unsigned hash;
+	intctr_t pending;		/* increments not yet applied to ctr */
+} dynstats_tcache_entry_t;
+
+/* Lock order is: mutThreadCaches -> dynstats_tcache_t.mut -> shard lock.
+ * A counter referenced from a cache entry can only be destructed by a bucket
+ * reset, which needs to hold all cache mutexes. So holding its own cache mutex
+ * is sufficient for a thread to access the counters it has cached.
+ */
+typedef struct dynstats_tcache_s {
+	pthread_mutex_t mut;
+	dynstats_tcache_entry_t entries[DYNSTATS_TCACHE_SIZE];
+	struct dynstats_tcache_s *next;
+	struct dynstats_tcache_s *prev;
+} dynstats_tcache_t;
+
+static pthread_key_t keyThreadCache;
+static pthread_mutex_t mutThreadCaches = PTHREAD_MUTEX_INITIALIZER;
+static dynstats_tcache_t *threadCacheRoot = NULL;
+
 static struct cnfparamdescr modpdescr[] = {
 	{ DYNSTATS_PARAM_NAME, eCmdHdlrString, CNFPARAM_REQUIRED },
 	{ DYNSTATS_PARAM_RESETTABLE, eCmdHdlrBinary, 0 },
@@ -58,11 +93,118 @@ static struct cnfparamblk modpblk =
   modpdescr
 };
 
+static void
+dynstats_tcacheFlushEntry(dynstats_tcache_entry_t *e) {
+	if (e->bucket != NULL && e->pending != 0) {
+		STATSCOUNTER_ADD(e->ctr->ctr, e->ctr->mutCtr, e->pending);
+		e->pending = 0;
+	}
+}
+
+/* thread-exit handler: fold pending increments into the counters and
+ * drop the cache.
+ */
+static void
+dynstats_tcacheDestruct(void *p) {
+	dynstats_tcache_t *tc = (dynstats_tcache_t *) p;
+	int i;
+
+	pthread_mutex_lock(&mutThreadCaches);
+	pthread_mutex_lock(&tc->mut);
+	for (i = 0 ; i < DYNSTATS_TCACHE_SIZE ; ++i) {
+		dynstats_tcacheFlushEntry(&tc->entries[i]);
+	}
+	if (tc->prev != NULL) {
+		tc->prev->next = tc->next;
+	}
+	if (tc->next != NULL) {
+		tc->next->prev = tc->prev;
+	}
+	if (tc == threadCacheRoot) {
+		threadCacheRoot = tc->next;
+	}
+	pthread_mutex_unlock(&tc->mut);
+	pthread_mutex_unlock(&mutThreadCaches);
+	pthread_mutex_destroy(&tc->mut);
+	free(tc);
+}
+
+/* obtain the calling thread's counter cache, creating it on first use.
+ * Returns NULL if no cache could be created, in which case the caller
+ * must operate on the shared tables directly.
+ */
+static dynstats_tcache_t *
+dynstats_tcacheGet(void) {
+	dynstats_tcache_t *tc;
+
+	tc = (dynstats_tcache_t *) pthread_getspecific(keyThreadCache);
+	if (tc == NULL) {
+		if ((tc = calloc(1, sizeof(dynstats_tcache_t))) == NULL) {
+			return NULL;
+		}
+		pthread_mutex_init(&tc->mut, NULL);
+		if (pthread_setspecific(keyThreadCache, tc) != 0) {
+			pthread_mutex_destroy(&tc->mut);
+			free(tc);
+			return NULL;
+		}
+		pthread_mutex_lock(&mutThreadCaches);
+		tc->next = threadCacheRoot;
+		if (threadCacheRoot != NULL) {
+			threadCacheRoot->prev = tc;
+		}
+		threadCacheRoot = tc;
+		pthread_mutex_unlock(&mutThreadCaches);
+	}
+	return tc;
+}
+
+static void
+dynstats_tcacheLockAll(void) {
+	dynstats_tcache_t *tc;
+	pthread_mutex_lock(&mutThreadCaches);
+	for (tc = threadCacheRoot ; tc != NULL ; tc = tc->next) {
+		pthread_mutex_lock(&tc->mut);
+	}
+}
+
+static void
+dynstats_tcacheUnlockAll(void) {
+	dynstats_tcache_t *tc;
+	for (tc = threadCacheRoot ; tc != NULL ; tc = tc->next) {
+		pthread_mutex_unlock(&tc->mut);
+	}
+	pthread_mutex_unlock(&mutThreadCaches);
+}
+
+static void /* assumes all thread caches are locked */
+dynstats_tcacheFlushBucket(dynstats_bucket_t *b, const int bInvalidate) {
+	dynstats_tcache_t *tc;
+	dynstats_tcache_entry_t *e;
+	int i;
+	for (tc = threadCacheRoot ; tc != NULL ; tc = tc->next) {
+		for (i = 0 ; i < DYNSTATS_TCACHE_SIZE ; ++i) {
+			e = &tc->entries[i];
+			if (e->bucket == b) {
+				dynstats_tcacheFlushEntry(e);
+				if (bInvalidate) {
+					e->bucket = NULL;
+				}
+			}
+		}
+	}
+}
+
 rsRetVal
 dynstatsClassInit(void) {
 	DEFiRet;
 	CHKiRet(objGetObjInterface(&obj));
 	CHKiRet(objUse(statsobj, CORE_COMPONENT));
+	if (pthread_key_create(&keyThreadCache, dynstats_tcacheDestruct) != 0) {
+		LogError(errno, RS_RET_INTERNAL_ERROR, "dynstats: could not create "
+			"per-thread counter cache key");
+		ABORT_FINALIZE(RS_RET_INTERNAL_ERROR);
+	}
 finalize_it:
 	RETiRet;
 }
@@ -78,7 +220,9 @@ static void /* assumes exclusive access to bucket */
 dynstats_destroyCountersIn(dynstats_bucket_t *b, htable *table, dynstats_ctr_t *ctrs) {
 	dynstats_ctr_t *ctr;
 	int ctrs_purged = 0;
-	hashtable_destroy(table, 0);
+	if (table != NULL) {
+		hashtable_destroy(table, 0);
+	}
 	while (ctrs != NULL) {
 		ctr = ctrs;
 		ctrs = ctrs->next;
@@ -91,19 +235,32 @@ dynstats_destroyCountersIn(dynstats_bucket_t *b, htable *table, dynstats_ctr_t *
 
 static void /* assumes exclusive access to bucket */
 dynstats_destroyCounters(dynstats_bucket_t *b) {
+	int i;
 	statsobj.UnlinkAllCounters(b->stats);
-	dynstats_destroyCountersIn(b, b->table, b->ctrs);
+	for (i = 0 ; i < DYNSTATS_SHARD_COUNT ; ++i) {
+		dynstats_destroyCountersIn(b, b->shards[i].table, b->shards[i].ctrs);
+	}
 }
 
 static void
 dynstats_destroyBucket(dynstats_bucket_t* b) {
 	dynstats_buckets_t *bkts;
+	dynstats_shard_t *shard;
+	int i;
 
 	bkts = &loadConf->dynstats_buckets;
 
+	dynstats_tcacheLockAll();
+	dynstats_tcacheFlushBucket(b, 1);
+	dynstats_tcacheUnlockAll();
+
 	pthread_rwlock_wrlock(&b->lock);
 	dynstats_destroyCounters(b);
-	dynstats_destroyCountersIn(b, b->survivor_table, b->survivor_ctrs);
+	for (i = 0 ; i < DYNSTATS_SHARD_COUNT ; ++i) {
+		shard = &b->shards[i];
+		dynstats_destroyCountersIn(b, shard->survivor_table, shard->survivor_ctrs);
+		pthread_rwlock_destroy(&shard->lock);
+	}
 	statsobj.Destruct(&b->stats);
 	free(b->name);
 	pthread_rwlock_unlock(&b->lock);
@@ -209,45 +366,46 @@ finalize_it:
 static void
 no_op_free(void __attribute__((unused)) *ignore)  {}
 
-static rsRetVal  /* assumes exclusive access to bucket */
+static rsRetVal  /* assumes exclusive access to bucket (all shards write-locked) */
 dynstats_rebuildSurvivorTable(dynstats_bucket_t *b) {
-	htable *survivor_table = NULL;
-	htable *new_table = NULL;
+	htable *survivor_tables[DYNSTATS_SHARD_COUNT] = { NULL };
+	htable *new_tables[DYNSTATS_SHARD_COUNT] = { NULL };
+	dynstats_shard_t *shard;
 	size_t htab_sz;
+	int i;
 	DEFiRet;
 	
-	htab_sz = (size_t) (DYNSTATS_HASHTABLE_SIZE_OVERPROVISIONING * b->maxCardinality + 1);
-	if (b->table == NULL) {
-		CHKmalloc(survivor_table = create_hashtable(htab_sz, hash_from_string, key_equals_string,
+	htab_sz = (size_t) (DYNSTATS_HASHTABLE_SIZE_OVERPROVISIONING * b->maxCardinality
+		/ DYNSTATS_SHARD_COUNT + 1);
+	for (i = 0 ; i < DYNSTATS_SHARD_COUNT ; ++i) {
+		if (b->shards[i].table == NULL) {
+			CHKmalloc(survivor_tables[i] = create_hashtable(htab_sz, hash_from_string,
+				key_equals_string, no_op_free));
+		}
+		CHKmalloc(new_tables[i] = create_hashtable(htab_sz, hash_from_string, key_equals_string,
 			no_op_free));
 	}
-	CHKmalloc(new_table = create_hashtable(htab_sz, hash_from_string, key_equals_string, no_op_free));
 	statsobj.UnlinkAllCounters(b->stats);
-	if (b->survivor_table != NULL) {
-		dynstats_destroyCountersIn(b, b->survivor_table, b->survivor_ctrs);
+	for (i = 0 ; i < DYNSTATS_SHARD_COUNT ; ++i) {
+		shard = &b->shards[i];
+		if (shard->survivor_table != NULL) {
+			dynstats_destroyCountersIn(b, shard->survivor_table, shard->survivor_ctrs);
+		}
+		shard->survivor_table = (shard->table == NULL) ? survivor_tables[i] : shard->table;
+		shard->survivor_ctrs = shard->ctrs;
+		shard->table = new_tables[i];
+		shard->ctrs = NULL;
 	}
-	b->survivor_table = (b->table == NULL) ? survivor_table : b->table;
-	b->survivor_ctrs = b->ctrs;
-	b->table = new_table;
-	b->ctrs = NULL;
 finalize_it:
 	if (iRet != RS_RET_OK) {
 		LogError(errno, RS_RET_INTERNAL_ERROR, "error trying to evict "
 			"TTL-expired metrics of dyn-stats bucket named: %s", b->name);
-		if (new_table == NULL) {
-			LogError(errno, RS_RET_INTERNAL_ERROR, "error trying to "
-				"initialize hash-table for dyn-stats bucket named: %s", b->name);
-		} else {
-			assert(0); /* "can" not happen -- triggers Coverity CID 184307:
-			hashtable_destroy(new_table, 0);
-			We keep this as guard should code above change in the future */
-		}
-		if (b->table == NULL) {
-			if (survivor_table == NULL) {
-				LogError(errno, RS_RET_INTERNAL_ERROR, "error trying to initialize "
-				"ttl-survivor hash-table for dyn-stats bucket named: %s", b->name);
-			} else {
-				hashtable_destroy(survivor_table, 0);
+		for (i = 0 ; i < DYNSTATS_SHARD_COUNT ; ++i) {
+			if (new_tables[i] != NULL) {
+				hashtable_destroy(new_tables[i], 0);
+			}
+			if (survivor_tables[i] != NULL) {
+				hashtable_destroy(survivor_tables[i], 0);
 			}
 		}
 	}
@@ -256,9 +414,23 @@ finalize_it:
 
 static rsRetVal
 dynstats_resetBucket(dynstats_bucket_t *b) {
+	int i;
 	DEFiRet;
 	pthread_rwlock_wrlock(&b->lock);
-	CHKiRet(dynstats_rebuildSurvivorTable(b));
+	/* thread caches must stay locked until the tables are swapped, else a worker
+	 * could cache a counter that is just about to become a survivor.
+	 */
+	dynstats_tcacheLockAll();
+	dynstats_tcacheFlushBucket(b, 1);
+	for (i = 0 ; i < DYNSTATS_SHARD_COUNT ; ++i) {
+		pthread_rwlock_wrlock(&b->shards[i].lock);
+	}
+	iRet = dynstats_rebuildSurvivorTable(b);
+	for (i = 0 ; i < DYNSTATS_SHARD_COUNT ; ++i) {
+		pthread_rwlock_unlock(&b->shards[i].lock);
+	}
+	dynstats_tcacheUnlockAll();
+	CHKiRet(iRet);
 	STATSCOUNTER_INC(b->ctrPurgeTriggered, b->mutCtrPurgeTriggered);
 	timeoutComp(&b->metricCleanupTimeout, b->unusedMetricLife);
 finalize_it:
@@ -278,6 +450,13 @@ dynstats_resetIfExpired(dynstats_bucket_t *b) {
 	}
 }
 
+static void
+dynstats_preReadCallback(statsobj_t __attribute__((unused)) *ignore, void *b) {
+	dynstats_tcacheLockAll();
+	dynstats_tcacheFlushBucket((dynstats_bucket_t *) b, 0);
+	dynstats_tcacheUnlockAll();
+}
+
 static void
 dynstats_readCallback(statsobj_t __attribute__((unused)) *ignore, void *b) {
 	dynstats_buckets_t *bkts;
@@ -296,6 +475,7 @@ dynstats_initNewBucketStats(dynstats_bucket_t *b) {
 	CHKiRet(statsobj.SetOrigin(b->stats, UCHAR_CONSTANT("dynstats.bucket")));
 	CHKiRet(statsobj.SetName(b->stats, b->name));
 	CHKiRet(statsobj.SetReportingNamespace(b->stats, UCHAR_CONSTANT("values")));
+	statsobj.SetPreReadNotifier(b->stats, dynstats_preReadCallback, b);
 	statsobj.SetReadNotifier(b->stats, dynstats_readCallback, b);
 	CHKiRet(statsobj.ConstructFinalize(b->stats));
 	
@@ -309,6 +489,7 @@ dynstats_newBucket(const uchar* name, uint8_t resettable, uint32_t maxCardinalit
 	dynstats_buckets_t *bkts;
 	uint8_t lock_initialized, metric_count_mutex_initialized;
 	pthread_rwlockattr_t bucket_lock_attr;
+	int i;
 	DEFiRet;
 
 	lock_initialized = metric_count_mutex_initialized = 0;
@@ -329,6 +510,9 @@ dynstats_newBucket(const uchar* name, uint8_t resettable, uint32_t maxCardinalit
 #endif
 
 		pthread_rwlock_init(&b->lock, &bucket_lock_attr);
+		for (i = 0 ; i < DYNSTATS_SHARD_COUNT ; ++i) {
+			pthread_rwlock_init(&b->shards[i].lock, &bucket_lock_attr);
+		}
 		lock_initialized = 1;
 		pthread_mutex_init(&b->mutMetricCount, NULL);
 		metric_count_mutex_initialized = 1;
@@ -503,7 +687,8 @@ finalize_it:
 #pragma GCC diagnostic ignored "-Wmaybe-uninitialized" /* TODO: how can we fix these warnings? */
 #endif
 static rsRetVal
-dynstats_addNewCtr(dynstats_bucket_t *b, const uchar* metric, uint8_t doInitialIncrement) {
+dynstats_addNewCtr(dynstats_bucket_t *b, dynstats_shard_t *shard, const uchar* metric,
+	uint8_t doInitialIncrement, dynstats_ctr_t **pEffectiveCtr) {
 	dynstats_ctr_t *ctr;
 	dynstats_ctr_t *found_ctr, *survivor_ctr, *effective_ctr;
 	int created;
@@ -519,16 +704,19 @@ dynstats_addNewCtr(dynstats_bucket_t *b, const uchar* metric, uint8_t doInitialI
 	
 	CHKiRet(dynstats_createCtr(b, metric, &ctr));
 
-	pthread_rwlock_wrlock(&b->lock);
-	found_ctr = (dynstats_ctr_t*) hashtable_search(b->table, ctr->metric);
+	pthread_rwlock_wrlock(&shard->lock);
+	found_ctr = (dynstats_ctr_t*) hashtable_search(shard->table, ctr->metric);
 	if (found_ctr != NULL) {
 		if (doInitialIncrement) {
 			STATSCOUNTER_INC(found_ctr->ctr, found_ctr->mutCtr);
 		}
+		if (pEffectiveCtr != NULL) {
+			*pEffectiveCtr = found_ctr;
+		}
 	} else {
 		copy_of_key = ustrdup(ctr->metric);
 		if (copy_of_key != NULL) {
-			survivor_ctr = (dynstats_ctr_t*) hashtable_search(b->survivor_table, ctr->metric);
+			survivor_ctr = (dynstats_ctr_t*) hashtable_search(shard->survivor_table, ctr->metric);
 			if (survivor_ctr == NULL) {
 				effective_ctr = ctr;
 			} else {
@@ -539,27 +727,30 @@ dynstats_addNewCtr(dynstats_bucket_t *b, const uchar* metric, uint8_t doInitialI
 				if (survivor_ctr->next != NULL) {
 					survivor_ctr->next->prev = survivor_ctr->prev;
 				}
-				if (survivor_ctr == b->survivor_ctrs) {
-					b->survivor_ctrs = survivor_ctr->next;
+				if (survivor_ctr == shard->survivor_ctrs) {
+					shard->survivor_ctrs = survivor_ctr->next;
 				}
 			}
-			if ((created = hashtable_insert(b->table, copy_of_key, effective_ctr))) {
+			if ((created = hashtable_insert(shard->table, copy_of_key, effective_ctr))) {
 				statsobj.AddPreCreatedCtr(b->stats, effective_ctr->pCtr);
 			}
 		}
 		if (created) {
-			if (b->ctrs != NULL) {
-				b->ctrs->prev = effective_ctr;
+			if (shard->ctrs != NULL) {
+				shard->ctrs->prev = effective_ctr;
 			}
 			effective_ctr->prev = NULL;
-			effective_ctr->next = b->ctrs;
-			b->ctrs = effective_ctr;
+			effective_ctr->next = shard->ctrs;
+			shard->ctrs = effective_ctr;
 			if (doInitialIncrement) {
 				STATSCOUNTER_INC(effective_ctr->ctr, effective_ctr->mutCtr);
 			}
+			if (pEffectiveCtr != NULL) {
+				*pEffectiveCtr = effective_ctr;
+			}
 		}
 	}
-	pthread_rwlock_unlock(&b->lock);
+	pthread_rwlock_unlock(&shard->lock);
 
 	if (found_ctr != NULL) {
 		//ignore
@@ -583,9 +774,41 @@ finalize_it:
 #pragma GCC diagnostic pop
 #endif
 
+/* increment metric in the shared (sharded) table. If pCtr is non-NULL, the
+ * effective counter is returned there, so that the caller can cache it.
+ */
+static rsRetVal
+dynstats_incShared(dynstats_bucket_t *b, uchar* metric, const unsigned hash, dynstats_ctr_t **pCtr) {
+	dynstats_shard_t *shard;
+	dynstats_ctr_t *ctr;
+	DEFiRet;
+
+	shard = &b->shards[DYNSTATS_SHARD_IDX(hash)];
+	if (pthread_rwlock_tryrdlock(&shard->lock) == 0) {
+		ctr = (dynstats_ctr_t *) hashtable_search(shard->table, metric);
+		if (ctr != NULL) {
+			STATSCOUNTER_INC(ctr->ctr, ctr->mutCtr);
+		}
+		pthread_rwlock_unlock(&shard->lock);
+	} else {
+		ABORT_FINALIZE(RS_RET_NOENTRY);
+	}
+
+	if (ctr == NULL) {
+		CHKiRet(dynstats_addNewCtr(b, shard, metric, 1, pCtr));
+	} else if (pCtr != NULL) {
+		*pCtr = ctr;
+	}
+finalize_it:
+	RETiRet;
+}
+
 rsRetVal
 dynstats_inc(dynstats_bucket_t *b, uchar* metric) {
-	dynstats_ctr_t *ctr;
+	dynstats_tcache_t *tc;
+	dynstats_tcache_entry_t *e;
+	dynstats_ctr_t *ctr = NULL;
+	unsigned hash;
 	DEFiRet;
 
 	if (! GatherStats) {
@@ -597,19 +820,28 @@ dynstats_inc(dynstats_bucket_t *b, uchar* metric) {
 		FINALIZE;
 	}
 
-	if (pthread_rwlock_tryrdlock(&b->lock) == 0) {
-		ctr = (dynstats_ctr_t *) hashtable_search(b->table, metric);
-		if (ctr != NULL) {
-			STATSCOUNTER_INC(ctr->ctr, ctr->mutCtr);
-		}
-		pthread_rwlock_unlock(&b->lock);
-	} else {
-		ABORT_FINALIZE(RS_RET_NOENTRY);
+	hash = hash_from_string(metric);
+	if ((tc = dynstats_tcacheGet()) == NULL) {
+		CHKiRet(dynstats_incShared(b, metric, hash, NULL));
+		FINALIZE;
 	}
 
-	if (ctr == NULL) {
-		CHKiRet(dynstats_addNewCtr(b, metric, 1));
+	pthread_mutex_lock(&tc->mut);
+	e = &tc->entries[DYNSTATS_TCACHE_SLOT(b, hash)];
+	if (e->bucket == b && e->hash == hash && !ustrcmp(e->ctr->metric, metric)) {
+		++e->pending;
+	} else {
+		dynstats_tcacheFlushEntry(e);
+		e->bucket = NULL;
+		iRet = dynstats_incShared(b, metric, hash, &ctr);
+		if (iRet == RS_RET_OK && ctr != NULL) {
+			e->bucket = b;
+			e->ctr = ctr;
+			e->hash = hash;
+			e->pending = 0;
+		}
 	}
+	pthread_mutex_unlock(&tc->mut);
 finalize_it:
 	if (iRet != RS_RET_OK) {
 		if (iRet == RS_RET_NOENTRY) {
@@ -31,10 +31,26 @@ struct dynstats_ctr_s {
 	struct dynstats_ctr_s *prev;
 };
 
-struct dynstats_bucket_s {
+/* number of shards a bucket's metric table is split into. Each shard has its own
+ * lock, so that lookups and inserts for different metrics do not contend. MUST be
+ * a power of two.
+ */
+#define DYNSTATS_SHARD_COUNT 16
+
+struct dynstats_shard_s {
 	htable *table;
-	uchar *name;
 	pthread_rwlock_t lock;
+	struct dynstats_ctr_s *ctrs;
+	/*survivor objects are used to keep counter values around for upto unused-ttl duration,
+	  so in case it is accessed within (ttl - 2 * ttl) time-period we can re-store the
+	  accumulator value from this */
+	struct dynstats_ctr_s *survivor_ctrs;
+	htable *survivor_table;
+};
+
+struct dynstats_bucket_s {
+	uchar *name;
+	pthread_rwlock_t lock; /* guards cleanup timeout and serializes bucket resets */
 	statsobj_t *stats;
 	STATSCOUNTER_DEF(ctrOpsOverflow, mutCtrOpsOverflow);
 	ctr_t *pOpsOverflowCtr;
@@ -49,12 +65,7 @@ struct dynstats_bucket_s {
 	STATSCOUNTER_DEF(ctrPurgeTriggered, mutCtrPurgeTriggered);
 	ctr_t *pPurgeTriggeredCtr;
 	struct dynstats_bucket_s *next; /* linked list ptr */
-	struct dynstats_ctr_s *ctrs;
-	/*survivor objects are used to keep counter values around for upto unused-ttl duration,
-	  so in case it is accessed within (ttl - 2 * ttl) time-period we can re-store the
-	  accumulator value from this */
-	struct dynstats_ctr_s *survivor_ctrs;
-	htable *survivor_table;
+	struct dynstats_shard_s shards[DYNSTATS_SHARD_COUNT];
 	
 	uint32_t maxCardinality;
 	uint32_t metricCount;
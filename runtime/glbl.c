@@ -53,6 +53,7 @@
 #include "srUtils.h"
 #include "net.h"
 #include "rsconf.h"
+#include "lazyjson.h"
 
 /* some defaults */
 #ifndef DFLT_NETSTRM_DRVR
@@ -1135,6 +1136,7 @@ glblDoneLoadCnf(void)
 		} else if(!strcmp(paramblk.descr[i].name, "variables.casesensitive")) {
 			const int val = (int) cnfparamvals[i].val.d.n;
 			fjson_global_do_case_sensitive_comparison(val);
+			lazyjsonSetCaseSensitive(val);
 			DBGPRINTF("global/config: set case sensitive variables to %d\n",
 				val);
 		} else if(!strcmp(paramblk.descr[i].name, "localhostname")) {
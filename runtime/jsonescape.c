@@ -0,0 +1,268 @@
+/* The JSON escape scanner.
+ *
+ * Escaping itself is rare in practice - most message content does not
+ * contain quotes, backslashes or control characters. So what really
+ * matters is how fast we can skip over the clean parts. We do this
+ * either with SIMD compares (16 or 32 bytes at a time) or with a
+ * portable word-at-a-time check. The implementation is selected once
+ * during runtime initialization based on the features of the CPU we
+ * are actually running on, so binaries stay portable.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdint.h>
+#include <string.h>
+#include "jsonescape.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#	define JSONESC_HAVE_SSE2 1
+#	include <emmintrin.h>
+#	if defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+		/* older compilers do not permit AVX2 intrinsics outside of -mavx2 units */
+#		define JSONESC_HAVE_AVX2 1
+#		include <immintrin.h>
+#	endif
+#endif
+
+/* what is to be escaped */
+#define JSONESC_ALL 0	/* control chars, '"', '/', '\' - see jsonAddVal() */
+#define JSONESC_QUOTE 1	/* only '"' and '\' - see doEscape() */
+
+/* word-at-a-time helpers, see "Bit Twiddling Hacks" (public domain) */
+#define BCAST(c) (UINT64_C(0x0101010101010101) * (uint8_t) (c))
+#define HASZERO(w) (((w) - BCAST(0x01)) & ~(w) & BCAST(0x80))
+#define HASLESS(w, n) (((w) - BCAST(n)) & ~(w) & BCAST(0x80))
+
+static inline int
+isSpecial(const unsigned char c, const int mode)
+{
+	if(c == '"' || c == '\\')
+		return 1;
+	return mode == JSONESC_ALL && (c < 0x20 || c == '/');
+}
+
+/* Note: the word check may report false positives for bytes following
+ * a real hit, but never misses one. So we only use it to skip clean words
+ * and locate the exact position bytewise.
+ */
+static inline size_t
+findGeneric(const unsigned char *const buf, const size_t len, const int mode)
+{
+	uint64_t w;
+	uint64_t m;
+	size_t i;
+
+	for(i = 0 ; i + 8 <= len ; i += 8) {
+		memcpy(&w, buf + i, sizeof(w));
+		m = HASZERO(w ^ BCAST('"')) | HASZERO(w ^ BCAST('\\'));
+		if(mode == JSONESC_ALL)
+			m |= HASZERO(w ^ BCAST('/')) | HASLESS(w, 0x20);
+		if(m != 0)
+			break;
+	}
+	for( ; i < len ; ++i) {
+		if(isSpecial(buf[i], mode))
+			return i;
+	}
+	return len;
+}
+
+static size_t
+findSpecialGeneric(const unsigned char *const buf, const size_t len)
+{
+	return findGeneric(buf, len, JSONESC_ALL);
+}
+
+static size_t
+findQuoteGeneric(const unsigned char *const buf, const size_t len)
+{
+	return findGeneric(buf, len, JSONESC_QUOTE);
+}
+
+static int
+supportedAlways(void)
+{
+	return 1;
+}
+
+#ifdef JSONESC_HAVE_SSE2
+static inline size_t
+findSSE2(const unsigned char *const buf, const size_t len, const int mode)
+{
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i bslash = _mm_set1_epi8('\\');
+	const __m128i slash = _mm_set1_epi8('/');
+	const __m128i ctl = _mm_set1_epi8(0x1f);
+	__m128i v;
+	__m128i m;
+	int mask;
+	size_t i;
+
+	for(i = 0 ; i + 16 <= len ; i += 16) {
+		v = _mm_loadu_si128((const __m128i*) (buf + i));
+		m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash));
+		if(mode == JSONESC_ALL) {
+			/* min(v, 0x1f) == v <=> v <= 0x1f (unsigned) */
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, slash));
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v));
+		}
+		mask = _mm_movemask_epi8(m);
+		if(mask != 0)
+			return i + __builtin_ctz((unsigned) mask);
+	}
+	return i + findGeneric(buf + i, len - i, mode);
+}
+
+static size_t
+findSpecialSSE2(const unsigned char *const buf, const size_t len)
+{
+	return findSSE2(buf, len, JSONESC_ALL);
+}
+
+static size_t
+findQuoteSSE2(const unsigned char *const buf, const size_t len)
+{
+	return findSSE2(buf, len, JSONESC_QUOTE);
+}
+#endif /* #ifdef JSONESC_HAVE_SSE2 */
+
+#ifdef JSONESC_HAVE_AVX2
+static inline __attribute__((target("avx2"))) size_t
+findAVX2(const unsigned char *const buf, const size_t len, const int mode)
+{
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i bslash = _mm256_set1_epi8('\\');
+	const __m256i slash = _mm256_set1_epi8('/');
+	const __m256i ctl = _mm256_set1_epi8(0x1f);
+	__m256i v;
+	__m256i m;
+	unsigned mask;
+	size_t i;
+
+	for(i = 0 ; i + 32 <= len ; i += 32) {
+		v = _mm256_loadu_si256((const __m256i*) (buf + i));
+		m = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, bslash));
+		if(mode == JSONESC_ALL) {
+			m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, slash));
+			m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl), v));
+		}
+		mask = (unsigned) _mm256_movemask_epi8(m);
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i + findSSE2(buf + i, len - i, mode);
+}
+
+static __attribute__((target("avx2"))) size_t
+findSpecialAVX2(const unsigned char *const buf, const size_t len)
+{
+	return findAVX2(buf, len, JSONESC_ALL);
+}
+
+static __attribute__((target("avx2"))) size_t
+findQuoteAVX2(const unsigned char *const buf, const size_t len)
+{
+	return findAVX2(buf, len, JSONESC_QUOTE);
+}
+
+static int
+supportedAVX2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+#endif /* #ifdef JSONESC_HAVE_AVX2 */
+
+
+static const struct jsonescImpl_s {
+	const char *name;
+	int (*isSupported)(void);
+	size_t (*findSpecial)(const unsigned char *buf, size_t len);
+	size_t (*findQuote)(const unsigned char *buf, size_t len);
+} impls[] = {	/* in order of preference */
+#ifdef JSONESC_HAVE_AVX2
+	{ "avx2", supportedAVX2, findSpecialAVX2, findQuoteAVX2 },
+#endif
+#ifdef JSONESC_HAVE_SSE2
+	{ "sse2", supportedAlways, findSpecialSSE2, findQuoteSSE2 },
+#endif
+	{ "generic", supportedAlways, findSpecialGeneric, findQuoteGeneric }
+};
+#define NUM_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+/* the generic version is always correct, so we can use it
+ * until jsonescInit() has been called.
+ */
+static const struct jsonescImpl_s *currImpl = &impls[NUM_IMPLS - 1];
+
+
+size_t
+jsonescFindSpecial(const unsigned char *const buf, const size_t len)
+{
+	return currImpl->findSpecial(buf, len);
+}
+
+size_t
+jsonescFindQuote(const unsigned char *const buf, const size_t len)
+{
+	return currImpl->findQuote(buf, len);
+}
+
+const char *
+jsonescImplName(void)
+{
+	return currImpl->name;
+}
+
+/* select a specific implementation by name. This is primarily meant
+ * for the testbench and benchmarking. Returns 0 on success, -1 if the
+ * implementation is not available on this system.
+ */
+int
+jsonescSelectImpl(const char *const name)
+{
+	size_t i;
+
+	for(i = 0 ; i < NUM_IMPLS ; ++i) {
+		if(!strcmp(impls[i].name, name)) {
+			if(!impls[i].isSupported())
+				return -1;
+			currImpl = &impls[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* select the best implementation for the current CPU. Must be called
+ * before any worker threads are started.
+ */
+void
+jsonescInit(void)
+{
+	size_t i;
+
+	for(i = 0 ; i < NUM_IMPLS ; ++i) {
+		if(impls[i].isSupported()) {
+			currImpl = &impls[i];
+			break;
+		}
+	}
+}
@@ -0,0 +1,43 @@
+/* Definitions for the JSON escape scanner.
+ *
+ * These functions locate the first character inside a buffer that
+ * requires JSON escaping. They are used by the escaping code in msg.c
+ * and template.c so that runs of "clean" characters can be copied in
+ * bulk. Depending on the CPU, a SIMD implementation is selected at
+ * runtime; a portable word-at-a-time implementation is always available.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_JSONESCAPE_H
+#define INCLUDED_JSONESCAPE_H
+
+#include <stddef.h>
+
+/* return offset of first char that needs escaping as JSON value
+ * (control chars, '"', '/' and '\'), or len if there is none.
+ */
+size_t jsonescFindSpecial(const unsigned char *buf, size_t len);
+/* same, but only '"' and '\' are considered (template option.json) */
+size_t jsonescFindQuote(const unsigned char *buf, size_t len);
+
+void jsonescInit(void);
+const char *jsonescImplName(void);
+int jsonescSelectImpl(const char *name);
+
+#endif /* #ifndef INCLUDED_JSONESCAPE_H */
@@ -0,0 +1,819 @@
+/* lazyjson.c
+ * Implementation of the lazy JSON object.
+ *
+ * When a JSON object is "parsed" into a lazy object, we only validate the
+ * text. No memory besides a copy of the text is allocated. On the first
+ * lookup, a tape is built. The tape is a flat array of tokens in document
+ * order, where each token records where its text starts and ends and where
+ * its next sibling is located. That permits to skip whole subtrees when
+ * searching for a path, so lookups touch only the structural tokens on the
+ * way to the requested value. Values are only converted to C strings or
+ * json-c objects when they are actually requested.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "rsyslog.h"
+#include "unicode-helper.h"
+#include "lazyjson.h"
+
+/* we use the json-c tokener default nesting depth, so that anything we accept
+ * can also be converted to a json-c object later on.
+ */
+#define LAZYJSON_MAX_DEPTH 32
+#define LAZYJSON_MAX_NAME_LEN 1024 /* same as MAX_VARIABLE_NAME_LEN */
+
+/* mirrors the global variables.casesensitive setting (json-c does the same) */
+static int bKeysCaseSensitive = 0;
+
+typedef struct lazyjsonScanner_s {
+	const uchar *buf;
+	uint32_t len;
+	uint32_t pos;
+	lazyjsonTok_t *tape;	/* if NULL, we only validate and count tokens */
+	uint32_t nTape;
+} lazyjsonScanner_t;
+
+static rsRetVal scanValue(lazyjsonScanner_t *const sc, const int depth);
+
+void
+lazyjsonSetCaseSensitive(const int bCaseSensitive)
+{
+	bKeysCaseSensitive = bCaseSensitive;
+}
+
+static inline void
+skipWS(lazyjsonScanner_t *const sc)
+{
+	while(sc->pos < sc->len) {
+		const uchar c = sc->buf[sc->pos];
+		if(c != ' ' && c != '\t' && c != '\n' && c != '\r')
+			break;
+		++sc->pos;
+	}
+}
+
+static inline uint32_t
+beginTok(lazyjsonScanner_t *const sc, const lazyjsonType_t type)
+{
+	const uint32_t idx = sc->nTape++;
+	if(sc->tape != NULL) {
+		sc->tape[idx].start = sc->pos;
+		sc->tape[idx].type = (uint8_t) type;
+		sc->tape[idx].bEscaped = 0;
+	}
+	return idx;
+}
+
+static inline void
+endTok(lazyjsonScanner_t *const sc, const uint32_t idx)
+{
+	if(sc->tape != NULL) {
+		sc->tape[idx].len = sc->pos - sc->tape[idx].start;
+		sc->tape[idx].next = sc->nTape;
+	}
+}
+
+static rsRetVal
+scanString(lazyjsonScanner_t *const sc)
+{
+	const uint32_t idx = beginTok(sc, LAZYJSON_STRING);
+	uint8_t bEscaped = 0;
+	int i;
+	DEFiRet;
+
+	++sc->pos; /* opening quote */
+	while(1) {
+		if(sc->pos >= sc->len)
+			ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+		const uchar c = sc->buf[sc->pos];
+		if(c == '"') {
+			break;
+		} else if(c == '\\') {
+			bEscaped = 1;
+			if(++sc->pos >= sc->len)
+				ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+			switch(sc->buf[sc->pos]) {
+			case '"':
+			case '\\':
+			case '/':
+			case 'b':
+			case 'f':
+			case 'n':
+			case 'r':
+			case 't':
+				break;
+			case 'u':
+				for(i = 0 ; i < 4 ; ++i) {
+					if(++sc->pos >= sc->len || !isxdigit(sc->buf[sc->pos]))
+						ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+				}
+				break;
+			default:
+				ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+			}
+		} else if(c < 0x20) {
+			ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+		}
+		++sc->pos;
+	}
+	++sc->pos; /* closing quote */
+	endTok(sc, idx);
+	if(sc->tape != NULL)
+		sc->tape[idx].bEscaped = bEscaped;
+
+finalize_it:
+	RETiRet;
+}
+
+static inline int
+scanDigits(lazyjsonScanner_t *const sc)
+{
+	const uint32_t begin = sc->pos;
+	while(sc->pos < sc->len && isdigit(sc->buf[sc->pos]))
+		++sc->pos;
+	return sc->pos != begin;
+}
+
+static rsRetVal
+scanNumber(lazyjsonScanner_t *const sc)
+{
+	const uint32_t idx = beginTok(sc, LAZYJSON_NUMBER);
+	DEFiRet;
+
+	if(sc->buf[sc->pos] == '-')
+		++sc->pos;
+	if(sc->pos < sc->len && sc->buf[sc->pos] == '0') {
+		++sc->pos;
+	} else if(!scanDigits(sc)) {
+		ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+	}
+	if(sc->pos < sc->len && sc->buf[sc->pos] == '.') {
+		++sc->pos;
+		if(!scanDigits(sc))
+			ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+	}
+	if(sc->pos < sc->len && (sc->buf[sc->pos] == 'e' || sc->buf[sc->pos] == 'E')) {
+		++sc->pos;
+		if(sc->pos < sc->len && (sc->buf[sc->pos] == '+' || sc->buf[sc->pos] == '-'))
+			++sc->pos;
+		if(!scanDigits(sc))
+			ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+	}
+	endTok(sc, idx);
+
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+scanLiteral(lazyjsonScanner_t *const sc, const char *const lit, const uint32_t lenLit,
+	const lazyjsonType_t type)
+{
+	const uint32_t idx = beginTok(sc, type);
+	DEFiRet;
+
+	if(sc->len - sc->pos < lenLit || memcmp(sc->buf + sc->pos, lit, lenLit))
+		ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+	sc->pos += lenLit;
+	endTok(sc, idx);
+
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+scanObject(lazyjsonScanner_t *const sc, const int depth)
+{
+	uint32_t idx;
+	DEFiRet;
+
+	if(depth > LAZYJSON_MAX_DEPTH)
+		ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+	idx = beginTok(sc, LAZYJSON_OBJECT);
+	++sc->pos; /* '{' */
+	skipWS(sc);
+	if(sc->pos < sc->len && sc->buf[sc->pos] == '}') {
+		++sc->pos;
+	} else {
+		while(1) {
+			skipWS(sc);
+			if(sc->pos >= sc->len || sc->buf[sc->pos] != '"')
+				ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+			CHKiRet(scanString(sc));
+			skipWS(sc);
+			if(sc->pos >= sc->len || sc->buf[sc->pos] != ':')
+				ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+			++sc->pos;
+			CHKiRet(scanValue(sc, depth));
+			skipWS(sc);
+			if(sc->pos >= sc->len)
+				ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+			if(sc->buf[sc->pos] == '}') {
+				++sc->pos;
+				break;
+			} else if(sc->buf[sc->pos] != ',') {
+				ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+			}
+			++sc->pos;
+		}
+	}
+	endTok(sc, idx);
+
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+scanArray(lazyjsonScanner_t *const sc, const int depth)
+{
+	uint32_t idx;
+	DEFiRet;
+
+	if(depth > LAZYJSON_MAX_DEPTH)
+		ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+	idx = beginTok(sc, LAZYJSON_ARRAY);
+	++sc->pos; /* '[' */
+	skipWS(sc);
+	if(sc->pos < sc->len && sc->buf[sc->pos] == ']') {
+		++sc->pos;
+	} else {
+		while(1) {
+			CHKiRet(scanValue(sc, depth));
+			skipWS(sc);
+			if(sc->pos >= sc->len)
+				ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+			if(sc->buf[sc->pos] == ']') {
+				++sc->pos;
+				break;
+			} else if(sc->buf[sc->pos] != ',') {
+				ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+			}
+			++sc->pos;
+		}
+	}
+	endTok(sc, idx);
+
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+scanValue(lazyjsonScanner_t *const sc, const int depth)
+{
+	DEFiRet;
+
+	skipWS(sc);
+	if(sc->pos >= sc->len)
+		ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+	switch(sc->buf[sc->pos]) {
+	case '{':
+		CHKiRet(scanObject(sc, depth + 1));
+		break;
+	case '[':
+		CHKiRet(scanArray(sc, depth + 1));
+		break;
+	case '"':
+		CHKiRet(scanString(sc));
+		break;
+	case 't':
+		CHKiRet(scanLiteral(sc, "true", 4, LAZYJSON_BOOL));
+		break;
+	case 'f':
+		CHKiRet(scanLiteral(sc, "false", 5, LAZYJSON_BOOL));
+		break;
+	case 'n':
+		CHKiRet(scanLiteral(sc, "null", 4, LAZYJSON_NULL));
+		break;
+	default:
+		CHKiRet(scanNumber(sc));
+		break;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+/* scan a complete document, which must be a single JSON object */
+static rsRetVal
+scanDocument(lazyjsonScanner_t *const sc)
+{
+	DEFiRet;
+
+	skipWS(sc);
+	if(sc->pos >= sc->len || sc->buf[sc->pos] != '{')
+		ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+	CHKiRet(scanObject(sc, 1));
+	skipWS(sc);
+	if(sc->pos != sc->len)
+		ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+buildTape(lazyjson_t *const pThis)
+{
+	lazyjsonScanner_t sc;
+	DEFiRet;
+
+	CHKmalloc(pThis->tape = malloc(pThis->nTape * sizeof(lazyjsonTok_t)));
+	sc.buf = pThis->text;
+	sc.len = pThis->lenText;
+	sc.pos = 0;
+	sc.tape = pThis->tape;
+	sc.nTape = 0;
+	CHKiRet(scanDocument(&sc));
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		free(pThis->tape);
+		pThis->tape = NULL;
+	}
+	RETiRet;
+}
+
+/* validates the text and creates a lazy object from it. Leading and trailing
+ * whitespace is not kept. Returns RS_RET_JSON_PARSE_ERR if the text is not a
+ * (strictly) valid JSON object.
+ */
+rsRetVal
+lazyjsonConstruct(lazyjson_t **const ppThis, const uchar *text, size_t lenText)
+{
+	lazyjson_t *pThis = NULL;
+	lazyjsonScanner_t sc;
+	DEFiRet;
+
+	while(lenText > 0 && isspace(*text)) {
+		++text;
+		--lenText;
+	}
+	while(lenText > 0 && isspace(text[lenText-1]))
+		--lenText;
+	if(lenText >= UINT32_MAX)
+		ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+
+	sc.buf = text;
+	sc.len = (uint32_t) lenText;
+	sc.pos = 0;
+	sc.tape = NULL;
+	sc.nTape = 0;
+	CHKiRet(scanDocument(&sc));
+
+	CHKmalloc(pThis = calloc(1, sizeof(lazyjson_t)));
+	CHKmalloc(pThis->text = malloc(lenText + 1));
+	memcpy(pThis->text, text, lenText);
+	pThis->text[lenText] = '\0';
+	pThis->lenText = (uint32_t) lenText;
+	pThis->nTape = sc.nTape;
+	*ppThis = pThis;
+	pThis = NULL;
+
+finalize_it:
+	if(pThis != NULL)
+		lazyjsonDestruct(&pThis);
+	RETiRet;
+}
+
+void
+lazyjsonDestruct(lazyjson_t **const ppThis)
+{
+	lazyjson_t *const pThis = *ppThis;
+	if(pThis == NULL)
+		return;
+	free(pThis->text);
+	free(pThis->tape);
+	free(pThis);
+	*ppThis = NULL;
+}
+
+rsRetVal
+lazyjsonDup(lazyjson_t *const pThis, lazyjson_t **const ppNew)
+{
+	lazyjson_t *pNew = NULL;
+	DEFiRet;
+
+	CHKmalloc(pNew = calloc(1, sizeof(lazyjson_t)));
+	CHKmalloc(pNew->text = malloc(pThis->lenText + 1));
+	memcpy(pNew->text, pThis->text, pThis->lenText + 1);
+	pNew->lenText = pThis->lenText;
+	pNew->nTape = pThis->nTape;
+	if(pThis->tape != NULL) {
+		CHKmalloc(pNew->tape = malloc(pThis->nTape * sizeof(lazyjsonTok_t)));
+		memcpy(pNew->tape, pThis->tape, pThis->nTape * sizeof(lazyjsonTok_t));
+	}
+	*ppNew = pNew;
+	pNew = NULL;
+
+finalize_it:
+	if(pNew != NULL)
+		lazyjsonDestruct(&pNew);
+	RETiRet;
+}
+
+static inline unsigned
+hex4(const uchar *const p)
+{
+	unsigned val = 0;
+	int i;
+	for(i = 0 ; i < 4 ; ++i) {
+		const uchar c = p[i];
+		val <<= 4;
+		if(c >= '0' && c <= '9')
+			val |= c - '0';
+		else
+			val |= (tolower(c) - 'a') + 10;
+	}
+	return val;
+}
+
+static inline size_t
+utf8Encode(unsigned cp, uchar *const dst)
+{
+	if(cp < 0x80) {
+		dst[0] = (uchar) cp;
+		return 1;
+	} else if(cp < 0x800) {
+		dst[0] = (uchar) (0xc0 | (cp >> 6));
+		dst[1] = (uchar) (0x80 | (cp & 0x3f));
+		return 2;
+	} else if(cp < 0x10000) {
+		dst[0] = (uchar) (0xe0 | (cp >> 12));
+		dst[1] = (uchar) (0x80 | ((cp >> 6) & 0x3f));
+		dst[2] = (uchar) (0x80 | (cp & 0x3f));
+		return 3;
+	}
+	dst[0] = (uchar) (0xf0 | (cp >> 18));
+	dst[1] = (uchar) (0x80 | ((cp >> 12) & 0x3f));
+	dst[2] = (uchar) (0x80 | ((cp >> 6) & 0x3f));
+	dst[3] = (uchar) (0x80 | (cp & 0x3f));
+	return 4;
+}
+
+/* decode the (already validated) string content src into dst. The decoded
+ * string is never longer than the encoded one, so dst must be at least
+ * lenSrc + 1 bytes. Returns the length of the decoded string.
+ */
+static size_t
+decodeString(const uchar *const src, const size_t lenSrc, uchar *const dst)
+{
+	size_t i, j = 0;
+	unsigned cp, lo;
+
+	for(i = 0 ; i < lenSrc ; ++i) {
+		if(src[i] != '\\') {
+			dst[j++] = src[i];
+			continue;
+		}
+		++i;
+		switch(src[i]) {
+		case 'b':
+			dst[j++] = '\b';
+			break;
+		case 'f':
+			dst[j++] = '\f';
+			break;
+		case 'n':
+			dst[j++] = '\n';
+			break;
+		case 'r':
+			dst[j++] = '\r';
+			break;
+		case 't':
+			dst[j++] = '\t';
+			break;
+		case 'u':
+			cp = hex4(src + i + 1);
+			i += 4;
+			if(cp >= 0xd800 && cp <= 0xdbff && i + 6 < lenSrc
+			   && src[i+1] == '\\' && src[i+2] == 'u') {
+				lo = hex4(src + i + 3);
+				if(lo >= 0xdc00 && lo <= 0xdfff) {
+					cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+					i += 6;
+				}
+			}
+			j += utf8Encode(cp, dst + j);
+			break;
+		default: /* '"', '\\', '/' */
+			dst[j++] = src[i];
+			break;
+		}
+	}
+	dst[j] = '\0';
+	return j;
+}
+
+/* get the content of a string token as newly allocated C string */
+static rsRetVal
+getTokString(lazyjson_t *const pThis, const lazyjsonTok_t *const tok, uchar **const ppRes,
+	rs_size_t *const pLen)
+{
+	const uchar *const content = pThis->text + tok->start + 1;
+	const size_t lenContent = tok->len - 2;
+	uchar *res;
+	size_t len;
+	DEFiRet;
+
+	CHKmalloc(res = malloc(lenContent + 1));
+	if(tok->bEscaped) {
+		len = decodeString(content, lenContent, res);
+	} else {
+		memcpy(res, content, lenContent);
+		res[lenContent] = '\0';
+		len = lenContent;
+	}
+	*ppRes = res;
+	if(pLen != NULL)
+		*pLen = (rs_size_t) len;
+
+finalize_it:
+	RETiRet;
+}
+
+static int
+keyEquals(lazyjson_t *const pThis, const lazyjsonTok_t *const tok, const uchar *const key,
+	const size_t lenKey)
+{
+	uchar *decoded = NULL;
+	const uchar *name = pThis->text + tok->start + 1;
+	size_t lenName = tok->len - 2;
+	int r;
+
+	if(tok->bEscaped) {
+		if((decoded = malloc(lenName + 1)) == NULL)
+			return 0;
+		lenName = decodeString(name, lenName, decoded);
+		name = decoded;
+	}
+	if(lenName != lenKey) {
+		r = 0;
+	} else if(bKeysCaseSensitive) {
+		r = !memcmp(name, key, lenKey);
+	} else {
+		r = !strncasecmp((const char*) name, (const char*) key, lenKey);
+	}
+	free(decoded);
+	return r;
+}
+
+/* find member "key" in the object at tape index idxObj. As with json-c, the
+ * last one wins if a key is present multiple times.
+ */
+static rsRetVal
+objectGet(lazyjson_t *const pThis, const uint32_t idxObj, const uchar *const key,
+	const size_t lenKey, uint32_t *const pIdx)
+{
+	const lazyjsonTok_t *const obj = pThis->tape + idxObj;
+	uint32_t i;
+	int bFound = 0;
+	DEFiRet;
+
+	if(obj->type != LAZYJSON_OBJECT)
+		ABORT_FINALIZE(RS_RET_JNAME_NOTFOUND);
+	for(i = idxObj + 1 ; i < obj->next ; i = pThis->tape[i+1].next) {
+		if(keyEquals(pThis, pThis->tape + i, key, lenKey)) {
+			*pIdx = i + 1;
+			bFound = 1;
+		}
+	}
+	if(!bFound)
+		ABORT_FINALIZE(RS_RET_JNAME_NOTFOUND);
+
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+arrayGet(lazyjson_t *const pThis, const uint32_t idxArr, long n, uint32_t *const pIdx)
+{
+	const lazyjsonTok_t *const arr = pThis->tape + idxArr;
+	uint32_t i;
+	DEFiRet;
+
+	if(arr->type != LAZYJSON_ARRAY || n < 0)
+		ABORT_FINALIZE(RS_RET_JNAME_NOTFOUND);
+	for(i = idxArr + 1 ; i < arr->next ; i = pThis->tape[i].next) {
+		if(n-- == 0) {
+			*pIdx = i;
+			FINALIZE;
+		}
+	}
+	ABORT_FINALIZE(RS_RET_JNAME_NOTFOUND);
+
+finalize_it:
+	RETiRet;
+}
+
+/* resolve a single path element, including array subscripts. Semantics
+ * follow jsonVarExtract() in msg.c.
+ */
+static rsRetVal
+memberGet(lazyjson_t *const pThis, const uint32_t idxObj, const uchar *const name,
+	const size_t lenName, uint32_t *const pIdx)
+{
+	const uchar *subscript;
+	char *end;
+	long n;
+	uint32_t idxArr;
+	DEFiRet;
+
+	if(lenName > 0 && name[lenName-1] == ']'
+	   && (subscript = memchr(name, '[', lenName)) != NULL) {
+		errno = 0;
+		n = strtol((const char*) subscript + 1, &end, 10);
+		if(errno == 0 && (const uchar*) end == name + lenName - 1
+		   && objectGet(pThis, idxObj, name, subscript - name, &idxArr) == RS_RET_OK
+		   && pThis->tape[idxArr].type == LAZYJSON_ARRAY) {
+			CHKiRet(arrayGet(pThis, idxArr, n, pIdx));
+			FINALIZE;
+		}
+	}
+	CHKiRet(objectGet(pThis, idxObj, name, lenName, pIdx));
+
+finalize_it:
+	RETiRet;
+}
+
+/* find the tape index of the value at path (e.g. "!foo!bar[1]") */
+static rsRetVal
+findPath(lazyjson_t *const pThis, const uchar *path, uint32_t *const pIdx)
+{
+	uchar namebuf[LAZYJSON_MAX_NAME_LEN];
+	uint32_t idx = 0;
+	size_t i;
+	DEFiRet;
+
+	if(pThis->tape == NULL)
+		CHKiRet(buildTape(pThis));
+
+	while(*path != '\0') {
+		if(*path == '!') {
+			++path;
+			continue;
+		}
+		for(i = 0 ; *path != '\0' && *path != '!' && i < sizeof(namebuf) - 1 ; ++i, ++path)
+			namebuf[i] = *path;
+		namebuf[i] = '\0';
+		CHKiRet(memberGet(pThis, idx, namebuf, i, &idx));
+	}
+	*pIdx = idx;
+
+finalize_it:
+	RETiRet;
+}
+
+/* convert the value at tape index idx into a new json-c object */
+static rsRetVal
+tokToJSON(lazyjson_t *const pThis, const uint32_t idx, struct json_object **const pjson)
+{
+	const lazyjsonTok_t *const tok = pThis->tape + idx;
+	uchar *buf = NULL;
+	DEFiRet;
+
+	*pjson = NULL;
+	switch(tok->type) {
+	case LAZYJSON_NULL:
+		break;
+	case LAZYJSON_BOOL:
+		CHKmalloc(*pjson = json_object_new_boolean(pThis->text[tok->start] == 't'));
+		break;
+	case LAZYJSON_STRING:
+		CHKiRet(getTokString(pThis, tok, &buf, NULL));
+		CHKmalloc(*pjson = json_object_new_string((char*) buf));
+		break;
+	default:
+		if(idx == 0) {
+			*pjson = json_tokener_parse((char*) pThis->text);
+		} else {
+			CHKmalloc(buf = malloc(tok->len + 1));
+			memcpy(buf, pThis->text + tok->start, tok->len);
+			buf[tok->len] = '\0';
+			*pjson = json_tokener_parse((char*) buf);
+		}
+		if(*pjson == NULL)
+			ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+		break;
+	}
+
+finalize_it:
+	free(buf);
+	RETiRet;
+}
+
+/* Get a value as string, like json_object_get_string() would do it, with the
+ * exception that containers are not re-rendered but returned in their original
+ * text form. The caller must free *ppRes. If the value is not found or JSON
+ * null, RS_RET_JNAME_NOTFOUND is returned.
+ */
+rsRetVal
+lazyjsonGetString(lazyjson_t *const pThis, const uchar *const path, uchar **const ppRes,
+	rs_size_t *const pLen)
+{
+	const lazyjsonTok_t *tok;
+	uint32_t idx;
+	DEFiRet;
+
+	CHKiRet(findPath(pThis, path, &idx));
+	tok = pThis->tape + idx;
+	switch(tok->type) {
+	case LAZYJSON_NULL:
+		ABORT_FINALIZE(RS_RET_JNAME_NOTFOUND);
+	case LAZYJSON_STRING:
+		CHKiRet(getTokString(pThis, tok, ppRes, pLen));
+		break;
+	default:
+		CHKmalloc(*ppRes = malloc(tok->len + 1));
+		memcpy(*ppRes, pThis->text + tok->start, tok->len);
+		(*ppRes)[tok->len] = '\0';
+		if(pLen != NULL)
+			*pLen = (rs_size_t) tok->len;
+		break;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+/* Same semantics as msgGetJSONPropJSONorString(): strings (and null, as empty
+ * string) are returned in *pcstr, everything else as new json-c object.
+ */
+rsRetVal
+lazyjsonGetJSONorString(lazyjson_t *const pThis, const uchar *const path,
+	struct json_object **const pjson, uchar **const pcstr)
+{
+	uint32_t idx;
+	DEFiRet;
+
+	*pjson = NULL;
+	*pcstr = NULL;
+	CHKiRet(findPath(pThis, path, &idx));
+	switch(pThis->tape[idx].type) {
+	case LAZYJSON_NULL:
+		CHKmalloc(*pcstr = (uchar*) strdup(""));
+		break;
+	case LAZYJSON_STRING:
+		CHKiRet(getTokString(pThis, pThis->tape + idx, pcstr, NULL));
+		break;
+	default:
+		CHKiRet(tokToJSON(pThis, idx, pjson));
+		break;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+/* get the value at path as new json-c object. JSON null is returned as
+ * NULL object with RS_RET_OK, just like json-c does.
+ */
+rsRetVal
+lazyjsonGetJSON(lazyjson_t *const pThis, const uchar *const path, struct json_object **const pjson)
+{
+	uint32_t idx;
+	DEFiRet;
+
+	*pjson = NULL;
+	CHKiRet(findPath(pThis, path, &idx));
+	CHKiRet(tokToJSON(pThis, idx, pjson));
+
+finalize_it:
+	RETiRet;
+}
+
+/* convert the whole lazy object into a json-c object tree */
+rsRetVal
+lazyjsonToJSON(lazyjson_t *const pThis, struct json_object **const pjson)
+{
+	DEFiRet;
+
+	if((*pjson = json_tokener_parse((char*) pThis->text)) == NULL)
+		ABORT_FINALIZE(RS_RET_JSON_PARSE_ERR);
+
+finalize_it:
+	RETiRet;
+}
@@ -0,0 +1,69 @@
+/* Definitions for the lazy JSON object.
+ *
+ * A lazy JSON object keeps the original JSON text of an object and
+ * only builds a compact structural index (the "tape") when a value is
+ * actually looked up. A json-c object tree is created only if the caller
+ * explicitly asks for one, usually because the data is about to be
+ * modified.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_LAZYJSON_H
+#define INCLUDED_LAZYJSON_H
+
+#include <json.h>
+
+typedef enum lazyjsonType_e {
+	LAZYJSON_NULL = 0,
+	LAZYJSON_BOOL = 1,
+	LAZYJSON_NUMBER = 2,
+	LAZYJSON_STRING = 3,
+	LAZYJSON_OBJECT = 4,
+	LAZYJSON_ARRAY = 5
+} lazyjsonType_t;
+
+/* a single tape entry. Object members are stored as key token, directly
+ * followed by the value token (and its subtree).
+ */
+typedef struct lazyjsonTok_s {
+	uint32_t start;		/* offset of first char of token inside text */
+	uint32_t len;		/* length of token text (strings include quotes) */
+	uint32_t next;		/* tape index of next sibling, i.e. first index after our subtree */
+	uint8_t type;		/* a lazyjsonType_t */
+	uint8_t bEscaped;	/* string token contains escape sequences */
+} lazyjsonTok_t;
+
+struct lazyjson_s {
+	uchar *text;		/* original JSON text, always '\0'-terminated */
+	uint32_t lenText;
+	lazyjsonTok_t *tape;	/* structural index, NULL until first lookup */
+	uint32_t nTape;		/* number of tape entries (known after validation) */
+};
+
+rsRetVal lazyjsonConstruct(lazyjson_t **ppThis, const uchar *text, size_t lenText);
+void lazyjsonDestruct(lazyjson_t **ppThis);
+rsRetVal lazyjsonDup(lazyjson_t *pThis, lazyjson_t **ppNew);
+rsRetVal lazyjsonGetString(lazyjson_t *pThis, const uchar *path, uchar **ppRes, rs_size_t *pLen);
+rsRetVal lazyjsonGetJSONorString(lazyjson_t *pThis, const uchar *path, struct json_object **pjson,
+	uchar **pcstr);
+rsRetVal lazyjsonGetJSON(lazyjson_t *pThis, const uchar *path, struct json_object **pjson);
+rsRetVal lazyjsonToJSON(lazyjson_t *pThis, struct json_object **pjson);
+void lazyjsonSetCaseSensitive(int bCaseSensitive);
+
+#endif /* #ifndef INCLUDED_LAZYJSON_H */
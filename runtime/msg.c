@@ -66,6 +66,8 @@
 #include "rsconf.h"
 #include "parserif.h"
 #include "errmsg.h"
+#include "lazyjson.h"
+#include "jsonescape.h"
 
 /* inlines */
 extern void msgSetPRI(smsg_t *const __restrict__ pMsg, syslog_pri_t pri);
@@ -423,6 +425,7 @@ static rsRetVal jsonPathFindParent(struct json_object *jroot, uchar *name, uchar
 	struct json_object **parent, int bCreate);
 static uchar * jsonPathGetLeaf(uchar *name, int lenName);
 static struct json_object *jsonDeepCopy(struct json_object *src);
+static rsRetVal materializeLazyJSON(smsg_t *const pM);
 static json_bool jsonVarExtract(struct json_object* root, const char *key, struct json_object **value);
 void getRawMsgAfterPRI(smsg_t * const pM, uchar **pBuf, int *piLen);
 
@@ -858,6 +861,7 @@ msgBaseConstruct(smsg_t **ppThis)
 	pM->rcvFrom.pRcvFrom = NULL;
 	pM->pRuleset = NULL;
 	pM->json = NULL;
+	pM->lazyjson = NULL;
 	pM->localvars = NULL;
 	pM->dfltTZ[0] = '\0';
 	memset(&pM->tRcvdAt, 0, sizeof(pM->tRcvdAt));
@@ -1009,6 +1013,7 @@ CODESTARTobjDestruct(msg)
 			rsCStrDestruct(&pThis->pCSMSGID);
 		if(pThis->json != NULL)
 			json_object_put(pThis->json);
+		lazyjsonDestruct(&pThis->lazyjson);
 		if(pThis->localvars != NULL)
 			json_object_put(pThis->localvars);
 		if(pThis->pszUUID != NULL)
@@ -1165,6 +1170,12 @@ smsg_t* MsgDup(smsg_t* pOld)
 
 	if(pOld->json != NULL)
 		pNew->json = jsonDeepCopy(pOld->json);
+	if(pOld->lazyjson != NULL) {
+		if(lazyjsonDup(pOld->lazyjson, &pNew->lazyjson) != RS_RET_OK) {
+			msgDestruct(&pNew);
+			return NULL;
+		}
+	}
 	if(pOld->localvars != NULL)
 		pNew->localvars = jsonDeepCopy(pOld->localvars);
 
@@ -1226,6 +1237,9 @@ static rsRetVal MsgSerialize(smsg_t *pThis, strm_t *pStrm)
 	if(pThis->json != NULL) {
 		psz = (uchar*) json_object_get_string(pThis->json);
 		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("json"), PROPTYPE_PSZ, (void*) psz));
+	} else if(pThis->lazyjson != NULL) {
+		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("json"), PROPTYPE_PSZ,
+			(void*) pThis->lazyjson->text));
 	}
 	if(pThis->localvars != NULL) {
 		psz = (uchar*) json_object_get_string(pThis->localvars);
@@ -2394,6 +2408,7 @@ msgGetJSONMESG(smsg_t *__restrict__ const pMsg)
 	json_object_object_add(json, "uuid", jval);
 #endif
 
+	msgMaterializeJSON(pMsg);
 	json_object_object_add(json, "$!", json_object_get(pMsg->json));
 
 	pRes = (uchar*) strdup(json_object_get_string(json));
@@ -3092,6 +3107,12 @@ getJSONPropVal(smsg_t * const pMsg, msgPropDescr_t *pProp, uchar **pRes, rs_size
 	CHKiRet(getJSONRootAndMutex(pMsg, pProp->id, &jroot, &mut));
 	pthread_mutex_lock(mut);
 
+	if(pProp->id == PROP_CEE && pMsg->lazyjson != NULL) {
+		if(lazyjsonGetString(pMsg->lazyjson, pProp->name, pRes, buflen) == RS_RET_OK)
+			*pbMustBeFreed = 1;
+		FINALIZE;
+	}
+
 	if(*jroot == NULL) FINALIZE;
 
 	if(!strcmp((char*)pProp->name, "!")) {
@@ -3145,6 +3166,18 @@ msgGetJSONPropJSONorString(smsg_t * const pMsg, msgPropDescr_t *pProp, struct js
 
 	CHKiRet(getJSONRootAndMutex(pMsg, pProp->id, &jroot, &mut));
 	pthread_mutex_lock(mut);
+	if(pProp->id == PROP_CEE && pMsg->lazyjson != NULL) {
+		/* results are new objects, so no deep copy is needed */
+		if(!strcmp((char*)pProp->name, "!")) {
+			iRet = lazyjsonToJSON(pMsg->lazyjson, pjson);
+		} else {
+			iRet = lazyjsonGetJSONorString(pMsg->lazyjson, pProp->name, pjson, pcstr);
+		}
+		pthread_mutex_unlock(mut);
+		if(iRet == RS_RET_JNAME_NOTFOUND)
+			iRet = RS_RET_NOT_FOUND;
+		RETiRet;
+	}
 	if(!strcmp((char*)pProp->name, "!")) {
 		*pjson = *jroot;
 		FINALIZE;
@@ -3193,6 +3226,19 @@ msgGetJSONPropJSON(smsg_t * const pMsg, msgPropDescr_t *pProp, struct json_objec
 	CHKiRet(getJSONRootAndMutex(pMsg, pProp->id, &jroot, &mut));
 	pthread_mutex_lock(mut);
 
+	if(pProp->id == PROP_CEE && pMsg->lazyjson != NULL) {
+		/* results are newly created objects, so no deep copy is needed */
+		if(!strcmp((char*)pProp->name, "!")) {
+			iRet = lazyjsonToJSON(pMsg->lazyjson, pjson);
+		} else {
+			iRet = lazyjsonGetJSON(pMsg->lazyjson, pProp->name, pjson);
+		}
+		pthread_mutex_unlock(mut);
+		if(iRet == RS_RET_JNAME_NOTFOUND)
+			iRet = RS_RET_NOT_FOUND;
+		RETiRet;
+	}
+
 	if(!strcmp((char*)pProp->name, "!")) {
 		*pjson = *jroot;
 		FINALIZE;
@@ -3223,90 +3269,91 @@ jsonAddVal(uchar *pSrc, unsigned buflen, es_str_t **dst, int escapeAll)
 {
 	unsigned char c;
 	es_size_t i;
+	es_size_t iNext;
 	char numbuf[4];
 	unsigned ni;
 	unsigned char nc;
 	int j;
 	DEFiRet;
 
-	for(i = 0 ; i < buflen ; ++i) {
+	i = 0;
+	while(i < buflen) {
+		/* skip (and copy) everything that does not need escaping in one go */
+		iNext = i + jsonescFindSpecial(pSrc + i, buflen - i);
+		if(*dst != NULL && iNext > i)
+			es_addBuf(dst, (char*)pSrc + i, iNext - i);
+		if(iNext == buflen)
+			break;
+		i = iNext;
 		c = pSrc[i];
-		if(   (c >= 0x23 && c <= 0x2e)
-		   || (c >= 0x30 && c <= 0x5b)
-		   || (c >= 0x5d /* && c <= 0x10FFFF*/)
-		   || c == 0x20 || c == 0x21) {
-			/* no need to escape */
-			if(*dst != NULL)
-				es_addChar(dst, c);
-		} else {
+		if(*dst == NULL) {
+			if(i == 0) {
+				/* we hope we have only few escapes... */
+				*dst = es_newStr(buflen+10);
+			} else {
+				*dst = es_newStrFromBuf((char*)pSrc, i);
+			}
 			if(*dst == NULL) {
-				if(i == 0) {
-					/* we hope we have only few escapes... */
-					*dst = es_newStr(buflen+10);
-				} else {
-					*dst = es_newStrFromBuf((char*)pSrc, i);
-				}
-				if(*dst == NULL) {
-					ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
-				}
+				ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 			}
-			/* we must escape, try RFC4627-defined special sequences first */
-			switch(c) {
-			case '\0':
-				es_addBuf(dst, "\\u0000", 6);
-				break;
-			case '\"':
-				es_addBuf(dst, "\\\"", 2);
-				break;
-			case '/':
-				es_addBuf(dst, "\\/", 2);
-				break;
-			case '\\':
-				if (escapeAll == RSFALSE) {
-					ni = i + 1;
-					if (ni <= buflen) {
-						nc = pSrc[ni];
-
-						/* Attempt to not double encode */
-						if (   nc == '"' || nc == '/' || nc == '\\' || nc == 'b' || nc == 'f'
-							|| nc == 'n' || nc == 'r' || nc == 't' || nc == 'u') {
-
-							es_addChar(dst, c);
-							es_addChar(dst, nc);
-							i = ni;
-							break;
-						}
+		}
+		/* we must escape, try RFC4627-defined special sequences first */
+		switch(c) {
+		case '\0':
+			es_addBuf(dst, "\\u0000", 6);
+			break;
+		case '\"':
+			es_addBuf(dst, "\\\"", 2);
+			break;
+		case '/':
+			es_addBuf(dst, "\\/", 2);
+			break;
+		case '\\':
+			if (escapeAll == RSFALSE) {
+				ni = i + 1;
+				if (ni <= buflen) {
+					nc = pSrc[ni];
+
+					/* Attempt to not double encode */
+					if (   nc == '"' || nc == '/' || nc == '\\' || nc == 'b' || nc == 'f'
+						|| nc == 'n' || nc == 'r' || nc == 't' || nc == 'u') {
+
+						es_addChar(dst, c);
+						es_addChar(dst, nc);
+						i = ni;
+						break;
 					}
 				}
+			}
 
-				es_addBuf(dst, "\\\\", 2);
-				break;
-			case '\010':
-				es_addBuf(dst, "\\b", 2);
-				break;
-			case '\014':
-				es_addBuf(dst, "\\f", 2);
-				break;
-			case '\n':
-				es_addBuf(dst, "\\n", 2);
-				break;
-			case '\r':
-				es_addBuf(dst, "\\r", 2);
-				break;
-			case '\t':
-				es_addBuf(dst, "\\t", 2);
-				break;
-			default:
-				/* TODO : proper Unicode encoding (see header comment) */
-				for(j = 0 ; j < 4 ; ++j) {
-					numbuf[3-j] = hexdigit[c % 16];
-					c = c / 16;
-				}
-				es_addBuf(dst, "\\u", 2);
-				es_addBuf(dst, numbuf, 4);
-				break;
+			es_addBuf(dst, "\\\\", 2);
+			break;
+		case '\010':
+			es_addBuf(dst, "\\b", 2);
+			break;
+		case '\014':
+			es_addBuf(dst, "\\f", 2);
+			break;
+		case '\n':
+			es_addBuf(dst, "\\n", 2);
+			break;
+		case '\r':
+			es_addBuf(dst, "\\r", 2);
+			break;
+		case '\t':
+			es_addBuf(dst, "\\t", 2);
+			break;
+		default:
+			/* TODO : proper Unicode encoding (see header comment) */
+			for(j = 0 ; j < 4 ; ++j) {
+				numbuf[3-j] = hexdigit[c % 16];
+				c = c / 16;
 			}
+			es_addBuf(dst, "\\u", 2);
+			es_addBuf(dst, numbuf, 4);
+			break;
 		}
+		++i;
 	}
 finalize_it:
 	RETiRet;
@@ -3701,7 +3748,18 @@ uchar *MsgGetProp(smsg_t *__restrict__ const pMsg, struct templateEntry *__restr
 			break;
 		case PROP_CEE_ALL_JSON:
 		case PROP_CEE_ALL_JSON_PLAIN:
-			if(pMsg->json == NULL) {
+			if(pMsg->lazyjson != NULL) {
+				/* unmodified lazy tree: emit original text, no rendering needed */
+				MsgLock(pMsg);
+				if(pMsg->lazyjson != NULL) {
+					pRes = (uchar*) strdup((char*) pMsg->lazyjson->text);
+					bufLen = pMsg->lazyjson->lenText;
+				}
+				MsgUnlock(pMsg);
+			}
+			if(pRes != NULL) {
+				*pbMustBeFreed = 1;
+			} else if(pMsg->json == NULL) {
 				pRes = (uchar*) "{}";
 				bufLen = 2;
 				*pbMustBeFreed = 0;
@@ -4802,6 +4860,9 @@ msgAddJSON(smsg_t * const pM, uchar *name, struct json_object *json, int force_r
 	CHKiRet(getJSONRootAndMutexByVarChar(pM, name[0], &jroot, &mut));
 	pthread_mutex_lock(mut);
 
+	if(name[0] == '!')
+		CHKiRet(materializeLazyJSON(pM));
+
 	if(name[0] == '/') { /* globl var special handling */
 		if (sharedReference) {
 			given = json;
@@ -4877,6 +4938,9 @@ msgDelJSON(smsg_t * const pM, uchar *name)
 	CHKiRet(getJSONRootAndMutexByVarChar(pM, name[0], &jroot, &mut));
 	pthread_mutex_lock(mut);
 
+	if(name[0] == '!')
+		CHKiRet(materializeLazyJSON(pM));
+
 	if(*jroot == NULL) {
 		DBGPRINTF("msgDelJSONVar; jroot empty in unset for property %s\n",
 			  name);
@@ -4912,6 +4976,68 @@ finalize_it:
 	RETiRet;
 }
 
+/* convert a lazy $! tree into a regular json-c object tree. This must be
+ * done before the tree is modified or handed out by reference.
+ * Must be called with the message mutex locked.
+ */
+static rsRetVal
+materializeLazyJSON(smsg_t *const pM)
+{
+	struct json_object *json;
+	DEFiRet;
+
+	if(pM->lazyjson == NULL)
+		FINALIZE;
+	CHKiRet(lazyjsonToJSON(pM->lazyjson, &json));
+	lazyjsonDestruct(&pM->lazyjson);
+	pM->json = json;
+finalize_it:
+	RETiRet;
+}
+
+/* same as materializeLazyJSON(), but for callers outside the message object */
+rsRetVal
+msgMaterializeJSON(smsg_t *const pM)
+{
+	DEFiRet;
+	if(pM->lazyjson == NULL)
+		FINALIZE;
+	MsgLock(pM);
+	iRet = materializeLazyJSON(pM);
+	MsgUnlock(pM);
+finalize_it:
+	RETiRet;
+}
+
+/* set the $! tree from JSON text without building a json-c object tree.
+ * The text is only validated; values are extracted on demand. If the tree
+ * already has content, the text is parsed and merged just like msgAddJSON()
+ * does. Returns RS_RET_JSON_PARSE_ERR if the text is not a strictly valid
+ * JSON object - the caller may then use the (more lenient) json-c parser.
+ */
+rsRetVal
+msgAddLazyJSON(smsg_t *const pM, const uchar *const text, const size_t lenText)
+{
+	lazyjson_t *lazy = NULL;
+	struct json_object *json;
+	DEFiRet;
+
+	CHKiRet(lazyjsonConstruct(&lazy, text, lenText));
+	MsgLock(pM);
+	if(pM->json == NULL && pM->lazyjson == NULL) {
+		pM->lazyjson = lazy;
+		lazy = NULL;
+	}
+	MsgUnlock(pM);
+	if(lazy != NULL) {
+		CHKiRet(lazyjsonToJSON(lazy, &json));
+		CHKiRet(msgAddJSON(pM, (uchar*)"!", json, 0, 0));
+	}
+finalize_it:
+	lazyjsonDestruct(&lazy);
+	RETiRet;
+}
+
 /* add Metadata to the message. This is stored in a special JSON
  * container. Note that only string types are currently supported,
  * what should pose absolutely no problem with the string-ish nature
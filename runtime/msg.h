@@ -110,6 +110,8 @@ struct msg {
 	struct syslogTime tRcvdAt;/* time the message entered this program */
 	struct syslogTime tTIMESTAMP;/* (parsed) value of the timestamp */
 	struct json_object *json;
+	lazyjson_t *lazyjson;	/* $! tree in its original text form (see lazyjson.h); if
+				   set, json is NULL. Converted to json on first modification. */
 	struct json_object *localvars;
 	/* some fixed-size buffers to save malloc()/free() for frequently used fields (from the default templates) */
 	uchar szRawMsg[CONF_RAWMSG_BUFSIZE];
@@ -206,6 +208,8 @@ const char *getPRI(smsg_t *pMsg);
 int getPRIi(const smsg_t * const pM);
 void getRawMsg(smsg_t *pM, uchar **pBuf, int *piLen);
 rsRetVal msgAddJSON(smsg_t *pM, uchar *name, struct json_object *json, int force_reset, int sharedReference);
+rsRetVal msgAddLazyJSON(smsg_t *pM, const uchar *text, size_t lenText);
+rsRetVal msgMaterializeJSON(smsg_t *pM);
 rsRetVal msgAddMetadata(smsg_t *msg, uchar *metaname, uchar *metaval);
 rsRetVal msgAddMultiMetadata(smsg_t *msg, const uchar **metaname, const uchar **metaval, const int count);
 rsRetVal MsgGetSeverity(smsg_t *pThis, int *piSeverity);
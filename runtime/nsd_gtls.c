@@ -29,6 +29,9 @@
 #include <string.h>
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
+#ifdef HAVE_GNUTLS_TRANSPORT_IS_KTLS_ENABLED
+#	include <gnutls/socket.h>
+#endif
 #if GNUTLS_VERSION_NUMBER <= 0x020b00
 #	include <gcrypt.h>
 #endif
@@ -101,6 +104,25 @@ static pthread_mutex_t mutGtlsStrerror;
 
 /* ------------------------------ GnuTLS specifics ------------------------------ */
 static gnutls_certificate_credentials_t xcred;
+#ifdef HAVE_GNUTLS_SESSION_TICKET_KEY_GENERATE
+static gnutls_datum_t ticketKey = { NULL, 0 };	/* key to encrypt session tickets (server side) */
+#endif
+
+/* Client side session cache. When we reconnect to a server we already had
+ * a session with, we try to resume that session. This avoids the public key
+ * operations of a full handshake, which is especially useful if many
+ * connections are re-established at the same time. Entries are replaced
+ * round-robin if the cache is full. Besides the peer, the key contains all
+ * settings that affect the session (see gtlsSessCacheKey()), so connections
+ * with different settings never resume each other's sessions.
+ */
+#define GTLS_SESS_CACHE_SIZE 64
+static struct {
+	uchar *pszKey;
+	gnutls_datum_t data;
+} sessCache[GTLS_SESS_CACHE_SIZE];
+static int iSessCacheNext = 0;	/* next entry to be replaced */
+static pthread_mutex_t mutSessCache = PTHREAD_MUTEX_INITIALIZER;
 
 /* This defines a log function to be provided to GnuTLS. It hopefully
  * helps us track down hard to find problems.
@@ -552,6 +574,36 @@ finalize_it:
 }
 
 
+/* receive a record directly into the caller-provided buffer. This must
+ * only be used if no GnuTLS state must be kept when the call needs to be
+ * retried (see gtlsIsKtlsRecv()). In contrast to gtlsRecordRecv(), a retry
+ * is not scheduled: the regular select()/poll() processing calls us again
+ * once there is new data.
+ */
+static rsRetVal
+gtlsRecordRecvDirect(nsd_gtls_t *pThis, uchar *pBuf, ssize_t *pLenBuf, int *const oserr)
+{
+	ssize_t lenRcvd;
+	DEFiRet;
+
+	lenRcvd = gnutls_record_recv(pThis->sess, pBuf, *pLenBuf);
+	if(lenRcvd > 0) {
+		*pLenBuf = lenRcvd;
+	} else if(lenRcvd == 0) { /* EOS */
+		*oserr = errno;
+		ABORT_FINALIZE(RS_RET_CLOSED);
+	} else if(lenRcvd == GNUTLS_E_AGAIN || lenRcvd == GNUTLS_E_INTERRUPTED) {
+		ABORT_FINALIZE(RS_RET_RETRY);
+	} else {
+		int gnuRet = lenRcvd;
+		ABORTgnutls;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* add our own certificate to the certificate set, so that the peer
  * can identify us. Please note that we try to use mutual authentication,
  * so we always add a cert, even if we are in the client role (later,
@@ -663,6 +715,12 @@ gtlsInitSession(nsd_gtls_t *pThis)
 	/* request client certificate if any.  */
 	gnutls_certificate_server_set_request( session, GNUTLS_CERT_REQUEST);
 
+#	ifdef HAVE_GNUTLS_SESSION_TICKET_KEY_GENERATE
+	if(ticketKey.data != NULL) {
+		CHKgnutls(gnutls_session_ticket_enable_server(session, &ticketKey));
+	}
+#	endif
+
 	pThis->sess = session;
 
 #	if HAVE_GNUTLS_CERTIFICATE_SET_RETRIEVE_FUNCTION 
@@ -698,6 +756,15 @@ gtlsGlblInitLstn(void)
 
 		/* now we need to add our certificate */
 		CHKiRet(gtlsAddOurCert());
+
+#		ifdef HAVE_GNUTLS_SESSION_TICKET_KEY_GENERATE
+		/* permit clients to resume their sessions via session tickets */
+		if(gnutls_session_ticket_key_generate(&ticketKey) != 0) {
+			dbgprintf("GnuTLS: could not generate session ticket key, "
+				"session resumption not supported\n");
+			ticketKey.data = NULL;
+		}
+#		endif
 	}
 
 finalize_it:
@@ -1137,6 +1204,136 @@ finalize_it:
 }
 
 
+/* build the session cache key for a connection to host:port. It contains
+ * the peer as well as our certificate, authentication mode, permitted peers
+ * and priority string. Returns NULL if out of memory.
+ */
+static uchar *
+gtlsSessCacheKey(nsd_gtls_t *const pThis, const uchar *const host, const uchar *const port)
+{
+	const uchar *const certFile = glbl.GetDfltNetstrmDrvrCertFile();
+	const uchar *const keyFile = glbl.GetDfltNetstrmDrvrKeyFile();
+	const uchar *const prio = pThis->gnutlsPriorityString;
+	permittedPeers_t *pPeer;
+	size_t len;
+	uchar *pszKey;
+	uchar *p;
+
+	len = ustrlen(host) + ustrlen(port) + 32;
+	len += (certFile == NULL) ? 0 : ustrlen(certFile);
+	len += (keyFile == NULL) ? 0 : ustrlen(keyFile);
+	len += (prio == NULL) ? 0 : ustrlen(prio);
+	for(pPeer = pThis->pPermPeers ; pPeer != NULL ; pPeer = pPeer->pNext)
+		len += ustrlen(pPeer->pszID) + 1;
+
+	if((pszKey = malloc(len)) == NULL)
+		return NULL;
+	p = pszKey + snprintf((char*) pszKey, len, "%s:%s|%s|%s|%d|%s|", host, port,
+		(certFile == NULL) ? "" : (char*) certFile, (keyFile == NULL) ? "" : (char*) keyFile,
+		(int) pThis->authMode, (prio == NULL) ? "" : (char*) prio);
+	for(pPeer = pThis->pPermPeers ; pPeer != NULL ; pPeer = pPeer->pNext)
+		p += snprintf((char*) p, len - (p - pszKey), "%s,", pPeer->pszID);
+	return pszKey;
+}
+
+
+/* find a session cache entry, must be called with mutSessCache locked.
+ * Returns -1 if there is no entry for the key.
+ */
+static int
+gtlsSessCacheFind(const uchar *const pszKey)
+{
+	int i;
+
+	for(i = 0 ; i < GTLS_SESS_CACHE_SIZE ; ++i) {
+		if(sessCache[i].pszKey != NULL && !ustrcmp(sessCache[i].pszKey, pszKey))
+			return i;
+	}
+	return -1;
+}
+
+
+/* provide the data of the last session with the same key (if any) to GnuTLS,
+ * so that it tries to resume it during the handshake.
+ */
+static void
+gtlsSessCacheRestore(nsd_gtls_t *const pThis, const uchar *const pszKey)
+{
+	int i;
+
+	pthread_mutex_lock(&mutSessCache);
+	if((i = gtlsSessCacheFind(pszKey)) != -1) {
+		if(gnutls_session_set_data(pThis->sess, sessCache[i].data.data, sessCache[i].data.size) != 0) {
+			dbgprintf("GnuTLS: could not use cached session for %s\n", pszKey);
+		}
+	}
+	pthread_mutex_unlock(&mutSessCache);
+}
+
+
+/* remember the current session under the given key, so that it can be
+ * resumed on the next connect. Failures are not reported, as they just
+ * mean we need a full handshake next time.
+ */
+static void
+gtlsSessCacheStore(nsd_gtls_t *const pThis, const uchar *const pszKey)
+{
+	gnutls_datum_t data;
+	uchar *pszKeyCopy;
+	int i;
+
+	if(gnutls_session_get_data2(pThis->sess, &data) != 0)
+		return;
+
+	pthread_mutex_lock(&mutSessCache);
+	if((i = gtlsSessCacheFind(pszKey)) == -1) {
+		if((pszKeyCopy = ustrdup(pszKey)) == NULL) {
+			gnutls_free(data.data);
+			goto done;
+		}
+		i = iSessCacheNext;
+		iSessCacheNext = (iSessCacheNext + 1) % GTLS_SESS_CACHE_SIZE;
+		free(sessCache[i].pszKey);
+		sessCache[i].pszKey = pszKeyCopy;
+	}
+	gnutls_free(sessCache[i].data.data);
+	sessCache[i].data = data;
+done:
+	pthread_mutex_unlock(&mutSessCache);
+}
+
+
+static void
+gtlsSessCacheExit(void)
+{
+	int i;
+
+	for(i = 0 ; i < GTLS_SESS_CACHE_SIZE ; ++i) {
+		free(sessCache[i].pszKey);
+		gnutls_free(sessCache[i].data.data);
+		sessCache[i].pszKey = NULL;
+		sessCache[i].data.data = NULL;
+	}
+}
+
+
+/* check if received records are decrypted by the kernel (kTLS). This is
+ * the case if GnuTLS is configured to use kTLS (see "ktls" in the GnuTLS
+ * system configuration) and the kernel supports the negotiated cipher.
+ * GnuTLS hands the session keys to the kernel after the handshake.
+ */
+static int
+gtlsIsKtlsRecv(nsd_gtls_t *const pThis)
+{
+#ifdef HAVE_GNUTLS_TRANSPORT_IS_KTLS_ENABLED
+	return pThis->bHaveSess && (gnutls_transport_is_ktls_enabled(pThis->sess) & GNUTLS_KTLS_RECV);
+#else
+	(void) pThis;
+	return 0;
+#endif
+}
+
+
 /* globally de-initialize GnuTLS */
 static rsRetVal
 gtlsGlblExit(void)
@@ -1144,6 +1341,11 @@ gtlsGlblExit(void)
 	DEFiRet;
 	/* X509 stuff */
 	gnutls_certificate_free_credentials(xcred);
+#	ifdef HAVE_GNUTLS_SESSION_TICKET_KEY_GENERATE
+	gnutls_free(ticketKey.data);
+	ticketKey.data = NULL;
+#	endif
+	gtlsSessCacheExit();
 	gnutls_global_deinit(); /* we are done... */
 	RETiRet;
 }
@@ -1614,6 +1816,16 @@ Rcv(nsd_t *pNsd, uchar *pBuf, ssize_t *pLenBuf, int *const oserr)
 	 * is already in the receive buffer ... risk accepted. -- rgerhards, 2008-06-23
 	 */
 
+	if(gtlsIsKtlsRecv(pThis) && (pThis->pszRcvBuf == NULL || pThis->lenRcvBuf == -1)) {
+		/* With kTLS, the kernel decrypts the records and GnuTLS does not
+		 * need to keep any state between calls. So the restriction that a
+		 * retry must use the same buffer does not exist and we can receive
+		 * straight into the caller's buffer, saving a copy.
+		 */
+		CHKiRet(gtlsRecordRecvDirect(pThis, pBuf, pLenBuf, oserr));
+		FINALIZE;
+	}
+
 	if(pThis->pszRcvBuf == NULL) {
 		/* we have no buffer, so we need to malloc one */
 		CHKmalloc(pThis->pszRcvBuf = MALLOC(NSD_GTLS_MAX_RCVBUF));
@@ -1754,6 +1966,7 @@ Connect(nsd_t *pNsd, int family, uchar *port, uchar *host, char *device)
 	int sock;
 	int gnuRet;
 	const char *error_position;
+	uchar *pszSessKey = NULL;
 #	ifdef HAVE_GNUTLS_CERTIFICATE_TYPE_SET_PRIORITY
 	static const int cert_type_priority[2] = { GNUTLS_CRT_X509, 0 };
 #	endif
@@ -1833,9 +2046,16 @@ Connect(nsd_t *pNsd, int family, uchar *port, uchar *host, char *device)
 	 */
 	CHKmalloc(pThis->pszConnectHost = (uchar*)strdup((char*)host));
 
+	/* try to resume our last session with this peer, if there is one */
+	pszSessKey = gtlsSessCacheKey(pThis, host, port);
+	if(pszSessKey != NULL)
+		gtlsSessCacheRestore(pThis, pszSessKey);
+
 	/* and perform the handshake */
 	CHKgnutls(gnutls_handshake(pThis->sess));
-	dbgprintf("GnuTLS handshake succeeded\n");
+	dbgprintf("GnuTLS handshake succeeded, session %sresumed, kTLS %sused for reception, "
+		"session cache key '%s'\n", gnutls_session_is_resumed(pThis->sess) ? "" : "not ",
+		gtlsIsKtlsRecv(pThis) ? "" : "not ", (pszSessKey == NULL) ? "" : (char*) pszSessKey);
 
 	/* now check if the remote peer is permitted to talk to us - ideally, we 
 	 * should do this during the handshake, but GnuTLS does not yet provide 
@@ -1843,7 +2063,12 @@ Connect(nsd_t *pNsd, int family, uchar *port, uchar *host, char *device)
 	 */
 	CHKiRet(gtlsChkPeerAuth(pThis));
 
+	/* only sessions with authorized peers are kept for resumption */
+	if(pszSessKey != NULL)
+		gtlsSessCacheStore(pThis, pszSessKey);
+
 finalize_it:
+	free(pszSessKey);
 	if(iRet != RS_RET_OK) {
 		if(pThis->bHaveSess) {
 			gnutls_deinit(pThis->sess);
@@ -1,6 +1,6 @@
 /* An implementation of the nsd interface for GnuTLS.
  *
- * Copyright 2008-2016 Adiscon GmbH.
+ * Copyright 2008-2018 Adiscon GmbH.
  *
  * This file is part of the rsyslog runtime library.
  *
@@ -24,7 +24,7 @@
 
 #include "nsd.h"
 
-#define NSD_GTLS_MAX_RCVBUF 8 * 1024 /* max size of buffer for message reception */
+#define NSD_GTLS_MAX_RCVBUF 16 * 1024 /* max size of buffer for message reception (one full TLS record) */
 
 typedef enum {
 	gtlsRtry_None = 0,	/**< no call needs to be retried */
@@ -111,6 +111,12 @@ static uchar template_StdJSONFmt[] = "\"{\\\"message\\\":\\\"%msg:::json%\\\",\\
 "%HOSTNAME:::json%\\\",\\\"facility\\\":\\\"%syslogfacility-text%\\\",\\\"priority\\\":\\\""
 "%syslogpriority-text%\\\",\\\"timereported\\\":\\\"%timereported:::date-rfc3339%\\\",\\\"timegenerated\\\":\\\""
 "%timegenerated:::date-rfc3339%\\\"}\"";
+static uchar template_StdMongoDocFmt[] = "\"{\\\"sys\\\":\\\"%HOSTNAME:::json%\\\",\\\"time\\\":\\\""
+"%timereported:::date-unixtimestamp%.%timereported:::date-subseconds%\\\",\\\"time_rcvd\\\":\\\""
+"%timegenerated:::date-unixtimestamp%.%timegenerated:::date-subseconds%\\\",\\\"msg\\\":\\\""
+"%msg:::json%\\\",\\\"syslog_fac\\\":%syslogfacility%,\\\"syslog_sever\\\":%syslogseverity%,"
+"\\\"syslog_tag\\\":\\\"%syslogtag:::json%\\\",\\\"procid\\\":\\\"%programname:::json%\\\","
+"\\\"pid\\\":\\\"%procid:::json%\\\"}\"";
 /* end templates */
 
 /* tables for interfacing with the v6 config system (as far as we need to) */
@@ -1258,6 +1264,8 @@ initLegacyConf(void)
 	tplAddLine(ourConf, " StdPgSQLFmt", &pTmp);
 	pTmp = template_StdJSONFmt;
 	tplAddLine(ourConf, " StdJSONFmt", &pTmp);
+	pTmp = template_StdMongoDocFmt;
+	tplAddLine(ourConf, " StdMongoDocFmt", &pTmp);
 	pTmp = template_spoofadr;
 	tplLastStaticInit(ourConf, tplAddLine(ourConf, "RSYSLOG_omudpspoofDfltSourceTpl", &pTmp));
 
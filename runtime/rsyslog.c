@@ -82,6 +82,8 @@
 #include "statsobj.h"
 #include "atomic.h"
 #include "srUtils.h"
+#include "jsonescape.h"
+#include "utf8valid.h"
 
 pthread_attr_t default_thread_attr;
 #ifdef HAVE_PTHREAD_SETSCHEDPARAM
@@ -205,6 +207,8 @@ rsrtInit(const char **ppErrObj, obj_if_t *pObjIF)
 		/* dummy "classes" */
 		if(ppErrObj != NULL) *ppErrObj = "str";
 		CHKiRet(strInit());
+		jsonescInit();
+		utf8validInit();
 	}
 
 	++iRefCount;
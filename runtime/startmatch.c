@@ -0,0 +1,471 @@
+/* The message start matcher.
+ *
+ * We support the subset of POSIX ERE that consists of an optional "^"
+ * anchor followed by a sequence of atoms, where each atom is a literal
+ * char, ".", a bracket expression or one of the GNU escapes \w \W \s \S,
+ * optionally followed by one of the quantifiers "*", "+", "?", "{n}",
+ * "{n,}" or "{n,m}". Quantified atoms are expanded into up to
+ * STARTMATCH_MAX_ELEMS elements, each of them a set of chars which is
+ * mandatory or optional and may or may not repeat.
+ *
+ * Such a sequence is matched by the classic shift-and algorithm: bit k
+ * of the state word is set if the first k elements have been matched
+ * so far. As the regex is not anchored at the end, we are done as soon
+ * as the final state is reached. For anchored expressions, we are also
+ * done as soon as no state is active any longer - for typical stack
+ * trace continuation lines this happens on the very first char.
+ *
+ * Everything else (groups, alternation, backreferences, "$", ...) as well
+ * as multibyte locales is handed over to regexec(). The regex is always
+ * compiled via regcomp(), so syntax checking and error messages are
+ * exactly as before.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <regex.h>
+#include "rsyslog.h"
+#include "startmatch.h"
+
+#define QUANT_INF -1
+
+/* parse a character class name like "[:digit:]". On entry, *pp points
+ * to the ':' after the '['. Returns 0 on success, -1 if unsupported.
+ */
+static int
+addCharClass(const uchar **const pp, uchar *const set)
+{
+	static const struct {
+		const char *name;
+		int (*isClass)(int);
+	} classes[] = {
+		{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+		{ "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+		{ "lower", islower }, { "print", isprint }, { "punct", ispunct },
+		{ "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit }
+	};
+	const uchar *const name = *pp + 1;
+	const uchar *end;
+	size_t i;
+	int c;
+
+	if((end = (const uchar*) strstr((const char*) name, ":]")) == NULL)
+		return -1;
+	for(i = 0 ; i < sizeof(classes) / sizeof(classes[0]) ; ++i) {
+		if(strlen(classes[i].name) == (size_t) (end - name)
+		   && !strncmp(classes[i].name, (const char*) name, end - name)) {
+			for(c = 1 ; c < 256 ; ++c) {
+				if(classes[i].isClass(c))
+					set[c] = 1;
+			}
+			*pp = end + 1; /* the ']' of ":]" */
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* parse a bracket expression. On entry, *pp points to the opening '[',
+ * on successful exit to the closing ']'.
+ */
+static int
+parseBracket(const uchar **const pp, uchar *const set)
+{
+	const uchar *p = *pp + 1;
+	int bNegate = 0;
+	int first = 1;
+	int c, cEnd;
+
+	if(*p == '^') {
+		bNegate = 1;
+		++p;
+	}
+	while(*p != ']' || first) {
+		first = 0;
+		if(*p == '\0')
+			return -1;
+		if(*p == '[' && (p[1] == '.' || p[1] == '='))
+			return -1; /* collating elements/equivalence classes */
+		if(*p == '[' && p[1] == ':') {
+			++p;
+			if(addCharClass(&p, set) != 0)
+				return -1;
+			++p;
+			continue;
+		}
+		c = *p++;
+		if(*p == '-' && p[1] != ']' && p[1] != '\0') {
+			if(p[1] == '[')
+				return -1;
+			cEnd = p[1];
+			if(cEnd < c)
+				return -1;
+			for( ; c <= cEnd ; ++c)
+				set[c] = 1;
+			p += 2;
+		} else {
+			set[c] = 1;
+		}
+	}
+
+	if(bNegate) {
+		for(c = 1 ; c < 256 ; ++c)
+			set[c] = !set[c];
+	}
+	*pp = p;
+	return 0;
+}
+
+/* parse the char set for the atom at *pp. On exit, *pp points to
+ * the last char of the atom.
+ */
+static int
+parseAtom(const uchar **const pp, uchar *const set)
+{
+	const uchar *p = *pp;
+	int c;
+
+	switch(*p) {
+	case '.':
+		memset(set + 1, 1, 255);
+		break;
+	case '[':
+		if(parseBracket(&p, set) != 0)
+			return -1;
+		break;
+	case '\\':
+		c = *++p;
+		if(c == 'w' || c == 'W') {
+			for(c = 1 ; c < 256 ; ++c)
+				set[c] = (isalnum(c) || c == '_') == (*p == 'w');
+		} else if(c == 's' || c == 'S') {
+			for(c = 1 ; c < 256 ; ++c)
+				set[c] = (isspace(c) != 0) == (*p == 's');
+		} else if(c == '\0' || isalnum(c) || c == '`' || c == '\'') {
+			return -1; /* backreference, anchor or other special escape */
+		} else {
+			set[c] = 1;
+		}
+		break;
+	case '(':
+	case ')':
+	case '|':
+	case '^':
+	case '$':
+	case '*':
+	case '+':
+	case '?':
+	case '{':
+		return -1;
+	default:
+		set[*p] = 1;
+		break;
+	}
+	*pp = p;
+	return 0;
+}
+
+/* parse an optional quantifier following an atom. On exit, *pp points
+ * to the first char after the quantifier.
+ */
+static int
+parseQuantifier(const uchar **const pp, int *const pMin, int *const pMax)
+{
+	const uchar *p = *pp;
+
+	*pMin = *pMax = 1;
+	switch(*p) {
+	case '*':
+		*pMin = 0;
+		*pMax = QUANT_INF;
+		++p;
+		break;
+	case '+':
+		*pMax = QUANT_INF;
+		++p;
+		break;
+	case '?':
+		*pMin = 0;
+		++p;
+		break;
+	case '{':
+		++p;
+		if(!isdigit(*p))
+			return -1;
+		for(*pMin = 0 ; isdigit(*p) ; ++p) {
+			*pMin = *pMin * 10 + (*p - '0');
+			if(*pMin > STARTMATCH_MAX_ELEMS)
+				return -1;
+		}
+		if(*p == ',') {
+			++p;
+			if(isdigit(*p)) {
+				for(*pMax = 0 ; isdigit(*p) ; ++p) {
+					*pMax = *pMax * 10 + (*p - '0');
+					if(*pMax > STARTMATCH_MAX_ELEMS)
+						return -1;
+				}
+				if(*pMax < *pMin)
+					return -1;
+			} else {
+				*pMax = QUANT_INF;
+			}
+		} else {
+			*pMax = *pMin;
+		}
+		if(*p++ != '}')
+			return -1;
+		break;
+	default:
+		break;
+	}
+	if(*p == '*' || *p == '+' || *p == '?' || *p == '{')
+		return -1; /* stacked quantifiers have surprising semantics */
+	*pp = p;
+	return 0;
+}
+
+static int
+addElem(startmatch_t *const pThis, const uchar *const set, const int bOpt, const int bRep)
+{
+	const int i = pThis->nElems;
+	int c;
+
+	if(i >= STARTMATCH_MAX_ELEMS)
+		return -1;
+	for(c = 1 ; c < 256 ; ++c) {
+		if(set[c])
+			pThis->charMask[c] |= UINT64_C(1) << i;
+	}
+	if(bOpt)
+		pThis->optIdx[pThis->nOpt++] = i;
+	if(bRep)
+		pThis->repMask |= UINT64_C(1) << i;
+	++pThis->nElems;
+	return 0;
+}
+
+/* try to compile the regex into an element sequence. Returns 0 if
+ * that worked, -1 if we need to fall back to regexec().
+ */
+static int
+compileNFA(startmatch_t *const pThis, const uchar *const regex)
+{
+	const uchar *p = regex;
+	uchar set[256];
+	int min, max;
+	int i;
+
+	if(MB_CUR_MAX > 1)
+		return -1;
+	if(*p == '^') {
+		pThis->bAnchored = 1;
+		++p;
+	}
+	while(*p != '\0') {
+		memset(set, 0, sizeof(set));
+		if(parseAtom(&p, set) != 0)
+			return -1;
+		++p;
+		if(parseQuantifier(&p, &min, &max) != 0)
+			return -1;
+		for(i = 0 ; i < min ; ++i) {
+			if(addElem(pThis, set, 0, max == QUANT_INF && i == min - 1) != 0)
+				return -1;
+		}
+		if(max == QUANT_INF) {
+			if(min == 0 && addElem(pThis, set, 1, 1) != 0)
+				return -1;
+		} else {
+			for(i = min ; i < max ; ++i) {
+				if(addElem(pThis, set, 1, 0) != 0)
+					return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* check if the element sequence is just an anchored literal prefix
+ * and, if so, extract it.
+ */
+static rsRetVal
+checkLiteral(startmatch_t *const pThis)
+{
+	uchar *lit = NULL;
+	int c, cLit;
+	int i;
+	DEFiRet;
+
+	if(!pThis->bAnchored || pThis->nOpt != 0 || pThis->repMask != 0 || pThis->nElems == 0)
+		FINALIZE;
+	CHKmalloc(lit = malloc(pThis->nElems));
+	for(i = 0 ; i < pThis->nElems ; ++i) {
+		cLit = -1;
+		for(c = 1 ; c < 256 ; ++c) {
+			if(pThis->charMask[c] & (UINT64_C(1) << i)) {
+				if(cLit != -1)
+					FINALIZE; /* more than one char */
+				cLit = c;
+			}
+		}
+		lit[i] = (uchar) cLit;
+	}
+	pThis->literal = lit;
+	pThis->lenLiteral = pThis->nElems;
+	pThis->mode = STARTMATCH_LITERAL;
+	lit = NULL;
+
+finalize_it:
+	free(lit);
+	RETiRet;
+}
+
+rsRetVal
+startmatchConstruct(startmatch_t **const ppThis, const uchar *const regex,
+	char *const errbuf, const size_t lenErrbuf)
+{
+	startmatch_t *pThis = NULL;
+	int errcode;
+	DEFiRet;
+
+	CHKmalloc(pThis = calloc(1, sizeof(startmatch_t)));
+	errcode = regcomp(&pThis->preg, (const char*) regex, REG_EXTENDED);
+	if(errcode != 0) {
+		regerror(errcode, &pThis->preg, errbuf, lenErrbuf);
+		free(pThis);
+		pThis = NULL;
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	STATSCOUNTER_INIT(pThis->ctrLines, pThis->mutCtrLines);
+	STATSCOUNTER_INIT(pThis->ctrMatched, pThis->mutCtrMatched);
+	STATSCOUNTER_INIT(pThis->ctrRegexec, pThis->mutCtrRegexec);
+
+	if(compileNFA(pThis, regex) == 0) {
+		pThis->mode = STARTMATCH_NFA;
+		CHKiRet(checkLiteral(pThis));
+	} else {
+		pThis->mode = STARTMATCH_REGEX;
+	}
+	DBGPRINTF("startmatch: regex '%s' uses mode %s, %d elements\n", regex,
+		startmatchModeName(pThis), pThis->nElems);
+	*ppThis = pThis;
+	pThis = NULL;
+
+finalize_it:
+	if(pThis != NULL)
+		startmatchDestruct(&pThis);
+	RETiRet;
+}
+
+void
+startmatchDestruct(startmatch_t **const ppThis)
+{
+	startmatch_t *const pThis = *ppThis;
+
+	if(pThis == NULL)
+		return;
+	regfree(&pThis->preg);
+	free(pThis->literal);
+	DESTROY_ATOMIC_HELPER_MUT64(pThis->mutCtrLines);
+	DESTROY_ATOMIC_HELPER_MUT64(pThis->mutCtrMatched);
+	DESTROY_ATOMIC_HELPER_MUT64(pThis->mutCtrRegexec);
+	free(pThis);
+	*ppThis = NULL;
+}
+
+static inline uint64_t
+closure(const startmatch_t *const pThis, uint64_t state)
+{
+	int i;
+
+	for(i = 0 ; i < pThis->nOpt ; ++i) {
+		if(state & (UINT64_C(1) << pThis->optIdx[i]))
+			state |= UINT64_C(1) << (pThis->optIdx[i] + 1);
+	}
+	return state;
+}
+
+static int
+execNFA(const startmatch_t *const pThis, const uchar *p)
+{
+	const uint64_t accept = UINT64_C(1) << pThis->nElems;
+	uint64_t state;
+	uint64_t mask;
+
+	state = closure(pThis, 1);
+	while(1) {
+		if(state & accept)
+			return 1;
+		if(*p == '\0')
+			return 0;
+		mask = pThis->charMask[*p++];
+		state = ((state & mask) << 1) | (state & ((mask & pThis->repMask) << 1));
+		if(!pThis->bAnchored)
+			state |= 1;
+		else if(state == 0)
+			return 0;
+		state = closure(pThis, state);
+	}
+}
+
+/* check if the line is the start of a new message. The line must be a
+ * NUL-terminated string; as with regexec(), the first NUL ends it.
+ */
+int
+startmatchExec(startmatch_t *const pThis, const uchar *const line)
+{
+	int isMatch;
+
+	STATSCOUNTER_INC(pThis->ctrLines, pThis->mutCtrLines);
+	switch(pThis->mode) {
+	case STARTMATCH_LITERAL:
+		isMatch = !strncmp((const char*) line, (const char*) pThis->literal, pThis->lenLiteral);
+		break;
+	case STARTMATCH_NFA:
+		isMatch = execNFA(pThis, line);
+		break;
+	case STARTMATCH_REGEX:
+	default:
+		STATSCOUNTER_INC(pThis->ctrRegexec, pThis->mutCtrRegexec);
+		isMatch = !regexec(&pThis->preg, (const char*) line, 0, NULL, 0);
+		break;
+	}
+	if(isMatch) {
+		STATSCOUNTER_INC(pThis->ctrMatched, pThis->mutCtrMatched);
+	}
+	return isMatch;
+}
+
+const char *
+startmatchModeName(const startmatch_t *const pThis)
+{
+	switch(pThis->mode) {
+	case STARTMATCH_LITERAL:
+		return "literal";
+	case STARTMATCH_NFA:
+		return "nfa";
+	case STARTMATCH_REGEX:
+	default:
+		return "regex";
+	}
+}
@@ -0,0 +1,65 @@
+/* Definitions for the message start matcher.
+ *
+ * The matcher decides whether a line is the first line of a new
+ * (multi-line) message, based on a user-provided POSIX ERE. Most
+ * such expressions in practice are simple anchored prefixes like
+ * "^[0-9]{4}-[0-9]{2}-[0-9]{2}" or "^[^ \t]". These are compiled into
+ * a small bit-parallel automaton or plain literal compare, so that
+ * regexec() only needs to be called for expressions that we cannot
+ * handle ourselves.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_STARTMATCH_H
+#define INCLUDED_STARTMATCH_H
+
+#include <stdint.h>
+#include <regex.h>
+#include "statsobj.h"
+
+#define STARTMATCH_MAX_ELEMS 63	/* one bit per state, plus the initial state */
+
+typedef enum {
+	STARTMATCH_REGEX = 0,	/* not supported by us, use regexec() */
+	STARTMATCH_LITERAL = 1,	/* anchored literal prefix */
+	STARTMATCH_NFA = 2	/* sequence of (quantified) char classes */
+} startmatchMode_t;
+
+typedef struct startmatch_s {
+	regex_t preg;			/* always compiled, used for STARTMATCH_REGEX */
+	startmatchMode_t mode;
+	sbool bAnchored;
+	uchar *literal;			/* for STARTMATCH_LITERAL */
+	size_t lenLiteral;
+	int nElems;			/* for STARTMATCH_NFA */
+	uint64_t charMask[256];		/* bit i: element i accepts this char */
+	uint64_t repMask;		/* bit i: element i may repeat */
+	int nOpt;			/* number of optional elements */
+	int optIdx[STARTMATCH_MAX_ELEMS]; /* optional elements, ascending */
+	STATSCOUNTER_DEF(ctrLines, mutCtrLines)
+	STATSCOUNTER_DEF(ctrMatched, mutCtrMatched)
+	STATSCOUNTER_DEF(ctrRegexec, mutCtrRegexec)
+} startmatch_t;
+
+rsRetVal startmatchConstruct(startmatch_t **ppThis, const uchar *regex, char *errbuf, size_t lenErrbuf);
+void startmatchDestruct(startmatch_t **ppThis);
+int startmatchExec(startmatch_t *pThis, const uchar *line);
+const char *startmatchModeName(const startmatch_t *pThis);
+
+#endif /* #ifndef INCLUDED_STARTMATCH_H */
@@ -0,0 +1,681 @@
+/* The shared state store.
+ *
+ * The log file consists of records of the form
+ *    <op> <keylen> <vallen> <checksum>\n<key><value>\n
+ * where op is 'P' (put) or 'D' (delete) and checksum is the FNV-1a
+ * hash of op, key and value in hex. On load, the log is replayed into
+ * an in-memory hash table. A torn or otherwise invalid record ends the
+ * replay; the file is truncated at that point, so that later records
+ * are appended to valid data.
+ *
+ * Callers only update the hash table and append the record to a
+ * pending buffer. A background thread writes that buffer and fsync()s
+ * the log at most STATESTORE_COMMIT_INTERVAL ms after the first pending
+ * update (or earlier, if requested via statestoreSync()). After that,
+ * the log is compacted if it has become much larger than its live
+ * content: the live records are written to a temporary file, which then
+ * atomically replaces the log. If writing to the log fails, the torn
+ * record is cut off again and the log is rewritten the same way, so that
+ * it always contains the complete in-memory state.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "rsyslog.h"
+#include "errmsg.h"
+#include "srUtils.h"
+#include "hashtable.h"
+#include "hashtable_itr.h"
+#include "statestore.h"
+
+#define COMPACT_MIN_SIZE (64 * 1024)	/* do not bother compacting smaller logs */
+#define COMPACT_FACTOR 4		/* compact if log is this times larger than live data */
+#define PENDING_HIGH_WATER (256 * 1024)	/* commit early if that much data is pending */
+#define MAX_HDR_LEN 64
+
+typedef struct storeBuf_s {
+	char *buf;
+	size_t len;
+	size_t size;
+} storeBuf_t;
+
+typedef struct storeEntry_s {
+	char *val;
+	size_t lenVal;
+	size_t lenRec;	/* size of the put record in the log */
+} storeEntry_t;
+
+struct statestore_s {
+	statestore_t *next;
+	char *fn;
+	int nRefs;
+	int fd;
+	struct hashtable *ht;	/* key -> storeEntry_t */
+	pthread_mutex_t mut;
+	pthread_cond_t condWork;	/* something to do for the writer */
+	pthread_cond_t condCommitted;	/* writer has committed records */
+	pthread_t tid;
+	sbool bStop;
+	sbool bSyncReq;
+	sbool bNeedRewrite;	/* log lacks records due to a write error */
+	storeBuf_t pending;	/* records not yet written */
+	storeBuf_t spare;	/* buffer currently (or last) written by the writer */
+	uint64_t nQueued;	/* records queued so far */
+	uint64_t nCommitted;	/* records written and synced so far */
+	off_t sizeLog;
+	off_t sizeLive;		/* size the log would have if compacted */
+};
+
+static statestore_t *stores = NULL;	/* all currently open stores */
+static pthread_mutex_t mutStores = PTHREAD_MUTEX_INITIALIZER;
+
+
+static uint32_t
+recChecksum(const char op, const char *const key, const size_t lenKey,
+	const char *const val, const size_t lenVal)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	h = (h ^ (uchar) op) * 16777619u;
+	for(i = 0 ; i < lenKey ; ++i)
+		h = (h ^ (uchar) key[i]) * 16777619u;
+	h = (h ^ 0) * 16777619u;
+	for(i = 0 ; i < lenVal ; ++i)
+		h = (h ^ (uchar) val[i]) * 16777619u;
+	return h;
+}
+
+/* append a record to buf, returns its size in *pLenRec */
+static rsRetVal
+bufAddRecord(storeBuf_t *const buf, const char op, const char *const key,
+	const char *const val, const size_t lenVal, size_t *const pLenRec)
+{
+	const size_t lenKey = strlen(key);
+	char hdr[MAX_HDR_LEN];
+	int lenHdr;
+	size_t lenRec;
+	size_t newSize;
+	char *newBuf;
+	DEFiRet;
+
+	lenHdr = snprintf(hdr, sizeof(hdr), "%c %zu %zu %08" PRIx32 "\n", op, lenKey, lenVal,
+		recChecksum(op, key, lenKey, val, lenVal));
+	lenRec = lenHdr + lenKey + lenVal + 1;
+	if(buf->len + lenRec > buf->size) {
+		newSize = (buf->size == 0) ? 4096 : buf->size;
+		while(newSize < buf->len + lenRec)
+			newSize *= 2;
+		CHKmalloc(newBuf = realloc(buf->buf, newSize));
+		buf->buf = newBuf;
+		buf->size = newSize;
+	}
+	memcpy(buf->buf + buf->len, hdr, lenHdr);
+	memcpy(buf->buf + buf->len + lenHdr, key, lenKey);
+	memcpy(buf->buf + buf->len + lenHdr + lenKey, val, lenVal);
+	buf->buf[buf->len + lenRec - 1] = '\n';
+	buf->len += lenRec;
+	*pLenRec = lenRec;
+
+finalize_it:
+	RETiRet;
+}
+
+static int
+writeAll(const int fd, const char *buf, size_t len)
+{
+	ssize_t w;
+
+	while(len > 0) {
+		w = write(fd, buf, len);
+		if(w < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += w;
+		len -= w;
+	}
+	return 0;
+}
+
+static void
+entryDestruct(void *const pEntry)
+{
+	storeEntry_t *const entry = (storeEntry_t*) pEntry;
+
+	free(entry->val);
+	free(entry);
+}
+
+/* update the hash table with a put or delete. Caller must hold the mutex
+ * (or be the only one that knows the store).
+ */
+static rsRetVal
+applyRecord(statestore_t *const pThis, const char op, const char *const key,
+	const char *const val, const size_t lenVal, const size_t lenRec)
+{
+	storeEntry_t *entry;
+	char *newVal = NULL;
+	char *keyCopy = NULL;
+	DEFiRet;
+
+	if(op == 'D') {
+		if((entry = hashtable_remove(pThis->ht, (void*) key)) != NULL) {
+			pThis->sizeLive -= entry->lenRec;
+			entryDestruct(entry);
+		}
+		FINALIZE;
+	}
+
+	CHKmalloc(newVal = malloc(lenVal + 1));
+	memcpy(newVal, val, lenVal);
+	newVal[lenVal] = '\0';
+	if((entry = hashtable_search(pThis->ht, (void*) key)) != NULL) {
+		pThis->sizeLive -= entry->lenRec;
+		free(entry->val);
+	} else {
+		CHKmalloc(entry = calloc(1, sizeof(storeEntry_t)));
+		if((keyCopy = strdup(key)) == NULL || !hashtable_insert(pThis->ht, keyCopy, entry)) {
+			free(entry);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		keyCopy = NULL;
+	}
+	entry->val = newVal;
+	entry->lenVal = lenVal;
+	entry->lenRec = lenRec;
+	pThis->sizeLive += lenRec;
+	newVal = NULL;
+
+finalize_it:
+	free(newVal);
+	free(keyCopy);
+	RETiRet;
+}
+
+/* replay the log into the hash table */
+static rsRetVal
+loadLog(statestore_t *const pThis)
+{
+	struct stat st;
+	char *buf = NULL;
+	char *key = NULL;
+	char *eoh;
+	char op;
+	size_t lenKey, lenVal, lenHdr;
+	uint32_t checksum;
+	off_t offs = 0;
+	ssize_t r;
+	DEFiRet;
+
+	if(fstat(pThis->fd, &st) != 0) {
+		LogError(errno, RS_RET_IO_ERROR, "state store '%s': cannot stat log", pThis->fn);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	if(st.st_size == 0)
+		FINALIZE;
+
+	CHKmalloc(buf = malloc(st.st_size));
+	while(offs < st.st_size) {
+		r = pread(pThis->fd, buf + offs, st.st_size - offs, offs);
+		if(r <= 0) {
+			if(r < 0 && errno == EINTR)
+				continue;
+			LogError(errno, RS_RET_IO_ERROR, "state store '%s': cannot read log", pThis->fn);
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+		offs += r;
+	}
+
+	offs = 0;
+	while(offs < st.st_size) {
+		eoh = memchr(buf + offs, '\n', st.st_size - offs);
+		if(eoh == NULL || eoh - (buf + offs) >= MAX_HDR_LEN)
+			break;
+		*eoh = '\0';
+		if(sscanf(buf + offs, "%c %zu %zu %" SCNx32, &op, &lenKey, &lenVal, &checksum) != 4
+		   || (op != 'P' && op != 'D'))
+			break;
+		lenHdr = eoh - (buf + offs) + 1;
+		if(lenKey > (size_t) st.st_size || lenVal > (size_t) st.st_size
+		   || offs + lenHdr + lenKey + lenVal + 1 > (size_t) st.st_size
+		   || buf[offs + lenHdr + lenKey + lenVal] != '\n')
+			break;
+		const char *const pKey = buf + offs + lenHdr;
+		const char *const pVal = pKey + lenKey;
+		if(recChecksum(op, pKey, lenKey, pVal, lenVal) != checksum
+		   || memchr(pKey, '\0', lenKey) != NULL)
+			break;
+		CHKmalloc(key = malloc(lenKey + 1));
+		memcpy(key, pKey, lenKey);
+		key[lenKey] = '\0';
+		CHKiRet(applyRecord(pThis, op, key, pVal, lenVal, lenHdr + lenKey + lenVal + 1));
+		free(key);
+		key = NULL;
+		offs += lenHdr + lenKey + lenVal + 1;
+	}
+
+	if(offs < st.st_size) {
+		LogMsg(0, RS_RET_OK, LOG_WARNING, "state store '%s': ignoring %lld bytes of "
+			"incomplete or invalid data at end of log - probably from an "
+			"unclean shutdown", pThis->fn, (long long) (st.st_size - offs));
+		if(ftruncate(pThis->fd, offs) != 0) {
+			LogError(errno, RS_RET_IO_ERROR, "state store '%s': cannot truncate log",
+				pThis->fn);
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+	}
+	pThis->sizeLog = offs;
+
+finalize_it:
+	free(key);
+	free(buf);
+	RETiRet;
+}
+
+static void
+syncDir(const char *const fn)
+{
+	char dir[MAXFNAME];
+	const char *const slash = strrchr(fn, '/');
+	int fd;
+
+	if(slash == NULL) {
+		strcpy(dir, ".");
+	} else if(slash == fn) {
+		strcpy(dir, "/");
+	} else {
+		snprintf(dir, sizeof(dir), "%.*s", (int) (slash - fn), fn);
+	}
+	if((fd = open(dir, O_RDONLY | O_CLOEXEC)) >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+}
+
+/* write the live records into a new log and replace the current one
+ * with it. Must be called with the mutex held. It is only held to take a
+ * snapshot of the table and to swap the logs, not while the new log is
+ * written and synced, so that updates are not blocked by the I/O. Updates
+ * made in the meantime are still pending and go to the new log with the
+ * next commit. Only the writer thread (or the only user of the store)
+ * calls this, so nobody else touches the log while the mutex is released.
+ */
+static rsRetVal
+compactLog(statestore_t *const pThis)
+{
+	char tmpfn[MAXFNAME];
+	storeBuf_t buf = { NULL, 0, 0 };
+	struct hashtable_itr *itr = NULL;
+	storeEntry_t *entry;
+	size_t lenRec;
+	int fdTmp = -1;
+	int fdNew;
+	int bOK;
+	DEFiRet;
+
+	DBGPRINTF("state store '%s': compacting log, size %lld, live %lld\n", pThis->fn,
+		(long long) pThis->sizeLog, (long long) pThis->sizeLive);
+	if(hashtable_count(pThis->ht) > 0) {
+		itr = hashtable_iterator(pThis->ht);
+		do {
+			entry = (storeEntry_t*) hashtable_iterator_value(itr);
+			CHKiRet(bufAddRecord(&buf, 'P', (char*) hashtable_iterator_key(itr),
+				entry->val, entry->lenVal, &lenRec));
+		} while(hashtable_iterator_advance(itr));
+	}
+
+	pthread_mutex_unlock(&pThis->mut);
+	snprintf(tmpfn, sizeof(tmpfn), "%s.tmp", pThis->fn);
+	fdTmp = open(tmpfn, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOCTTY, 0600);
+	bOK = fdTmp >= 0 && writeAll(fdTmp, buf.buf, buf.len) == 0 && fsync(fdTmp) == 0;
+	if(!bOK) {
+		LogError(errno, RS_RET_IO_ERROR, "state store '%s': cannot write compacted "
+			"log '%s' - keeping the current one", pThis->fn, tmpfn);
+		if(fdTmp >= 0)
+			unlink(tmpfn);
+	}
+	pthread_mutex_lock(&pThis->mut);
+	if(!bOK)
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+
+	if(rename(tmpfn, pThis->fn) != 0) {
+		LogError(errno, RS_RET_IO_ERROR, "state store '%s': cannot replace log by "
+			"compacted log '%s'", pThis->fn, tmpfn);
+		unlink(tmpfn);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	syncDir(pThis->fn);
+	if((fdNew = open(pThis->fn, O_WRONLY | O_APPEND | O_CLOEXEC | O_NOCTTY)) < 0) {
+		/* very unlikely - keep writing to the (now unlinked) old log, we will
+		 * retry compaction on next commit.
+		 */
+		LogError(errno, RS_RET_IO_ERROR, "state store '%s': cannot reopen compacted log",
+			pThis->fn);
+		pThis->sizeLog = pThis->sizeLive * COMPACT_FACTOR + 1;
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	close(pThis->fd);
+	pThis->fd = fdNew;
+	pThis->sizeLog = buf.len;
+	pThis->bNeedRewrite = 0;
+
+finalize_it:
+	if(fdTmp >= 0)
+		close(fdTmp);
+	free(itr);
+	free(buf.buf);
+	RETiRet;
+}
+
+static int
+needCompaction(const statestore_t *const pThis)
+{
+	return pThis->sizeLog > COMPACT_MIN_SIZE && pThis->sizeLog > COMPACT_FACTOR * pThis->sizeLive;
+}
+
+/* write and sync all pending records. Must be called with the mutex held,
+ * which is released while doing the actual I/O. Only the writer thread calls
+ * this, so pThis->fd cannot change while we write to it.
+ */
+static void
+commitPending(statestore_t *const pThis)
+{
+	storeBuf_t buf = pThis->pending;
+	const uint64_t nQueued = pThis->nQueued;
+	const off_t sizeLog = pThis->sizeLog;
+	int bOK;
+
+	pThis->pending = pThis->spare;
+	pThis->bSyncReq = 0;
+	pthread_mutex_unlock(&pThis->mut);
+
+	bOK = writeAll(pThis->fd, buf.buf, buf.len) == 0 && fdatasync(pThis->fd) == 0;
+	if(!bOK) {
+		LogError(errno, RS_RET_IO_ERROR, "state store '%s': cannot write log - "
+			"will rewrite it", pThis->fn);
+		/* a torn record ends the replay on next startup, so all records
+		 * appended after it would be lost. Cut it off; the rewrite then
+		 * adds what is missing.
+		 */
+		if(ftruncate(pThis->fd, sizeLog) != 0) {
+			LogError(errno, RS_RET_IO_ERROR, "state store '%s': cannot truncate "
+				"log after write error", pThis->fn);
+		}
+	}
+
+	pthread_mutex_lock(&pThis->mut);
+	if(bOK)
+		pThis->sizeLog += buf.len;
+	else
+		pThis->bNeedRewrite = 1;
+	buf.len = 0;
+	pThis->spare = buf;
+	pThis->nCommitted = nQueued;
+	pthread_cond_broadcast(&pThis->condCommitted);
+}
+
+static void *
+writerThread(void *const arg)
+{
+	statestore_t *const pThis = (statestore_t*) arg;
+	struct timespec t;
+
+	pthread_mutex_lock(&pThis->mut);
+	while(1) {
+		while(pThis->pending.len == 0 && !pThis->bStop)
+			pthread_cond_wait(&pThis->condWork, &pThis->mut);
+		if(pThis->pending.len == 0)
+			break; /* we are requested to stop and everything is written */
+		/* group commit: give further updates a chance to join this commit */
+		timeoutComp(&t, STATESTORE_COMMIT_INTERVAL);
+		while(!pThis->bStop && !pThis->bSyncReq && pThis->pending.len < PENDING_HIGH_WATER) {
+			if(pthread_cond_timedwait(&pThis->condWork, &pThis->mut, &t) == ETIMEDOUT)
+				break;
+		}
+		commitPending(pThis);
+		if(pThis->bNeedRewrite || needCompaction(pThis))
+			compactLog(pThis);
+	}
+	pthread_mutex_unlock(&pThis->mut);
+	return NULL;
+}
+
+/* append a record to the pending buffer and update the hash table.
+ * Must be called with the mutex held.
+ */
+static rsRetVal
+queueRecord(statestore_t *const pThis, const char op, const char *const key,
+	const char *const val, const size_t lenVal)
+{
+	const size_t lenPending = pThis->pending.len;
+	size_t lenRec;
+	DEFiRet;
+
+	CHKiRet(bufAddRecord(&pThis->pending, op, key, val, lenVal, &lenRec));
+	iRet = applyRecord(pThis, op, key, val, lenVal, lenRec);
+	if(iRet != RS_RET_OK) {
+		pThis->pending.len = lenPending;
+		FINALIZE;
+	}
+	++pThis->nQueued;
+	if(lenPending == 0 || pThis->pending.len >= PENDING_HIGH_WATER)
+		pthread_cond_signal(&pThis->condWork);
+
+finalize_it:
+	RETiRet;
+}
+
+static void
+storeDestruct(statestore_t *const pThis)
+{
+	if(pThis->ht != NULL)
+		hashtable_destroy(pThis->ht, 1);
+	if(pThis->fd != -1)
+		close(pThis->fd);
+	free(pThis->pending.buf);
+	free(pThis->spare.buf);
+	free(pThis->fn);
+	free(pThis);
+}
+
+/* open the store with the given file name. If it is already open, the
+ * existing instance is shared.
+ */
+rsRetVal
+statestoreOpen(statestore_t **const ppThis, const char *const fn)
+{
+	statestore_t *pThis;
+	int bMutInit = 0;
+	DEFiRet;
+
+	pthread_mutex_lock(&mutStores);
+	for(pThis = stores ; pThis != NULL ; pThis = pThis->next) {
+		if(!strcmp(pThis->fn, fn)) {
+			++pThis->nRefs;
+			FINALIZE;
+		}
+	}
+
+	CHKmalloc(pThis = calloc(1, sizeof(statestore_t)));
+	pThis->fd = -1;
+	pThis->nRefs = 1;
+	CHKmalloc(pThis->fn = strdup(fn));
+	CHKmalloc(pThis->ht = create_hashtable(64, hash_from_string, key_equals_string, entryDestruct));
+	pThis->fd = open(fn, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC | O_NOCTTY, 0600);
+	if(pThis->fd < 0) {
+		LogError(errno, RS_RET_IO_ERROR, "state store: cannot open log '%s'", fn);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	pthread_mutex_init(&pThis->mut, NULL);
+	pthread_cond_init(&pThis->condWork, NULL);
+	pthread_cond_init(&pThis->condCommitted, NULL);
+	bMutInit = 1;
+	CHKiRet(loadLog(pThis));
+	if(needCompaction(pThis)) {
+		pthread_mutex_lock(&pThis->mut);
+		compactLog(pThis);
+		pthread_mutex_unlock(&pThis->mut);
+	}
+	DBGPRINTF("state store '%s' opened, %u entries, log size %lld\n", fn,
+		hashtable_count(pThis->ht), (long long) pThis->sizeLog);
+
+	if(pthread_create(&pThis->tid, NULL, writerThread, pThis) != 0) {
+		LogError(errno, RS_RET_ERR, "state store '%s': cannot create writer thread", fn);
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	pThis->next = stores;
+	stores = pThis;
+
+finalize_it:
+	pthread_mutex_unlock(&mutStores);
+	if(iRet == RS_RET_OK) {
+		*ppThis = pThis;
+	} else if(pThis != NULL) {
+		if(bMutInit) {
+			pthread_mutex_destroy(&pThis->mut);
+			pthread_cond_destroy(&pThis->condWork);
+			pthread_cond_destroy(&pThis->condCommitted);
+		}
+		storeDestruct(pThis);
+	}
+	RETiRet;
+}
+
+/* release a store. The last user writes all pending updates and closes it. */
+void
+statestoreClose(statestore_t **const ppThis)
+{
+	statestore_t *const pThis = *ppThis;
+	statestore_t **ppPrev;
+
+	if(pThis == NULL)
+		return;
+	*ppThis = NULL;
+
+	pthread_mutex_lock(&mutStores);
+	if(--pThis->nRefs > 0) {
+		pthread_mutex_unlock(&mutStores);
+		return;
+	}
+	for(ppPrev = &stores ; *ppPrev != pThis ; ppPrev = &(*ppPrev)->next)
+		/* just search */;
+	*ppPrev = pThis->next;
+	pthread_mutex_unlock(&mutStores);
+
+	pthread_mutex_lock(&pThis->mut);
+	pThis->bStop = 1;
+	pthread_cond_signal(&pThis->condWork);
+	pthread_mutex_unlock(&pThis->mut);
+	pthread_join(pThis->tid, NULL);
+
+	pthread_mutex_lock(&pThis->mut);
+	if(needCompaction(pThis))
+		compactLog(pThis);
+	pthread_mutex_unlock(&pThis->mut);
+	pthread_mutex_destroy(&pThis->mut);
+	pthread_cond_destroy(&pThis->condWork);
+	pthread_cond_destroy(&pThis->condCommitted);
+	storeDestruct(pThis);
+}
+
+/* get a copy of the value for key, which the caller must free. Returns
+ * RS_RET_NOT_FOUND if there is no such key.
+ */
+rsRetVal
+statestoreGet(statestore_t *const pThis, const char *const key, char **const pVal)
+{
+	storeEntry_t *entry;
+	DEFiRet;
+
+	pthread_mutex_lock(&pThis->mut);
+	if((entry = hashtable_search(pThis->ht, (void*) key)) == NULL)
+		ABORT_FINALIZE(RS_RET_NOT_FOUND);
+	CHKmalloc(*pVal = malloc(entry->lenVal + 1));
+	memcpy(*pVal, entry->val, entry->lenVal + 1);
+
+finalize_it:
+	pthread_mutex_unlock(&pThis->mut);
+	RETiRet;
+}
+
+/* set key to val. Unchanged values are not written again. The update
+ * is durable after the next commit, see statestoreSync().
+ */
+rsRetVal
+statestorePut(statestore_t *const pThis, const char *const key, const char *const val)
+{
+	const size_t lenVal = strlen(val);
+	storeEntry_t *entry;
+	DEFiRet;
+
+	pthread_mutex_lock(&pThis->mut);
+	entry = hashtable_search(pThis->ht, (void*) key);
+	if(entry != NULL && entry->lenVal == lenVal && !memcmp(entry->val, val, lenVal))
+		FINALIZE;
+	CHKiRet(queueRecord(pThis, 'P', key, val, lenVal));
+
+finalize_it:
+	pthread_mutex_unlock(&pThis->mut);
+	RETiRet;
+}
+
+rsRetVal
+statestoreDel(statestore_t *const pThis, const char *const key)
+{
+	DEFiRet;
+
+	pthread_mutex_lock(&pThis->mut);
+	if(hashtable_search(pThis->ht, (void*) key) == NULL)
+		FINALIZE;
+	CHKiRet(queueRecord(pThis, 'D', key, "", 0));
+
+finalize_it:
+	pthread_mutex_unlock(&pThis->mut);
+	RETiRet;
+}
+
+/* wait until all updates done so far are written and synced */
+rsRetVal
+statestoreSync(statestore_t *const pThis)
+{
+	uint64_t nTarget;
+
+	pthread_mutex_lock(&pThis->mut);
+	nTarget = pThis->nQueued;
+	if(pThis->nCommitted < nTarget) {
+		pThis->bSyncReq = 1;
+		pthread_cond_signal(&pThis->condWork);
+		while(pThis->nCommitted < nTarget)
+			pthread_cond_wait(&pThis->condCommitted, &pThis->mut);
+	}
+	pthread_mutex_unlock(&pThis->mut);
+	return RS_RET_OK;
+}
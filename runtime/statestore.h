@@ -0,0 +1,43 @@
+/* Definitions for the shared state store.
+ *
+ * The state store keeps small key/value records (e.g. file offsets or
+ * journal cursors of input modules) in a single append-only log file.
+ * Updates are collected in memory and written as well as fsync()ed by a
+ * background thread, so many updates share a single commit. The log is
+ * compacted once it has grown well beyond its live content. All stores
+ * with the same file name share a single instance, so several modules
+ * may use the same log.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_STATESTORE_H
+#define INCLUDED_STATESTORE_H
+
+#define STATESTORE_COMMIT_INTERVAL 1000	/* max ms between update and fsync() */
+
+typedef struct statestore_s statestore_t;
+
+rsRetVal statestoreOpen(statestore_t **ppThis, const char *fn);
+void statestoreClose(statestore_t **ppThis);
+rsRetVal statestoreGet(statestore_t *pThis, const char *key, char **pVal);
+rsRetVal statestorePut(statestore_t *pThis, const char *key, const char *val);
+rsRetVal statestoreDel(statestore_t *pThis, const char *key);
+rsRetVal statestoreSync(statestore_t *pThis);
+
+#endif /* #ifndef INCLUDED_STATESTORE_H */
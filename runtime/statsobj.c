@@ -126,6 +126,7 @@ BEGINobjConstruct(statsobj) /* be sure to specify the object type also in END ma
 	pThis->ctrLast = NULL;
 	pThis->ctrRoot = NULL;
 	pThis->read_notifier = NULL;
+	pThis->pre_read_notifier = NULL;
 	pThis->flags = 0;
 ENDobjConstruct(statsobj)
 
@@ -152,6 +153,19 @@ setReadNotifier(statsobj_t *pThis, statsobj_read_notifier_t notifier, void* ctx)
 	RETiRet;
 }
 
+/* set pre_read_notifier (a function which is invoked before stats are read).
+ * This permits counter providers to bring their counters up to date, e.g.
+ * by folding in values that were buffered outside of the counter itself.
+ */
+static rsRetVal
+setPreReadNotifier(statsobj_t *pThis, statsobj_read_notifier_t notifier, void* ctx)
+{
+	DEFiRet;
+	pThis->pre_read_notifier = notifier;
+	pThis->pre_read_notifier_ctx = ctx;
+	RETiRet;
+}
+
 
 /* set origin (module name, etc).
  * Note that we make our own copy of the memory, caller is
@@ -529,6 +543,9 @@ getAllStatsLines(rsRetVal(*cb)(void*, const char*), void *const usrptr, statsFmt
 	DEFiRet;
 
 	for(o = objRoot ; o != NULL ; o = o->next) {
+		if (o->pre_read_notifier != NULL) {
+			o->pre_read_notifier(o, o->pre_read_notifier_ctx);
+		}
 		switch(fmt) {
 		case statsFmt_Legacy:
 			CHKiRet(getStatsLine(o, &cstr, bResetCtrs));
@@ -714,6 +731,7 @@ CODESTARTobjQueryInterface(statsobj)
 	pIf->SetName = setName;
 	pIf->SetOrigin = setOrigin;
 	pIf->SetReadNotifier = setReadNotifier;
+	pIf->SetPreReadNotifier = setPreReadNotifier;
 	pIf->SetReportingNamespace = setReportingNamespace;
 	pIf->SetStatsObjFlags = setStatsObjFlags;
 	pIf->GetAllStatsLines = getAllStatsLines;
@@ -768,6 +768,55 @@ static rsRetVal strmUnreadChar(strm_t *pThis, uchar c)
 	return RS_RET_OK;
 }
 
+/* read everything up to the next LF and append it to pCStr. The LF itself
+ * is consumed, but not appended. This does the same as calling strmReadChar()
+ * for each character, but searches the stream buffer via memchr() and copies
+ * whole runs at once. On error (most importantly EOF), everything read so far
+ * has been appended to pCStr.
+ */
+static rsRetVal
+strmReadToLF(strm_t *const pThis, cstr_t *const pCStr)
+{
+	int padBytes;
+	uchar *pLF;
+	size_t lenAvail;
+	size_t len;
+	DEFiRet;
+
+	if(pThis->iUngetC != -1) {
+		const uchar c = pThis->iUngetC;
+		pThis->iUngetC = -1;
+		++pThis->iCurrOffs;
+		if(c == '\n')
+			FINALIZE;
+		CHKiRet(cstrAppendChar(pCStr, c));
+	}
+
+	while(1) {
+		if(pThis->iBufPtr >= pThis->iBufPtrMax) {
+			padBytes = 0;
+			CHKiRet(strmReadBuf(pThis, &padBytes));
+			pThis->iCurrOffs += padBytes;
+		}
+		lenAvail = pThis->iBufPtrMax - pThis->iBufPtr;
+		pLF = memchr(pThis->pIOBuf + pThis->iBufPtr, '\n', lenAvail);
+		len = (pLF == NULL) ? lenAvail : (size_t) (pLF - (pThis->pIOBuf + pThis->iBufPtr));
+		if(len > 0) {
+			CHKiRet(rsCStrAppendStrWithLen(pCStr, pThis->pIOBuf + pThis->iBufPtr, len));
+			pThis->iBufPtr += len;
+			pThis->iCurrOffs += len;
+		}
+		if(pLF != NULL) {
+			++pThis->iBufPtr;
+			++pThis->iCurrOffs;
+			break;
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
 /* read a 'paragraph' from a strm file.
  * A paragraph may be terminated by a LF, by a LFLF, or by LF<not whitespace> depending on the option set.
  * The termination LF characters are read, but are
@@ -803,10 +852,10 @@ strmReadLine(strm_t *pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF,
 		cstrDestruct(&pThis->prevLineSegment);
 	}
         if(mode == 0) {
-		while(c != '\n') {
+		if(c != '\n') {
 			CHKiRet(cstrAppendChar(*ppCStr, c));
-			CHKiRet(strmReadChar(pThis, &c));
-        	}
+			CHKiRet(strmReadToLF(pThis, *ppCStr));
+		}
 		if (trimLineOverBytes > 0 && (uint32_t) cstrLen(*ppCStr) > trimLineOverBytes) {
 			/* Truncate long line at trimLineOverBytes position */
 			dbgprintf("Truncate long line at %u, mode %d\n", trimLineOverBytes, mode);
@@ -818,9 +867,11 @@ strmReadLine(strm_t *pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF,
 		finished=0;
 		while(finished == 0){
         		if(c != '\n') {
+				/* take the rest of the line at once, then process its LF */
                 		CHKiRet(cstrAppendChar(*ppCStr, c));
-                		CHKiRet(strmReadChar(pThis, &c));
 				pThis->bPrevWasNL = 0;
+				CHKiRet(strmReadToLF(pThis, *ppCStr));
+				c = '\n';
 			} else {
 				if ((((*ppCStr)->iStrLen) > 0) ){
 					if(pThis->bPrevWasNL) {
@@ -849,44 +900,32 @@ strmReadLine(strm_t *pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF,
 		/* indented follow-up lines */
 		finished=0;
 		while(finished == 0){
-			if ((*ppCStr)->iStrLen == 0){
-        			if(c != '\n') {
-				/* nothing in the buffer, and it's not a newline, add it to the buffer */
-               				CHKiRet(cstrAppendChar(*ppCStr, c));
-               				CHKiRet(strmReadChar(pThis, &c));
-				} else {
-					finished=1;  /* this is a blank line, a \n with nothing since the
-							last complete record */
-				}
+			if((*ppCStr)->iStrLen == 0 && c == '\n') {
+				finished=1;  /* this is a blank line, a \n with nothing since the
+						last complete record */
+			} else if((*ppCStr)->iStrLen > 0 && pThis->bPrevWasNL && c != ' ' && c != '\t') {
+				/* clean things up by putting the character we just read back into
+				 * the input buffer and removing the LF character that is
+				 * currently at the
+				 * end of the output string */
+				CHKiRet(strmUnreadChar(pThis, c));
+				rsCStrTruncate(*ppCStr, (bEscapeLF) ? 4 : 1);
+				finished=1;
 			} else {
-				if(pThis->bPrevWasNL) {
-					if ((c == ' ') || (c == '\t')){
-               					CHKiRet(cstrAppendChar(*ppCStr, c));
-               					CHKiRet(strmReadChar(pThis, &c));
-						pThis->bPrevWasNL = 0;
-					} else {
-						/* clean things up by putting the character we just read back into
-						 * the input buffer and removing the LF character that is
-						 * currently at the
-						 * end of the output string */
-						CHKiRet(strmUnreadChar(pThis, c));
-						rsCStrTruncate(*ppCStr, (bEscapeLF) ? 4 : 1);
-						finished=1;
-					}
-				} else { /* not the first character after a newline, add it to the buffer */
-					if(c == '\n') {
-						pThis->bPrevWasNL = 1;
-						if(bEscapeLF) {
-							CHKiRet(rsCStrAppendStrWithLen(*ppCStr, (uchar*)"#012",
-							sizeof("#012")-1));
-						} else {
-							CHKiRet(cstrAppendChar(*ppCStr, c));
-						}
-					} else {
-						CHKiRet(cstrAppendChar(*ppCStr, c));
-					}
-               				CHKiRet(strmReadChar(pThis, &c));
+				/* start or continuation of the entry - take the rest of the line at once */
+				if(c != '\n') {
+					CHKiRet(cstrAppendChar(*ppCStr, c));
+					pThis->bPrevWasNL = 0;
+					CHKiRet(strmReadToLF(pThis, *ppCStr));
+				}
+				pThis->bPrevWasNL = 1;
+				if(bEscapeLF) {
+					CHKiRet(rsCStrAppendStrWithLen(*ppCStr, (uchar*)"#012",
+					sizeof("#012")-1));
+				} else {
+					CHKiRet(cstrAppendChar(*ppCStr, '\n'));
 				}
+				CHKiRet(strmReadChar(pThis, &c));
 			}
 		}
 		if (trimLineOverBytes > 0 && (uint32_t) cstrLen(*ppCStr) > trimLineOverBytes) {
@@ -943,11 +982,11 @@ strmReadMultiLine_isTimedOut(const strm_t *const __restrict__ pThis)
 /* read a multi-line message from a strm file.
  * The multi-line message is terminated based on the user-provided
  * startRegex (Posix ERE). For performance reasons, the regex
- * must already have been compiled by the user.
+ * must already have been compiled by the user into a start matcher.
  * added 2015-05-12 rgerhards
  */
 rsRetVal
-strmReadMultiLine(strm_t *pThis, cstr_t **ppCStr, regex_t *preg, const sbool bEscapeLF,
+strmReadMultiLine(strm_t *pThis, cstr_t **ppCStr, startmatch_t *pStartMatch, const sbool bEscapeLF,
 	const sbool discardTruncatedMsg, const sbool msgDiscardingError, int64 *const strtOffs)
 {
         uchar c;
@@ -968,9 +1007,9 @@ strmReadMultiLine(strm_t *pThis, cstr_t **ppCStr, regex_t *preg, const sbool bEs
 			cstrDestruct(&pThis->prevLineSegment);
 		}
 
-		while(c != '\n') {
+		if(c != '\n') {
 			CHKiRet(cstrAppendChar(thisLine, c));
-			readCharRet = strmReadChar(pThis, &c);
+			readCharRet = strmReadToLF(pThis, thisLine);
 			if(readCharRet == RS_RET_EOF) {/* end of file reached without \n? */
 				CHKiRet(rsCStrConstructFromCStr(&pThis->prevLineSegment, thisLine));
 			}
@@ -979,7 +1018,7 @@ strmReadMultiLine(strm_t *pThis, cstr_t **ppCStr, regex_t *preg, const sbool bEs
 		cstrFinalize(thisLine);
 
 		/* we have a line, now let's assemble the message */
-		const int isMatch = !regexec(preg, (char*)rsCStrGetSzStrNoNULL(thisLine), 0, NULL, 0);
+		const int isMatch = startmatchExec(pStartMatch, rsCStrGetSzStrNoNULL(thisLine));
 
 		if(isMatch) {
 			/* in this case, the *previous* message is complete and we are
@@ -1016,9 +1055,9 @@ strmReadMultiLine(strm_t *pThis, cstr_t **ppCStr, regex_t *preg, const sbool bEs
 							/* we could do this faster, but for now keep it simple */
 						} else {
 							len = currLineLen-(len-maxMsgSize);
-							for(int z=0; z<len; z++) {
-								cstrAppendChar(pThis->prevMsgSegment,
-								thisLine->pBuf[z]);
+							if(len > 0) {
+								CHKiRet(rsCStrAppendStrWithLen(pThis->prevMsgSegment,
+									thisLine->pBuf, len));
 							}
 							finished = 1;
 							*ppCStr = pThis->prevMsgSegment;
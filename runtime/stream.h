@@ -65,7 +65,6 @@
 #ifndef STREAM_H_INCLUDED
 #define STREAM_H_INCLUDED
 
-#include <regex.h> // TODO: fix via own module
 #include <pthread.h>
 #include <stdint.h>
 #include <time.h>
@@ -73,6 +72,7 @@
 #include "glbl.h"
 #include "stream.h"
 #include "zlibw.h"
+#include "startmatch.h"
 #include "cryprov.h"
 
 /* stream types */
@@ -225,7 +225,7 @@ ENDinterface(strm)
 /* prototypes */
 PROTOTYPEObjClassInit(strm);
 rsRetVal strmMultiFileSeek(strm_t *pThis, unsigned int fileNum, off64_t offs, off64_t *bytesDel);
-rsRetVal strmReadMultiLine(strm_t *pThis, cstr_t **ppCStr, regex_t *preg,
+rsRetVal strmReadMultiLine(strm_t *pThis, cstr_t **ppCStr, startmatch_t *pStartMatch,
 	sbool bEscapeLF, sbool discardTruncatedMsg, sbool msgDiscardingError, int64 *const strtOffs);
 int strmReadMultiLine_isTimedOut(const strm_t *const __restrict__ pThis);
 void strmDebugOutBuf(const strm_t *const pThis);
@@ -130,6 +130,8 @@ typedef struct actWrkrIParams actWrkrIParams_t;
 typedef struct dynstats_bucket_s dynstats_bucket_t;
 typedef struct dynstats_buckets_s dynstats_buckets_t;
 typedef struct dynstats_ctr_s dynstats_ctr_t;
+typedef struct dynstats_shard_s dynstats_shard_t;
+typedef struct lazyjson_s lazyjson_t;
 
 /* under Solaris (actually only SPARC), we need to redefine some types
  * to be void, so that we get void* pointers. Otherwise, we will see
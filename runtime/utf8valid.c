@@ -0,0 +1,427 @@
+/* The UTF-8 validator.
+ *
+ * Most messages are pure ASCII or already valid UTF-8, so what really
+ * matters is how fast we can confirm that. The SIMD implementations
+ * follow the lookup table approach by Keiser and Lemire ("Validating
+ * UTF-8 In Less Than One Instruction Per Byte", also used by simdjson
+ * and simdutf): every byte is classified by three nibble table lookups
+ * on itself and its predecessor, which flags all invalid two-byte
+ * combinations at once. A second check verifies that the third and
+ * fourth byte of longer sequences are continuation bytes. Blocks of
+ * pure ASCII are skipped with a single compare and the last partial
+ * block is checked in a zero-padded copy. Once an error is detected
+ * somewhere in a block, we fall back to the bytewise check from the
+ * start of the last character before that block in order to find the
+ * exact position.
+ *
+ * The tables are adjusted to what mmutf8fix has always accepted, that
+ * is we do not flag overlong 3- and 4-byte forms and surrogates.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdint.h>
+#include <string.h>
+#include "utf8valid.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+	&& (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+	/* older compilers do not permit SSSE3/AVX2 intrinsics outside of -m<isa> units */
+#	define UTF8VALID_HAVE_SIMD 1
+#	include <immintrin.h>
+#endif
+
+#define BCAST(c) (UINT64_C(0x0101010101010101) * (uint8_t) (c))
+
+/* return the length of the valid multibyte sequence starting at p,
+ * or 0 if it is invalid or incomplete. p[0] must be >= 0x80.
+ */
+static inline size_t
+mbSeqLen(const unsigned char *const p, const size_t len)
+{
+	size_t n;
+	size_t i;
+
+	if(p[0] < 0xc2)		/* continuation byte or overlong 2-byte form */
+		return 0;
+	else if(p[0] < 0xe0)
+		n = 2;
+	else if(p[0] < 0xf0)
+		n = 3;
+	else if(p[0] < 0xf5)
+		n = 4;
+	else			/* > U+13FFFF, 5&6 byte forms forbidden by RFC3629 */
+		return 0;
+
+	if(n > len)
+		return 0;
+	for(i = 1 ; i < n ; ++i) {
+		if((p[i] & 0xc0) != 0x80)
+			return 0;
+	}
+	if(p[0] == 0xf4 && p[1] >= 0x90)	/* > U+10FFFF */
+		return 0;
+	return n;
+}
+
+static size_t
+validPrefixGeneric(const unsigned char *const buf, const size_t len)
+{
+	uint64_t w;
+	size_t i = 0;
+	size_t n;
+
+	while(i < len) {
+		if(i + 8 <= len) {
+			memcpy(&w, buf + i, sizeof(w));
+			if((w & BCAST(0x80)) == 0) {
+				i += 8;
+				continue;
+			}
+		}
+		if(buf[i] < 0x80) {
+			++i;
+		} else if((n = mbSeqLen(buf + i, len - i)) == 0) {
+			return i;
+		} else {
+			i += n;
+		}
+	}
+	return len;
+}
+
+static int
+supportedAlways(void)
+{
+	return 1;
+}
+
+#ifdef UTF8VALID_HAVE_SIMD
+/* error classes for a pair of (previous, current) byte. Each table
+ * sets the classes possible for the respective nibble, so an error is
+ * present if a bit survives AND-ing all three lookups.
+ */
+#define TOO_SHORT	0x01	/* lead byte not followed by continuation */
+#define TOO_LONG	0x02	/* ASCII followed by continuation */
+#define TOO_LARGE	0x08	/* 0xf4 0x90.., 0xf5.. 0x90.. (> U+10FFFF) */
+#define OVERLONG_2	0x20	/* 0xc0/0xc1 lead */
+#define TOO_LARGE_1000	0x40	/* 0xf5.. 0x80.. (> U+10FFFF) */
+#define TWO_CONTS	0x80	/* two continuation bytes - checked separately */
+#define CARRY		(TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+static const uint8_t tblPrevHigh[16] = {
+	/* 0_______ ASCII */
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+	/* 10______ continuation */
+	TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+	/* 1100____ */
+	TOO_SHORT | OVERLONG_2,
+	/* 1101____ */
+	TOO_SHORT,
+	/* 1110____ */
+	TOO_SHORT,
+	/* 1111____ */
+	TOO_SHORT | TOO_LARGE | TOO_LARGE_1000
+};
+static const uint8_t tblPrevLow[16] = {
+	/* ____000_ */
+	CARRY | OVERLONG_2, CARRY | OVERLONG_2,
+	/* ____001_ */
+	CARRY, CARRY,
+	/* ____0100 */
+	CARRY | TOO_LARGE,
+	/* ____0101 ... ____1111 */
+	CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000
+};
+static const uint8_t tblCurrHigh[16] = {
+	/* 0_______ ASCII */
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+	/* 1000____ */
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | TOO_LARGE_1000,
+	/* 1001____ */
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | TOO_LARGE,
+	/* 101_____ */
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | TOO_LARGE,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | TOO_LARGE,
+	/* 11______ lead */
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+};
+
+/* a sequence is incomplete at the end of a vector if one of the last
+ * three bytes is a lead byte that needs more bytes than are left.
+ */
+static const uint8_t maxComplete[32] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1
+};
+
+/* the error check may only tell us that something is wrong inside a
+ * block. Everything before the block is known to be valid, except that
+ * it may end with an incomplete sequence. So we restart at the last
+ * lead byte in front of the block, if there is one.
+ */
+static size_t
+finishBytewise(const unsigned char *const buf, const size_t len, const size_t i)
+{
+	size_t j;
+	size_t strt = i;
+
+	for(j = i ; j > 0 && i - j < 3 ; --j) {
+		if(buf[j - 1] < 0x80)
+			break;
+		if(buf[j - 1] >= 0xc0) {
+			strt = j - 1;
+			break;
+		}
+	}
+	return strt + validPrefixGeneric(buf + strt, len - strt);
+}
+
+static inline __attribute__((target("ssse3"))) __m128i
+checkSSSE3(const __m128i in, const __m128i prev)
+{
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+	const __m128i prev2 = _mm_alignr_epi8(in, prev, 14);
+	const __m128i prev3 = _mm_alignr_epi8(in, prev, 13);
+	__m128i sc;
+	__m128i must23;
+
+	sc = _mm_and_si128(
+		_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) tblPrevHigh),
+			_mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+		_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) tblPrevLow),
+			_mm_and_si128(prev1, nibble)));
+	sc = _mm_and_si128(sc,
+		_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) tblCurrHigh),
+			_mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+	/* only 111_____ resp. 1111____ end up >= 0x80 */
+	must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(0xe0 - 0x80)),
+			      _mm_subs_epu8(prev3, _mm_set1_epi8(0xf0 - 0x80)));
+	must23 = _mm_and_si128(must23, _mm_set1_epi8((char) 0x80));
+	return _mm_xor_si128(must23, sc);
+}
+
+/* check a 64 byte block, returns non-zero if an error was found */
+static inline __attribute__((target("ssse3"))) int
+blockErrSSSE3(const unsigned char *const p, __m128i *const prev, __m128i *const incompl)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i v0 = _mm_loadu_si128((const __m128i*) p);
+	const __m128i v1 = _mm_loadu_si128((const __m128i*) (p + 16));
+	const __m128i v2 = _mm_loadu_si128((const __m128i*) (p + 32));
+	const __m128i v3 = _mm_loadu_si128((const __m128i*) (p + 48));
+	__m128i err;
+
+	if(_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(v0, v1), _mm_or_si128(v2, v3))) == 0) {
+		err = *incompl;
+		*incompl = zero;
+	} else {
+		err = _mm_or_si128(_mm_or_si128(checkSSSE3(v0, *prev), checkSSSE3(v1, v0)),
+				   _mm_or_si128(checkSSSE3(v2, v1), checkSSSE3(v3, v2)));
+		*incompl = _mm_subs_epu8(v3, _mm_loadu_si128((const __m128i*) (maxComplete + 16)));
+	}
+	*prev = v3;
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(err, zero)) != 0xffff;
+}
+
+static __attribute__((target("ssse3"))) size_t
+validPrefixSSSE3(const unsigned char *const buf, const size_t len)
+{
+	unsigned char tail[64];
+	__m128i prev = _mm_setzero_si128();
+	__m128i incompl = _mm_setzero_si128();
+	size_t i;
+
+	for(i = 0 ; i + 64 <= len ; i += 64) {
+		if(blockErrSSSE3(buf + i, &prev, &incompl))
+			return finishBytewise(buf, len, i);
+	}
+	/* zero padding is ASCII, so an incomplete sequence at the end
+	 * of the buffer is flagged like any other error.
+	 */
+	if(i < len) {
+		memset(tail, 0, sizeof(tail));
+		memcpy(tail, buf + i, len - i);
+		if(blockErrSSSE3(tail, &prev, &incompl))
+			return finishBytewise(buf, len, i);
+	} else if(_mm_movemask_epi8(_mm_cmpeq_epi8(incompl, _mm_setzero_si128())) != 0xffff) {
+		return finishBytewise(buf, len, i);
+	}
+	return len;
+}
+
+static int
+supportedSSSE3(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("ssse3");
+}
+
+static inline __attribute__((target("avx2"))) __m256i
+checkAVX2(const __m256i in, const __m256i prev)
+{
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	const __m256i shifted = _mm256_permute2x128_si256(prev, in, 0x21);
+	const __m256i prev1 = _mm256_alignr_epi8(in, shifted, 15);
+	const __m256i prev2 = _mm256_alignr_epi8(in, shifted, 14);
+	const __m256i prev3 = _mm256_alignr_epi8(in, shifted, 13);
+	__m256i sc;
+	__m256i must23;
+
+	sc = _mm256_and_si256(
+		_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+			_mm_loadu_si128((const __m128i*) tblPrevHigh)),
+			_mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+		_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+			_mm_loadu_si128((const __m128i*) tblPrevLow)),
+			_mm256_and_si256(prev1, nibble)));
+	sc = _mm256_and_si256(sc,
+		_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+			_mm_loadu_si128((const __m128i*) tblCurrHigh)),
+			_mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+	must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8(0xe0 - 0x80)),
+				 _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xf0 - 0x80)));
+	must23 = _mm256_and_si256(must23, _mm256_set1_epi8((char) 0x80));
+	return _mm256_xor_si256(must23, sc);
+}
+
+static inline __attribute__((target("avx2"))) int
+blockErrAVX2(const unsigned char *const p, __m256i *const prev, __m256i *const incompl)
+{
+	const __m256i v0 = _mm256_loadu_si256((const __m256i*) p);
+	const __m256i v1 = _mm256_loadu_si256((const __m256i*) (p + 32));
+	__m256i err;
+
+	if(_mm256_movemask_epi8(_mm256_or_si256(v0, v1)) == 0) {
+		err = *incompl;
+		*incompl = _mm256_setzero_si256();
+	} else {
+		err = _mm256_or_si256(checkAVX2(v0, *prev), checkAVX2(v1, v0));
+		*incompl = _mm256_subs_epu8(v1, _mm256_loadu_si256((const __m256i*) maxComplete));
+	}
+	*prev = v1;
+	return !_mm256_testz_si256(err, err);
+}
+
+static __attribute__((target("avx2"))) size_t
+validPrefixAVX2(const unsigned char *const buf, const size_t len)
+{
+	unsigned char tail[64];
+	__m256i prev = _mm256_setzero_si256();
+	__m256i incompl = _mm256_setzero_si256();
+	size_t i;
+
+	for(i = 0 ; i + 64 <= len ; i += 64) {
+		if(blockErrAVX2(buf + i, &prev, &incompl))
+			return finishBytewise(buf, len, i);
+	}
+	if(i < len) {
+		memset(tail, 0, sizeof(tail));
+		memcpy(tail, buf + i, len - i);
+		if(blockErrAVX2(tail, &prev, &incompl))
+			return finishBytewise(buf, len, i);
+	} else if(!_mm256_testz_si256(incompl, incompl)) {
+		return finishBytewise(buf, len, i);
+	}
+	return len;
+}
+
+static int
+supportedAVX2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+#endif /* #ifdef UTF8VALID_HAVE_SIMD */
+
+
+static const struct utf8validImpl_s {
+	const char *name;
+	int (*isSupported)(void);
+	size_t (*validPrefix)(const unsigned char *buf, size_t len);
+} impls[] = {	/* in order of preference */
+#ifdef UTF8VALID_HAVE_SIMD
+	{ "avx2", supportedAVX2, validPrefixAVX2 },
+	{ "ssse3", supportedSSSE3, validPrefixSSSE3 },
+#endif
+	{ "generic", supportedAlways, validPrefixGeneric }
+};
+#define NUM_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+/* the generic version is always correct, so we can use it
+ * until utf8validInit() has been called.
+ */
+static const struct utf8validImpl_s *currImpl = &impls[NUM_IMPLS - 1];
+
+
+size_t
+utf8validPrefix(const unsigned char *const buf, const size_t len)
+{
+	return currImpl->validPrefix(buf, len);
+}
+
+const char *
+utf8validImplName(void)
+{
+	return currImpl->name;
+}
+
+/* select a specific implementation by name. This is primarily meant
+ * for the testbench and benchmarking. Returns 0 on success, -1 if the
+ * implementation is not available on this system.
+ */
+int
+utf8validSelectImpl(const char *const name)
+{
+	size_t i;
+
+	for(i = 0 ; i < NUM_IMPLS ; ++i) {
+		if(!strcmp(impls[i].name, name)) {
+			if(!impls[i].isSupported())
+				return -1;
+			currImpl = &impls[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* select the best implementation for the current CPU. Must be called
+ * before any worker threads are started.
+ */
+void
+utf8validInit(void)
+{
+	size_t i;
+
+	for(i = 0 ; i < NUM_IMPLS ; ++i) {
+		if(impls[i].isSupported()) {
+			currImpl = &impls[i];
+			break;
+		}
+	}
+}
@@ -0,0 +1,45 @@
+/* Definitions for the UTF-8 validator.
+ *
+ * These functions determine how much of a buffer consists of valid
+ * UTF-8, so that callers which need to repair invalid sequences (like
+ * mmutf8fix) only need to look at the bytes around the first problem.
+ * Depending on the CPU, a SIMD implementation is selected at runtime;
+ * a portable word-at-a-time implementation is always available.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_UTF8VALID_H
+#define INCLUDED_UTF8VALID_H
+
+#include <stddef.h>
+
+/* return the length of the longest prefix of buf that consists of
+ * complete, valid UTF-8 sequences, or len if the whole buffer is valid.
+ * The result is always the offset of the first byte of the offending
+ * sequence. Note that, for compatibility with mmutf8fix, overlong
+ * 3- and 4-byte forms as well as surrogates are accepted; only 0xc0/0xc1
+ * leads, 5/6 byte forms and code points above U+10FFFF are rejected.
+ */
+size_t utf8validPrefix(const unsigned char *buf, size_t len);
+
+void utf8validInit(void);
+const char *utf8validImplName(void);
+int utf8validSelectImpl(const char *name);
+
+#endif /* #ifndef INCLUDED_UTF8VALID_H */
@@ -36,6 +36,7 @@
 #include <signal.h>
 #include <pthread.h>
 #include <errno.h>
+#include <json.h>
 
 #include "rsyslog.h"
 #include "stringbuf.h"
@@ -394,11 +395,19 @@ wtiWorker(wti_t *__restrict__ const pThis)
 			actionRemoveWorker(pAction, wrkrInfo->actWrkrData);
 			pAction->pMod->mod.om.freeWrkrInstance(wrkrInfo->actWrkrData);
 			if(pAction->isTransactional) {
-				/* free iparam "cache" - we need to go through to max! */
+				/* free iparam "cache" - we need to go through to max!
+				 * JSON objects are only left over from an uncommitted
+				 * transaction. */
 				for(j = 0 ; j < wrkrInfo->p.tx.maxIParams ; ++j) {
 					for(k = 0 ; k < pAction->iNumTpls ; ++k) {
-						free(actParam(wrkrInfo->p.tx.iparams,
-							      pAction->iNumTpls, j, k).param);
+						if(pAction->peParamPassing[k] == ACT_JSON_PASSING) {
+							json_object_put((struct json_object*)
+								actParam(wrkrInfo->p.tx.iparams,
+								pAction->iNumTpls, j, k).param);
+						} else {
+							free(actParam(wrkrInfo->p.tx.iparams,
+								      pAction->iNumTpls, j, k).param);
+						}
 					}
 				}
 				free(wrkrInfo->p.tx.iparams);
@@ -47,6 +47,7 @@
 #include "msg.h"
 #include "parserif.h"
 #include "unicode-helper.h"
+#include "jsonescape.h"
 
 #if !defined(_AIX)
 #pragma GCC diagnostic ignored "-Wswitch-enum"
@@ -360,6 +361,7 @@ tplToJSON(struct template *pTpl, smsg_t *pMsg, struct json_object **pjson, struc
 	DEFiRet;
 
 	if(pTpl->bHaveSubtree){
+		CHKiRet(msgMaterializeJSON(pMsg));
 		if(jsonFind(pMsg->json, &pTpl->subtree, pjson) != RS_RET_OK)
 			*pjson = NULL;
 		if(*pjson == NULL) {
@@ -478,6 +480,8 @@ doEscape(uchar **pp, rs_size_t *pLen, unsigned short *pbMustBeFreed, int mode)
 	int iLen;
 	cstr_t *pStrB = NULL;
 	uchar *pszGenerated;
+	size_t lenRemain = 0;
+	size_t lenRun;
 
 	assert(pp != NULL);
 	assert(*pp != NULL);
@@ -491,9 +495,10 @@ doEscape(uchar **pp, rs_size_t *pLen, unsigned short *pbMustBeFreed, int mode)
 	else if(mode == SQL_ESCAPE)
 		for(p = *pp ; *p && *p != '\'' && *p != '\\' ; ++p)
 			;
-	else if(mode == JSON_ESCAPE)
-		for(p = *pp ; *p &&  (*p == '"' || *p == '\\' ) ; ++p)
-			;
+	else if(mode == JSON_ESCAPE) {
+		lenRemain = ustrlen(*pp);
+		p = *pp + jsonescFindQuote(*pp, lenRemain);
+	}
 	/* when we get out of the loop, we are either at the
 	 * string terminator or the first character to escape */
 	if(p && *p == '\0')
@@ -503,6 +508,23 @@ doEscape(uchar **pp, rs_size_t *pLen, unsigned short *pbMustBeFreed, int mode)
 	iLen = *pLen;
 	CHKiRet(cstrConstruct(&pStrB));
 
+	if(mode == JSON_ESCAPE) {
+		/* copy runs without quotes and backslashes in bulk */
+		while(1) {
+			lenRun = jsonescFindQuote(p, lenRemain);
+			CHKiRet(rsCStrAppendStrWithLen(pStrB, p, lenRun));
+			p += lenRun;
+			lenRemain -= lenRun;
+			if(lenRemain == 0)
+				break;
+			CHKiRet(cstrAppendChar(pStrB, '\\'));
+			CHKiRet(cstrAppendChar(pStrB, *p));
+			iLen++;	/* reflect the extra character */
+			++p;
+			--lenRemain;
+		}
+	}
+
 	while(*p) {
 		if((mode == SQL_ESCAPE || mode == STDSQL_ESCAPE) && *p == '\'') {
 			CHKiRet(cstrAppendChar(pStrB, (mode == STDSQL_ESCAPE) ? '\'' : '\\'));
@@ -510,9 +532,6 @@ doEscape(uchar **pp, rs_size_t *pLen, unsigned short *pbMustBeFreed, int mode)
 		} else if((mode == SQL_ESCAPE) && *p == '\\') {
 			CHKiRet(cstrAppendChar(pStrB, '\\'));
 			iLen++;	/* reflect the extra character */
-		} else if((mode == JSON_ESCAPE) &&  (*p == '"' || *p == '\\' )) {
-			CHKiRet(cstrAppendChar(pStrB, '\\'));
-			iLen++;	/* reflect the extra character */
 		}
 		CHKiRet(cstrAppendChar(pStrB, *p));
 		++p;
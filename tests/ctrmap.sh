@@ -0,0 +1,11 @@
+#!/bin/bash
+# check the concurrent counter map with many threads inserting and
+# looking up the same keys.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[ctrmap.sh\]: verify concurrent counter map
+./ctrmap_test
+if [ $? -ne 0 ]; then
+	echo "FAIL: counter map lost counts or entries"
+	exit 1
+fi
@@ -0,0 +1,128 @@
+/* Multi-threaded check of the concurrent counter map (runtime/ctrmap.c).
+ *
+ * A number of threads look up the same set of keys, each one starting
+ * at a different key, so that inserts of new keys race with lock-free
+ * lookups of keys other threads have just inserted. The map is built
+ * with very few buckets, so it is resized several times while lock-free
+ * lookups walk its chains. Checks:
+ * - all threads obtain the same counter for a key, and a counter once
+ *   obtained stays in the map (entries are published into the chains
+ *   fully initialized, never removed and not moved by a resize)
+ * - no increment is lost
+ * - ctrmapStepAndFetch() wraps correctly under contention
+ *
+ * Usage: ctrmap_test
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "rsyslog.h"
+#include "ctrmap.h"
+
+#define NTHREADS 8
+#define NKEYS 2000
+#define NROUNDS 20
+#define NBUCKETS 4	/* initial size, forces resizes */
+#define STEP_RANGE 7	/* range of the wrapping counter, not a divisor of the total */
+
+static ctrmap_t *map;
+static ctrmapCounter_t stepCtr;
+static char keys[NKEYS][16];
+static ctrmapCounter_t *seen[NTHREADS][NKEYS];
+
+static void *
+worker(void *arg)
+{
+	const int t = (int) (intptr_t) arg;
+	ctrmapCounter_t *pCtr;
+	int r, i, k;
+
+	for(r = 0 ; r < NROUNDS ; ++r) {
+		for(i = 0 ; i < NKEYS ; ++i) {
+			k = (i + t * (NKEYS / NTHREADS)) % NKEYS;
+			if(ctrmapGet(map, keys[k], 0, &pCtr) != RS_RET_OK) {
+				fprintf(stderr, "ctrmap_test: ctrmapGet failed\n");
+				exit(1);
+			}
+			if(seen[t][k] == NULL) {
+				seen[t][k] = pCtr;
+			} else if(seen[t][k] != pCtr) {
+				fprintf(stderr, "ctrmap_test: thread %d got a different counter "
+					"for key %s\n", t, keys[k]);
+				exit(1);
+			}
+			ctrmapIncAndFetch(pCtr);
+			ctrmapStepAndFetch(&stepCtr, 0, STEP_RANGE, 1);
+		}
+	}
+	return NULL;
+}
+
+int
+main(void)
+{
+	pthread_t thrds[NTHREADS];
+	ctrmapCounter_t *pCtr;
+	int t, k;
+	int ret = 0;
+
+	for(k = 0 ; k < NKEYS ; ++k)
+		snprintf(keys[k], sizeof(keys[k]), "key%d", k);
+	if(ctrmapConstruct(&map, NBUCKETS) != RS_RET_OK) {
+		fprintf(stderr, "ctrmap_test: ctrmapConstruct failed\n");
+		return 1;
+	}
+	ctrmapCounterInit(&stepCtr, 0);
+
+	for(t = 0 ; t < NTHREADS ; ++t)
+		pthread_create(&thrds[t], NULL, worker, (void*) (intptr_t) t);
+	for(t = 0 ; t < NTHREADS ; ++t)
+		pthread_join(thrds[t], NULL);
+
+	for(k = 0 ; k < NKEYS ; ++k) {
+		/* initVal must not matter for existing keys */
+		ctrmapGet(map, keys[k], -1, &pCtr);
+		for(t = 0 ; t < NTHREADS ; ++t) {
+			if(seen[t][k] != pCtr) {
+				fprintf(stderr, "ctrmap_test: key %s has more than one counter\n", keys[k]);
+				ret = 1;
+			}
+		}
+		if(pCtr->val != NTHREADS * NROUNDS) {
+			fprintf(stderr, "ctrmap_test: key %s counted %d, expected %d\n",
+				keys[k], pCtr->val, NTHREADS * NROUNDS);
+			ret = 1;
+		}
+	}
+	if(stepCtr.val != (NTHREADS * NROUNDS * NKEYS) % STEP_RANGE) {
+		fprintf(stderr, "ctrmap_test: wrapping counter is %d, expected %d\n",
+			stepCtr.val, (NTHREADS * NROUNDS * NKEYS) % STEP_RANGE);
+		ret = 1;
+	}
+
+	ctrmapCounterDestruct(&stepCtr);
+	ctrmapDestruct(&map);
+	return ret;
+}
@@ -0,0 +1,42 @@
+#!/bin/bash
+# Check that dyn-stats counters are exact when many worker threads
+# increment the same metrics concurrently (per-thread counter caches
+# must be folded into the reported values).
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[dynstats-mt.sh\]: test for dyn-stats with concurrent workers
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+main_queue(queue.workerThreads="4" queue.dequeueBatchSize="64")
+
+ruleset(name="stats") {
+  action(type="omfile" file="./rsyslog.out.stats.log")
+}
+
+module(load="../plugins/impstats/.libs/impstats" interval="1" severity="7" resetCounters="on" Ruleset="stats" bracketing="on")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+
+dyn_stats(name="msg_stats")
+
+if $msg contains "msgnum:" then {
+	set $.num = cnum(field($msg, 58, 2));
+	set $.metric = "key" & ($.num % 4);
+	set $.increment_successful = dyn_inc("msg_stats", $.metric);
+	action(type="omfile" file="./rsyslog.out.log" template="outfmt")
+}
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh wait-for-stats-flush 'rsyslog.out.stats.log'
+. $srcdir/diag.sh injectmsg 0 40000
+. $srcdir/diag.sh wait-queueempty
+. $srcdir/diag.sh msleep 2100 # wait for stats flush
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 39999
+. $srcdir/diag.sh first-column-sum-check 's/.*key0=\([0-9]\+\)/\1/g' 'key0=' 'rsyslog.out.stats.log' 10000
+. $srcdir/diag.sh first-column-sum-check 's/.*key1=\([0-9]\+\)/\1/g' 'key1=' 'rsyslog.out.stats.log' 10000
+. $srcdir/diag.sh first-column-sum-check 's/.*key2=\([0-9]\+\)/\1/g' 'key2=' 'rsyslog.out.stats.log' 10000
+. $srcdir/diag.sh first-column-sum-check 's/.*key3=\([0-9]\+\)/\1/g' 'key3=' 'rsyslog.out.stats.log' 10000
+. $srcdir/diag.sh exit
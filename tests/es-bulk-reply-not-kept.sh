@@ -0,0 +1,58 @@
+#!/bin/bash
+# This file is part of the rsyslog project, released under ASL 2.0
+# A successful bulk reply ("errors":false) must be recognized while it is
+# received and must not be accumulated, neither in sync nor in async mode.
+# The reply text is only needed for the error file or for replies that are
+# not regular bulk replies.
+. $srcdir/diag.sh init
+export RSYSLOG_DEBUG="debug nostdout"
+export RSYSLOG_DEBUGLOG="log"
+
+testsrv=es-bulk-test-server
+rm -f es_bulk_*.out
+python ./es_bulk_test_server.py 19290 rsyslog${testsrv}.pid rsyslogd${testsrv}.started > es_bulk_srv.log 2>&1 &
+BGPROCESS=$!
+. $srcdir/diag.sh wait-startup $testsrv
+echo background es_bulk_test_server.py process id is $BGPROCESS
+
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+template(name="tpl" type="string"
+	 string="{\"msgnum\":\"%msg:F,58:2%\"}")
+
+module(load="../plugins/omelasticsearch/.libs/omelasticsearch")
+if $msg contains "msgnum:" then {
+	action(type="omelasticsearch" server="localhost" serverport="19290"
+	       template="tpl" searchIndex="sync" bulkmode="on" maxbytes="16k")
+	action(type="omelasticsearch" server="localhost" serverport="19290"
+	       template="tpl" searchIndex="async" bulkmode="on" maxbytes="16k"
+	       maxinflight="4")
+}
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg 0 10000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+unset RSYSLOG_DEBUG RSYSLOG_DEBUGLOG
+
+kill $BGPROCESS
+. $srcdir/diag.sh wait-pid-termination rsyslog${testsrv}.pid
+
+nreplies=$(grep -c "bulk reply received" log)
+echo "$nreplies bulk replies received"
+if [ "$nreplies" -lt 2 ]; then
+	echo "FAIL: bulk replies missing in debug log"
+	cat es_bulk_srv.log
+	. $srcdir/diag.sh error-exit 1
+fi
+if grep "bulk reply received" log | grep -v " 0 bytes kept"; then
+	echo "FAIL: successful bulk reply was kept"
+	. $srcdir/diag.sh error-exit 1
+fi
+
+for idx in sync async; do
+	sort -n es_bulk_$idx.out > rsyslog.out.log
+	. $srcdir/diag.sh seq-check 0 9999
+done
+rm -f es_bulk_*.out es_bulk_srv.log
+. $srcdir/diag.sh exit
@@ -0,0 +1,27 @@
+#!/bin/bash
+# check that bulk requests are delivered correctly when several of them
+# are in flight concurrently and one of the servers is unreachable.
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh es-init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+template(name="tpl" type="string"
+	 string="{\"msgnum\":\"%msg:F,58:2%\"}")
+
+module(load="../plugins/omelasticsearch/.libs/omelasticsearch")
+:msg, contains, "msgnum:" action(type="omelasticsearch"
+				 server=["localhost", "localhost:9201"]
+				 template="tpl"
+				 searchIndex="rsyslog_testbench"
+				 bulkmode="on"
+				 maxbytes="1k"
+				 maxinflight="4")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg  0 10000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh es-getdata 10000
+. $srcdir/diag.sh seq-check  0 9999
+. $srcdir/diag.sh exit
@@ -0,0 +1,63 @@
+# Used by the omelasticsearch tests
+# This is a simple http server which implements the elasticsearch bulk
+# api. All requests succeed. The msgnum field of each document is
+# written to a local file named es_bulk_<index>.out, and the reply lists
+# all items, like the real thing does.
+# released under ASL 2.0
+import os
+import json
+import sys
+
+try:
+    from http.server import HTTPServer, BaseHTTPRequestHandler
+except ImportError:
+    from BaseHTTPServer import HTTPServer, BaseHTTPRequestHandler
+
+class SimpleHTTPRequestHandler(BaseHTTPRequestHandler):
+
+    def log_message(self, format, *args):
+        sys.stderr.write("%s - - [%s] %s\n" % (self.address_string(),
+                         self.log_date_time_string(), format % args))
+        sys.stderr.flush()
+
+    def do_POST(self):
+        data = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+        if not self.path.startswith('/_bulk'):
+            self.send_response(404)
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+            return
+        lines = [l for l in data.decode('utf-8').split('\n') if l]
+        items = []
+        for i in range(0, len(lines) - 1, 2):
+            meta = json.loads(lines[i])
+            action = list(meta.keys())[0]
+            index = meta[action]['_index']
+            doc = json.loads(lines[i + 1])
+            with open('es_bulk_' + index + '.out', 'a') as ff:
+                ff.write(doc['msgnum'] + '\n')
+            items.append({action: {"_index": index, "_type": "events",
+                "_id": "id%d" % (len(items)), "_version": 1,
+                "result": "created", "_shards": {"total": 2,
+                "successful": 1, "failed": 0}, "status": 201}})
+        body = json.dumps({"took": 1, "errors": False,
+                           "items": items}).encode('utf-8')
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+port = int(sys.argv[1])
+
+httpd = HTTPServer(('localhost', port), SimpleHTTPRequestHandler)
+
+# write "started" to file named in argv[3]
+with open(sys.argv[3], "w") as ff:
+    ff.write("started\n")
+
+# write pid to file named in argv[2]
+with open(sys.argv[2], "w") as ff:
+    ff.write('{0}\n'.format(os.getpid()))
+
+httpd.serve_forever()
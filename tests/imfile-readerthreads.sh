@@ -0,0 +1,31 @@
+#!/bin/bash
+# check that many concurrently written files are completely processed
+# when the reader thread pool is used.
+# This is part of the rsyslog testbench, licensed under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh check-inotify-only
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+module(load="../plugins/imfile/.libs/imfile" readerThreads="4")
+
+input(type="imfile" File="./rsyslog.input.*.log" Tag="file:")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+if $msg contains "msgnum:" then
+	action(type="omfile" file="rsyslog.out.log" template="outfmt")
+'
+# the first half is there on startup, the second half is appended
+# while rsyslog is running.
+for i in `seq 0 9`; do
+	./inputfilegen -m 2500 -i $((i * 5000)) > rsyslog.input.$i.log
+done
+. $srcdir/diag.sh startup
+for i in `seq 0 9`; do
+	./inputfilegen -m 2500 -i $((i * 5000 + 2500)) >> rsyslog.input.$i.log &
+done
+wait
+. $srcdir/diag.sh wait-file-lines rsyslog.out.log 50000 30
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 49999
+. $srcdir/diag.sh exit
@@ -0,0 +1,42 @@
+#!/bin/bash
+# check that imfile resumes at the right position after a restart if
+# its state is kept in the shared state store instead of state files.
+# This is part of the rsyslog testbench, licensed under ASL 2.0
+echo [imfile-statestore.sh]
+. $srcdir/diag.sh check-inotify
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+global(workDirectory="test-spool")
+
+module(load="../plugins/imfile/.libs/imfile" stateStore="imfile-state.log")
+
+input(	type="imfile"
+	file="./rsyslog.input"
+	tag="file:"
+	PersistStateInterval="100"
+)
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+if $msg contains "msgnum:" then
+	action(type="omfile" file="rsyslog.out.log" template="outfmt")
+'
+./inputfilegen -m 5000 > rsyslog.input
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh wait-file-lines rsyslog.out.log 5000 10
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+
+if [ ! -s test-spool/imfile-state.log ] || ls test-spool/imfile-state:* > /dev/null 2>&1; then
+	echo "FAIL: state was not kept in state store, test-spool is:"
+	ls -l test-spool
+	exit 1
+fi
+
+./inputfilegen -m 5000 -i 5000 >> rsyslog.input
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh wait-file-lines rsyslog.out.log 10000 10
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 9999
+. $srcdir/diag.sh exit
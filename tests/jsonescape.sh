@@ -0,0 +1,11 @@
+#!/bin/bash
+# check that all JSON escape scanner implementations available on this
+# CPU produce the same results as the bytewise reference.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[jsonescape.sh\]: verify JSON escape scanner implementations
+./jsonescape_bench -n 2000 -i 5
+if [ $? -ne 0 ]; then
+	echo "FAIL: JSON escape scanner mismatch"
+	exit 1
+fi
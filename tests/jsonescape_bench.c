@@ -0,0 +1,217 @@
+/* Microbenchmark and correctness check for the JSON escape scanner
+ * (runtime/jsonescape.c).
+ *
+ * A corpus of typical message texts is generated (sshd, kernel, web
+ * server access logs, Windows paths, embedded JSON, ...). Each available
+ * scanner implementation is first verified against a plain bytewise
+ * reference and then timed on that corpus.
+ *
+ * Usage: jsonescape_bench [-n messages] [-i iterations] [-I implementation]
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/time.h>
+#include "jsonescape.h"
+
+static const char *implNames[] = { "generic", "sse2", "avx2" };
+
+static const char *msgTemplates[] = {
+	"Accepted publickey for user%d from 10.0.%d.17 port 52413 ssh2: RSA SHA256:"
+		"hG4Kz0n3cX6uQ1vHjW0Lk9x8Yz3bA7sPqR2tD5eF1gI",
+	"pam_unix(sshd:session): session opened for user root by (uid=%d) pid=%d",
+	"[%d.123456] IN=eth0 OUT= MAC=52:54:00:12:34:56:52:54:00:65:43:21:08:00 SRC=192.0.2.%d "
+		"DST=198.51.100.1 LEN=60 TOS=0x00 PREC=0x00 TTL=64 ID=54321 DF PROTO=TCP SPT=443",
+	"192.0.2.%d - - [18/May/2018:10:12:%02d +0200] \"GET /api/v1/items?id=42&page=3 HTTP/1.1\" "
+		"200 5123 \"https://www.example.com/index.html\" \"Mozilla/5.0 (X11; Linux x86_64)\"",
+	"The service C:\\Program Files\\Example\\svc%d.exe terminated unexpectedly (%d times).",
+	"{\"level\":\"info\",\"ts\":%d.5,\"caller\":\"server/handler.go:%d\",\"msg\":\"request done\"}",
+	"connection %d closed\tbytes=%d\tstate=FIN_WAIT2",
+	"disk /dev/sda%d: %d%% used, consider cleanup of /var/log/journal",
+	"Started Session %d of user admin; unit session-%d.scope is now active and running fine",
+	"short msg %d %d"
+};
+#define NUM_TEMPLATES (sizeof(msgTemplates) / sizeof(msgTemplates[0]))
+
+static size_t
+refFind(const unsigned char *const buf, const size_t len, const int bQuoteOnly)
+{
+	size_t i;
+	unsigned char c;
+
+	for(i = 0 ; i < len ; ++i) {
+		c = buf[i];
+		if(c == '"' || c == '\\')
+			return i;
+		if(!bQuoteOnly && (c < 0x20 || c == '/'))
+			return i;
+	}
+	return len;
+}
+
+/* check all suffixes of buf, so that every alignment and tail length
+ * is exercised at least once.
+ */
+static int
+verifyBuf(const unsigned char *const buf, const size_t len)
+{
+	size_t i;
+
+	for(i = 0 ; i <= len ; ++i) {
+		if(jsonescFindSpecial(buf + i, len - i) != refFind(buf + i, len - i, 0)) {
+			fprintf(stderr, "%s: findSpecial mismatch at offset %zu of '%.*s'\n",
+				jsonescImplName(), i, (int) len, buf);
+			return 1;
+		}
+		if(jsonescFindQuote(buf + i, len - i) != refFind(buf + i, len - i, 1)) {
+			fprintf(stderr, "%s: findQuote mismatch at offset %zu of '%.*s'\n",
+				jsonescImplName(), i, (int) len, buf);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int
+verify(char **corpus, const int nMsgs)
+{
+	unsigned char buf[200];
+	int i;
+	size_t j;
+
+	for(i = 0 ; i < nMsgs ; ++i) {
+		if(verifyBuf((unsigned char*) corpus[i], strlen(corpus[i])))
+			return 1;
+	}
+	/* random data with a high share of chars that need escaping */
+	for(i = 0 ; i < 2000 ; ++i) {
+		for(j = 0 ; j < sizeof(buf) ; ++j)
+			buf[j] = (rand() % 4 == 0) ? (unsigned char) (rand() % 0x30) : (unsigned char) rand();
+		if(verifyBuf(buf, sizeof(buf)))
+			return 1;
+	}
+	return 0;
+}
+
+/* emulate what the escaper does: find each special char and skip it */
+static double
+bench(char **corpus, size_t *lens, const int nMsgs, const int nIter, size_t *pNSpecial)
+{
+	struct timeval tStart, tEnd;
+	const unsigned char *p;
+	size_t lenRemain, n;
+	size_t nSpecial = 0;
+	int i, iter;
+
+	gettimeofday(&tStart, NULL);
+	for(iter = 0 ; iter < nIter ; ++iter) {
+		for(i = 0 ; i < nMsgs ; ++i) {
+			p = (unsigned char*) corpus[i];
+			lenRemain = lens[i];
+			while(1) {
+				n = jsonescFindSpecial(p, lenRemain);
+				if(n == lenRemain)
+					break;
+				++nSpecial;
+				p += n + 1;
+				lenRemain -= n + 1;
+			}
+		}
+	}
+	gettimeofday(&tEnd, NULL);
+	*pNSpecial = nSpecial;
+	return (tEnd.tv_sec - tStart.tv_sec) + (tEnd.tv_usec - tStart.tv_usec) / 1000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+	int nMsgs = 10000;
+	int nIter = 100;
+	const char *implWanted = NULL;
+	char **corpus;
+	size_t *lens;
+	size_t total = 0;
+	size_t nSpecial;
+	double secs;
+	unsigned i;
+	int opt;
+	int ret = 0;
+
+	while((opt = getopt(argc, argv, "n:i:I:")) != -1) {
+		switch(opt) {
+		case 'n':	nMsgs = atoi(optarg);
+				break;
+		case 'i':	nIter = atoi(optarg);
+				break;
+		case 'I':	implWanted = optarg;
+				break;
+		default:	fprintf(stderr, "usage: jsonescape_bench [-n messages] [-i iterations] "
+					"[-I implementation]\n");
+				exit(1);
+		}
+	}
+
+	srand(1);
+	if((corpus = calloc(nMsgs, sizeof(char*))) == NULL
+	   || (lens = calloc(nMsgs, sizeof(size_t))) == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	for(i = 0 ; i < (unsigned) nMsgs ; ++i) {
+		corpus[i] = malloc(512);
+		if(corpus[i] == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+		snprintf(corpus[i], 512, msgTemplates[rand() % NUM_TEMPLATES], rand() % 1000, rand() % 60);
+		lens[i] = strlen(corpus[i]);
+		total += lens[i];
+	}
+
+	jsonescInit();
+	printf("default implementation: %s\n", jsonescImplName());
+	for(i = 0 ; i < sizeof(implNames) / sizeof(implNames[0]) ; ++i) {
+		if(implWanted != NULL && strcmp(implWanted, implNames[i]))
+			continue;
+		if(jsonescSelectImpl(implNames[i]) != 0) {
+			printf("%-8s not available\n", implNames[i]);
+			continue;
+		}
+		if(verify(corpus, nMsgs)) {
+			ret = 1;
+			continue;
+		}
+		secs = bench(corpus, lens, nMsgs, nIter, &nSpecial);
+		printf("%-8s %8.1f MB/s (%zu bytes, %zu special chars, %.3f s)\n", implNames[i],
+			secs > 0 ? (double) total * nIter / secs / (1024 * 1024) : 0.0,
+			total * nIter, nSpecial, secs);
+	}
+
+	for(i = 0 ; i < (unsigned) nMsgs ; ++i)
+		free(corpus[i]);
+	free(corpus);
+	free(lens);
+	return ret;
+}
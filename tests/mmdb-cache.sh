@@ -0,0 +1,57 @@
+#!/bin/bash
+# This file is part of the rsyslog project, released under ASL 2.0
+# mmdblookup lookup cache and decoding of a whole record (a map).
+# With a cache of 2 entries, the lookups A B A C A B must evict the
+# least recently used key: C evicts B, then B evicts C, so A is always
+# served from the cache.
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+template(name="outfmt" type="string" string="%$!ip% %$!iplocation%\n")
+
+module(load="../plugins/mmdblookup/.libs/mmdblookup")
+module(load="../plugins/mmnormalize/.libs/mmnormalize")
+module(load="../plugins/impstats/.libs/impstats" log.file="./rsyslog.out.stats.log"
+	log.syslog="off" interval="1" ruleset="stats")
+main_queue(queue.workerthreads="1")
+
+ruleset(name="stats") {
+	stop # nothing to do here
+}
+
+if $msg contains "seq" then {
+	action(type="mmnormalize" rulebase="./mmdb.rb")
+	# an empty field path ("!") yields the whole record
+	action(type="mmdblookup" mmdbfile="./test.mmdb" key="$!ip" cache.size="2"
+	       fields=[":rec:!", "city"])
+	action(type="omfile" file="./rsyslog.out.log" template="outfmt")
+}'
+printf '%s\n' \
+	'<167>Mar  6 16:57:54 172.20.245.8 tag: 202.106.0.20 seq1' \
+	'<167>Mar  6 16:57:54 172.20.245.8 tag: 10.0.0.1 seq2' \
+	'<167>Mar  6 16:57:54 172.20.245.8 tag: 202.106.0.20 seq3' \
+	'<167>Mar  6 16:57:54 172.20.245.8 tag: 10.0.0.2 seq4' \
+	'<167>Mar  6 16:57:54 172.20.245.8 tag: 202.106.0.20 seq5' \
+	'<167>Mar  6 16:57:54 172.20.245.8 tag: 10.0.0.1 seq6' > mmdb-cache.input
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg-litteral mmdb-cache.input
+. $srcdir/diag.sh wait-queueempty
+./msleep 2500 # wait for stats flush
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+rm -f mmdb-cache.input
+
+count=$(grep -cF '202.106.0.20 { "rec": { "city": "Beijing" }, "city": "Beijing" }' rsyslog.out.log)
+if [ "$count" != "3" ]; then
+	echo "FAIL: expected 3 full records for 202.106.0.20, got $count"
+	cat rsyslog.out.log
+	. $srcdir/diag.sh error-exit 1
+fi
+
+stats=$(grep "mmdblookup: origin=mmdblookup" rsyslog.out.stats.log | tail -1)
+echo "last stats: $stats"
+if ! echo "$stats" | grep -q "lookups=4 cache.hits=2 cache.misses=4 cache.evictions=2"; then
+	echo "FAIL: unexpected cache statistics"
+	. $srcdir/diag.sh error-exit 1
+fi
+. $srcdir/diag.sh exit
@@ -0,0 +1,34 @@
+#!/bin/bash
+# check that lazy JSON parsing provides the same values as a full parse
+# and that the tree is correctly converted when it is modified.
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+template(name="outfmt" type="string" string="msg: %$!foo[1]% | %$.quux% | %$.corge% | %$.grault% | %$!foo[3]!bar[1]!baz%\n")
+template(name="alljson" type="string" string="all: %$!all-json%\n")
+template(name="modified" type="string" string="modified: %$!added% | %$!foo[0]%\n")
+
+module(load="../plugins/mmjsonparse/.libs/mmjsonparse")
+module(load="../plugins/imptcp/.libs/imptcp")
+input(type="imptcp" port="13514")
+
+action(type="mmjsonparse" lazyparsing="on")
+if $parsesuccess == "OK" then {
+	set $.quux = $!foo[2];
+	set $.corge = $!foo[3]!bar[0]!baz;
+	set $.grault = $!foo[3]!bar[1];
+	action(type="omfile" file="./rsyslog.out.log" template="outfmt")
+	action(type="omfile" file="./rsyslog.out.log" template="alljson")
+	set $!added = "new";
+	action(type="omfile" file="./rsyslog.out.log" template="modified")
+}
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh tcpflood -m 1 -I $srcdir/testsuites/json_array_input
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh content-check 'msg: def1 | ghi2 | important_msg | { "baz": "other_msg" } | other_msg'
+. $srcdir/diag.sh content-check 'all: {"foo": ["abc0", "def1", "ghi2", {"bar": [{"baz": "important_msg"}, {"baz": "other_msg"}]}]}'
+. $srcdir/diag.sh content-check 'modified: new | abc0'
+. $srcdir/diag.sh exit
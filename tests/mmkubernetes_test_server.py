@@ -5,11 +5,16 @@
 import os
 import json
 import sys
+import time
 
 try:
     from http.server import HTTPServer, BaseHTTPRequestHandler
+    from socketserver import ThreadingMixIn
+    from urllib.parse import urlparse, parse_qs
 except ImportError:
     from BaseHTTPServer import HTTPServer, BaseHTTPRequestHandler
+    from SocketServer import ThreadingMixIn
+    from urlparse import urlparse, parse_qs
 
 ns_template = '''{{
   "kind": "Namespace",
@@ -80,9 +85,61 @@ pod_template = '''{{
   }}
 }}'''
 
+# pods known to the list and watch requests: the list returns the first
+# two, the watch adds the others
+list_pods = [('pod-name1', 'namespace-name1'), ('pod-name2', 'namespace-name2')]
+watch_pods = [('pod-name3', 'namespace-name3'), ('pod-name4', 'namespace-name4')]
+list_resource_version = 100
+
+def pod_json(pod_name, namespace_name, resource_version):
+    pod = json.loads(pod_template.format(namespace_name=namespace_name, pod_name=pod_name))
+    pod['metadata']['resourceVersion'] = str(resource_version)
+    return pod
+
 class SimpleHTTPRequestHandler(BaseHTTPRequestHandler):
 
+    def log_message(self, format, *args):
+        sys.stderr.write("%s - - [%s] %s\n" % (self.address_string(),
+                         self.log_date_time_string(), format % args))
+        sys.stderr.flush()
+
+    def send_json(self, obj):
+        self.send_response(200)
+        self.end_headers()
+        self.wfile.write(json.dumps(obj, separators=(',',':')).encode('utf-8'))
+
+    def do_watch(self, query):
+        # stream the watch_pods as ADDED events to a watch starting at
+        # the list resourceVersion; later watches just time out
+        rv = int(query.get('resourceVersion', ['0'])[0])
+        self.send_response(200)
+        self.end_headers()
+        if rv <= list_resource_version:
+            for ii, (pod_name, namespace_name) in enumerate(watch_pods):
+                event = {"type": "ADDED",
+                         "object": pod_json(pod_name, namespace_name, list_resource_version + ii + 1)}
+                self.wfile.write((json.dumps(event, separators=(',',':')) + '\n').encode('utf-8'))
+            self.wfile.flush()
+        time.sleep(1)
+
     def do_GET(self):
+        url = urlparse(self.path)
+        query = parse_qs(url.query)
+        if url.path == '/api/v1/pods':
+            if query.get('watch', ['false'])[0] == 'true':
+                self.do_watch(query)
+            else:
+                self.send_json({"kind": "PodList", "apiVersion": "v1",
+                                "metadata": {"resourceVersion": str(list_resource_version)},
+                                "items": [pod_json(pod, ns, list_resource_version)
+                                          for (pod, ns) in list_pods]})
+            return
+        if url.path == '/api/v1/namespaces':
+            self.send_json({"kind": "NamespaceList", "apiVersion": "v1",
+                            "metadata": {"resourceVersion": str(list_resource_version)},
+                            "items": [json.loads(ns_template.format(namespace_name=ns))
+                                      for (pod, ns) in list_pods + watch_pods]})
+            return
         # "http://localhost:18443/api/v1/namespaces/namespace-name2"
         # parse url - either /api/v1/namespaces/$ns_name
         # or
@@ -104,11 +161,14 @@ class SimpleHTTPRequestHandler(BaseHTTPRequestHandler):
             self.log_error(resp)
         self.send_response(status)
         self.end_headers()
-        self.wfile.write(json.dumps(json.loads(resp), separators=(',',':')))
+        self.wfile.write(json.dumps(json.loads(resp), separators=(',',':')).encode('utf-8'))
 
 port = int(sys.argv[1])
 
-httpd = HTTPServer(('localhost', port), SimpleHTTPRequestHandler)
+class ThreadingHTTPServer(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+
+httpd = ThreadingHTTPServer(('localhost', port), SimpleHTTPRequestHandler)
 
 # write "started" to file named in argv[3]
 with open(sys.argv[3], "w") as ff:
@@ -0,0 +1,34 @@
+#!/bin/bash
+# Test ommongodb with a plain list template (no option.jsonf). The
+# template is passed as JSON object, so each property becomes a field
+# of the stored document.
+# This file is part of the rsyslog project, released under ASL 2.0
+
+. $srcdir/diag.sh init
+
+mongo --quiet syslogtest --eval 'db.log.drop()'
+
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+template(name="mongotpl" type="list") {
+	property(outname="msgnum" name="msg" field.delimiter="58" field.number="2")
+	property(outname="severity" name="syslogseverity-text")
+}
+
+module(load="../plugins/ommongodb/.libs/ommongodb")
+if $msg contains "msgnum" then
+	action(type="ommongodb" server="127.0.0.1" db="syslogtest"
+		collection="log" template="mongotpl")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg  0 5000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+
+mongo --quiet syslogtest --eval 'db.log.find().forEach(function(d) { print(d.msgnum); })' > rsyslog.out.log
+. $srcdir/diag.sh seq-check  0 4999
+
+echo cleaning up test database
+mongo --quiet syslogtest --eval 'db.dropDatabase()'
+
+. $srcdir/diag.sh exit
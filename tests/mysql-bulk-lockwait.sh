@@ -0,0 +1,36 @@
+#!/bin/bash
+# Test bulk mode of ommysql while another session holds locks on the
+# table. Our inserts then fail with a lock wait timeout; this is no data
+# error, so the batch must be retried until the lock is released instead
+# of discarding its messages. Nothing may be lost or duplicated.
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+mysql --user=rsyslog --password=testbench < testsuites/mysql-truncate.sql
+printf '[client]\ninit-command="SET SESSION innodb_lock_wait_timeout=1"\n' > mysql-lockwait.cnf
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+template(name="tpl" type="string" option.sql="on"
+	string="insert into SystemEvents (Message) values ('"'"'%msg%'"'"')")
+
+module(load="../plugins/ommysql/.libs/ommysql")
+if $msg contains "msgnum" then {
+	action(type="ommysql" server="127.0.0.1" db="Syslog" uid="rsyslog" pwd="testbench"
+	       template="tpl" bulkmode="on" mysqlconfig.file="./mysql-lockwait.cnf"
+	       action.resumeRetryCount="-1" action.resumeInterval="1")
+}'
+. $srcdir/diag.sh startup
+# the locking read also locks the gap at the end of the table, which
+# blocks all inserts until the transaction ends
+mysql --user=rsyslog --password=testbench -e "use Syslog; start transaction;
+	select count(*) from SystemEvents for update; select sleep(5); commit;" > /dev/null &
+LOCKER=$!
+./msleep 1000
+. $srcdir/diag.sh injectmsg  0 5000
+wait $LOCKER
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+rm -f mysql-lockwait.cnf
+# note "-s" is requried to suppress the select "field header"
+mysql -s --user=rsyslog --password=testbench < testsuites/mysql-select-msg.sql > rsyslog.out.log
+. $srcdir/diag.sh seq-check  0 4999
+. $srcdir/diag.sh exit
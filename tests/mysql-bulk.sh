@@ -0,0 +1,47 @@
+#!/bin/bash
+# Test bulk mode of ommysql with a statement that violates the primary
+# key of a row inserted earlier in the same batch (ER_DUP_ENTRY). The
+# multi-row INSERT fails as a whole, after which only the offending row
+# may be discarded: all others, including the one holding the key, must
+# be in the database exactly once.
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+mysql --user=rsyslog --password=testbench < testsuites/mysql-truncate.sql
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+template(name="tpl" type="list" option.sql="on") {
+	constant(value="insert into SystemEvents (ID, Message) values (")
+	property(name="$.id")
+	constant(value=", '"'"'")
+	property(name="msg")
+	constant(value="'"'"')")
+}
+
+module(load="../plugins/ommysql/.libs/ommysql")
+if $msg contains "msgnum" then {
+	set $.id = field($msg, 58, 2) + 1;
+	# duplicates the key of message 0
+	if $msg contains "msgnum:00000250:" then
+		set $.id = 1;
+	action(type="ommysql" server="127.0.0.1" db="Syslog" uid="rsyslog" pwd="testbench"
+	       template="tpl" bulkmode="on" bulk.maxsize="4k")
+}'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg  0 5000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+# note "-s" is requried to suppress the select "field header"
+mysql -s --user=rsyslog --password=testbench < testsuites/mysql-select-msg.sql > rsyslog.out.log
+if grep -q '^00000250$' rsyslog.out.log; then
+	echo "FAIL: the message with the duplicate key was inserted"
+	. $srcdir/diag.sh error-exit 1
+fi
+mismatch=$(mysql -s --user=rsyslog --password=testbench -e \
+	"select count(*) from Syslog.SystemEvents where ID <> substring(Message,9,8) + 1")
+if [ "$mismatch" != "0" ]; then
+	echo "FAIL: $mismatch rows stored with the wrong key"
+	. $srcdir/diag.sh error-exit 1
+fi
+# only message 250 may be missing
+. $srcdir/diag.sh seq-check  0 4999 -m1
+. $srcdir/diag.sh exit
@@ -0,0 +1,69 @@
+#!/bin/bash
+# check omhiredis queue mode with batched pushes and keys sharded over
+# two redis servers. Needs redis-server and redis-cli.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[omhiredis-queue-sharded.sh\]: test batched pushes to two redis servers
+if ! command -v redis-server > /dev/null || ! command -v redis-cli > /dev/null; then
+	echo "redis-server or redis-cli not found, skipping test"
+	exit 77
+fi
+. $srcdir/diag.sh init
+
+REDIS_PORTS="13600 13601"
+for port in $REDIS_PORTS; do
+	redis-server --port $port --save '' --appendonly no --daemonize yes \
+		--pidfile $(pwd)/redis-$port.pid --logfile $(pwd)/redis-$port.log
+done
+for port in $REDIS_PORTS; do
+	for i in $(seq 1 50); do
+		redis-cli -p $port ping > /dev/null 2>&1 && break
+		./msleep 100
+	done
+done
+
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+template(name="outfmt" type="string" string="%msg:F,58:2%")
+# ten keys, by the last digit of the message number
+template(name="keyfmt" type="list") {
+	constant(value="key")
+	property(name="msg" field.delimiter="58" field.number="2" position.from="8" position.to="8")
+}
+
+module(load="../contrib/omhiredis/.libs/omhiredis")
+if $msg contains "msgnum:" then
+	action(type="omhiredis" mode="queue" userpush="on"
+		template="outfmt" key="keyfmt" dynakey="on"
+		servers=["127.0.0.1:13600", "127.0.0.1:13601"]
+		push.batchsize="50")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg 0 10000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+
+rm -f rsyslog.out.log
+for port in $REDIS_PORTS; do
+	if [ "$(redis-cli -p $port dbsize)" = "0" ]; then
+		echo "FAIL: no keys on redis server at port $port"
+		ERROR=1
+	fi
+	for key in $(redis-cli -p $port --raw keys 'key*'); do
+		redis-cli -p $port --raw lrange $key 0 -1 > redis-list.out
+		# messages for the same key must be kept in order
+		if ! sort -n -c redis-list.out; then
+			echo "FAIL: messages for $key are out of order"
+			ERROR=1
+		fi
+		cat redis-list.out >> rsyslog.out.log
+	done
+	redis-cli -p $port shutdown nosave > /dev/null 2>&1
+done
+rm -f redis-list.out redis-*.pid redis-*.log
+
+if [ -n "$ERROR" ]; then
+	. $srcdir/diag.sh error-exit 1
+fi
+. $srcdir/diag.sh seq-check 0 9999
+. $srcdir/diag.sh exit
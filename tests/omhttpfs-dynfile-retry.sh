@@ -0,0 +1,54 @@
+#!/bin/bash
+# This file is part of the rsyslog project, released under ASL 2.0
+# omhttpfs with a dynamic file name: a failed append must be retried
+# without appending the messages for other files of the batch again.
+#export RSYSLOG_DEBUG="debug"
+. $srcdir/diag.sh init
+
+testsrv=omhttpfs-test-server
+rm -f omhttpfs_rsyslog_file*
+python ./omhttpfs_test_server.py 18444 rsyslog${testsrv}.pid rsyslogd${testsrv}.started /rsyslog/file3 > omhttpfs_srv.log 2>&1 &
+BGPROCESS=$!
+. $srcdir/diag.sh wait-startup $testsrv
+echo background omhttpfs_test_server.py process id is $BGPROCESS
+
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+module(load="../contrib/omhttpfs/.libs/omhttpfs")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+template(name="dynfile" type="string" string="/rsyslog/file%$.file%")
+
+if $msg contains "msgnum:" then {
+	# runs of 10 messages go to the same file
+	set $.file = substring(field($msg, 58, 2), 6, 1);
+	action(type="omhttpfs" host="localhost" port="18444" user="rsyslog"
+	       file="dynfile" isDynFile="on" template="outfmt"
+	       action.resumeInterval="1" action.resumeRetryCount="-1")
+}
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg 0 1000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+
+kill $BGPROCESS
+. $srcdir/diag.sh wait-pid-termination rsyslog${testsrv}.pid
+cat omhttpfs_srv.log
+
+if ! grep -q "failing append to /rsyslog/file3" omhttpfs_srv.log; then
+	echo "FAIL: the append to /rsyslog/file3 did not fail"
+	. $srcdir/diag.sh error-exit 1
+fi
+
+# each message must be in its file exactly once
+for i in 0 1 2 3 4 5 6 7 8 9; do
+	if grep -v "^......$i.\$" omhttpfs_rsyslog_file$i; then
+		echo "FAIL: messages in wrong file omhttpfs_rsyslog_file$i"
+		. $srcdir/diag.sh error-exit 1
+	fi
+done
+cat omhttpfs_rsyslog_file* > rsyslog.out.log
+. $srcdir/diag.sh seq-check 0 999
+rm -f omhttpfs_rsyslog_file*
+. $srcdir/diag.sh exit
@@ -0,0 +1,97 @@
+# Used by the omhttpfs tests
+# This is a simple http server which implements the create and append
+# operations of the HttpFS/WebHDFS REST api. The data of each file is
+# written to a local file named by the path with '/' replaced by '_'.
+# The first append to the path given in argv[4] after the file has been
+# created fails once with HTTP 500, so the client has to retry it.
+# released under ASL 2.0
+import os
+import json
+import sys
+
+try:
+    from http.server import HTTPServer, BaseHTTPRequestHandler
+    from urllib.parse import urlparse, parse_qs
+except ImportError:
+    from BaseHTTPServer import HTTPServer, BaseHTTPRequestHandler
+    from urlparse import urlparse, parse_qs
+
+prefix = '/webhdfs/v1'
+files = {}
+fail_path = sys.argv[4] if len(sys.argv) > 4 else None
+failed = False
+
+class SimpleHTTPRequestHandler(BaseHTTPRequestHandler):
+
+    def log_message(self, format, *args):
+        sys.stderr.write("%s - - [%s] %s\n" % (self.address_string(),
+                         self.log_date_time_string(), format % args))
+        sys.stderr.flush()
+
+    def send_reply(self, status, exception=None):
+        body = b''
+        if exception is not None:
+            body = json.dumps({"RemoteException": {
+                "javaClassName": "java.io." + exception,
+                "exception": exception,
+                "message": exception + ": " + self.path}}).encode('utf-8')
+        self.send_response(status)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def store(self, path, data):
+        with open('omhttpfs' + path.replace('/', '_'), 'ab') as ff:
+            ff.write(data)
+
+    def do_request(self, method):
+        global failed
+        url = urlparse(self.path)
+        query = parse_qs(url.query)
+        op = query.get('op', [''])[0].lower()
+        data = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+        if not url.path.startswith(prefix):
+            self.send_reply(400, 'IllegalArgumentException')
+            return
+        path = url.path[len(prefix):]
+        if method == 'PUT' and op == 'create':
+            if path in files:
+                self.send_reply(500, 'FileAlreadyExistsException')
+                return
+            files[path] = True
+            self.store(path, data)
+            self.send_reply(201)
+        elif method == 'POST' and op == 'append':
+            if path not in files:
+                self.send_reply(404, 'FileNotFoundException')
+                return
+            if path == fail_path and not failed:
+                failed = True
+                self.log_error("failing append to %s once", path)
+                self.send_reply(500, 'IOException')
+                return
+            self.store(path, data)
+            self.send_reply(200)
+        else:
+            self.send_reply(400, 'UnsupportedOperationException')
+
+    def do_PUT(self):
+        self.do_request('PUT')
+
+    def do_POST(self):
+        self.do_request('POST')
+
+port = int(sys.argv[1])
+
+httpd = HTTPServer(('localhost', port), SimpleHTTPRequestHandler)
+
+# write "started" to file named in argv[3]
+with open(sys.argv[3], "w") as ff:
+    ff.write("started\n")
+
+# write pid to file named in argv[2]
+with open(sys.argv[2], "w") as ff:
+    ff.write('{0}\n'.format(os.getpid()))
+
+httpd.serve_forever()
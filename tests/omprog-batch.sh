@@ -0,0 +1,16 @@
+#!/bin/bash
+# This file is part of the rsyslog project, released under ASL 2.0
+
+# This test tests omprog in batch mode with octet-counted framing and
+# multiple program instances. Each instance receives its shard of the
+# batch in one write and confirms it with a single status line.
+
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup omprog-batch.conf
+. $srcdir/diag.sh wait-startup
+. $srcdir/diag.sh injectmsg 0 5000
+. $srcdir/diag.sh wait-queueempty
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 4999
+. $srcdir/diag.sh exit
@@ -0,0 +1,48 @@
+#!/bin/bash
+# Test bulk mode of ompgsql. Some statements are invalid, these must be
+# discarded while all others still reach the database.
+# This file is part of the rsyslog project, released under GPLv3
+
+. $srcdir/diag.sh init
+
+psql -h localhost -U postgres -f testsuites/pgsql-basic.sql
+
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+template(name="pgtemplate" type="list" option.sql="on") {
+	constant(value="INSERT INTO SystemEvents (SysLogTag, EventID) values ('"'"'")
+	property(name="msg")
+	constant(value="'"'"', ")
+	property(name="$.eventid")
+	# the trailing comment must not swallow the next statement of the batch
+	constant(value=") -- sent by rsyslog")
+}
+
+module(load="../plugins/ompgsql/.libs/ompgsql")
+if $msg contains "msgnum" then {
+	set $.eventid = "1";
+	# this yields a statement referring to a non-existing column
+	if $msg contains "msgnum:0000250" then
+		set $.eventid = "nosuchcolumn";
+	action(type="ompgsql" server="127.0.0.1"
+		db="syslogtest" user="postgres" pass="testbench"
+		template="pgtemplate" multirows="50")
+}'
+
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg  0 5000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+
+
+psql -h localhost -U postgres -d syslogtest -f testsuites/pgsql-select-syslogtag.sql -t -A > rsyslog.pgsql.log
+awk '$1 < 2500' rsyslog.pgsql.log > rsyslog.out.log
+. $srcdir/diag.sh seq-check  0 2499
+awk '$1 >= 2500' rsyslog.pgsql.log > rsyslog.out.log
+. $srcdir/diag.sh seq-check  2510 4999
+
+echo cleaning up test database
+psql -h localhost -U postgres -c 'DROP DATABASE IF EXISTS syslogtest;'
+rm -f rsyslog.pgsql.log
+
+. $srcdir/diag.sh exit
@@ -0,0 +1,6 @@
+#!/bin/bash
+# check that omrelp delivers all messages when using multiple sessions
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ====================================================================================
+echo \[sndrcv_relp_sessions.sh\]: testing sending and receiving via relp w/ multiple sessions
+. $srcdir/sndrcv_drvr.sh sndrcv_relp_sessions 50000
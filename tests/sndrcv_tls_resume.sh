@@ -0,0 +1,35 @@
+#!/bin/bash
+# check TLS session resumption on reconnect. The sender uses two actions
+# with the same target but different authentication modes; both rebind
+# frequently. Each of them must resume its own sessions, which are kept
+# under different session cache keys.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[sndrcv_tls_resume.sh\]: testing TLS session resumption
+. $srcdir/diag.sh init
+export RSYSLOG_DEBUGLOG="log"
+. $srcdir/diag.sh startup sndrcv_tls_resume_rcvr.conf
+. $srcdir/diag.sh wait-startup
+export RSYSLOG_DEBUG="debug nostdout"
+export RSYSLOG_DEBUGLOG="log2"
+. $srcdir/diag.sh startup sndrcv_tls_resume_sender.conf 2
+. $srcdir/diag.sh wait-startup 2
+unset RSYSLOG_DEBUG
+. $srcdir/diag.sh tcpflood -m5000 -i1
+sleep 5 # make sure all data is received in input buffers
+. $srcdir/diag.sh shutdown-when-empty 2
+. $srcdir/diag.sh wait-shutdown 2
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+
+# every message is sent by both actions
+. $srcdir/diag.sh seq-check 1 5000 -d
+
+# the key contains the authentication mode: 3 - anon, 2 - x509/certvalid
+for mode in 3 2; do
+	if ! grep -q "session resumed.*cache key '127.0.0.1:13515|[^|]*|[^|]*|$mode|" log2; then
+		echo "FAIL: no session resumed for authentication mode $mode"
+		. $srcdir/diag.sh error-exit 1
+	fi
+done
+. $srcdir/diag.sh exit
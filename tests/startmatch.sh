@@ -0,0 +1,11 @@
+#!/bin/bash
+# check that the message start matcher (imfile startmsg.regex) gives
+# the same results as regexec() for typical and random input.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[startmatch.sh\]: verify message start matcher
+./startmatch_bench -n 2000 -i 2
+if [ $? -ne 0 ]; then
+	echo "FAIL: message start matcher mismatch"
+	exit 1
+fi
@@ -0,0 +1,209 @@
+/* Microbenchmark and correctness check for the message start matcher
+ * (runtime/startmatch.c).
+ *
+ * For a set of typical startmsg.regex expressions, the matcher result
+ * is compared to plain regexec() on a corpus of typical multi-line log
+ * content (timestamped lines, Java stack traces, indented continuation
+ * lines) as well as on random data. Then both are timed on the corpus.
+ *
+ * Usage: startmatch_bench [-n lines] [-i iterations]
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/time.h>
+#include "rsyslog.h"
+#include "startmatch.h"
+
+/* satisfy the runtime references of startmatch.c */
+int Debug = 0;
+int GatherStats = 1;
+void r_dbgprintf(const char __attribute__((unused)) *srcname, const char __attribute__((unused)) *fmt, ...) {}
+
+static const char *regexes[] = {
+	"^[^ ]",
+	"^[^ \t]",
+	"^[^[:space:]]",
+	"^\\S",
+	"^[0-9]{4}-[0-9]{2}-[0-9]{2}",
+	"^[0-9]{4}-[0-9]{2}-[0-9]{2}[ T][0-9]{2}:[0-9]{2}:[0-9]{2}",
+	"^[[:digit:]]{2}:[[:digit:]]{2}",
+	"^(Jan|Feb|Mar) [ 0-9][0-9]",	/* needs regexec */
+	"^[A-Z][a-z]{2} [ 0-9]?[0-9] ",
+	"^\\[[0-9]+\\]",
+	"^INFO",
+	"^msgnum:",
+	"^[a-z]+[0-9]*x?y",
+	"^a*b*c*",
+	"^.",
+	"^.{3}a",
+	"^[]a-]b",
+	"^[^]a]",
+	"^",
+	"",
+	"ERROR",
+	"[0-9]+:[0-9]+ ",
+	"a.?b",
+	"^\\w+\\W",
+	"^[a-c]{1,3}[b-d]{2,}$",	/* needs regexec */
+	"^\tat "
+};
+#define NUM_REGEXES (sizeof(regexes) / sizeof(regexes[0]))
+
+static const char *lineTemplates[] = {
+	"2018-05-18 10:12:%02d,123 ERROR [main] com.example.Service - request %d failed",
+	"java.lang.IllegalStateException: invalid state %d (%d)",
+	"\tat com.example.Service.handle(Service.java:%d) [%d]",
+	"\tat org.eclipse.jetty.server.Server.handle(Server.java:%d) ~[jetty-%d.jar]",
+	"\t... %d more (%d)",
+	"Caused by: java.io.IOException: Broken pipe %d %d",
+	"May 18 10:12:%02d host app[%d]: something happened",
+	"  continuation line %d of %d",
+	"[%d] INFO msgnum:%d"
+};
+#define NUM_TEMPLATES (sizeof(lineTemplates) / sizeof(lineTemplates[0]))
+
+static int
+verifyLine(startmatch_t *const pMatch, regex_t *const preg, const char *const line,
+	const char *const regex)
+{
+	const int ref = !regexec(preg, line, 0, NULL, 0);
+	if(startmatchExec(pMatch, (const uchar*) line) != ref) {
+		fprintf(stderr, "mismatch for regex '%s' (%s) on line '%s': expected %d\n",
+			regex, startmatchModeName(pMatch), line, ref);
+		return 1;
+	}
+	return 0;
+}
+
+static int
+verify(startmatch_t *const pMatch, regex_t *const preg, char **corpus, const int nLines,
+	const char *const regex)
+{
+	static const char alphabet[] = "abcdxyz019AIN []-:\t_.";
+	char buf[32];
+	int i;
+	size_t j;
+
+	for(i = 0 ; i < nLines ; ++i) {
+		if(verifyLine(pMatch, preg, corpus[i], regex))
+			return 1;
+	}
+	for(i = 0 ; i < 20000 ; ++i) {
+		const size_t len = rand() % sizeof(buf);
+		for(j = 0 ; j < len ; ++j)
+			buf[j] = (rand() % 8 == 0) ? (char) (rand() % 255 + 1)
+						   : alphabet[rand() % (sizeof(alphabet) - 1)];
+		buf[len] = '\0';
+		if(verifyLine(pMatch, preg, buf, regex))
+			return 1;
+	}
+	return 0;
+}
+
+static double
+timeDiff(const struct timeval *const tStart, const struct timeval *const tEnd)
+{
+	return (tEnd->tv_sec - tStart->tv_sec) + (tEnd->tv_usec - tStart->tv_usec) / 1000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+	int nLines = 10000;
+	int nIter = 20;
+	char **corpus;
+	startmatch_t *pMatch;
+	regex_t preg;
+	char errbuf[256];
+	struct timeval tStart, tEnd;
+	double secsMatch, secsRegex;
+	int nMatch, nRegex;
+	unsigned i;
+	int iter, j;
+	int opt;
+	int ret = 0;
+
+	while((opt = getopt(argc, argv, "n:i:")) != -1) {
+		switch(opt) {
+		case 'n':	nLines = atoi(optarg);
+				break;
+		case 'i':	nIter = atoi(optarg);
+				break;
+		default:	fprintf(stderr, "usage: startmatch_bench [-n lines] [-i iterations]\n");
+				exit(1);
+		}
+	}
+
+	srand(1);
+	if((corpus = calloc(nLines, sizeof(char*))) == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	for(j = 0 ; j < nLines ; ++j) {
+		if((corpus[j] = malloc(256)) == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+		snprintf(corpus[j], 256, lineTemplates[rand() % NUM_TEMPLATES], rand() % 60, rand() % 1000);
+	}
+
+	for(i = 0 ; i < NUM_REGEXES ; ++i) {
+		if(startmatchConstruct(&pMatch, (const uchar*) regexes[i], errbuf, sizeof(errbuf)) != RS_RET_OK) {
+			fprintf(stderr, "cannot compile '%s': %s\n", regexes[i], errbuf);
+			ret = 1;
+			continue;
+		}
+		regcomp(&preg, regexes[i], REG_EXTENDED);
+		if(verify(pMatch, &preg, corpus, nLines, regexes[i])) {
+			ret = 1;
+		} else {
+			gettimeofday(&tStart, NULL);
+			for(iter = nMatch = 0 ; iter < nIter ; ++iter) {
+				for(j = 0 ; j < nLines ; ++j)
+					nMatch += startmatchExec(pMatch, (uchar*) corpus[j]);
+			}
+			gettimeofday(&tEnd, NULL);
+			secsMatch = timeDiff(&tStart, &tEnd);
+			gettimeofday(&tStart, NULL);
+			for(iter = nRegex = 0 ; iter < nIter ; ++iter) {
+				for(j = 0 ; j < nLines ; ++j)
+					nRegex += !regexec(&preg, corpus[j], 0, NULL, 0);
+			}
+			gettimeofday(&tEnd, NULL);
+			secsRegex = timeDiff(&tStart, &tEnd);
+			printf("%-58s %-7s %8.3f s, regexec %8.3f s (%d matches)\n", regexes[i],
+				startmatchModeName(pMatch), secsMatch, secsRegex, nMatch);
+			if(nMatch != nRegex)
+				ret = 1;
+		}
+		regfree(&preg);
+		startmatchDestruct(&pMatch);
+	}
+
+	for(j = 0 ; j < nLines ; ++j)
+		free(corpus[j]);
+	free(corpus);
+	return ret;
+}
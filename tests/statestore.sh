@@ -0,0 +1,11 @@
+#!/bin/bash
+# check that the state store log stays valid if a write fails in the
+# middle of a record.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[statestore.sh\]: verify state store after write error
+./statestore_test statestore-test.log
+if [ $? -ne 0 ]; then
+	echo "FAIL: state store lost data after write error"
+	exit 1
+fi
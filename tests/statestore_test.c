@@ -0,0 +1,166 @@
+/* Check of the state store (runtime/statestore.c) under write errors.
+ *
+ * write() is replaced by a version which, once armed, writes only half
+ * of the first buffer and then fails with ENOSPC, like a disk running
+ * full in the middle of a record. All records, including the ones of
+ * the failed commit and those written afterwards, must still be found
+ * when the store is reopened.
+ *
+ * Usage: statestore_test <file>
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "rsyslog.h"
+#include "statestore.h"
+
+/* satisfy the runtime references of statestore.c */
+int Debug = 0;
+void r_dbgprintf(const char __attribute__((unused)) *srcname, const char __attribute__((unused)) *fmt, ...) {}
+
+static int nLogMsgs = 0; /* warnings, e.g. about a torn log on load */
+
+void
+LogError(const int iErrno, const int __attribute__((unused)) iErrCode, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "statestore_test: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, " [errno %d]\n", iErrno);
+	va_end(ap);
+}
+
+void
+LogMsg(const int iErrno, const int __attribute__((unused)) iErrCode,
+	const int __attribute__((unused)) severity, const char *fmt, ...)
+{
+	va_list ap;
+
+	++nLogMsgs;
+	va_start(ap, fmt);
+	fprintf(stderr, "statestore_test: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, " [errno %d]\n", iErrno);
+	va_end(ap);
+}
+
+rsRetVal
+timeoutComp(struct timespec *pt, long iTimeout)
+{
+	clock_gettime(CLOCK_REALTIME, pt);
+	pt->tv_sec += iTimeout / 1000;
+	pt->tv_nsec += (iTimeout % 1000) * 1000000;
+	if(pt->tv_nsec >= 1000000000) {
+		pt->tv_nsec -= 1000000000;
+		++pt->tv_sec;
+	}
+	return RS_RET_OK;
+}
+
+static volatile int failState = 0; /* 1 - next write short, 2 - next write fails */
+
+ssize_t
+write(int fd, const void *buf, size_t count)
+{
+	if(failState == 1 && fd > 2 && count > 1) {
+		failState = 2;
+		count /= 2;
+	} else if(failState == 2 && fd > 2) {
+		failState = 0;
+		errno = ENOSPC;
+		return -1;
+	}
+	return syscall(SYS_write, fd, buf, count);
+}
+
+static int
+check(statestore_t *const store, const char *const key, const char *const expected)
+{
+	char *val = NULL;
+
+	if(statestoreGet(store, key, &val) != RS_RET_OK || val == NULL || strcmp(val, expected)) {
+		fprintf(stderr, "FAIL: key '%s' has value '%s', expected '%s'\n", key,
+			val == NULL ? "(none)" : val, expected);
+		free(val);
+		return 1;
+	}
+	free(val);
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	statestore_t *store = NULL;
+	int nErr = 0;
+
+	if(argc != 2) {
+		fprintf(stderr, "usage: statestore_test <file>\n");
+		exit(1);
+	}
+	unlink(argv[1]);
+
+	if(statestoreOpen(&store, argv[1]) != RS_RET_OK)
+		goto open_fail;
+	statestorePut(store, "file1", "100");
+	statestoreSync(store);
+
+	failState = 1;
+	statestorePut(store, "file2", "200");
+	statestoreSync(store);
+	if(failState != 0) {
+		fprintf(stderr, "FAIL: write error was not triggered\n");
+		exit(1);
+	}
+
+	statestorePut(store, "file3", "300");
+	statestorePut(store, "file1", "150");
+	statestoreSync(store);
+	statestoreClose(&store);
+
+	if(statestoreOpen(&store, argv[1]) != RS_RET_OK)
+		goto open_fail;
+	if(nLogMsgs != 0) {
+		fprintf(stderr, "FAIL: log was not valid after write error\n");
+		++nErr;
+	}
+	nErr += check(store, "file1", "150");
+	nErr += check(store, "file2", "200");
+	nErr += check(store, "file3", "300");
+	statestoreClose(&store);
+
+	unlink(argv[1]);
+	return nErr == 0 ? 0 : 1;
+
+open_fail:
+	fprintf(stderr, "FAIL: cannot open state store '%s'\n", argv[1]);
+	exit(1);
+}
@@ -0,0 +1,29 @@
+#!/bin/bash
+
+# Reads octet-counted records ("<length> <record>") and writes the messages
+# of each transaction to the output file once it is committed. Every batch
+# is confirmed with a single status line.
+
+export LC_ALL=C
+outfile=rsyslog.out.log
+
+echo "OK"
+
+batch=()
+while IFS= read -r -d ' ' len; do
+    IFS= read -r -N "$len" record || break
+    case "$record" in
+    "BEGIN TRANSACTION"$'\n')
+        batch=()
+        ;;
+    "COMMIT TRANSACTION"$'\n')
+        printf '%s' "${batch[@]}" >> $outfile
+        echo "OK"
+        ;;
+    *)
+        batch+=("$record")
+        ;;
+    esac
+done
+
+exit 0
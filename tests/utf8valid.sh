@@ -0,0 +1,11 @@
+#!/bin/bash
+# check that all UTF-8 validator implementations available on this
+# CPU produce the same results as the bytewise mmutf8fix reference.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[utf8valid.sh\]: verify UTF-8 validator implementations
+./utf8valid_bench -n 2000 -i 5
+if [ $? -ne 0 ]; then
+	echo "FAIL: UTF-8 validator mismatch"
+	exit 1
+fi
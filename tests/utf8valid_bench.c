@@ -0,0 +1,373 @@
+/* Microbenchmark and correctness check for the UTF-8 validator
+ * (runtime/utf8valid.c).
+ *
+ * The reference is the bytewise repair loop mmutf8fix used before the
+ * validator was introduced: the valid prefix of a buffer ends at the
+ * first byte that loop would replace. Each available validator
+ * implementation is verified against it on an ASCII-heavy corpus (typical
+ * log lines), a multibyte-heavy corpus (Latin, Cyrillic, CJK and emoji
+ * text) as well as on random data with many invalid sequences. Then the
+ * reference loop and the validators are timed on both corpora.
+ *
+ * Usage: utf8valid_bench [-n messages] [-i iterations] [-I implementation]
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <sys/time.h>
+#include "utf8valid.h"
+
+static const char *implNames[] = { "generic", "ssse3", "avx2" };
+
+static const char *asciiTemplates[] = {
+	"Accepted publickey for user%d from 10.0.%d.17 port 52413 ssh2: RSA SHA256:"
+		"hG4Kz0n3cX6uQ1vHjW0Lk9x8Yz3bA7sPqR2tD5eF1gI",
+	"pam_unix(sshd:session): session opened for user root by (uid=%d) pid=%d",
+	"192.0.2.%d - - [18/May/2018:10:12:%02d +0200] \"GET /api/v1/items?id=42&page=3 HTTP/1.1\" "
+		"200 5123 \"https://www.example.com/index.html\" \"Mozilla/5.0 (X11; Linux x86_64)\"",
+	"Started Session %d of user admin; unit session-%d.scope is now active and running fine",
+	"user J\xc3\xbcrgen logged in from 10.0.%d.%d",
+	"short msg %d %d"
+};
+#define NUM_ASCII_TEMPLATES (sizeof(asciiTemplates) / sizeof(asciiTemplates[0]))
+
+static const char *mbTemplates[] = {
+	"Gr\xc3\xb6\xc3\x9f" "e der Datei \xc3\xbc" "berschreitet das Limit (%d > %d), "
+		"\xc3\x84nderungen werden verworfen",
+	"\xd0\x9f\xd0\xbe\xd0\xbb\xd1\x8c\xd0\xb7\xd0\xbe\xd0\xb2\xd0\xb0\xd1\x82\xd0\xb5\xd0\xbb"
+		"\xd1\x8c %d \xd0\xb2\xd0\xbe\xd1\x88\xd1\x91\xd0\xbb \xd0\xb2 \xd1\x81\xd0\xb8\xd1\x81"
+		"\xd1\x82\xd0\xb5\xd0\xbc\xd1\x83 (%d)",
+	"\xe3\x83\xa6\xe3\x83\xbc\xe3\x82\xb6\xe3\x83\xbc %d \xe3\x81\x8c\xe3\x83\xad\xe3\x82\xb0"
+		"\xe3\x82\xa4\xe3\x83\xb3\xe3\x81\x97\xe3\x81\xbe\xe3\x81\x97\xe3\x81\x9f "
+		"\xe6\x8e\xa5\xe7\xb6\x9a\xe5\x85\x83 %d",
+	"\xe6\x9c\x8d\xe5\x8a\xa1\xe5\x99\xa8 %d \xe5\x93\x8d\xe5\xba\x94\xe8\xb6\x85\xe6\x97\xb6"
+		"\xef\xbc\x8c\xe9\x87\x8d\xe8\xaf\x95\xe6\xac\xa1\xe6\x95\xb0 %d",
+	"deploy %d finished \xf0\x9f\x9a\x80\xf0\x9f\x8e\x89 build %d \xe2\x9c\x94",
+	"\xce\x91\xce\xb9\xcf\x84\xce\xb7\xce\xbc\xce\xb1 %d \xce\xb1\xcf\x80\xce\xad\xcf\x84\xcf\x85"
+		"\xcf\x87\xce\xb5 (%d)"
+};
+#define NUM_MB_TEMPLATES (sizeof(mbTemplates) / sizeof(mbTemplates[0]))
+
+/* the bytewise loop of mmutf8fix before it used the validator */
+static void
+refFixInvldMBSeq(unsigned char *msg, int lenMsg, int strtIdx, int *endIdx, int8_t seqLen,
+	const unsigned char replChar)
+{
+	int i;
+
+	*endIdx = strtIdx + seqLen;
+	if(*endIdx > lenMsg)
+		*endIdx = lenMsg;
+	for(i = strtIdx ; i < *endIdx ; ++i)
+		msg[i] = replChar;
+}
+
+static void
+refDoUTF8(unsigned char *msg, int lenMsg, const unsigned char replChar)
+{
+	unsigned char c;
+	int8_t seqLen = 0, bytesLeft = 0;
+	uint32_t codepoint = 0;
+	int strtIdx = 0, endIdx = 0;
+	int i;
+
+	for(i = 0 ; i < lenMsg ; ++i) {
+		c = msg[i];
+		if(bytesLeft) {
+			if((c & 0xc0) != 0x80) {
+				refFixInvldMBSeq(msg, lenMsg, strtIdx, &endIdx, seqLen, replChar);
+				i = endIdx - 1;
+				bytesLeft = 0;
+			} else {
+				codepoint = (codepoint << 6) | (c & 0x3f);
+				--bytesLeft;
+				if(bytesLeft == 0 && codepoint > 0x10FFFF)
+					refFixInvldMBSeq(msg, lenMsg, strtIdx, &endIdx, seqLen, replChar);
+			}
+		} else {
+			if((c & 0x80) == 0) {
+				;
+			} else if((c & 0xe0) == 0xc0) {
+				if(c == 0xc0 || c == 0xc1) {
+					msg[i] = replChar;
+				} else {
+					strtIdx = i;
+					seqLen = bytesLeft = 1;
+					codepoint = c & 0x1f;
+				}
+			} else if((c & 0xf0) == 0xe0) {
+				strtIdx = i;
+				seqLen = bytesLeft = 2;
+				codepoint = c & 0x0f;
+			} else if((c & 0xf8) == 0xf0) {
+				strtIdx = i;
+				seqLen = bytesLeft = 3;
+				codepoint = c & 0x07;
+			} else {
+				msg[i] = replChar;
+			}
+			if(i+bytesLeft >= lenMsg) {
+				int dummy = lenMsg;
+				refFixInvldMBSeq(msg, lenMsg, strtIdx, &dummy, seqLen, replChar);
+				i = lenMsg - 1;
+			}
+		}
+	}
+}
+
+/* the reference valid prefix ends at the first byte the repair loop
+ * modifies. We use two different replacement chars so that replacing
+ * a byte by itself can not hide a modification.
+ */
+static size_t
+refValidPrefix(const unsigned char *const buf, const size_t len)
+{
+	unsigned char work[2][512];
+	size_t i;
+
+	memcpy(work[0], buf, len);
+	memcpy(work[1], buf, len);
+	refDoUTF8(work[0], (int) len, 0x00);
+	refDoUTF8(work[1], (int) len, 0xff);
+	for(i = 0 ; i < len ; ++i) {
+		if(work[0][i] != buf[i] || work[1][i] != buf[i])
+			return i;
+	}
+	return len;
+}
+
+/* check all suffixes of buf, so that every alignment and block boundary
+ * is exercised at least once.
+ */
+static int
+verifyBuf(const unsigned char *const buf, const size_t len)
+{
+	size_t i;
+	size_t ref, res;
+
+	for(i = 0 ; i <= len ; ++i) {
+		ref = refValidPrefix(buf + i, len - i);
+		res = utf8validPrefix(buf + i, len - i);
+		if(res != ref) {
+			fprintf(stderr, "%s: mismatch at offset %zu (len %zu): expected %zu, got %zu\n",
+				utf8validImplName(), i, len, ref, res);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int
+verify(char **corpus, const int nMsgs)
+{
+	static const unsigned char pieces[][4] = {
+		{ 0xc3, 0xa4 }, { 0xe2, 0x82, 0xac }, { 0xf0, 0x9f, 0x98, 0x80 },
+		{ 0xf4, 0x8f, 0xbf, 0xbf }, { 0xf4, 0x90, 0x80, 0x80 }, { 0xf5, 0x80, 0x80, 0x80 },
+		{ 0xe0, 0x80, 0x80 }, { 0xed, 0xa0, 0x80 }, { 0xf0, 0x80, 0x80, 0x80 },
+		{ 0xc0, 0x80 }, { 0xc1, 0xbf }, { 0xf8, 0x88, 0x80, 0x80 }
+	};
+	unsigned char buf[300];
+	size_t len, n;
+	int i;
+	int pick;
+
+	for(i = 0 ; i < nMsgs ; ++i) {
+		if(verifyBuf((unsigned char*) corpus[i], strlen(corpus[i])))
+			return 1;
+	}
+	/* mostly valid data with sprinkled in truncated, stray and invalid sequences */
+	for(i = 0 ; i < 3000 ; ++i) {
+		const size_t lenWanted = rand() % sizeof(buf);
+		for(len = 0 ; len + 4 <= lenWanted ; ) {
+			pick = rand() % 32;
+			if(pick < 16) {
+				buf[len++] = 'a' + rand() % 26;
+			} else if(pick < 28) {
+				n = (pieces[pick - 16][0] < 0xe0) ? 2 : (pieces[pick - 16][0] < 0xf0) ? 3 : 4;
+				if(rand() % 16 == 0)	/* truncate */
+					n = rand() % n;
+				memcpy(buf + len, pieces[pick - 16], n);
+				len += n;
+			} else {
+				buf[len++] = (unsigned char) (rand() % 256);
+			}
+		}
+		if(verifyBuf(buf, len))
+			return 1;
+	}
+	return 0;
+}
+
+static double
+timeDiff(const struct timeval *const tStart, const struct timeval *const tEnd)
+{
+	return (tEnd->tv_sec - tStart->tv_sec) + (tEnd->tv_usec - tStart->tv_usec) / 1000000.0;
+}
+
+/* corpora are valid, so the reference loop does not modify them */
+static double
+benchRef(char **corpus, size_t *lens, const int nMsgs, const int nIter)
+{
+	struct timeval tStart, tEnd;
+	int i, iter;
+
+	gettimeofday(&tStart, NULL);
+	for(iter = 0 ; iter < nIter ; ++iter) {
+		for(i = 0 ; i < nMsgs ; ++i)
+			refDoUTF8((unsigned char*) corpus[i], (int) lens[i], ' ');
+	}
+	gettimeofday(&tEnd, NULL);
+	return timeDiff(&tStart, &tEnd);
+}
+
+static double
+benchValidator(char **corpus, size_t *lens, const int nMsgs, const int nIter, int *pRet)
+{
+	struct timeval tStart, tEnd;
+	int i, iter;
+
+	gettimeofday(&tStart, NULL);
+	for(iter = 0 ; iter < nIter ; ++iter) {
+		for(i = 0 ; i < nMsgs ; ++i) {
+			if(utf8validPrefix((unsigned char*) corpus[i], lens[i]) != lens[i])
+				*pRet = 1;
+		}
+	}
+	gettimeofday(&tEnd, NULL);
+	return timeDiff(&tStart, &tEnd);
+}
+
+static void
+printResult(const char *const name, const char *const corpusName, const size_t total,
+	const int nIter, const double secs)
+{
+	printf("%-8s %-10s %8.1f MB/s (%zu bytes, %.3f s)\n", name, corpusName,
+		secs > 0 ? (double) total * nIter / secs / (1024 * 1024) : 0.0,
+		total * nIter, secs);
+}
+
+static char **
+genCorpus(const char **templates, const size_t nTemplates, const int nMsgs, size_t **pLens,
+	size_t *pTotal)
+{
+	char **corpus;
+	size_t *lens;
+	size_t lenTpl;
+	int i;
+
+	if((corpus = calloc(nMsgs, sizeof(char*))) == NULL
+	   || (lens = calloc(nMsgs, sizeof(size_t))) == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	*pTotal = 0;
+	for(i = 0 ; i < nMsgs ; ++i) {
+		if((corpus[i] = malloc(512)) == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+		/* make some messages long enough to exercise multiple blocks */
+		snprintf(corpus[i], 512, templates[rand() % nTemplates], rand() % 1000, rand() % 60);
+		if(rand() % 4 == 0) {
+			lenTpl = strlen(corpus[i]);
+			snprintf(corpus[i] + lenTpl, 512 - lenTpl, " | %s", templates[rand() % nTemplates]);
+		}
+		lens[i] = strlen(corpus[i]);
+		*pTotal += lens[i];
+	}
+	*pLens = lens;
+	return corpus;
+}
+
+static void
+freeCorpus(char **corpus, size_t *lens, const int nMsgs)
+{
+	int i;
+
+	for(i = 0 ; i < nMsgs ; ++i)
+		free(corpus[i]);
+	free(corpus);
+	free(lens);
+}
+
+int main(int argc, char *argv[])
+{
+	int nMsgs = 10000;
+	int nIter = 100;
+	const char *implWanted = NULL;
+	char **corpusAscii, **corpusMB;
+	size_t *lensAscii, *lensMB;
+	size_t totalAscii, totalMB;
+	unsigned i;
+	int opt;
+	int ret = 0;
+
+	while((opt = getopt(argc, argv, "n:i:I:")) != -1) {
+		switch(opt) {
+		case 'n':	nMsgs = atoi(optarg);
+				break;
+		case 'i':	nIter = atoi(optarg);
+				break;
+		case 'I':	implWanted = optarg;
+				break;
+		default:	fprintf(stderr, "usage: utf8valid_bench [-n messages] [-i iterations] "
+					"[-I implementation]\n");
+				exit(1);
+		}
+	}
+
+	srand(1);
+	corpusAscii = genCorpus(asciiTemplates, NUM_ASCII_TEMPLATES, nMsgs, &lensAscii, &totalAscii);
+	corpusMB = genCorpus(mbTemplates, NUM_MB_TEMPLATES, nMsgs, &lensMB, &totalMB);
+
+	printResult("bytewise", "ascii", totalAscii, nIter,
+		benchRef(corpusAscii, lensAscii, nMsgs, nIter));
+	printResult("bytewise", "multibyte", totalMB, nIter,
+		benchRef(corpusMB, lensMB, nMsgs, nIter));
+
+	utf8validInit();
+	printf("default implementation: %s\n", utf8validImplName());
+	for(i = 0 ; i < sizeof(implNames) / sizeof(implNames[0]) ; ++i) {
+		if(implWanted != NULL && strcmp(implWanted, implNames[i]))
+			continue;
+		if(utf8validSelectImpl(implNames[i]) != 0) {
+			printf("%-8s not available\n", implNames[i]);
+			continue;
+		}
+		if(verify(corpusAscii, nMsgs) || verify(corpusMB, nMsgs)) {
+			ret = 1;
+			continue;
+		}
+		printResult(implNames[i], "ascii", totalAscii, nIter,
+			benchValidator(corpusAscii, lensAscii, nMsgs, nIter, &ret));
+		printResult(implNames[i], "multibyte", totalMB, nIter,
+			benchValidator(corpusMB, lensMB, nMsgs, nIter, &ret));
+	}
+
+	freeCorpus(corpusAscii, lensAscii, nMsgs);
+	freeCorpus(corpusMB, lensMB, nMsgs);
+	return ret;
+}